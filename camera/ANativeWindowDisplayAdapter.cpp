@@ -15,6 +15,7 @@
  */
 
 #include "ANativeWindowDisplayAdapter.h"
+#include "FrameTracer.h"
 #include <OMX_IVCommon.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferMapper.h>
@@ -537,8 +538,7 @@ CameraBuffer* ANativeWindowDisplayAdapter::allocateBufferList(int width, int hei
     for ( i=0; i < mBufferCount; i++ )
     {
         buffer_handle_t *handle;
-        int stride;  // dummy variable to get stride
-        // TODO(XXX): Do we need to keep stride information in camera hal?
+        int stride;  // in pixels, one byte each for the NV12 luma plane
 
         err = mANativeWindow->dequeue_buffer(mANativeWindow, &handle, &stride);
 
@@ -558,6 +558,9 @@ CameraBuffer* ANativeWindowDisplayAdapter::allocateBufferList(int width, int hei
         mBuffers[i].opaque = (void *)handle;
         mBuffers[i].type = CAMERA_BUFFER_ANW;
         mBuffers[i].format = mPixelFormat;
+        mBuffers[i].width = width;
+        mBuffers[i].height = height;
+        mBuffers[i].stride = stride;
         mFramesWithCameraAdapterMap.add(handle, i);
 
         // Tag remaining preview buffers as preview frames
@@ -1261,6 +1264,10 @@ void ANativeWindowDisplayAdapter::frameCallback(CameraFrame* caFrame)
     df.mWidth = caFrame->mWidth;
     df.mHeight = caFrame->mHeight;
     PostFrame(df);
+
+    if ( CameraFrame::PREVIEW_FRAME_SYNC == df.mType ) {
+        FrameTracer::mark(FrameTracer::STAGE_DISPLAY, caFrame->mTimestamp);
+    }
 }
 
 void ANativeWindowDisplayAdapter::setExternalLocking(bool extBuffLocking)
@@ -40,6 +40,10 @@ ifdef TI_CAMERAHAL_MAX_CAMERAS_SUPPORTED
     CAMERAHAL_CFLAGS += -DMAX_CAMERAS_SUPPORTED=$(TI_CAMERAHAL_MAX_CAMERAS_SUPPORTED)
 endif
 
+ifdef TI_CAMERAHAL_MAX_SIMUL_CAMERAS_SUPPORTED
+    CAMERAHAL_CFLAGS += -DMAX_SIMUL_CAMERAS_SUPPORTED=$(TI_CAMERAHAL_MAX_SIMUL_CAMERAS_SUPPORTED)
+endif
+
 ifdef TI_CAMERAHAL_TREAT_FRONT_AS_BACK
     CAMERAHAL_CFLAGS += -DTREAT_FRONT_AS_BACK
 endif
@@ -90,12 +94,18 @@ TI_CAMERAHAL_COMMON_SRC := \
     ANativeWindowDisplayAdapter.cpp \
     BufferSourceAdapter.cpp \
     CameraProperties.cpp \
+    CapabilitiesCache.cpp \
     BaseCameraAdapter.cpp \
+    FrameRefTable.cpp \
+    FrameTracer.cpp \
     MemoryManager.cpp \
     Encoder_libjpeg.cpp \
     Decoder_libjpeg.cpp \
     SensorListener.cpp  \
+    WorkerPool.cpp \
+    EncoderScheduler.cpp \
     NV12_resize.cpp \
+    ColorConvert.cpp \
     CameraParameters.cpp \
     TICameraParameters.cpp \
     CameraHalCommon.cpp \
@@ -123,6 +133,10 @@ TI_CAMERAHAL_USB_SRC := \
     V4LCameraAdapter/V4LCameraAdapter.cpp \
     V4LCameraAdapter/V4LCapabilities.cpp
 
+TI_CAMERAHAL_REPLAY_SRC := \
+    ReplayCameraAdapter/ReplayCameraAdapter.cpp \
+    ReplayCameraAdapter/ReplayCapabilities.cpp
+
 TI_CAMERAHAL_COMMON_SHARED_LIBRARIES := \
     libui \
     libbinder \
@@ -165,6 +179,13 @@ TI_CAMERAHAL_COMMON_STATIC_LIBRARIES += \
     libcpcamcamera_client
 endif
 
+ifdef TI_CAMERAHAL_REPLAY
+# Camera playing a recording back, for running the HAL without a sensor
+CAMERAHAL_CFLAGS += -DREPLAY_CAMERA_ADAPTER
+TI_CAMERAHAL_COMMON_SRC += $(TI_CAMERAHAL_REPLAY_SRC)
+TI_CAMERAHAL_COMMON_INCLUDES += $(LOCAL_PATH)/inc/ReplayCameraAdapter
+endif
+
 
 # ====================
 #  OMX Camera Adapter
@@ -17,17 +17,69 @@
 #include "CameraHal.h"
 #include "VideoMetadata.h"
 #include "Encoder_libjpeg.h"
+#include "FrameTracer.h"
 #include <MetadataBufferType.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferMapper.h>
 #include "NV12_resize.h"
+#include "ColorConvert.h"
 #include "TICameraParameters.h"
 
+#include <sys/mman.h>
+#include <cutils/ashmem.h>
+
 namespace Ti {
 namespace Camera {
 
 const int AppCallbackNotifier::NOTIFIER_TIMEOUT = -1;
-android::KeyedVector<void*, android::sp<Encoder_libjpeg> > gEncoderQueue;
+
+// software JPEG encodes in flight; more of them only hold frames and memory
+static const int ENCODER_THREADS = 2;
+static const size_t ENCODER_CAPACITY = 4;
+
+// room for SOI + APP1 (EXIF and thumbnail) ahead of the compressed image
+static const size_t EXIF_HEADER_RESERVE = 64 * 1024;
+
+/**
+ * Destination of a JPEG encode. It is ashmem backed, so the finished file
+ * is handed to the application by mapping the region's fd instead of
+ * copying it into a freshly requested buffer.
+ */
+struct EncodedPicture {
+    int fd;
+    uint8_t* data;
+    size_t size;
+};
+
+static EncodedPicture* allocateEncodedPicture(size_t size) {
+    EncodedPicture* picture = new EncodedPicture;
+
+    picture->fd = ashmem_create_region("camera-jpeg", size);
+    if (picture->fd < 0) {
+        CAMHAL_LOGEB("ashmem_create_region failed %d", picture->fd);
+        delete picture;
+        return NULL;
+    }
+
+    picture->data = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, picture->fd, 0);
+    if (picture->data == MAP_FAILED) {
+        CAMHAL_LOGEB("mmap of %u bytes failed %d", (unsigned int) size, errno);
+        close(picture->fd);
+        delete picture;
+        return NULL;
+    }
+
+    picture->size = size;
+    return picture;
+}
+
+static void releaseEncodedPicture(EncodedPicture* picture) {
+    if (picture) {
+        munmap(picture->data, picture->size);
+        close(picture->fd);
+        delete picture;
+    }
+}
 
 void AppCallbackNotifierEncoderCallback(void* main_jpeg,
                                         void* thumb_jpeg,
@@ -38,20 +90,21 @@ void AppCallbackNotifierEncoderCallback(void* main_jpeg,
                                         void* cookie4,
                                         bool canceled)
 {
-    if (cookie1 && !canceled) {
+    if (cookie1) {
         AppCallbackNotifier* cb = (AppCallbackNotifier*) cookie1;
-        cb->EncoderDoneCb(main_jpeg, thumb_jpeg, type, cookie2, cookie3, cookie4);
+        if (!canceled) {
+            cb->EncoderDoneCb(main_jpeg, thumb_jpeg, type, cookie2, cookie3, cookie4);
+        } else {
+            cb->EncoderCanceledCb(cookie2, cookie3);
+        }
     }
 
-    if (main_jpeg) {
-        free(main_jpeg);
-    }
+    // parameter blocks and the thumbnail buffer come from the encoder's pool
+    EncoderContextPool::releaseBuffer(main_jpeg);
 
     if (thumb_jpeg) {
-       if (((Encoder_libjpeg::params *) thumb_jpeg)->dst) {
-           free(((Encoder_libjpeg::params *) thumb_jpeg)->dst);
-       }
-       free(thumb_jpeg);
+        EncoderContextPool::releaseBuffer(((Encoder_libjpeg::params *) thumb_jpeg)->dst);
+        EncoderContextPool::releaseBuffer(thumb_jpeg);
     }
 }
 
@@ -59,12 +112,10 @@ void AppCallbackNotifierEncoderCallback(void* main_jpeg,
 
 void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, CameraFrame::FrameType type, void* cookie1, void* cookie2, void *cookie3)
 {
-    camera_memory_t* encoded_mem = NULL;
+    EncodedPicture* encoded_mem = NULL;
     Encoder_libjpeg::params *main_param = NULL, *thumb_param = NULL;
     size_t jpeg_size;
-    uint8_t* src = NULL;
     CameraBuffer *camera_buffer;
-    android::sp<Encoder_libjpeg> encoder = NULL;
 
     LOG_FUNCTION_NAME;
 
@@ -77,14 +128,14 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
         goto exit;
     }
 
-    encoded_mem = (camera_memory_t*) cookie1;
+    encoded_mem = (EncodedPicture*) cookie1;
     main_param = (Encoder_libjpeg::params *) main_jpeg;
     jpeg_size = main_param->jpeg_size;
     camera_buffer = (CameraBuffer *)cookie3;
-    src = main_param->src;
 
-    if(encoded_mem && encoded_mem->data && (jpeg_size > 0)) {
-        if (cookie2) {
+    if(encoded_mem && (jpeg_size > 0)) {
+        if (cookie2 && (main_param->header_size == 0)) {
+            // the encoder couldn't write EXIF in place, fall back to jhead
             ExifElementsTable* exif = (ExifElementsTable*) cookie2;
             Section_t* exif_section = NULL;
 
@@ -107,9 +158,16 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
             delete exif;
             cookie2 = NULL;
         } else {
-            picture = mRequestMemory(-1, jpeg_size, 1, NULL);
-            if (picture && picture->data) {
-                memcpy(picture->data, encoded_mem->data, jpeg_size);
+            // the encoded file is complete, share it without copying
+            picture = mRequestMemory(encoded_mem->fd, jpeg_size, 1, NULL);
+            if (!picture || !picture->data) {
+                if (picture) {
+                    picture->release(picture);
+                }
+                picture = mRequestMemory(-1, jpeg_size, 1, NULL);
+                if (picture && picture->data) {
+                    memcpy(picture->data, encoded_mem->data, jpeg_size);
+                }
             }
         }
     }
@@ -146,24 +204,31 @@ void AppCallbackNotifier::EncoderDoneCb(void* main_jpeg, void* thumb_jpeg, Camer
         picture->release(picture);
     }
 
+    releaseEncodedPicture(encoded_mem);
+    if (cookie2) {
+        delete (ExifElementsTable*) cookie2;
+    }
+
     if (mNotifierState == AppCallbackNotifier::NOTIFIER_STARTED) {
-        if (encoded_mem) {
-            encoded_mem->release(encoded_mem);
-        }
-        if (cookie2) {
-            delete (ExifElementsTable*) cookie2;
-        }
-        encoder = gEncoderQueue.valueFor(src);
-        if (encoder.get()) {
-            gEncoderQueue.removeItem(src);
-            encoder.clear();
-        }
         mFrameProvider->returnFrame(camera_buffer, type);
     }
 
     LOG_FUNCTION_NAME_EXIT;
 }
 
+void AppCallbackNotifier::EncoderCanceledCb(void* cookie1, void* cookie2)
+{
+    LOG_FUNCTION_NAME;
+
+    // only happens when stopping, the frame goes back with the others
+    releaseEncodedPicture((EncodedPicture*) cookie1);
+    if (cookie2) {
+        delete (ExifElementsTable*) cookie2;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
 /**
   * NotificationHandler class
   */
@@ -177,8 +242,24 @@ status_t AppCallbackNotifier::initialize()
 
     mMeasurementEnabled = false;
 
+    mVideoScaler = new NV12Scaler();
+
+    mEncoderContexts = new EncoderContextPool();
+
+    mEncoderScheduler = new EncoderScheduler();
+    if ( mEncoderScheduler->initialize(ENCODER_THREADS, ENCODER_CAPACITY) != NO_ERROR ) {
+        CAMHAL_LOGEA("Couldn't start the encoder scheduler");
+        mEncoderScheduler.clear();
+        return NO_INIT;
+    }
+
     mNotifierState = NOTIFIER_STOPPED;
 
+    ///Smooth zoom reports every step; the app only needs the latest one
+    if ( mEventQ.setCoalescing(NOTIFIER_CMD_PROCESS_ZOOM_EVENT, discardEvent) != NO_ERROR ) {
+        CAMHAL_LOGDA("Zoom events are not coalesced");
+    }
+
     ///Create the app notifier thread
     mNotificationThread = new NotificationThread(this);
     if(!mNotificationThread.get())
@@ -229,6 +310,13 @@ void AppCallbackNotifier::setCallbacks(CameraHal* cameraHal,
     LOG_FUNCTION_NAME_EXIT;
 }
 
+void AppCallbackNotifier::setWorkerPool(const android::sp<WorkerPool> &pool)
+{
+    android::AutoMutex lock(mLock);
+
+    mWorkerPool = pool;
+}
+
 void AppCallbackNotifier::setMeasurements(bool enable)
 {
     android::AutoMutex lock(mLock);
@@ -343,6 +431,7 @@ void AppCallbackNotifier::notifyEvent()
     switch(msg.command)
         {
         case AppCallbackNotifier::NOTIFIER_CMD_PROCESS_EVENT:
+        case AppCallbackNotifier::NOTIFIER_CMD_PROCESS_ZOOM_EVENT:
 
             evt = ( CameraHalEvent * ) msg.arg1;
 
@@ -463,21 +552,6 @@ void AppCallbackNotifier::notifyEvent()
 
 }
 
-static void alignYV12(int width,
-                      int height,
-                      size_t &yStride,
-                      size_t &uvStride,
-                      size_t &ySize,
-                      size_t &uvSize,
-                      size_t &size)
-{
-    yStride = ( width + 0xF ) & ~0xF;
-    uvStride = ( yStride / 2 + 0xF ) & ~0xF;
-    ySize = yStride * height;
-    uvSize = uvStride * height / 2;
-    size = ySize + uvSize * 2;
-}
-
 static void copy2Dto1D(void *dst,
                        void *src,
                        int width,
@@ -490,8 +564,6 @@ static void copy2Dto1D(void *dst,
 {
     unsigned int alignedRow, row;
     unsigned char *bufferDst, *bufferSrc;
-    unsigned char *bufferDstEnd, *bufferSrcEnd;
-    uint16_t *bufferSrc_UV;
 
     unsigned int *y_uv = (unsigned int *)src;
 
@@ -544,166 +616,27 @@ static void copy2Dto1D(void *dst,
             }
 
             return;
-        } else if (strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0 ||
-                   strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420P) == 0) {
-            bytesPerPixel = 1;
-            bufferDst = ( unsigned char * ) dst;
-            bufferDstEnd = ( unsigned char * ) dst + width*height*bytesPerPixel;
-            bufferSrc = ( unsigned char * ) y_uv[0] + offset;
-            bufferSrcEnd = ( unsigned char * ) ( ( size_t ) y_uv[0] + length + offset);
-            row = width*bytesPerPixel;
-            alignedRow = stride-width;
-            int stride_bytes = stride / 8;
+        } else if (strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
             uint32_t xOff = offset % stride;
             uint32_t yOff = offset / stride;
+            const uint8_t *srcY = ( uint8_t * ) y_uv[0] + offset;
+            const uint8_t *srcUV = ( uint8_t * ) y_uv[1] + (stride/2)*yOff + xOff;
 
             // going to convert from NV12 here and return
-            // Step 1: Y plane: iterate through each row and copy
-            for ( int i = 0 ; i < height ; i++) {
-                memcpy(bufferDst, bufferSrc, row);
-                bufferSrc += stride;
-                bufferDst += row;
-                if ( ( bufferSrc > bufferSrcEnd ) || ( bufferDst > bufferDstEnd ) ) {
-                    break;
-                }
-            }
+            ColorConvert::nv12ToNV21(srcY, srcUV, stride, ( uint8_t * ) dst, width, height);
+            return ;
 
-            bufferSrc_UV = ( uint16_t * ) ((uint8_t*)y_uv[1] + (stride/2)*yOff + xOff);
-
-            if (strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-                 uint16_t *bufferDst_UV;
-
-                // Step 2: UV plane: convert NV12 to NV21 by swapping U & V
-                bufferDst_UV = (uint16_t *) (((uint8_t*)dst)+row*height);
-
-#ifdef ARCH_ARM_HAVE_NEON
-                for (int i = 0 ; i < height/2 ; i++, bufferSrc_UV += alignedRow/2) {
-                    int n = width;
-                    asm volatile (
-                    "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                    "   cmp %[n], #32                                               \n\t"
-                    "   blt 1f                                                      \n\t"
-                    "0: @ 32 byte swap                                              \n\t"
-                    "   sub %[n], %[n], #32                                         \n\t"
-                    "   vld2.8  {q0, q1} , [%[src]]!                                \n\t"
-                    "   vswp q0, q1                                                 \n\t"
-                    "   cmp %[n], #32                                               \n\t"
-                    "   vst2.8  {q0,q1},[%[dst]]!                                   \n\t"
-                    "   bge 0b                                                      \n\t"
-                    "1: @ Is there enough data?                                     \n\t"
-                    "   cmp %[n], #16                                               \n\t"
-                    "   blt 3f                                                      \n\t"
-                    "2: @ 16 byte swap                                              \n\t"
-                    "   sub %[n], %[n], #16                                         \n\t"
-                    "   vld2.8  {d0, d1} , [%[src]]!                                \n\t"
-                    "   vswp d0, d1                                                 \n\t"
-                    "   cmp %[n], #16                                               \n\t"
-                    "   vst2.8  {d0,d1},[%[dst]]!                                   \n\t"
-                    "   bge 2b                                                      \n\t"
-                    "3: @ Is there enough data?                                     \n\t"
-                    "   cmp %[n], #8                                                \n\t"
-                    "   blt 5f                                                      \n\t"
-                    "4: @ 8 byte swap                                               \n\t"
-                    "   sub %[n], %[n], #8                                          \n\t"
-                    "   vld2.8  {d0, d1} , [%[src]]!                                \n\t"
-                    "   vswp d0, d1                                                 \n\t"
-                    "   cmp %[n], #8                                                \n\t"
-                    "   vst2.8  {d0[0],d1[0]},[%[dst]]!                             \n\t"
-                    "   bge 4b                                                      \n\t"
-                    "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                    "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                    : [dst] "+r" (bufferDst_UV), [src] "+r" (bufferSrc_UV), [n] "+r" (n)
-                    : [src_stride] "r" (stride_bytes)
-                    : "cc", "memory", "q0", "q1"
-                    );
-                }
-#else
-                for ( int i = 0; i < height/2; ++i ) {
-                    for ( int j = 0; j < width/2; ++j ) {
-                        bufferDst_UV[j] = (bufferSrc_UV[j] >> 8) | (bufferSrc_UV[j] << 8);
-                    }
-                    bufferSrc_UV += stride/bytesPerPixel/2;
-                    bufferDst_UV += width/2;
-                }
-#endif
-            } else if (strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420P) == 0) {
-                // Step 2: UV plane: convert NV12 to YV12 by de-interleaving U & V
-                // TODO(XXX): This version of CameraHal assumes NV12 format it set at
-                //            camera adapter to support YV12. Need to address for
-                //            USBCamera
-
-                size_t yStride, uvStride, ySize, uvSize, size;
-                alignYV12(width, height, yStride, uvStride, ySize, uvSize, size);
-
-                uint16_t *bufferDst_V = (uint16_t *) (((uint8_t*)dst) + ySize);
-                uint16_t *bufferDst_U = (uint16_t *) (((uint8_t*)dst) + ySize + uvSize);
-
-#ifdef ARCH_ARM_HAVE_NEON
-                int inc = (uvStride - width/2)/2;
-
-                for (int i = 0 ; i < height/2 ; i++, bufferSrc_UV += alignedRow/2) {
-                    int n = width;
-                    asm volatile (
-                    "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                    "   cmp %[n], #32                                               \n\t"
-                    "   blt 1f                                                      \n\t"
-                    "0: @ 32 byte swap                                              \n\t"
-                    "   sub %[n], %[n], #32                                         \n\t"
-                    "   vld2.8  {q0, q1} , [%[src]]!                                \n\t"
-                    "   cmp %[n], #32                                               \n\t"
-                    "   vst1.8  {q1},[%[dst_v]]!                                    \n\t"
-                    "   vst1.8  {q0},[%[dst_u]]!                                    \n\t"
-                    "   bge 0b                                                      \n\t"
-                    "1: @ Is there enough data?                                     \n\t"
-                    "   cmp %[n], #16                                               \n\t"
-                    "   blt 3f                                                      \n\t"
-                    "2: @ 16 byte swap                                              \n\t"
-                    "   sub %[n], %[n], #16                                         \n\t"
-                    "   vld2.8  {d0, d1} , [%[src]]!                                \n\t"
-                    "   cmp %[n], #16                                               \n\t"
-                    "   vst1.8  {d1},[%[dst_v]]!                                    \n\t"
-                    "   vst1.8  {d0},[%[dst_u]]!                                    \n\t"
-                    "   bge 2b                                                      \n\t"
-                    "3: @ Is there enough data?                                     \n\t"
-                    "   cmp %[n], #8                                                \n\t"
-                    "   blt 5f                                                      \n\t"
-                    "4: @ 8 byte swap                                               \n\t"
-                    "   sub %[n], %[n], #8                                          \n\t"
-                    "   vld2.8  {d0, d1} , [%[src]]!                                \n\t"
-                    "   cmp %[n], #8                                                \n\t"
-                    "   vst1.8  {d1[0]},[%[dst_v]]!                                 \n\t"
-                    "   vst1.8  {d0[0]},[%[dst_u]]!                                 \n\t"
-                    "   bge 4b                                                      \n\t"
-                    "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                    "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                    : [dst_u] "+r" (bufferDst_U), [dst_v] "+r" (bufferDst_V),
-                      [src] "+r" (bufferSrc_UV), [n] "+r" (n)
-                    : [src_stride] "r" (stride_bytes)
-                    : "cc", "memory", "q0", "q1"
-                    );
-
-                    bufferDst_U += inc;
-                    bufferDst_V += inc;
-                }
-#else
-                uint8_t * udst = reinterpret_cast<uint8_t*>(bufferDst_V);
-                uint8_t * vdst = reinterpret_cast<uint8_t*>(bufferDst_U);
+        } else if (strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_YUV420P) == 0) {
+            uint32_t xOff = offset % stride;
+            uint32_t yOff = offset / stride;
+            const uint8_t *srcY = ( uint8_t * ) y_uv[0] + offset;
+            const uint8_t *srcUV = ( uint8_t * ) y_uv[1] + (stride/2)*yOff + xOff;
 
-                for ( int i = 0; i < height/2; ++i ) {
-                    for ( int j = 0; j < width/2; ++j ) {
-                        udst[j] = bufferSrc_UV[j] >> 8;
-                        vdst[j] = bufferSrc_UV[j] & 0x00ff;
-                    }
-                    bufferSrc_UV += stride/bytesPerPixel/2;
-                    udst += width/2;
-                    vdst += width/2;
-                }
-#endif
-            }
+            // going to convert from NV12 here and return
+            // TODO(XXX): This version of CameraHal assumes NV12 format it set at
+            //            camera adapter to support YV12. Need to address for
+            //            USBCamera
+            ColorConvert::nv12ToYV12(srcY, srcUV, stride, ( uint8_t * ) dst, width, height);
             return ;
 
         } else if(strcmp(pixelFormat, android::CameraParameters::PIXEL_FORMAT_RGB565) == 0) {
@@ -914,6 +847,10 @@ void AppCallbackNotifier::copyAndSendPreviewFrame(CameraFrame* frame, int32_t ms
             mDataCb(msgType, mPreviewMemory, mPreviewBufCount, NULL, mCallbackCookie);
     }
 
+    if ( CAMERA_MSG_PREVIEW_FRAME == msgType ) {
+        FrameTracer::mark(FrameTracer::STAGE_CALLBACK, frame->mTimestamp);
+    }
+
     if (mExternalLocking) {
         unlockBufferAndUpdatePtrs(frame);
     }
@@ -1018,7 +955,8 @@ void AppCallbackNotifier::notifyFrame()
                 else if ( (CameraFrame::IMAGE_FRAME == frame->mFrameType) &&
                           (NULL != mCameraHal) &&
                           (NULL != mDataCb) &&
-                          (CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & frame->mQuirks) )
+                          ((CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG |
+                            CameraFrame::ENCODE_RAW_YUV420SP_TO_JPEG) & frame->mQuirks) )
                     {
 
                     int encode_quality = 100, tn_quality = 100;
@@ -1027,7 +965,7 @@ void AppCallbackNotifier::notifyFrame()
                     Encoder_libjpeg::params *main_jpeg = NULL, *tn_jpeg = NULL;
                     void* exif_data = NULL;
                     const char *previewFormat = NULL;
-                    camera_memory_t* raw_picture = mRequestMemory(-1, frame->mLength, 1, NULL);
+                    EncodedPicture* raw_picture = allocateEncodedPicture(frame->mLength + EXIF_HEADER_RESERVE);
 
                     if(raw_picture) {
                         buf = raw_picture->data;
@@ -1053,11 +991,15 @@ void AppCallbackNotifier::notifyFrame()
                     }
 
                     main_jpeg = (Encoder_libjpeg::params*)
-                                    malloc(sizeof(Encoder_libjpeg::params));
+                                    mEncoderContexts->acquireBuffer(sizeof(Encoder_libjpeg::params));
+
+                    // zero shutter lag pictures come from yuv420sp preview frames
+                    const bool yuv420sp = (CameraFrame::ENCODE_RAW_YUV420SP_TO_JPEG & frame->mQuirks);
+                    const int stride = yuv420sp ? frame->mAlignment : frame->mAlignment/2;
 
                     // Video snapshot with LDCNSF on adds a few bytes start offset
                     // and a few bytes on every line. They must be skipped.
-                    int rightCrop = frame->mAlignment/2 - frame->mWidth;
+                    int rightCrop = stride - frame->mWidth;
 
                     CAMHAL_LOGDB("Video snapshot right crop = %d", rightCrop);
                     CAMHAL_LOGDB("Video snapshot offset = %d", frame->mOffset);
@@ -1066,15 +1008,18 @@ void AppCallbackNotifier::notifyFrame()
                         main_jpeg->src = (uint8_t *)frame->mBuffer->mapped;
                         main_jpeg->src_size = frame->mLength;
                         main_jpeg->dst = (uint8_t*) buf;
-                        main_jpeg->dst_size = frame->mLength;
+                        main_jpeg->dst_size = frame->mLength + EXIF_HEADER_RESERVE;
                         main_jpeg->quality = encode_quality;
-                        main_jpeg->in_width = frame->mAlignment/2; // use stride here
+                        main_jpeg->in_width = stride; // use stride here
                         main_jpeg->in_height = frame->mHeight;
-                        main_jpeg->out_width = frame->mAlignment/2;
+                        main_jpeg->out_width = stride;
                         main_jpeg->out_height = frame->mHeight;
                         main_jpeg->right_crop = rightCrop;
                         main_jpeg->start_offset = frame->mOffset;
-                        if ( CameraFrame::FORMAT_YUV422I_UYVY & frame->mQuirks) {
+                        if ( yuv420sp ) {
+                            main_jpeg->format = android::CameraParameters::PIXEL_FORMAT_YUV420SP;
+                        }
+                        else if ( CameraFrame::FORMAT_YUV422I_UYVY & frame->mQuirks) {
                             main_jpeg->format = TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY;
                         }
                         else { //if ( CameraFrame::FORMAT_YUV422I_YUYV & frame->mQuirks)
@@ -1088,7 +1033,7 @@ void AppCallbackNotifier::notifyFrame()
 
                     if ((tn_width > 0) && (tn_height > 0) && ( NULL != previewFormat )) {
                         tn_jpeg = (Encoder_libjpeg::params*)
-                                      malloc(sizeof(Encoder_libjpeg::params));
+                                      mEncoderContexts->acquireBuffer(sizeof(Encoder_libjpeg::params));
                         // if malloc fails just keep going and encode main jpeg
                         if (!tn_jpeg) {
                             tn_jpeg = NULL;
@@ -1104,7 +1049,7 @@ void AppCallbackNotifier::notifyFrame()
                         tn_jpeg->dst_size = CameraHal::calculateBufferSize(previewFormat,
                                                                 tn_width,
                                                                 tn_height);
-                        tn_jpeg->dst = (uint8_t*) malloc(tn_jpeg->dst_size);
+                        tn_jpeg->dst = (uint8_t*) mEncoderContexts->acquireBuffer(tn_jpeg->dst_size);
                         tn_jpeg->quality = tn_quality;
                         tn_jpeg->in_width = width;
                         tn_jpeg->in_height = height;
@@ -1122,8 +1067,13 @@ void AppCallbackNotifier::notifyFrame()
                                                       this,
                                                       raw_picture,
                                                       exif_data, frame->mBuffer);
-                    gEncoderQueue.add(frame->mBuffer->mapped, encoder);
-                    encoder->run();
+                    encoder->setWorkerPool(mWorkerPool);
+                    encoder->setContextPool(mEncoderContexts);
+                    encoder->setExif((ExifElementsTable*) exif_data);
+                    encoder->setFrameTimestamp(frame->mTimestamp);
+                    // may wait here for a free slot, holding back the capture path
+                    mEncoderScheduler->submit(encoder,
+                            mBurst ? EncoderScheduler::PRIORITY_LOW : EncoderScheduler::PRIORITY_HIGH);
                     encoder.clear();
                     if (params != NULL)
                       {
@@ -1215,7 +1165,10 @@ void AppCallbackNotifier::notifyFrame()
                                                           (mmByte *)y_uv[1],
                                                           0};
 
-                                VT_resizeFrame_Video_opt2_lp(&input, &output, NULL, 0);
+                                if ( mVideoScaler->configure(frame->mWidth, frame->mHeight,
+                                                             mVideoWidth, mVideoHeight) == NO_ERROR ) {
+                                    mVideoScaler->scale(&input, &output, NULL, mWorkerPool.get());
+                                }
                                 mapper.unlock((buffer_handle_t)vBuf->opaque);
                                 if (mExternalLocking) {
                                     unlockBufferAndUpdatePtrs(frame);
@@ -1237,6 +1190,7 @@ void AppCallbackNotifier::notifyFrame()
 
                             mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME,
                                                 videoMedatadaBufferMemory, 0, mCallbackCookie);
+                            FrameTracer::mark(FrameTracer::STAGE_CALLBACK, frame->mTimestamp);
                             }
                         else
                             {
@@ -1252,6 +1206,7 @@ void AppCallbackNotifier::notifyFrame()
                             }
                             *reinterpret_cast<buffer_handle_t*>(fakebuf->data) = reinterpret_cast<buffer_handle_t>(frame->mBuffer->mapped);
                             mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME, fakebuf, 0, mCallbackCookie);
+                            FrameTracer::mark(FrameTracer::STAGE_CALLBACK, frame->mTimestamp);
                             fakebuf->release(fakebuf);
                             if (mExternalLocking) {
                                 unlockBufferAndUpdatePtrs(frame);
@@ -1376,6 +1331,11 @@ void AppCallbackNotifier::eventCallbackRelay(CameraHalEvent* chEvt)
     LOG_FUNCTION_NAME_EXIT;
 }
 
+void AppCallbackNotifier::discardEvent(Utils::Message *msg)
+{
+    delete ( CameraHalEvent * ) msg->arg1;
+}
+
 void AppCallbackNotifier::eventCallback(CameraHalEvent* chEvt)
 {
 
@@ -1392,11 +1352,29 @@ void AppCallbackNotifier::eventCallback(CameraHalEvent* chEvt)
         event = new CameraHalEvent(*chEvt);
         if ( NULL != event )
             {
+            Utils::MessageQueue::Priority priority = Utils::MessageQueue::PRIORITY_NORMAL;
+
             msg.command = AppCallbackNotifier::NOTIFIER_CMD_PROCESS_EVENT;
             msg.arg1 = event;
+
+            switch ( event->mEventType )
+                {
+                ///The app waits on these, don't queue them behind metadata
+                case CameraHalEvent::EVENT_SHUTTER:
+                case CameraHalEvent::EVENT_FOCUS_LOCKED:
+                case CameraHalEvent::EVENT_FOCUS_ERROR:
+                    priority = Utils::MessageQueue::PRIORITY_HIGH;
+                    break;
+                case CameraHalEvent::EVENT_ZOOM_INDEX_REACHED:
+                    msg.command = AppCallbackNotifier::NOTIFIER_CMD_PROCESS_ZOOM_EVENT;
+                    break;
+                default:
+                    break;
+                }
+
             {
             android::AutoMutex lock(mLock);
-            mEventQ.put(&msg);
+            mEventQ.put(&msg, priority);
             }
             }
         else
@@ -1487,6 +1465,12 @@ AppCallbackNotifier::~AppCallbackNotifier()
     //Delete the display thread
     mNotificationThread.clear();
 
+    // nothing submits encodes anymore, wait for the ones still running
+    if ( mEncoderScheduler.get() ) {
+        mEncoderScheduler->deinitialize();
+        mEncoderScheduler.clear();
+    }
+
 
     ///Free the event and frame providers
     if ( NULL != mEventProvider )
@@ -1505,6 +1489,11 @@ AppCallbackNotifier::~AppCallbackNotifier()
         mFrameProvider = NULL;
         }
 
+    delete mVideoScaler;
+    mVideoScaler = NULL;
+    mWorkerPool.clear();
+    mEncoderContexts.clear();
+
     releaseSharedVideoBuffers();
 
     LOG_FUNCTION_NAME_EXIT;
@@ -1943,8 +1932,6 @@ status_t AppCallbackNotifier::start()
     mNotifierState = AppCallbackNotifier::NOTIFIER_STARTED;
     CAMHAL_LOGDA(" --> AppCallbackNotifier NOTIFIER_STARTED \n");
 
-    gEncoderQueue.clear();
-
     LOG_FUNCTION_NAME_EXIT;
 
     return NO_ERROR;
@@ -1968,25 +1955,9 @@ status_t AppCallbackNotifier::stop()
     CAMHAL_LOGDA(" --> AppCallbackNotifier NOTIFIER_STOPPED \n");
     }
 
-    while(!gEncoderQueue.isEmpty()) {
-        android::sp<Encoder_libjpeg> encoder = gEncoderQueue.valueAt(0);
-        camera_memory_t* encoded_mem = NULL;
-        ExifElementsTable* exif = NULL;
-
-        if(encoder.get()) {
-            encoder->cancel();
-
-            encoder->getCookies(NULL, (void**) &encoded_mem, (void**) &exif);
-            if (encoded_mem) {
-                encoded_mem->release(encoded_mem);
-            }
-            if (exif) {
-                delete exif;
-            }
-
-            encoder.clear();
-        }
-        gEncoderQueue.removeItemsAt(0);
+    // canceled encodes release their buffers through EncoderCanceledCb
+    if ( mEncoderScheduler.get() ) {
+        mEncoderScheduler->flush();
     }
 
     LOG_FUNCTION_NAME_EXIT;
@@ -15,9 +15,19 @@
  */
 
 #include "BaseCameraAdapter.h"
+#include "CapabilitiesCache.h"
+#include "FrameTracer.h"
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 const int EVENT_MASK = 0xffff;
 
+// preview frames kept for zero shutter lag captures unless configured
+#define FRAME_HISTORY_DEFAULT_DEPTH "2"
+// preview buffers the camera keeps queued whatever the history holds
+#define FRAME_HISTORY_MIN_QUEUED 2
+
 namespace Ti {
 namespace Camera {
 
@@ -90,6 +100,16 @@ BaseCameraAdapter::BaseCameraAdapter()
 
     mSharedAllocator = NULL;
 
+    mSubscribers = new Subscribers();
+    mSubscribers->incStrong(this);
+    mSubscriberReaders = 0;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.camera.zsl.history", value, FRAME_HISTORY_DEFAULT_DEPTH);
+    mHistoryDepth = max(atoi(value), 0);
+    mHistoryEnabled = 0;
+    mHistoryLimit = 0;
+
 #if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
     mStartFocus.tv_sec = 0;
     mStartFocus.tv_usec = 0;
@@ -105,16 +125,14 @@ BaseCameraAdapter::~BaseCameraAdapter()
 
      android::AutoMutex lock(mSubscriberLock);
 
-     mFrameSubscribers.clear();
-     mImageSubscribers.clear();
-     mRawSubscribers.clear();
-     mVideoSubscribers.clear();
-     mVideoInSubscribers.clear();
-     mFocusSubscribers.clear();
-     mShutterSubscribers.clear();
-     mZoomSubscribers.clear();
-     mSnapshotSubscribers.clear();
-     mMetadataSubscribers.clear();
+     mSubscribers->decStrong(this);
+     mSubscribers = NULL;
+
+     for ( size_t i = 0 ; i < mRetiredSubscribers.size() ; i++ )
+         {
+         mRetiredSubscribers[i]->decStrong(this);
+         }
+     mRetiredSubscribers.clear();
 
      LOG_FUNCTION_NAME_EXIT;
 }
@@ -175,6 +193,8 @@ void BaseCameraAdapter::enableMsgType(int32_t msgs, frame_callback callback, eve
 
     LOG_FUNCTION_NAME;
 
+    Subscribers *subscribers = new Subscribers(*mSubscribers);
+
     int32_t frameMsg = ((msgs >> MessageNotifier::FRAME_BIT_FIELD_POSITION) & EVENT_MASK);
     int32_t eventMsg = ((msgs >> MessageNotifier::EVENT_BIT_FIELD_POSITION) & EVENT_MASK);
 
@@ -184,25 +204,25 @@ void BaseCameraAdapter::enableMsgType(int32_t msgs, frame_callback callback, eve
         switch ( frameMsg )
             {
             case CameraFrame::PREVIEW_FRAME_SYNC:
-                mFrameSubscribers.add((int) cookie, callback);
+                subscribers->mFrame.add((int) cookie, callback);
                 break;
             case CameraFrame::FRAME_DATA_SYNC:
-                mFrameDataSubscribers.add((int) cookie, callback);
+                subscribers->mFrameData.add((int) cookie, callback);
                 break;
             case CameraFrame::SNAPSHOT_FRAME:
-                mSnapshotSubscribers.add((int) cookie, callback);
+                subscribers->mSnapshot.add((int) cookie, callback);
                 break;
             case CameraFrame::IMAGE_FRAME:
-                mImageSubscribers.add((int) cookie, callback);
+                subscribers->mImage.add((int) cookie, callback);
                 break;
             case CameraFrame::RAW_FRAME:
-                mRawSubscribers.add((int) cookie, callback);
+                subscribers->mRaw.add((int) cookie, callback);
                 break;
             case CameraFrame::VIDEO_FRAME_SYNC:
-                mVideoSubscribers.add((int) cookie, callback);
+                subscribers->mVideo.add((int) cookie, callback);
                 break;
             case CameraFrame::REPROCESS_INPUT_FRAME:
-                mVideoInSubscribers.add((int) cookie, callback);
+                subscribers->mVideoIn.add((int) cookie, callback);
                 break;
             default:
                 CAMHAL_LOGEA("Frame message type id=0x%x subscription no supported yet!", frameMsg);
@@ -215,10 +235,10 @@ void BaseCameraAdapter::enableMsgType(int32_t msgs, frame_callback callback, eve
         CAMHAL_LOGVB("Event message type id=0x%x subscription request", eventMsg);
         if ( CameraHalEvent::ALL_EVENTS == eventMsg )
             {
-            mFocusSubscribers.add((int) cookie, eventCb);
-            mShutterSubscribers.add((int) cookie, eventCb);
-            mZoomSubscribers.add((int) cookie, eventCb);
-            mMetadataSubscribers.add((int) cookie, eventCb);
+            subscribers->mFocus.add((int) cookie, eventCb);
+            subscribers->mShutter.add((int) cookie, eventCb);
+            subscribers->mZoom.add((int) cookie, eventCb);
+            subscribers->mMetadata.add((int) cookie, eventCb);
             }
         else
             {
@@ -226,6 +246,8 @@ void BaseCameraAdapter::enableMsgType(int32_t msgs, frame_callback callback, eve
             }
         }
 
+    publishSubscribers(subscribers);
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -235,6 +257,8 @@ void BaseCameraAdapter::disableMsgType(int32_t msgs, void* cookie)
 
     LOG_FUNCTION_NAME;
 
+    Subscribers *subscribers = new Subscribers(*mSubscribers);
+
     int32_t frameMsg = ((msgs >> MessageNotifier::FRAME_BIT_FIELD_POSITION) & EVENT_MASK);
     int32_t eventMsg = ((msgs >> MessageNotifier::EVENT_BIT_FIELD_POSITION) & EVENT_MASK);
 
@@ -244,34 +268,34 @@ void BaseCameraAdapter::disableMsgType(int32_t msgs, void* cookie)
         switch ( frameMsg )
             {
             case CameraFrame::PREVIEW_FRAME_SYNC:
-                mFrameSubscribers.removeItem((int) cookie);
+                subscribers->mFrame.removeItem((int) cookie);
                 break;
             case CameraFrame::FRAME_DATA_SYNC:
-                mFrameDataSubscribers.removeItem((int) cookie);
+                subscribers->mFrameData.removeItem((int) cookie);
                 break;
             case CameraFrame::SNAPSHOT_FRAME:
-                mSnapshotSubscribers.removeItem((int) cookie);
+                subscribers->mSnapshot.removeItem((int) cookie);
                 break;
             case CameraFrame::IMAGE_FRAME:
-                mImageSubscribers.removeItem((int) cookie);
+                subscribers->mImage.removeItem((int) cookie);
                 break;
             case CameraFrame::RAW_FRAME:
-                mRawSubscribers.removeItem((int) cookie);
+                subscribers->mRaw.removeItem((int) cookie);
                 break;
             case CameraFrame::VIDEO_FRAME_SYNC:
-                mVideoSubscribers.removeItem((int) cookie);
+                subscribers->mVideo.removeItem((int) cookie);
                 break;
             case CameraFrame::REPROCESS_INPUT_FRAME:
-                mVideoInSubscribers.removeItem((int) cookie);
+                subscribers->mVideoIn.removeItem((int) cookie);
                 break;
             case CameraFrame::ALL_FRAMES:
-                mFrameSubscribers.removeItem((int) cookie);
-                mFrameDataSubscribers.removeItem((int) cookie);
-                mSnapshotSubscribers.removeItem((int) cookie);
-                mImageSubscribers.removeItem((int) cookie);
-                mRawSubscribers.removeItem((int) cookie);
-                mVideoSubscribers.removeItem((int) cookie);
-                mVideoInSubscribers.removeItem((int) cookie);
+                subscribers->mFrame.removeItem((int) cookie);
+                subscribers->mFrameData.removeItem((int) cookie);
+                subscribers->mSnapshot.removeItem((int) cookie);
+                subscribers->mImage.removeItem((int) cookie);
+                subscribers->mRaw.removeItem((int) cookie);
+                subscribers->mVideo.removeItem((int) cookie);
+                subscribers->mVideoIn.removeItem((int) cookie);
                 break;
             default:
                 CAMHAL_LOGEA("Frame message type id=0x%x subscription remove not supported yet!", frameMsg);
@@ -285,10 +309,10 @@ void BaseCameraAdapter::disableMsgType(int32_t msgs, void* cookie)
         if ( CameraHalEvent::ALL_EVENTS == eventMsg)
             {
             //TODO: Process case by case
-            mFocusSubscribers.removeItem((int) cookie);
-            mShutterSubscribers.removeItem((int) cookie);
-            mZoomSubscribers.removeItem((int) cookie);
-            mMetadataSubscribers.removeItem((int) cookie);
+            subscribers->mFocus.removeItem((int) cookie);
+            subscribers->mShutter.removeItem((int) cookie);
+            subscribers->mZoom.removeItem((int) cookie);
+            subscribers->mMetadata.removeItem((int) cookie);
             }
         else
             {
@@ -296,13 +320,58 @@ void BaseCameraAdapter::disableMsgType(int32_t msgs, void* cookie)
             }
         }
 
+    publishSubscribers(subscribers);
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
+BaseCameraAdapter::Subscribers::Subscribers(const Subscribers &other)
+    : mFrame(other.mFrame),
+      mSnapshot(other.mSnapshot),
+      mFrameData(other.mFrameData),
+      mVideo(other.mVideo),
+      mVideoIn(other.mVideoIn),
+      mImage(other.mImage),
+      mRaw(other.mRaw),
+      mFocus(other.mFocus),
+      mZoom(other.mZoom),
+      mShutter(other.mShutter),
+      mMetadata(other.mMetadata)
+{
+}
+
+BaseCameraAdapter::SubscribersRef::SubscribersRef(const BaseCameraAdapter *adapter)
+{
+    // while mSubscriberReaders is raised the publisher keeps its reference
+    // on the instance it replaced, so loading and referencing is atomic
+    __atomic_add_fetch(&adapter->mSubscriberReaders, 1, __ATOMIC_SEQ_CST);
+    mSubscribers = __atomic_load_n(&adapter->mSubscribers, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&adapter->mSubscriberReaders, 1, __ATOMIC_SEQ_CST);
+}
+
+void BaseCameraAdapter::publishSubscribers(Subscribers *subscribers)
+{
+    subscribers->incStrong(this);
+    Subscribers *previous = __atomic_exchange_n(&mSubscribers, subscribers, __ATOMIC_SEQ_CST);
+    mRetiredSubscribers.add(previous);
+
+    // a dispatcher that loaded a replaced instance may not have referenced
+    // it yet; once none is in between, drop ours and let the last
+    // dispatcher still using an instance free it
+    if ( 0 == __atomic_load_n(&mSubscriberReaders, __ATOMIC_SEQ_CST) )
+        {
+        for ( size_t i = 0 ; i < mRetiredSubscribers.size() ; i++ )
+            {
+            mRetiredSubscribers[i]->decStrong(this);
+            }
+        mRetiredSubscribers.clear();
+        }
+}
+
 void BaseCameraAdapter::addFramePointers(CameraBuffer *frameBuf, void *buf)
 {
   unsigned int *pBuf = (unsigned int *)buf;
-  android::AutoMutex lock(mSubscriberLock);
+  android::AutoMutex lock(mFrameQueueLock);
 
   if ((frameBuf != NULL) && ( pBuf != NULL) )
     {
@@ -318,7 +387,7 @@ void BaseCameraAdapter::addFramePointers(CameraBuffer *frameBuf, void *buf)
 
 void BaseCameraAdapter::removeFramePointers()
 {
-  android::AutoMutex lock(mSubscriberLock);
+  android::AutoMutex lock(mFrameQueueLock);
 
   int size = mFrameQueue.size();
   CAMHAL_LOGVB("Removing %d Frames = ", size);
@@ -345,31 +414,20 @@ void BaseCameraAdapter::returnFrame(CameraBuffer * frameBuf, CameraFrame::FrameT
 
     if ( NO_ERROR == res)
         {
-        android::AutoMutex lock(mReturnFrameLock);
-
-        refCount = getFrameRefCountByType(frameBuf, frameType);
-
         if(frameType == CameraFrame::PREVIEW_FRAME_SYNC)
             {
-            mFramesWithDisplay--;
+            __atomic_fetch_sub(&mFramesWithDisplay, 1, __ATOMIC_RELAXED);
             }
         else if(frameType == CameraFrame::VIDEO_FRAME_SYNC)
             {
-            mFramesWithEncoder--;
+            __atomic_fetch_sub(&mFramesWithEncoder, 1, __ATOMIC_RELAXED);
             }
 
-        if ( 0 < refCount )
-            {
-
-            refCount--;
-            setFrameRefCountByType(frameBuf, frameType, refCount);
-
-            if (mRecording) {
-                refCount += getFrameRefCount(frameBuf);
-            }
+        // while recording the preview buffers are shared with the encoder,
+        // so a buffer is only free once no frame type references it
+        refCount = mFrameRefs.release(frameBuf, frameType, mRecording);
 
-            }
-        else
+        if ( 0 > refCount )
             {
             CAMHAL_LOGDA("Frame returned when ref count is already zero!!");
             return;
@@ -431,21 +489,19 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                     android::AutoMutex lock(mPreviewBufferLock);
                     mPreviewBuffers = desc->mBuffers;
                     mPreviewBuffersLength = desc->mLength;
-                    mPreviewBuffersAvailable.clear();
-                    mSnapshotBuffersAvailable.clear();
-                    for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
-                        {
-                        mPreviewBuffersAvailable.add(&mPreviewBuffers[i], 0);
-                        }
                     // initial ref count for undeqeueued buffers is 1 since buffer provider
                     // is still holding on to it
-                    for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
-                        {
-                        mPreviewBuffersAvailable.add(&mPreviewBuffers[i], 1);
-                        }
+                    ret = mFrameRefs.track(FrameRefTable::PREVIEW_SET,
+                                           mPreviewBuffers,
+                                           desc->mCount,
+                                           desc->mMaxQueueable,
+                                           CameraFrame::PREVIEW_FRAME_SYNC);
+
+                    android::AutoMutex historyLock(mHistoryLock);
+                    mHistoryLimit = max((int) desc->mMaxQueueable - FRAME_HISTORY_MIN_QUEUED, 0);
                     }
 
-                if ( NULL != desc )
+                if ( ret == NO_ERROR )
                     {
                     ret = useBuffers(CameraAdapter::CAMERA_PREVIEW,
                                      desc->mBuffers,
@@ -485,20 +541,16 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                         android::AutoMutex lock(mPreviewDataBufferLock);
                         mPreviewDataBuffers = desc->mBuffers;
                         mPreviewDataBuffersLength = desc->mLength;
-                        mPreviewDataBuffersAvailable.clear();
-                        for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
-                            {
-                            mPreviewDataBuffersAvailable.add(&mPreviewDataBuffers[i], 0);
-                            }
                         // initial ref count for undeqeueued buffers is 1 since buffer provider
                         // is still holding on to it
-                        for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
-                            {
-                            mPreviewDataBuffersAvailable.add(&mPreviewDataBuffers[i], 1);
-                            }
+                        ret = mFrameRefs.track(FrameRefTable::PREVIEW_DATA_SET,
+                                               mPreviewDataBuffers,
+                                               desc->mCount,
+                                               desc->mMaxQueueable,
+                                               CameraFrame::FRAME_DATA_SYNC);
                         }
 
-                    if ( NULL != desc )
+                    if ( ret == NO_ERROR )
                         {
                         ret = useBuffers(CameraAdapter::CAMERA_MEASUREMENT,
                                          desc->mBuffers,
@@ -577,15 +629,16 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
             if (ret == NO_ERROR) {
                 android::AutoMutex lock(mVideoInBufferLock);
                 mVideoInBuffers = desc->mBuffers;
-                mVideoInBuffersAvailable.clear();
-                for (uint32_t i = 0 ; i < desc->mMaxQueueable ; i++) {
-                    mVideoInBuffersAvailable.add(&mVideoInBuffers[i], 0);
-                }
                 // initial ref count for undeqeueued buffers is 1 since buffer provider
                 // is still holding on to it
-                for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ ) {
-                    mVideoInBuffersAvailable.add(&mVideoInBuffers[i], 1);
-                }
+                ret = mFrameRefs.track(FrameRefTable::VIDEO_IN_SET,
+                                       mVideoInBuffers,
+                                       desc->mCount,
+                                       desc->mMaxQueueable,
+                                       CameraFrame::REPROCESS_INPUT_FRAME);
+            }
+
+            if (ret == NO_ERROR) {
                 ret = useBuffers(CameraAdapter::CAMERA_REPROCESS,
                                  desc->mBuffers,
                                  desc->mCount,
@@ -697,6 +750,9 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                 ret = stopPreview();
                 }
 
+            // no preview frame arrives anymore, give the held ones back
+            flushFrameHistory();
+
             if ( ret == NO_ERROR )
                 {
                 ret = commitState();
@@ -1072,18 +1128,16 @@ status_t BaseCameraAdapter::sendCommand(CameraCommands operation, int value1, in
                  android::AutoMutex lock(mVideoBufferLock);
                  mVideoBuffers = desc->mBuffers;
                  mVideoBuffersLength = desc->mLength;
-                 mVideoBuffersAvailable.clear();
-                 for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ ) {
-                     mVideoBuffersAvailable.add(&mVideoBuffers[i], 1);
-                 }
                  // initial ref count for undeqeueued buffers is 1 since buffer provider
                  // is still holding on to it
-                 for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ ) {
-                     mVideoBuffersAvailable.add(&mVideoBuffers[i], 1);
-                 }
+                 ret = mFrameRefs.track(FrameRefTable::VIDEO_SET,
+                                        mVideoBuffers,
+                                        desc->mCount,
+                                        0,
+                                        CameraFrame::VIDEO_FRAME_SYNC);
              }
 
-             if ( NULL != desc ) {
+             if ( ret == NO_ERROR ) {
                  ret = useBuffers(CameraAdapter::CAMERA_VIDEO,
                          desc->mBuffers,
                          desc->mCount,
@@ -1134,7 +1188,9 @@ status_t BaseCameraAdapter::notifyFocusSubscribers(CameraHalEvent::FocusStatus s
 
     LOG_FUNCTION_NAME;
 
-    if ( mFocusSubscribers.size() == 0 ) {
+    SubscribersRef subscribers(this);
+
+    if ( subscribers->mFocus.size() == 0 ) {
         CAMHAL_LOGDA("No Focus Subscribers!");
         return NO_INIT;
     }
@@ -1156,10 +1212,10 @@ status_t BaseCameraAdapter::notifyFocusSubscribers(CameraHalEvent::FocusStatus s
     focusEvent.mEventType = CameraHalEvent::EVENT_FOCUS_LOCKED;
     focusEvent.mEventData->focusEvent.focusStatus = status;
 
-    for (unsigned int i = 0 ; i < mFocusSubscribers.size(); i++ )
+    for (unsigned int i = 0 ; i < subscribers->mFocus.size(); i++ )
         {
-        focusEvent.mCookie = (void *) mFocusSubscribers.keyAt(i);
-        eventCb = (event_callback) mFocusSubscribers.valueAt(i);
+        focusEvent.mCookie = (void *) subscribers->mFocus.keyAt(i);
+        eventCb = (event_callback) subscribers->mFocus.valueAt(i);
         eventCb ( &focusEvent );
         }
 
@@ -1178,7 +1234,9 @@ status_t BaseCameraAdapter::notifyShutterSubscribers()
 
     LOG_FUNCTION_NAME;
 
-    if ( mShutterSubscribers.size() == 0 )
+    SubscribersRef subscribers(this);
+
+    if ( subscribers->mShutter.size() == 0 )
         {
         CAMHAL_LOGEA("No shutter Subscribers!");
         return NO_INIT;
@@ -1192,9 +1250,9 @@ status_t BaseCameraAdapter::notifyShutterSubscribers()
     shutterEvent.mEventType = CameraHalEvent::EVENT_SHUTTER;
     shutterEvent.mEventData->shutterEvent.shutterClosed = true;
 
-    for (unsigned int i = 0 ; i < mShutterSubscribers.size() ; i++ ) {
-        shutterEvent.mCookie = ( void * ) mShutterSubscribers.keyAt(i);
-        eventCb = ( event_callback ) mShutterSubscribers.valueAt(i);
+    for (unsigned int i = 0 ; i < subscribers->mShutter.size() ; i++ ) {
+        shutterEvent.mCookie = ( void * ) subscribers->mShutter.keyAt(i);
+        eventCb = ( event_callback ) subscribers->mShutter.valueAt(i);
 
         CAMHAL_LOGD("Sending shutter callback");
 
@@ -1216,7 +1274,9 @@ status_t BaseCameraAdapter::notifyZoomSubscribers(int zoomIdx, bool targetReache
 
     LOG_FUNCTION_NAME;
 
-    if ( mZoomSubscribers.size() == 0 ) {
+    SubscribersRef subscribers(this);
+
+    if ( subscribers->mZoom.size() == 0 ) {
         CAMHAL_LOGDA("No zoom Subscribers!");
         return NO_INIT;
     }
@@ -1230,9 +1290,9 @@ status_t BaseCameraAdapter::notifyZoomSubscribers(int zoomIdx, bool targetReache
     zoomEvent.mEventData->zoomEvent.currentZoomIndex = zoomIdx;
     zoomEvent.mEventData->zoomEvent.targetZoomIndexReached = targetReached;
 
-    for (unsigned int i = 0 ; i < mZoomSubscribers.size(); i++ ) {
-        zoomEvent.mCookie = (void *) mZoomSubscribers.keyAt(i);
-        eventCb = (event_callback) mZoomSubscribers.valueAt(i);
+    for (unsigned int i = 0 ; i < subscribers->mZoom.size(); i++ ) {
+        zoomEvent.mCookie = (void *) subscribers->mZoom.keyAt(i);
+        eventCb = (event_callback) subscribers->mZoom.valueAt(i);
 
         eventCb ( &zoomEvent );
     }
@@ -1252,7 +1312,9 @@ status_t BaseCameraAdapter::notifyMetadataSubscribers(android::sp<CameraMetadata
 
     LOG_FUNCTION_NAME;
 
-    if ( mMetadataSubscribers.size() == 0 ) {
+    SubscribersRef subscribers(this);
+
+    if ( subscribers->mMetadata.size() == 0 ) {
         CAMHAL_LOGDA("No preview metadata subscribers!");
         return NO_INIT;
     }
@@ -1265,9 +1327,9 @@ status_t BaseCameraAdapter::notifyMetadataSubscribers(android::sp<CameraMetadata
     metaEvent.mEventType = CameraHalEvent::EVENT_METADATA;
     metaEvent.mEventData->metadataEvent = meta;
 
-    for (unsigned int i = 0 ; i < mMetadataSubscribers.size(); i++ ) {
-        metaEvent.mCookie = (void *) mMetadataSubscribers.keyAt(i);
-        eventCb = (event_callback) mMetadataSubscribers.valueAt(i);
+    for (unsigned int i = 0 ; i < subscribers->mMetadata.size(); i++ ) {
+        metaEvent.mCookie = (void *) subscribers->mMetadata.keyAt(i);
+        eventCb = (event_callback) subscribers->mMetadata.valueAt(i);
 
         eventCb ( &metaEvent );
     }
@@ -1290,6 +1352,19 @@ status_t BaseCameraAdapter::sendFrameToSubscribers(CameraFrame *frame)
         return -EINVAL;
         }
 
+    if ( frame->mFrameMask & CameraFrame::PREVIEW_FRAME_SYNC ) {
+        FrameTracer::mark(FrameTracer::STAGE_SENSOR, frame->mTimestamp);
+        // held before the subscribers get it, they may return it right away
+        addToHistory(*frame);
+    }
+
+    // the encoders look the captured frame up by its own timestamp
+    if ( frame->mFrameMask & ( CameraFrame::IMAGE_FRAME | CameraFrame::RAW_FRAME ) ) {
+        FrameTracer::mark(FrameTracer::STAGE_CAPTURE, frame->mTimestamp);
+    }
+
+    SubscribersRef subscribers(this);
+
     for( mask = 1; mask < CameraFrame::ALL_FRAMES; mask <<= 1){
       if( mask & frame->mFrameMask ){
         switch( mask ){
@@ -1299,37 +1374,38 @@ status_t BaseCameraAdapter::sendFrameToSubscribers(CameraFrame *frame)
 #if PPM_INSTRUMENTATION || PPM_INSTRUMENTATION_ABS
             CameraHal::PPM("Shot to Jpeg: ", &mStartCapture);
 #endif
-            ret = __sendFrameToSubscribers(frame, &mImageSubscribers, CameraFrame::IMAGE_FRAME);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mImage, CameraFrame::IMAGE_FRAME);
           }
           break;
         case CameraFrame::RAW_FRAME:
           {
-            ret = __sendFrameToSubscribers(frame, &mRawSubscribers, CameraFrame::RAW_FRAME);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mRaw, CameraFrame::RAW_FRAME);
           }
           break;
         case CameraFrame::PREVIEW_FRAME_SYNC:
           {
-            ret = __sendFrameToSubscribers(frame, &mFrameSubscribers, CameraFrame::PREVIEW_FRAME_SYNC);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mFrame, CameraFrame::PREVIEW_FRAME_SYNC);
+            FrameTracer::mark(FrameTracer::STAGE_DISPATCH, frame->mTimestamp);
           }
           break;
         case CameraFrame::SNAPSHOT_FRAME:
           {
-            ret = __sendFrameToSubscribers(frame, &mSnapshotSubscribers, CameraFrame::SNAPSHOT_FRAME);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mSnapshot, CameraFrame::SNAPSHOT_FRAME);
           }
           break;
         case CameraFrame::VIDEO_FRAME_SYNC:
           {
-            ret = __sendFrameToSubscribers(frame, &mVideoSubscribers, CameraFrame::VIDEO_FRAME_SYNC);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mVideo, CameraFrame::VIDEO_FRAME_SYNC);
           }
           break;
         case CameraFrame::FRAME_DATA_SYNC:
           {
-            ret = __sendFrameToSubscribers(frame, &mFrameDataSubscribers, CameraFrame::FRAME_DATA_SYNC);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mFrameData, CameraFrame::FRAME_DATA_SYNC);
           }
           break;
         case CameraFrame::REPROCESS_INPUT_FRAME:
           {
-            ret = __sendFrameToSubscribers(frame, &mVideoInSubscribers, CameraFrame::REPROCESS_INPUT_FRAME);
+            ret = __sendFrameToSubscribers(frame, &subscribers->mVideoIn, CameraFrame::REPROCESS_INPUT_FRAME);
           }
           break;
         default:
@@ -1349,7 +1425,7 @@ status_t BaseCameraAdapter::sendFrameToSubscribers(CameraFrame *frame)
 }
 
 status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
-                                                     android::KeyedVector<int, frame_callback> *subscribers,
+                                                     const android::KeyedVector<int, frame_callback> *subscribers,
                                                      CameraFrame::FrameType frameType)
 {
     size_t refCount = 0;
@@ -1361,6 +1437,7 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
     if ( (frameType == CameraFrame::PREVIEW_FRAME_SYNC) ||
          (frameType == CameraFrame::VIDEO_FRAME_SYNC) ||
          (frameType == CameraFrame::SNAPSHOT_FRAME) ){
+        android::AutoMutex lock(mFrameQueueLock);
         if (mFrameQueue.size() > 0){
           CameraFrame *lframe = (CameraFrame *)mFrameQueue.valueFor(frame->mBuffer);
           frame->mYuv[0] = lframe->mYuv[0];
@@ -1380,7 +1457,7 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
             return -EINVAL;
         }
 
-        if (refCount > subscribers->size()) {
+        if (refCount > FrameRefTable::MAX_REF_COUNT) {
             CAMHAL_LOGEB("Invalid ref count for frame type: 0x%x", frameType);
             return -EINVAL;
         }
@@ -1390,7 +1467,14 @@ status_t BaseCameraAdapter::__sendFrameToSubscribers(CameraFrame* frame,
                      ( uint32_t ) frame->mBuffer,
                      refCount);
 
-        for ( unsigned int i = 0 ; i < refCount; i++ ) {
+        // the ref count was taken from an earlier snapshot, subscribers
+        // that left since then won't return their references
+        const size_t delivered = min(refCount, subscribers->size());
+        for ( size_t i = delivered ; i < refCount ; i++ ) {
+            returnFrame(frame->mBuffer, frameType);
+        }
+
+        for ( unsigned int i = 0 ; i < delivered; i++ ) {
             frame->mCookie = ( void * ) subscribers->keyAt(i);
             callback = (frame_callback) subscribers->valueAt(i);
 
@@ -1421,43 +1505,45 @@ int BaseCameraAdapter::setInitFrameRefCount(CameraBuffer * buf, unsigned int mas
       return -EINVAL;
     }
 
+  SubscribersRef subscribers(this);
+
   for( lmask = 1; lmask < CameraFrame::ALL_FRAMES; lmask <<= 1){
     if( lmask & mask ){
       switch( lmask ){
 
       case CameraFrame::IMAGE_FRAME:
         {
-            setFrameRefCountByType(buf, CameraFrame::IMAGE_FRAME, (int) mImageSubscribers.size());
+            ret |= setFrameRefCountByType(buf, CameraFrame::IMAGE_FRAME, (int) subscribers->mImage.size());
         }
         break;
       case CameraFrame::RAW_FRAME:
         {
-            setFrameRefCountByType(buf, CameraFrame::RAW_FRAME, mRawSubscribers.size());
+            ret |= setFrameRefCountByType(buf, CameraFrame::RAW_FRAME, subscribers->mRaw.size());
         }
         break;
       case CameraFrame::PREVIEW_FRAME_SYNC:
         {
-            setFrameRefCountByType(buf, CameraFrame::PREVIEW_FRAME_SYNC, mFrameSubscribers.size());
+            ret |= setFrameRefCountByType(buf, CameraFrame::PREVIEW_FRAME_SYNC, subscribers->mFrame.size());
         }
         break;
       case CameraFrame::SNAPSHOT_FRAME:
         {
-            setFrameRefCountByType(buf, CameraFrame::SNAPSHOT_FRAME, mSnapshotSubscribers.size());
+            ret |= setFrameRefCountByType(buf, CameraFrame::SNAPSHOT_FRAME, subscribers->mSnapshot.size());
         }
         break;
       case CameraFrame::VIDEO_FRAME_SYNC:
         {
-            setFrameRefCountByType(buf,CameraFrame::VIDEO_FRAME_SYNC, mVideoSubscribers.size());
+            ret |= setFrameRefCountByType(buf,CameraFrame::VIDEO_FRAME_SYNC, subscribers->mVideo.size());
         }
         break;
       case CameraFrame::FRAME_DATA_SYNC:
         {
-            setFrameRefCountByType(buf, CameraFrame::FRAME_DATA_SYNC, mFrameDataSubscribers.size());
+            ret |= setFrameRefCountByType(buf, CameraFrame::FRAME_DATA_SYNC, subscribers->mFrameData.size());
         }
         break;
       case CameraFrame::REPROCESS_INPUT_FRAME:
         {
-            setFrameRefCountByType(buf,CameraFrame::REPROCESS_INPUT_FRAME, mVideoInSubscribers.size());
+            ret |= setFrameRefCountByType(buf,CameraFrame::REPROCESS_INPUT_FRAME, subscribers->mVideoIn.size());
         }
         break;
       default:
@@ -1473,136 +1559,117 @@ int BaseCameraAdapter::setInitFrameRefCount(CameraBuffer * buf, unsigned int mas
 
 int BaseCameraAdapter::getFrameRefCount(CameraBuffer * frameBuf)
 {
-    int res = 0, refCnt = 0;
+    return mFrameRefs.total(frameBuf);
+}
 
-    for (unsigned int frameType = 1; frameType < CameraFrame::ALL_FRAMES; frameType <<= 1) {
-        refCnt = getFrameRefCountByType(frameBuf, static_cast<CameraFrame::FrameType>(frameType));
-        if (refCnt > 0) res += refCnt;
+int BaseCameraAdapter::getFrameRefCountByType(CameraBuffer * frameBuf, CameraFrame::FrameType frameType)
+{
+    return mFrameRefs.get(frameBuf, frameType);
+}
+
+status_t BaseCameraAdapter::setFrameRefCountByType(CameraBuffer * frameBuf, CameraFrame::FrameType frameType, int refCount)
+{
+    return mFrameRefs.set(frameBuf, frameType, refCount);
+}
+
+void BaseCameraAdapter::enableFrameHistory(bool enable)
+{
+    if ( !enable ) {
+        flushFrameHistory();
     }
-    return res;
+
+    android::AutoMutex lock(mHistoryLock);
+    android_atomic_release_store(( enable && ( mHistoryDepth > 0 ) ) ? 1 : 0, &mHistoryEnabled);
+
+    CAMHAL_LOGDB("Frame history %s, depth %d", mHistoryEnabled ? "on" : "off", mHistoryDepth);
 }
 
-int BaseCameraAdapter::getFrameRefCountByType(CameraBuffer * frameBuf, CameraFrame::FrameType frameType)
+bool BaseCameraAdapter::isFrameHistoryEnabled()
 {
-    int res = -1;
-    ssize_t index = NAME_NOT_FOUND;
+    android::AutoMutex lock(mHistoryLock);
+    return mHistoryEnabled != 0;
+}
 
-    LOG_FUNCTION_NAME;
+void BaseCameraAdapter::addToHistory(const CameraFrame &frame)
+{
+    CameraBuffer *evicted = NULL;
 
-    switch (frameType) {
-        case CameraFrame::IMAGE_FRAME:
-        case CameraFrame::RAW_FRAME:
-        {
-            android::AutoMutex lock(mCaptureBufferLock);
-            index = mCaptureBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mCaptureBuffersAvailable[index];
-            }
-            break;
-        }
-        case CameraFrame::SNAPSHOT_FRAME:
-        {
-            android::AutoMutex lock(mSnapshotBufferLock);
-            index = mSnapshotBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mSnapshotBuffersAvailable[index];
-            }
-            break;
-        }
-        case CameraFrame::PREVIEW_FRAME_SYNC:
-        {
-            android::AutoMutex lock(mPreviewBufferLock);
-            index = mPreviewBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mPreviewBuffersAvailable[index];
-            }
-            break;
+    // checked again under the lock, adapters without a history take none
+    if ( 0 == android_atomic_acquire_load(&mHistoryEnabled) ) {
+        return;
+    }
+
+    {
+        android::AutoMutex lock(mHistoryLock);
+
+        const int depth = min(mHistoryDepth, mHistoryLimit);
+        if ( !mHistoryEnabled || depth <= 0 || !mFrameRefs.hold(frame.mBuffer) ) {
+            return;
         }
-        case CameraFrame::FRAME_DATA_SYNC:
-        {
-            android::AutoMutex lock(mPreviewDataBufferLock);
-            index = mPreviewDataBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mPreviewDataBuffersAvailable[index];
-            }
-            break;
+
+        mHistory.push_back(frame);
+        if ( (int) mHistory.size() > depth ) {
+            evicted = mHistory[0].mBuffer;
+            mHistory.removeAt(0);
         }
-        case CameraFrame::VIDEO_FRAME_SYNC:
-        {
-            android::AutoMutex lock(mVideoBufferLock);
-            index = mVideoBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mVideoBuffersAvailable[index];
-            }
-            break;
+    }
+
+    if ( NULL != evicted ) {
+        releaseHistoryFrame(evicted);
+    }
+}
+
+status_t BaseCameraAdapter::takeHistoryFrame(nsecs_t shutter, CameraFrame &frame)
+{
+    android::AutoMutex lock(mHistoryLock);
+
+    if ( mHistory.isEmpty() ) {
+        return NOT_ENOUGH_DATA;
+    }
+
+    size_t best = 0;
+    nsecs_t bestDistance = -1;
+    for ( size_t i = 0 ; i < mHistory.size() ; i++ ) {
+        nsecs_t distance = mHistory[i].mTimestamp - shutter;
+        if ( distance < 0 ) {
+            distance = -distance;
         }
-        case CameraFrame::REPROCESS_INPUT_FRAME:
-        {
-            android::AutoMutex lock(mVideoInBufferLock);
-            index = mVideoInBuffersAvailable.indexOfKey(frameBuf);
-            if (index != NAME_NOT_FOUND) {
-                res = mVideoInBuffersAvailable[index];
-            }
-            break;
+        if ( ( bestDistance < 0 ) || ( distance < bestDistance ) ) {
+            best = i;
+            bestDistance = distance;
         }
-        default:
-            break;
     }
 
-    LOG_FUNCTION_NAME_EXIT;
+    frame = mHistory[best];
+    mHistory.removeAt(best);
 
-    return res;
+    CAMHAL_LOGDB("History frame %lld ns from the shutter, %d frames left",
+                 bestDistance, mHistory.size());
+
+    return NO_ERROR;
 }
 
-void BaseCameraAdapter::setFrameRefCountByType(CameraBuffer * frameBuf, CameraFrame::FrameType frameType, int refCount)
+void BaseCameraAdapter::releaseHistoryFrame(CameraBuffer *buffer)
 {
+    // the subscribers may all have returned the frame while it was held
+    if ( 0 == mFrameRefs.unhold(buffer) ) {
+        fillThisBuffer(buffer, CameraFrame::PREVIEW_FRAME_SYNC);
+    }
+}
 
-    LOG_FUNCTION_NAME;
-
-    switch ( frameType )
-        {
-        case CameraFrame::IMAGE_FRAME:
-        case CameraFrame::RAW_FRAME:
-                {
-                android::AutoMutex lock(mCaptureBufferLock);
-                mCaptureBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::SNAPSHOT_FRAME:
-                {
-                android::AutoMutex lock(mSnapshotBufferLock);
-                mSnapshotBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::PREVIEW_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mPreviewBufferLock);
-                mPreviewBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::FRAME_DATA_SYNC:
-                {
-                android::AutoMutex lock(mPreviewDataBufferLock);
-                mPreviewDataBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::VIDEO_FRAME_SYNC:
-                {
-                android::AutoMutex lock(mVideoBufferLock);
-                mVideoBuffersAvailable.replaceValueFor(frameBuf, refCount);
-                }
-            break;
-        case CameraFrame::REPROCESS_INPUT_FRAME: {
-            android::AutoMutex lock(mVideoInBufferLock);
-            mVideoInBuffersAvailable.replaceValueFor(frameBuf, refCount);
-        }
-            break;
-        default:
-            break;
-        };
+void BaseCameraAdapter::flushFrameHistory()
+{
+    android::Vector<CameraFrame> history;
 
-    LOG_FUNCTION_NAME_EXIT;
+    {
+        android::AutoMutex lock(mHistoryLock);
+        history = mHistory;
+        mHistory.clear();
+    }
 
+    for ( size_t i = 0 ; i < history.size() ; i++ ) {
+        releaseHistoryFrame(history[i].mBuffer);
+    }
 }
 
 status_t BaseCameraAdapter::startVideoCapture()
@@ -1623,12 +1690,9 @@ status_t BaseCameraAdapter::startVideoCapture()
     if ( NO_ERROR == ret )
         {
 
-        mVideoBuffersAvailable.clear();
-
-        for ( unsigned int i = 0 ; i < mPreviewBuffersAvailable.size() ; i++ )
-            {
-            mVideoBuffersAvailable.add(mPreviewBuffersAvailable.keyAt(i), 0);
-            }
+        // recording starts on the preview buffers
+        mFrameRefs.untrack(FrameRefTable::VIDEO_SET);
+        mFrameRefs.reset(FrameRefTable::PREVIEW_SET, CameraFrame::VIDEO_FRAME_SYNC);
 
         mRecording = true;
         }
@@ -1651,12 +1715,17 @@ status_t BaseCameraAdapter::stopVideoCapture()
 
     if ( NO_ERROR == ret )
         {
-        for ( unsigned int i = 0 ; i < mVideoBuffersAvailable.size() ; i++ )
+        const FrameRefTable::BufferSet sets[] = { FrameRefTable::PREVIEW_SET,
+                                                  FrameRefTable::VIDEO_SET };
+        for ( unsigned int i = 0 ; i < sizeof(sets) / sizeof(sets[0]) ; i++ )
             {
-            CameraBuffer *frameBuf = mVideoBuffersAvailable.keyAt(i);
-            if( getFrameRefCountByType(frameBuf,  CameraFrame::VIDEO_FRAME_SYNC) > 0)
+            for ( int j = 0 ; j < mFrameRefs.size(sets[i]) ; j++ )
                 {
-                returnFrame(frameBuf, CameraFrame::VIDEO_FRAME_SYNC);
+                CameraBuffer *frameBuf = mFrameRefs.bufferAt(sets[i], j);
+                if( getFrameRefCountByType(frameBuf,  CameraFrame::VIDEO_FRAME_SYNC) > 0)
+                    {
+                    returnFrame(frameBuf, CameraFrame::VIDEO_FRAME_SYNC);
+                    }
                 }
             }
 
@@ -2697,6 +2766,9 @@ extern "C" status_t OMXCameraAdapter_Capabilities(
 extern "C" status_t V4LCameraAdapter_Capabilities(
         CameraProperties::Properties * const properties_array,
         const int starting_camera, const int max_camera, int & supportedCameras);
+extern "C" status_t ReplayCameraAdapter_Capabilities(
+        CameraProperties::Properties * const properties_array,
+        const int starting_camera, const int max_camera, int & supportedCameras);
 
 extern "C" status_t CameraAdapter_Capabilities(
         CameraProperties::Properties * const properties_array,
@@ -2711,12 +2783,19 @@ extern "C" status_t CameraAdapter_Capabilities(
 
     supportedCameras = 0;
 #ifdef OMX_CAMERA_ADAPTER
-    //Query OMX cameras
-    err = OMXCameraAdapter_Capabilities( properties_array, starting_camera,
-                                         max_camera, supportedCameras);
-    if(err != NO_ERROR) {
-        CAMHAL_LOGEA("error while getting OMXCameraAdapter capabilities");
-        ret = UNKNOWN_ERROR;
+    //Query OMX cameras, the sensors don't change between builds so their
+    //capabilities come from the cache unless it is stale
+    CapabilitiesCache cache;
+    if ( cache.load(properties_array + starting_camera, max_camera - starting_camera,
+                    supportedCameras) != NO_ERROR ) {
+        err = OMXCameraAdapter_Capabilities( properties_array, starting_camera,
+                                             max_camera, supportedCameras);
+        if(err != NO_ERROR) {
+            CAMHAL_LOGEA("error while getting OMXCameraAdapter capabilities");
+            ret = UNKNOWN_ERROR;
+        } else if ( supportedCameras > 0 ) {
+            cache.store(properties_array + starting_camera, supportedCameras);
+        }
     }
 #endif
 #ifdef V4L_CAMERA_ADAPTER
@@ -2728,6 +2807,20 @@ extern "C" status_t CameraAdapter_Capabilities(
         ret = UNKNOWN_ERROR;
     }
 #endif
+#ifdef REPLAY_CAMERA_ADAPTER
+    //Query the replay camera, present while a recording is configured
+    {
+    int num_replay_cameras = 0;
+    err = ReplayCameraAdapter_Capabilities( properties_array,
+                                            supportedCameras + num_cameras_supported,
+                                            max_camera, num_replay_cameras);
+    if(err != NO_ERROR) {
+        CAMHAL_LOGEA("error while getting ReplayCameraAdapter capabilities");
+        ret = UNKNOWN_ERROR;
+    }
+    num_cameras_supported += num_replay_cameras;
+    }
+#endif
 
     supportedCameras += num_cameras_supported;
     CAMHAL_LOGEB("supportedCameras= %d\n", supportedCameras);
@@ -26,6 +26,7 @@
 #include "BufferSourceAdapter.h"
 #include "TICameraParameters.h"
 #include "CameraProperties.h"
+#include "FrameTracer.h"
 #include <cutils/properties.h>
 
 #include <poll.h>
@@ -36,6 +37,7 @@ namespace Camera {
 
 extern "C" CameraAdapter* OMXCameraAdapter_Factory(size_t);
 extern "C" CameraAdapter* V4LCameraAdapter_Factory(size_t, CameraHal*);
+extern "C" CameraAdapter* ReplayCameraAdapter_Factory(size_t);
 
 /*****************************************************************************/
 
@@ -370,15 +372,275 @@ int CameraHal::setParameters(const char* parameters)
     return setParameters(params);
 }
 
+// Keys apps change every frame or so while previewing, none of them needs
+// more than a new value in mParameters and, with 'update' set, a push to
+// the adapter even when preview is stopped (see doesSetParameterNeedUpdate()).
+struct RuntimeParameter {
+    const char *key;
+    bool update;
+};
+
+static const RuntimeParameter RUNTIME_PARAMETERS[] = {
+    { android::CameraParameters::KEY_ZOOM, true },
+    { android::CameraParameters::KEY_AUTO_EXPOSURE_LOCK, true },
+    { android::CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK, true },
+    { android::CameraParameters::KEY_EXPOSURE_COMPENSATION, false },
+    { android::CameraParameters::KEY_FOCUS_AREAS, false },
+    { android::CameraParameters::KEY_METERING_AREAS, false },
+};
+
+static const RuntimeParameter * findRuntimeParameter(const char *key, size_t length)
+{
+    for (size_t i = 0; i < sizeof(RUNTIME_PARAMETERS) / sizeof(RUNTIME_PARAMETERS[0]); i++) {
+        const char *name = RUNTIME_PARAMETERS[i].key;
+        if ((strncmp(name, key, length) == 0) && ('\0' == name[length])) {
+            return &RUNTIME_PARAMETERS[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Splits the "key=value" entry at 'pos' of a flattened CameraParameters.
+static const char * nextFlattenedEntry(const char *pos, size_t &keyLength, size_t &length)
+{
+    const char *end = strchr(pos, ';');
+    const char *sep;
+
+    length = end ? (size_t) (end - pos) : strlen(pos);
+    sep = (const char *) memchr(pos, '=', length);
+    keyLength = sep ? (size_t) (sep - pos) : length;
+
+    return end ? end + 1 : pos + length;
+}
+
+/**
+   Collects the runtime parameters whose values differ between two flattened
+   CameraParameters. Both list their keys in the same sorted order, so one
+   walk over the strings finds every key added, removed or changed.
+
+   @return false if a key that isn't a runtime parameter changed
+ */
+static bool diffRuntimeParameters(const char *from, const char *to,
+                                  android::Vector<const RuntimeParameter *> &changed)
+{
+    while (*from || *to) {
+        size_t fromKey = 0, fromLength = 0, toKey = 0, toLength = 0;
+        const char *fromNext = from, *toNext = to;
+        const char *key;
+        size_t keyLength;
+        int order;
+
+        if (*from) {
+            fromNext = nextFlattenedEntry(from, fromKey, fromLength);
+        }
+        if (*to) {
+            toNext = nextFlattenedEntry(to, toKey, toLength);
+        }
+
+        if (!*from) {
+            order = 1;
+        } else if (!*to) {
+            order = -1;
+        } else {
+            order = strncmp(from, to, min(fromKey, toKey));
+            if (0 == order) {
+                order = (int) fromKey - (int) toKey;
+            }
+        }
+
+        if (0 == order) {
+            const bool same = (fromLength == toLength) && (memcmp(from, to, fromLength) == 0);
+            key = from;
+            keyLength = fromKey;
+            from = fromNext;
+            to = toNext;
+            if (same) {
+                continue;
+            }
+        } else if (order < 0) {
+            key = from;
+            keyLength = fromKey;
+            from = fromNext;
+        } else {
+            key = to;
+            keyLength = toKey;
+            to = toNext;
+        }
+
+        const RuntimeParameter *param = findRuntimeParameter(key, keyLength);
+        if (NULL == param) {
+            return false;
+        }
+        changed.add(param);
+    }
+
+    return true;
+}
+
 /**
    @brief Set the camera parameters.
 
+   Apps resend the complete parameter set for every change, often several
+   times per second while zooming or metering. The parameters of the last
+   call that went through applyParameters() are kept flattened, together
+   with the mParameters it produced and the HAL state it ran in. While
+   neither mParameters nor that state changed since, only the keys that
+   differ from the kept set need handling: nothing at all if none does,
+   and just the new values if all of them are runtime parameters.
+   Anything else goes through the full handling again.
+
    @param[in] params Camera parameters to configure the camera
    @return NO_ERROR
    @todo Define error codes
 
  */
 int CameraHal::setParameters(const android::CameraParameters& params)
+{
+    android::String8 incoming = params.flatten();
+    android::Vector<const RuntimeParameter *> changed;
+    bool shortcut = false;
+    int ret;
+
+    LOG_FUNCTION_NAME;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        if ( !mAppliedParameters.isEmpty() &&
+             ( parameterState() == mAppliedState ) &&
+             ( mParameters.flatten() == mResultParameters ) ) {
+            shortcut = diffRuntimeParameters(mAppliedParameters.string(),
+                                             incoming.string(),
+                                             changed);
+        }
+
+        if ( shortcut ) {
+            ret = applyRuntimeParameters(params, changed);
+            if ( NO_ERROR == ret ) {
+                mAppliedParameters = incoming;
+                mResultParameters = mParameters.flatten();
+            }
+
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
+        }
+    }
+
+    ret = applyParameters(params);
+
+    android::AutoMutex lock(mLock);
+    if ( NO_ERROR == ret ) {
+        mAppliedParameters = incoming;
+        mResultParameters = mParameters.flatten();
+        mAppliedState = parameterState();
+    } else {
+        mAppliedParameters.clear();
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+/**
+   @brief Applies the runtime parameters that changed since the last call.
+
+   Keeps to what applyParameters() does for these keys. Removed keys stay
+   in mParameters there, so only new values are taken over.
+
+   @param[in] params Camera parameters to configure the camera
+   @param[in] changed Runtime parameters that differ from the last call
+   @return NO_ERROR or the error of the validation or the adapter
+ */
+int CameraHal::applyRuntimeParameters(const android::CameraParameters& params,
+                                      const android::Vector<const RuntimeParameter *>& changed)
+{
+    android::Vector<const char *> keys;
+    android::Vector<android::String8> previous;
+    bool updateRequired = false;
+    const char *valstr;
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+#ifdef V4L_CAMERA_ADAPTER
+    if (strcmp (V4L_CAMERA_NAME_USB, mCameraProperties->get(CameraProperties::PROP_CAMERA_NAME)) == 0 ) {
+        updateRequired = true;
+    }
+#endif
+
+    for ( size_t i = 0; i < changed.size(); i++ ) {
+        const RuntimeParameter *param = changed[i];
+
+        if ( (valstr = params.get(param->key)) == NULL ) {
+            continue;
+        }
+
+        if ( param->key == android::CameraParameters::KEY_ZOOM ) {
+            const int varint = atoi(valstr);
+            if ( varint < 0 || varint > mMaxZoomSupported ) {
+                CAMHAL_LOGEB("ERROR: Invalid Zoom: %s", valstr);
+                ret = BAD_VALUE;
+                break;
+            }
+        }
+
+        CAMHAL_LOGDB("%s set %s", param->key, valstr);
+        keys.add(param->key);
+        previous.add(android::String8(mParameters.get(param->key)));
+        if ( param->update ) {
+            doesSetParameterNeedUpdate(valstr, mParameters.get(param->key), updateRequired);
+        }
+        mParameters.set(param->key, valstr);
+    }
+
+    if ( ( NO_ERROR == ret ) && ( NULL != mCameraAdapter ) &&
+         ( mPreviewEnabled || updateRequired ) ) {
+        ret = mCameraAdapter->setParameters(mParameters);
+    }
+
+    // on failure restore what was set, mParameters had all of these keys
+    if ( NO_ERROR != ret ) {
+        for ( size_t i = 0; i < previous.size(); i++ ) {
+            mParameters.set(keys[i], previous[i].string());
+        }
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+/**
+   @brief HAL state setParameters() results depend on, besides mParameters.
+ */
+unsigned int CameraHal::parameterState()
+{
+    unsigned int state = 0;
+
+    state |= previewEnabled() ? 0x1 : 0;
+    state |= mRecordingEnabled ? 0x2 : 0;
+    state |= mDisplayPaused ? 0x4 : 0;
+    state |= mBracketingEnabled ? 0x8 : 0;
+    state |= mBracketingRunning ? 0x10 : 0;
+#ifdef OMAP_ENHANCEMENT_VTC
+    // the tunnel is set up from a later call, go through all of it until then
+    state |= ( mVTCUseCase && !mTunnelSetup ) ? 0x20 : 0;
+#endif
+
+    return state;
+}
+
+/**
+   @brief Validates and applies every camera parameter.
+
+   @param[in] params Camera parameters to configure the camera
+   @return NO_ERROR
+   @todo Define error codes
+
+ */
+int CameraHal::applyParameters(const android::CameraParameters& params)
 {
 
     LOG_FUNCTION_NAME;
@@ -397,7 +659,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
 #endif
 
 #ifdef V4L_CAMERA_ADAPTER
-    if (strcmp (V4L_CAMERA_NAME_USB, mCameraProperties->get(CameraProperties::CAMERA_NAME)) == 0 ) {
+    if (strcmp (V4L_CAMERA_NAME_USB, mCameraProperties->get(CameraProperties::PROP_CAMERA_NAME)) == 0 ) {
         updateRequired = true;
     }
 #endif
@@ -409,7 +671,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         if(!previewEnabled())
             {
             if ((valstr = params.getPreviewFormat()) != NULL) {
-                if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS))) {
+                if ( mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_PREVIEW_FORMATS, valstr)) {
                     mParameters.setPreviewFormat(valstr);
                     CAMHAL_LOGDB("PreviewFormat set %s", valstr);
                 } else {
@@ -420,8 +682,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
             if ((valstr = params.get(TICameraParameters::KEY_VNF)) != NULL) {
-                if (strcmp(mCameraProperties->get(CameraProperties::VNF_SUPPORTED),
-                           android::CameraParameters::TRUE) == 0) {
+                if (mCameraProperties->isEnabled(CameraProperties::PROP_VNF_SUPPORTED)) {
                     CAMHAL_LOGDB("VNF %s", valstr);
                     mParameters.set(TICameraParameters::KEY_VNF, valstr);
                 } else if (strcmp(valstr, android::CameraParameters::TRUE) == 0) {
@@ -436,8 +697,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             if ((valstr = params.get(android::CameraParameters::KEY_VIDEO_STABILIZATION)) != NULL) {
                 // make sure we support vstab...if we don't and application is trying to set
                 // vstab then return an error
-                if (strcmp(mCameraProperties->get(CameraProperties::VSTAB_SUPPORTED),
-                           android::CameraParameters::TRUE) != 0 &&
+                if (!mCameraProperties->isEnabled(CameraProperties::PROP_VSTAB_SUPPORTED) &&
                     strcmp(valstr, android::CameraParameters::TRUE) == 0) {
                     CAMHAL_LOGEB("ERROR: Invalid VSTAB: %s", valstr);
                     return BAD_VALUE;
@@ -493,7 +753,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(TICameraParameters::KEY_IPP)) != NULL) {
-            if (isParameterValid(valstr,mCameraProperties->get(CameraProperties::SUPPORTED_IPP_MODES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_IPP_MODES, valstr)) {
                 if ((mParameters.get(TICameraParameters::KEY_IPP) == NULL) ||
                         (strcmp(valstr, mParameters.get(TICameraParameters::KEY_IPP)))) {
                     CAMHAL_LOGDB("IPP mode set %s", params.get(TICameraParameters::KEY_IPP));
@@ -577,10 +837,10 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             restartPreviewRequired |= resetVideoModeParameters();
             }
 
-        if ( (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SUBSAMPLED_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES)))
-                && (!isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_TOPBOTTOM_SIZES))) ) {
+        if ( (!mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PREVIEW_SIZES, w, h))
+                && (!mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PREVIEW_SUBSAMPLED_SIZES, w, h))
+                && (!mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES, w, h))
+                && (!mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PREVIEW_TOPBOTTOM_SIZES, w, h)) ) {
             CAMHAL_LOGEB("Invalid preview resolution %d x %d", w, h);
             return BAD_VALUE;
         }
@@ -596,7 +856,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         CAMHAL_LOGDB("Preview Resolution: %d x %d", w, h);
 
         if ((valstr = params.get(android::CameraParameters::KEY_FOCUS_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FOCUS_MODES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_FOCUS_MODES, valstr)) {
                 CAMHAL_LOGDB("Focus mode set %s", valstr);
 
                 // we need to take a decision on the capture mode based on whether CAF picture or
@@ -631,10 +891,10 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
         params.getPictureSize(&w, &h);
-        if ( (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SUBSAMPLED_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_TOPBOTTOM_SIZES)))
-                || (isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIDEBYSIDE_SIZES))) ) {
+        if ( (mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PICTURE_SIZES, w, h))
+                || (mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PICTURE_SUBSAMPLED_SIZES, w, h))
+                || (mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PICTURE_TOPBOTTOM_SIZES, w, h))
+                || (mCameraProperties->hasSize(CameraProperties::PROP_SUPPORTED_PICTURE_SIDEBYSIDE_SIZES, w, h)) ) {
             mParameters.setPictureSize(w, h);
         } else {
             CAMHAL_LOGEB("ERROR: Invalid picture resolution %d x %d", w, h);
@@ -644,7 +904,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         CAMHAL_LOGDB("Picture Size by App %d x %d", w, h);
 
         if ( (valstr = params.getPictureFormat()) != NULL ) {
-            if (isParameterValid(valstr,mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_PICTURE_FORMATS, valstr)) {
                 if ((strcmp(valstr, android::CameraParameters::PIXEL_FORMAT_BAYER_RGGB) == 0) &&
                     mCameraProperties->get(CameraProperties::MAX_PICTURE_WIDTH) &&
                     mCameraProperties->get(CameraProperties::MAX_PICTURE_HEIGHT)) {
@@ -734,8 +994,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(TICameraParameters::KEY_GBCE)) != NULL) {
-            if (strcmp(mCameraProperties->get(CameraProperties::SUPPORTED_GBCE),
-                    android::CameraParameters::TRUE) == 0) {
+            if (mCameraProperties->isEnabled(CameraProperties::PROP_SUPPORTED_GBCE)) {
                 CAMHAL_LOGDB("GBCE %s", valstr);
                 mParameters.set(TICameraParameters::KEY_GBCE, valstr);
             } else if (strcmp(valstr, android::CameraParameters::TRUE) == 0) {
@@ -749,8 +1008,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(TICameraParameters::KEY_GLBCE)) != NULL) {
-            if (strcmp(mCameraProperties->get(CameraProperties::SUPPORTED_GLBCE),
-                    android::CameraParameters::TRUE) == 0) {
+            if (mCameraProperties->isEnabled(CameraProperties::PROP_SUPPORTED_GLBCE)) {
                 CAMHAL_LOGDB("GLBCE %s", valstr);
                 mParameters.set(TICameraParameters::KEY_GLBCE, valstr);
             } else if (strcmp(valstr, android::CameraParameters::TRUE) == 0) {
@@ -784,8 +1042,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if((valstr = params.get(TICameraParameters::KEY_MECHANICAL_MISALIGNMENT_CORRECTION)) != NULL) {
-            if ( strcmp(mCameraProperties->get(CameraProperties::MECHANICAL_MISALIGNMENT_CORRECTION_SUPPORTED),
-                    android::CameraParameters::TRUE) == 0 ) {
+            if ( mCameraProperties->isEnabled(CameraProperties::PROP_MECHANICAL_MISALIGNMENT_CORRECTION_SUPPORTED) ) {
                 CAMHAL_LOGDB("Mechanical Mialignment Correction is %s", valstr);
                 mParameters.set(TICameraParameters::KEY_MECHANICAL_MISALIGNMENT_CORRECTION, valstr);
             } else {
@@ -794,7 +1051,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(TICameraParameters::KEY_EXPOSURE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EXPOSURE_MODES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_EXPOSURE_MODES, valstr)) {
                 CAMHAL_LOGDB("Exposure mode set = %s", valstr);
                 mParameters.set(TICameraParameters::KEY_EXPOSURE_MODE, valstr);
                 if (!strcmp(valstr, TICameraParameters::EXPOSURE_MODE_MANUAL)) {
@@ -852,7 +1109,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
 #endif
 
         if ((valstr = params.get(android::CameraParameters::KEY_WHITE_BALANCE)) != NULL) {
-           if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE))) {
+           if ( mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_WHITE_BALANCE, valstr)) {
                CAMHAL_LOGDB("White balance set %s", valstr);
                mParameters.set(android::CameraParameters::KEY_WHITE_BALANCE, valstr);
             } else {
@@ -904,7 +1161,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
 #endif
 
         if ((valstr = params.get(android::CameraParameters::KEY_ANTIBANDING)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ANTIBANDING))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_ANTIBANDING, valstr)) {
                 CAMHAL_LOGDB("Antibanding set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_ANTIBANDING, valstr);
              } else {
@@ -915,7 +1172,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
 
 #ifdef OMAP_ENHANCEMENT
         if ((valstr = params.get(TICameraParameters::KEY_ISO)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ISO_VALUES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_ISO_VALUES, valstr)) {
                 CAMHAL_LOGDB("ISO set %s", valstr);
                 mParameters.set(TICameraParameters::KEY_ISO, valstr);
             } else {
@@ -960,7 +1217,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
             }
 
         if ((valstr = params.get(android::CameraParameters::KEY_SCENE_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_SCENE_MODES, valstr)) {
                 CAMHAL_LOGDB("Scene mode set %s", valstr);
                 doesSetParameterNeedUpdate(valstr,
                                            mParameters.get(android::CameraParameters::KEY_SCENE_MODE),
@@ -973,7 +1230,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(android::CameraParameters::KEY_FLASH_MODE)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FLASH_MODES))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_FLASH_MODES, valstr)) {
                 CAMHAL_LOGDB("Flash mode set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_FLASH_MODE, valstr);
             } else {
@@ -983,7 +1240,7 @@ int CameraHal::setParameters(const android::CameraParameters& params)
         }
 
         if ((valstr = params.get(android::CameraParameters::KEY_EFFECT)) != NULL) {
-            if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS))) {
+            if (mCameraProperties->hasValue(CameraProperties::PROP_SUPPORTED_EFFECTS, valstr)) {
                 CAMHAL_LOGDB("Effect set %s", valstr);
                 mParameters.set(android::CameraParameters::KEY_EFFECT, valstr);
              } else {
@@ -2775,8 +3032,7 @@ bool CameraHal::setVideoModeParameters(const android::CameraParameters& params)
     } else {
         if ((valstrRemote = params.get(android::CameraParameters::KEY_VIDEO_STABILIZATION)) != NULL) {
             // make sure we support vstab
-            if (strcmp(mCameraProperties->get(CameraProperties::VSTAB_SUPPORTED),
-                       android::CameraParameters::TRUE) == 0) {
+            if (mCameraProperties->isEnabled(CameraProperties::PROP_VSTAB_SUPPORTED)) {
                 if (strcmp(valstr, valstrRemote) != 0) {
                     restartPreviewRequired = true;
                 }
@@ -3468,10 +3724,12 @@ status_t CameraHal::__takePicture(const char *params, struct timeval *captureSta
          }
 
         // pause preview during normal image capture
-        // do not pause preview if recording (video state)
+        // do not pause preview if recording (video state) or if the
+        // adapter takes the picture from held preview frames (zero shutter lag)
         if ( (NO_ERROR == ret) && (NULL != mDisplayAdapter.get()) ) {
             if ((mCameraAdapter->getState() != CameraAdapter::VIDEO_STATE) &&
-                (mCameraAdapter->getState() != CameraAdapter::VIDEO_AF_STATE)) {
+                (mCameraAdapter->getState() != CameraAdapter::VIDEO_AF_STATE) &&
+                !mCameraAdapter->isFrameHistoryEnabled()) {
                 mDisplayPaused = true;
                 mPreviewEnabled = false;
                 ret = mDisplayAdapter->pauseDisplay(mDisplayPaused);
@@ -4012,6 +4270,7 @@ status_t  CameraHal::dump(int fd) const
 {
     LOG_FUNCTION_NAME;
     ///Implement this method when the h/w dump function is supported on Ducati side
+    FrameTracer::dump(fd);
     return NO_ERROR;
 }
 
@@ -4055,6 +4314,7 @@ CameraHal::CameraHal(int cameraId)
     mBracketRangePositive = 1;
     mBracketRangeNegative = 1;
     mMaxZoomSupported = 0;
+    mAppliedState = 0;
     mShutterEnabled = true;
     mMeasurementEnabled = false;
     mPreviewDataBuffers = NULL;
@@ -4135,6 +4395,12 @@ CameraHal::~CameraHal()
     /// Free the callback notifier
     mAppCallbackNotifier.clear();
 
+    /// Stop the worker threads once nothing can submit work anymore
+    if ( mWorkerPool.get() ) {
+        mWorkerPool->deinitialize();
+        mWorkerPool.clear();
+    }
+
     /// Free the display adapter
     mDisplayAdapter.clear();
 
@@ -4158,7 +4424,7 @@ CameraHal::~CameraHal()
 /**
    @brief Initialize the Camera HAL
 
-   Creates CameraAdapter, AppCallbackNotifier, DisplayAdapter and MemoryManager
+   Creates CameraAdapter, AppCallbackNotifier, WorkerPool, DisplayAdapter and MemoryManager
 
    @param None
    @return NO_ERROR - On success
@@ -4195,14 +4461,19 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
         sensor_index = atoi(mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX));
         }
 
-    if (strcmp(CameraProperties::DEFAULT_VALUE, mCameraProperties->get(CameraProperties::CAMERA_NAME)) != 0 ) {
-        sensor_name = mCameraProperties->get(CameraProperties::CAMERA_NAME);
+    if (strcmp(CameraProperties::DEFAULT_VALUE, mCameraProperties->get(CameraProperties::PROP_CAMERA_NAME)) != 0 ) {
+        sensor_name = mCameraProperties->get(CameraProperties::PROP_CAMERA_NAME);
     }
     CAMHAL_LOGDB("Sensor index= %d; Sensor name= %s", sensor_index, sensor_name);
 
     if (strcmp(sensor_name, V4L_CAMERA_NAME_USB) == 0) {
 #ifdef V4L_CAMERA_ADAPTER
         mCameraAdapter = V4LCameraAdapter_Factory(sensor_index, this);
+#endif
+    }
+    else if (strcmp(sensor_name, REPLAY_CAMERA_NAME) == 0) {
+#ifdef REPLAY_CAMERA_ADAPTER
+        mCameraAdapter = ReplayCameraAdapter_Factory(sensor_index);
 #endif
     }
     else {
@@ -4233,6 +4504,19 @@ status_t CameraHal::initialize(CameraProperties::Properties* properties)
             }
         }
 
+    if(!mWorkerPool.get())
+        {
+        /// Create the worker threads shared by the image processing paths
+        mWorkerPool = new WorkerPool();
+        if( ( NULL == mWorkerPool.get() ) || ( mWorkerPool->initialize() != NO_ERROR))
+            {
+            CAMHAL_LOGEA("Unable to create or initialize WorkerPool");
+            goto fail_loop;
+            }
+        }
+
+    mAppCallbackNotifier->setWorkerPool(mWorkerPool);
+
     if(!mMemoryManager.get())
         {
         /// Create Memory Manager
@@ -4375,8 +4659,8 @@ bool CameraHal::isFpsRangeValid(int fpsMin, int fpsMax, const char *supportedFps
 bool CameraHal::isParameterValid(const char *param, const char *supportedParams)
 {
     bool ret = false;
-    char *pos;
-    char supported[MAX_PROP_VALUE_LENGTH];
+    const char *pos;
+    size_t length;
 
     LOG_FUNCTION_NAME;
 
@@ -4390,15 +4674,17 @@ bool CameraHal::isParameterValid(const char *param, const char *supportedParams)
         goto exit;
     }
 
-    strncpy(supported, supportedParams, MAX_PROP_VALUE_LENGTH - 1);
-
-    pos = strtok(supported, ",");
-    while (pos != NULL) {
-        if (!strcmp(pos, param)) {
+    // compare against the entries in place, no copy of the whole list
+    length = strlen(param);
+    pos = supportedParams;
+    while ((pos != NULL) && (length > 0)) {
+        const char *end = strchr(pos, ',');
+        const size_t entry = end ? (size_t) (end - pos) : strlen(pos);
+        if ((entry == length) && !strncmp(pos, param, length)) {
             ret = true;
             break;
         }
-        pos = strtok(NULL, ",");
+        pos = end ? end + 1 : NULL;
     }
 
 exit:
@@ -4508,7 +4794,7 @@ void CameraHal::insertSupportedParams()
     android::CameraParameters &p = mParameters;
 
     ///Set the name of the camera
-    p.set(TICameraParameters::KEY_CAMERA_NAME, mCameraProperties->get(CameraProperties::CAMERA_NAME));
+    p.set(TICameraParameters::KEY_CAMERA_NAME, mCameraProperties->get(CameraProperties::PROP_CAMERA_NAME));
 
     mMaxZoomSupported = atoi(mCameraProperties->get(CameraProperties::SUPPORTED_ZOOM_STAGES));
 
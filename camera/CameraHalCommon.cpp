@@ -189,9 +189,13 @@ size_t CameraHal::calculateBufferSize(const char* parametersFormat, int width, i
     if ( NULL != parametersFormat ) {
         if ( 0 == strcmp(parametersFormat, (const char *) android::CameraParameters::PIXEL_FORMAT_YUV422I) ) {
             bufferSize = width * height * 2;
-        } else if ( (0 == strcmp(parametersFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP)) ||
-                    (0 == strcmp(parametersFormat, android::CameraParameters::PIXEL_FORMAT_YUV420P)) ) {
+        } else if ( 0 == strcmp(parametersFormat, android::CameraParameters::PIXEL_FORMAT_YUV420SP) ) {
             bufferSize = width * height * 3 / 2;
+        } else if ( 0 == strcmp(parametersFormat, android::CameraParameters::PIXEL_FORMAT_YUV420P) ) {
+            // YV12 rows are 16 byte aligned in both the luma and chroma planes
+            const int yStride = (width + 0xF) & ~0xF;
+            const int uvStride = (yStride / 2 + 0xF) & ~0xF;
+            bufferSize = yStride * height + uvStride * height / 2 * 2;
         } else if ( 0 == strcmp(parametersFormat, (const char *) android::CameraParameters::PIXEL_FORMAT_RGB565) ) {
             bufferSize = width * height * 2;
         } else if ( 0 == strcmp(parametersFormat, (const char *) android::CameraParameters::PIXEL_FORMAT_BAYER_RGGB) ) {
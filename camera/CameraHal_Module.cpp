@@ -26,6 +26,7 @@
 #include "CameraHal.h"
 #include "CameraProperties.h"
 #include "TICameraParameters.h"
+#include "FrameTracer.h"
 
 
 #ifdef CAMERAHAL_DEBUG_VERBOSE
@@ -41,6 +42,8 @@ namespace Camera {
 static CameraProperties gCameraProperties;
 static CameraHal* gCameraHals[MAX_CAMERAS_SUPPORTED];
 static unsigned int gCamerasOpen = 0;
+//Open cameras driven by the OMX component, see isOmxCamera()
+static bool gOmxCameraOpen[MAX_CAMERAS_SUPPORTED];
 static android::Mutex gCameraHalDeviceLock;
 
 static int camera_device_open(const hw_module_t* module, const char* name,
@@ -595,6 +598,7 @@ int camera_device_close(hw_device_t* device)
         if (gCameraHals[ti_dev->cameraid]) {
             delete gCameraHals[ti_dev->cameraid];
             gCameraHals[ti_dev->cameraid] = NULL;
+            gOmxCameraOpen[ti_dev->cameraid] = false;
             gCamerasOpen--;
         }
 
@@ -614,6 +618,28 @@ done:
  * implementation of camera_module functions
  *******************************************************************/
 
+/* OMX cameras share the one ISP on Ducati, the others (USB, replay) each
+ * own their device and can run next to any camera
+ */
+static bool isOmxCamera(CameraProperties::Properties* properties)
+{
+    const char *name = properties->get(CameraProperties::PROP_CAMERA_NAME);
+
+    return (NULL == name) ||
+           ((strcmp(name, V4L_CAMERA_NAME_USB) != 0) && (strcmp(name, REPLAY_CAMERA_NAME) != 0));
+}
+
+static bool omxCameraOpen()
+{
+    for (int i = 0; i < MAX_CAMERAS_SUPPORTED; i++) {
+        if (gOmxCameraOpen[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /* open device handle to one of the cameras
  *
  * assume camera service will keep singleton of each camera
@@ -639,7 +665,7 @@ int camera_device_open(const hw_module_t* module, const char* name,
         cameraid = atoi(name);
         num_cameras = gCameraProperties.camerasSupported();
 
-        if(cameraid > num_cameras)
+        if((cameraid < 0) || (cameraid >= num_cameras))
         {
             CAMHAL_LOGE("camera service provided cameraid out of bounds, "
                     "cameraid = %d, num supported = %d",
@@ -655,6 +681,13 @@ int camera_device_open(const hw_module_t* module, const char* name,
             goto fail;
         }
 
+        if(gCameraHals[cameraid])
+        {
+            CAMHAL_LOGE("camera %d is already open", cameraid);
+            rv = -EBUSY;
+            goto fail;
+        }
+
         camera_device = (ti_camera_device_t*)malloc(sizeof(*camera_device));
         if(!camera_device)
         {
@@ -717,6 +750,23 @@ int camera_device_open(const hw_module_t* module, const char* name,
             goto fail;
         }
 
+        if(isOmxCamera(properties) && omxCameraOpen())
+        {
+            CAMHAL_LOGE("another OMX camera is already open");
+            rv = -EBUSY;
+            goto fail;
+        }
+
+        // latency statistics are process wide, they start over with the
+        // first camera opened while no frames flow
+        if(0 == gCamerasOpen)
+        {
+            char value[PROPERTY_VALUE_MAX];
+            property_get("persist.camera.frametrace", value, "1");
+            FrameTracer::setEnabled(atoi(value) != 0);
+            FrameTracer::reset();
+        }
+
         camera = new CameraHal(cameraid);
 
         if(!camera)
@@ -734,6 +784,7 @@ int camera_device_open(const hw_module_t* module, const char* name,
         }
 
         gCameraHals[cameraid] = camera;
+        gOmxCameraOpen[cameraid] = isOmxCamera(properties);
         gCamerasOpen++;
     }
 
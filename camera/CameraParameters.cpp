@@ -30,6 +30,8 @@ const char CameraProperties::INVALID[]="prop-invalid-key";
 const char CameraProperties::CAMERA_NAME[]="prop-camera-name";
 const char CameraProperties::CAMERA_SENSOR_INDEX[]="prop-sensor-index";
 const char CameraProperties::CAMERA_SENSOR_ID[] = "prop-sensor-id";
+const char CameraProperties::CAMERA_DEVICE_PATH[] = "prop-device-path";
+const char CameraProperties::FIRMWARE_VERSION[] = "prop-firmware-version";
 const char CameraProperties::ORIENTATION_INDEX[]="prop-orientation";
 const char CameraProperties::FACING_INDEX[]="prop-facing";
 const char CameraProperties::SUPPORTED_PREVIEW_SIZES[] = "prop-preview-size-values";
@@ -145,6 +147,62 @@ const char CameraProperties::DEFAULT_VALUE[] = "";
 
 const char CameraProperties::PARAMS_DELIMITER []= ",";
 
+enum PropertyType {
+    PROPERTY_STRING,
+    PROPERTY_BOOL,
+    PROPERTY_LIST,
+    PROPERTY_SIZE_LIST
+};
+
+struct PropertyInfo {
+    const char *name;
+    PropertyType type;
+};
+
+// in CameraProperties::PropertyKey order
+static const PropertyInfo PROPERTY_INFO[] = {
+    { CameraProperties::CAMERA_NAME, PROPERTY_STRING },
+    { CameraProperties::SUPPORTED_PREVIEW_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PREVIEW_SUBSAMPLED_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PREVIEW_TOPBOTTOM_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PREVIEW_FORMATS, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_PICTURE_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PICTURE_SUBSAMPLED_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PICTURE_TOPBOTTOM_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PICTURE_SIDEBYSIDE_SIZES, PROPERTY_SIZE_LIST },
+    { CameraProperties::SUPPORTED_PICTURE_FORMATS, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_IPP_MODES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_FOCUS_MODES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_EXPOSURE_MODES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_WHITE_BALANCE, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_ANTIBANDING, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_ISO_VALUES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_SCENE_MODES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_FLASH_MODES, PROPERTY_LIST },
+    { CameraProperties::SUPPORTED_EFFECTS, PROPERTY_LIST },
+    { CameraProperties::VNF_SUPPORTED, PROPERTY_BOOL },
+    { CameraProperties::VSTAB_SUPPORTED, PROPERTY_BOOL },
+    { CameraProperties::SUPPORTED_GBCE, PROPERTY_BOOL },
+    { CameraProperties::SUPPORTED_GLBCE, PROPERTY_BOOL },
+    { CameraProperties::MECHANICAL_MISALIGNMENT_CORRECTION_SUPPORTED, PROPERTY_BOOL },
+};
+
+// one entry per key
+typedef char PropertyInfoComplete[
+        (sizeof(PROPERTY_INFO) / sizeof(PROPERTY_INFO[0]) == CameraProperties::PROPERTY_KEY_COUNT) ? 1 : -1];
+
+static int findPropertyKey(const char *prop)
+{
+    for (int i = 0; i < CameraProperties::PROPERTY_KEY_COUNT; i++) {
+        if ((PROPERTY_INFO[i].name == prop) || (strcmp(PROPERTY_INFO[i].name, prop) == 0)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 // Returns the properties class for a specific Camera
 // Each value is indexed by the CameraProperties::CameraPropertyIndex enum
 int CameraProperties::getProperties(int cameraIndex, CameraProperties::Properties** properties)
@@ -171,6 +229,60 @@ void CameraProperties::Properties::set(const char * const prop, const char * con
     } else {
         mProperties[mCurrentMode].replaceValueFor(android::String8(prop), android::String8(value));
     }
+
+    const int key = findPropertyKey(prop);
+    if ( key >= 0 ) {
+        parse(static_cast<PropertyKey>(key), value);
+    }
+}
+
+void CameraProperties::Properties::parse(PropertyKey key, const char *value) {
+    TypedValue &typed = mTyped[mCurrentMode][key];
+
+    typed = TypedValue();
+    if ( !value ) {
+        return;
+    }
+
+    typed.value = value;
+
+    switch ( PROPERTY_INFO[key].type ) {
+        case PROPERTY_BOOL:
+            typed.enabled = (strcmp(value, "true") == 0);
+            break;
+
+        case PROPERTY_LIST:
+        case PROPERTY_SIZE_LIST:
+            for ( const char *pos = value; *pos; ) {
+                const char *end = strchr(pos, ',');
+                const size_t length = end ? (size_t) (end - pos) : strlen(pos);
+
+                if ( length > 0 ) {
+                    const android::String8 entry(pos, length);
+                    int width, height;
+                    char tail;
+
+                    if ( PROPERTY_LIST == PROPERTY_INFO[key].type ) {
+                        typed.entries.add(entry);
+                    } else if ( sscanf(entry.string(), "%dx%d%c", &width, &height, &tail) == 2 ) {
+                        typed.sizes.add(width);
+                        typed.sizes.add(height);
+                    } else {
+                        CAMHAL_LOGEB("Malformed size %s in %s", entry.string(), PROPERTY_INFO[key].name);
+                    }
+                }
+
+                if ( !end ) {
+                    break;
+                }
+                pos = end + 1;
+            }
+            break;
+
+        case PROPERTY_STRING:
+        default:
+            break;
+    }
 }
 
 void CameraProperties::Properties::set(const char * const prop, const int value) {
@@ -191,6 +303,42 @@ int CameraProperties::Properties::getInt(const char * prop) const {
     return strtol(value, 0, 0);
 }
 
+const char* CameraProperties::Properties::get(PropertyKey key) const {
+    return mTyped[mCurrentMode][key].value.string();
+}
+
+bool CameraProperties::Properties::isEnabled(PropertyKey key) const {
+    return mTyped[mCurrentMode][key].enabled;
+}
+
+bool CameraProperties::Properties::hasValue(PropertyKey key, const char *value) const {
+    const android::Vector<android::String8> &entries = mTyped[mCurrentMode][key].entries;
+
+    if ( !value ) {
+        return false;
+    }
+
+    for ( size_t i = 0; i < entries.size(); i++ ) {
+        if ( strcmp(entries[i].string(), value) == 0 ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CameraProperties::Properties::hasSize(PropertyKey key, int width, int height) const {
+    const android::Vector<int> &sizes = mTyped[mCurrentMode][key].sizes;
+
+    for ( size_t i = 0; i + 1 < sizes.size(); i += 2 ) {
+        if ( (sizes[i] == width) && (sizes[i + 1] == height) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void CameraProperties::Properties::setSensorIndex(int idx) {
     OperatingMode originalMode = getMode();
     for ( int i = 0 ; i < MODE_MAX ; i++ ) {
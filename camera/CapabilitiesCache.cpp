@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CapabilitiesCache.cpp
+*
+* This file implements the on disk cache of the camera capabilities.
+*
+*/
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CapabilitiesCache.h"
+
+namespace Ti {
+namespace Camera {
+
+const char CapabilitiesCache::DEFAULT_PATH[] = "/data/misc/camera/capabilities.cache";
+
+// 'TICC'
+static const uint32_t CACHE_MAGIC = 0x43434954;
+// bump whenever the layout or the meaning of a property changes
+static const uint32_t CACHE_VERSION = 3;
+// a few modes of a few hundred properties, anything bigger is garbage
+static const size_t MAX_CACHE_SIZE = 1024 * 1024;
+
+// the first image found identifies the camera firmware
+static const char * const FIRMWARE_IMAGES[] = {
+    "/vendor/firmware/ducati-m3-core0.xem3",
+    "/vendor/firmware/ducati-m3.bin",
+};
+
+// DCC tuning files live in one directory per DCC URI below these roots
+static const char * const DCC_ROOTS[] = {
+    "/data/misc/camera/",
+    "/system/etc/omapcam/",
+};
+
+/**
+ * Adds the files of the per URI directories below 'root' to the DCC
+ * identity. Files directly in the root, like the cache itself, are not
+ * tuning data.
+ */
+static void addDccFiles(const char *root, uint32_t &count, uint32_t &size, int64_t &time) {
+    DIR *dir = opendir(root);
+    if ( NULL == dir ) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) != NULL ) {
+        if ( entry->d_name[0] == '.' ) {
+            continue;
+        }
+
+        const android::String8 uriPath = android::String8(root) + entry->d_name;
+        DIR *uriDir = opendir(uriPath.string());
+        if ( NULL == uriDir ) {
+            continue;
+        }
+
+        struct dirent *file;
+        while ( (file = readdir(uriDir)) != NULL ) {
+            struct stat st;
+            const android::String8 filePath = uriPath + "/" + file->d_name;
+            if ( file->d_name[0] == '.' || stat(filePath.string(), &st) != 0 ||
+                 !S_ISREG(st.st_mode) ) {
+                continue;
+            }
+
+            count++;
+            size += st.st_size;
+            time = max(time, (int64_t) st.st_mtime);
+        }
+        closedir(uriDir);
+    }
+    closedir(dir);
+}
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+struct BuildIdSearch {
+    const void *address;
+    char *id;
+    size_t size;
+};
+
+/**
+ * dl_iterate_phdr() callback: if the module loads 'address', writes the hex
+ * of its GNU build id note to 'id' and stops the iteration.
+ */
+static int findBuildId(struct dl_phdr_info *info, size_t, void *data) {
+    BuildIdSearch *search = static_cast<BuildIdSearch *>(data);
+    const uintptr_t address = reinterpret_cast<uintptr_t>(search->address);
+    bool found = false;
+
+    for ( int i = 0; i < info->dlpi_phnum && !found; i++ ) {
+        const Elf32_Phdr &phdr = info->dlpi_phdr[i];
+        const uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        found = ( phdr.p_type == PT_LOAD ) && ( address >= start ) &&
+                ( address < start + phdr.p_memsz );
+    }
+
+    if ( !found ) {
+        return 0;
+    }
+
+    for ( int i = 0; i < info->dlpi_phnum; i++ ) {
+        const Elf32_Phdr &phdr = info->dlpi_phdr[i];
+        if ( phdr.p_type != PT_NOTE ) {
+            continue;
+        }
+
+        const uint8_t *note = reinterpret_cast<const uint8_t *>(info->dlpi_addr + phdr.p_vaddr);
+        const uint8_t *end = note + phdr.p_memsz;
+        while ( note + sizeof(Elf32_Nhdr) <= end ) {
+            const Elf32_Nhdr *header = reinterpret_cast<const Elf32_Nhdr *>(note);
+            const uint8_t *name = note + sizeof(Elf32_Nhdr);
+            const uint8_t *desc = name + ((header->n_namesz + 3) & ~3);
+            if ( desc + header->n_descsz > end ) {
+                break;
+            }
+
+            if ( header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 &&
+                 memcmp(name, "GNU", 4) == 0 ) {
+                const size_t bytes = min((size_t) header->n_descsz, (search->size - 1) / 2);
+                for ( size_t j = 0; j < bytes; j++ ) {
+                    snprintf(search->id + 2 * j, 3, "%02x", desc[j]);
+                }
+                return 1;
+            }
+
+            note = desc + ((header->n_descsz + 3) & ~3);
+        }
+    }
+
+    // the module was found but was linked without a build id
+    return 1;
+}
+
+static const uint32_t * crcTable() {
+    static struct Table {
+        Table() {
+            for ( uint32_t i = 0; i < 256; i++ ) {
+                uint32_t c = i;
+                for ( int k = 0; k < 8; k++ ) {
+                    c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+                }
+                entries[i] = c;
+            }
+        }
+        uint32_t entries[256];
+    } table;
+
+    return table.entries;
+}
+
+CapabilitiesCache::CapabilitiesCache(const char *path) : mPath(path) {
+}
+
+bool CapabilitiesCache::isEnabled() const {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("persist.camera.capscache", value, "1");
+    return atoi(value) != 0;
+}
+
+void CapabilitiesCache::fillIdentity(Header &header) const {
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+
+    property_get("ro.build.fingerprint", header.build, "");
+
+    BuildIdSearch search = { DEFAULT_PATH, header.halBuild, sizeof(header.halBuild) };
+    dl_iterate_phdr(findBuildId, &search);
+
+    for ( size_t i = 0; i < sizeof(FIRMWARE_IMAGES) / sizeof(FIRMWARE_IMAGES[0]); i++ ) {
+        struct stat st;
+        if ( stat(FIRMWARE_IMAGES[i], &st) == 0 ) {
+            header.firmwareSize = st.st_size;
+            header.firmwareTime = st.st_mtime;
+            break;
+        }
+    }
+
+    for ( size_t i = 0; i < sizeof(DCC_ROOTS) / sizeof(DCC_ROOTS[0]); i++ ) {
+        addDccFiles(DCC_ROOTS[i], header.dccCount, header.dccSize, header.dccTime);
+    }
+}
+
+uint32_t CapabilitiesCache::crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    const uint32_t *table = crcTable();
+
+    crc = ~crc;
+    for ( size_t i = 0; i < size; i++ ) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+void CapabilitiesCache::write(Buffer &buffer, uint32_t value) {
+    buffer.appendArray(reinterpret_cast<const uint8_t *>(&value), sizeof(value));
+}
+
+void CapabilitiesCache::write(Buffer &buffer, const android::String8 &value) {
+    write(buffer, (uint32_t) value.length());
+    buffer.appendArray(reinterpret_cast<const uint8_t *>(value.string()), value.length());
+}
+
+bool CapabilitiesCache::read(const Buffer &buffer, size_t &offset, uint32_t &value) {
+    if ( buffer.size() - offset < sizeof(value) ) {
+        return false;
+    }
+
+    memcpy(&value, buffer.array() + offset, sizeof(value));
+    offset += sizeof(value);
+
+    return true;
+}
+
+bool CapabilitiesCache::read(const Buffer &buffer, size_t &offset, android::String8 &value) {
+    uint32_t length;
+
+    if ( !read(buffer, offset, length) || buffer.size() - offset < length ) {
+        return false;
+    }
+
+    value.setTo(reinterpret_cast<const char *>(buffer.array() + offset), length);
+    offset += length;
+
+    return true;
+}
+
+void CapabilitiesCache::encode(Buffer &buffer, const CameraProperties::Properties &properties) {
+    write(buffer, (uint32_t) properties.getInt(CameraProperties::CAMERA_SENSOR_ID));
+    write(buffer, (uint32_t) properties.getMode());
+
+    for ( int mode = 0; mode < MODE_MAX; mode++ ) {
+        const android::DefaultKeyedVector<android::String8, android::String8> &values =
+                properties.mProperties[mode];
+
+        write(buffer, (uint32_t) values.size());
+        for ( size_t i = 0; i < values.size(); i++ ) {
+            write(buffer, values.keyAt(i));
+            write(buffer, values.valueAt(i));
+        }
+    }
+}
+
+bool CapabilitiesCache::decode(const Buffer &buffer, size_t &offset,
+                               CameraProperties::Properties &properties) {
+    uint32_t sensorId, currentMode;
+
+    if ( !read(buffer, offset, sensorId) || !read(buffer, offset, currentMode) ||
+         currentMode >= MODE_MAX ) {
+        return false;
+    }
+
+    for ( int mode = 0; mode < MODE_MAX; mode++ ) {
+        uint32_t count;
+        if ( !read(buffer, offset, count) ) {
+            return false;
+        }
+
+        properties.setMode(static_cast<OperatingMode>(mode));
+        for ( uint32_t i = 0; i < count; i++ ) {
+            android::String8 key, value;
+            if ( !read(buffer, offset, key) || !read(buffer, offset, value) ) {
+                return false;
+            }
+            properties.set(key.string(), value.string());
+        }
+    }
+
+    properties.setMode(static_cast<OperatingMode>(currentMode));
+
+    // the record must describe the sensor it was keyed with
+    return properties.getInt(CameraProperties::CAMERA_SENSOR_ID) == (int) sensorId;
+}
+
+status_t CapabilitiesCache::load(CameraProperties::Properties *properties, int maxCameras, int &count) {
+    LOG_FUNCTION_NAME;
+
+    count = 0;
+
+    if ( !isEnabled() ) {
+        return NAME_NOT_FOUND;
+    }
+
+    const int fd = open(mPath.string(), O_RDONLY);
+    if ( fd < 0 ) {
+        CAMHAL_LOGDB("No capabilities cache at %s", mPath.string());
+        return NAME_NOT_FOUND;
+    }
+
+    struct stat st;
+    Buffer buffer;
+    bool complete = false;
+
+    if ( fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(Header) &&
+         (size_t) st.st_size <= MAX_CACHE_SIZE ) {
+        buffer.insertAt((uint8_t) 0, 0, st.st_size);
+        complete = ( ::read(fd, buffer.editArray(), buffer.size()) == (ssize_t) buffer.size() );
+    }
+    close(fd);
+
+    if ( !complete ) {
+        CAMHAL_LOGEB("Can't read the capabilities cache %s", mPath.string());
+        return BAD_VALUE;
+    }
+
+    Header header, expected;
+    memcpy(&header, buffer.array(), sizeof(header));
+    fillIdentity(expected);
+
+    if ( header.magic != expected.magic || header.version != expected.version ||
+         header.size != buffer.size() ||
+         strncmp(header.build, expected.build, sizeof(header.build)) != 0 ||
+         strncmp(header.halBuild, expected.halBuild, sizeof(header.halBuild)) != 0 ||
+         header.firmwareSize != expected.firmwareSize ||
+         header.firmwareTime != expected.firmwareTime ||
+         header.dccCount != expected.dccCount ||
+         header.dccSize != expected.dccSize ||
+         header.dccTime != expected.dccTime ) {
+        CAMHAL_LOGI("Capabilities cache is stale");
+        return NAME_NOT_FOUND;
+    }
+
+    const uint32_t crc = header.crc;
+    header.crc = 0;
+    const uint32_t actual = crc32(crc32(0, reinterpret_cast<const uint8_t *>(&header), sizeof(header)),
+                                  buffer.array() + sizeof(header), buffer.size() - sizeof(header));
+    if ( actual != crc ) {
+        CAMHAL_LOGEB("Capabilities cache checksum mismatch 0x%x != 0x%x", actual, crc);
+        return BAD_VALUE;
+    }
+
+    if ( header.cameraCount == 0 || header.cameraCount > (uint32_t) maxCameras ) {
+        CAMHAL_LOGEB("Capabilities cache holds %u cameras, %d supported",
+                     header.cameraCount, maxCameras);
+        return BAD_VALUE;
+    }
+
+    size_t offset = sizeof(header);
+    for ( uint32_t i = 0; i < header.cameraCount; i++ ) {
+        if ( !decode(buffer, offset, properties[i]) ) {
+            CAMHAL_LOGEB("Capabilities cache record %u is malformed", i);
+            for ( uint32_t j = 0; j <= i; j++ ) {
+                properties[j] = CameraProperties::Properties();
+            }
+            return BAD_VALUE;
+        }
+    }
+
+    count = header.cameraCount;
+    CAMHAL_LOGI("Loaded capabilities of %d cameras from %s", count, mPath.string());
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+status_t CapabilitiesCache::store(const CameraProperties::Properties *properties, int count) {
+    LOG_FUNCTION_NAME;
+
+    if ( !isEnabled() ) {
+        return NO_ERROR;
+    }
+
+    if ( NULL == properties || count <= 0 ) {
+        return BAD_VALUE;
+    }
+
+    Header header;
+    fillIdentity(header);
+    header.cameraCount = count;
+
+    Buffer buffer;
+    buffer.insertAt((uint8_t) 0, 0, sizeof(header));
+    for ( int i = 0; i < count; i++ ) {
+        encode(buffer, properties[i]);
+    }
+
+    if ( buffer.size() > MAX_CACHE_SIZE ) {
+        CAMHAL_LOGEB("Capabilities too large to cache: %d bytes", buffer.size());
+        return NO_MEMORY;
+    }
+
+    header.size = buffer.size();
+    header.crc = crc32(crc32(0, reinterpret_cast<const uint8_t *>(&header), sizeof(header)),
+                       buffer.array() + sizeof(header), buffer.size() - sizeof(header));
+    memcpy(buffer.editArray(), &header, sizeof(header));
+
+    // written aside and renamed, a reader never sees a partial file
+    const android::String8 tmpPath = mPath + ".tmp";
+    const int fd = open(tmpPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if ( fd < 0 ) {
+        CAMHAL_LOGEB("Can't create %s: %s", tmpPath.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    const bool written = ( ::write(fd, buffer.array(), buffer.size()) == (ssize_t) buffer.size() );
+    close(fd);
+
+    if ( !written || rename(tmpPath.string(), mPath.string()) != 0 ) {
+        CAMHAL_LOGEB("Can't write the capabilities cache %s: %s", mPath.string(), strerror(errno));
+        unlink(tmpPath.string());
+        return UNKNOWN_ERROR;
+    }
+
+    CAMHAL_LOGI("Stored capabilities of %d cameras in %s", count, mPath.string());
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+void CapabilitiesCache::invalidate() {
+    if ( unlink(mPath.string()) != 0 && errno != ENOENT ) {
+        CAMHAL_LOGEB("Can't remove %s: %s", mPath.string(), strerror(errno));
+    }
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,650 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ColorConvert.cpp
+*
+* Scalar, NEON and SSE2 implementations of the pixel format conversion
+* kernels declared in ColorConvert.h and the runtime backend selection.
+*
+*/
+
+#include "ColorConvert.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#   define COLOR_CONVERT_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__)
+#   define COLOR_CONVERT_HAVE_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace Ti {
+namespace Camera {
+namespace ColorConvert {
+
+/*--------------------Scalar kernels-----------------------------*/
+
+static void swapUVRow_Scalar(const uint8_t *src, uint8_t *dst, size_t pairs) {
+    for ( size_t i = 0; i < pairs; i++ ) {
+        const uint8_t u = src[0];
+        dst[0] = src[1];
+        dst[1] = u;
+        src += 2;
+        dst += 2;
+    }
+}
+
+static void splitUVRow_Scalar(const uint8_t *src, uint8_t *dstU, uint8_t *dstV, size_t pairs) {
+    for ( size_t i = 0; i < pairs; i++ ) {
+        dstU[i] = src[0];
+        dstV[i] = src[1];
+        src += 2;
+    }
+}
+
+static void mergeUVRow_Scalar(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, size_t pairs) {
+    for ( size_t i = 0; i < pairs; i++ ) {
+        dst[0] = srcU[i];
+        dst[1] = srcV[i];
+        dst += 2;
+    }
+}
+
+static void yuyvToNV12Row_Scalar(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    for ( size_t i = 0; i < width; i++ ) {
+        dstY[i] = src[2*i];
+    }
+    if ( dstUV ) {
+        for ( size_t i = 0; i < (width & ~1u); i++ ) {
+            dstUV[i] = src[2*i + 1];
+        }
+    }
+}
+
+static void uyvyToNV12Row_Scalar(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    for ( size_t i = 0; i < width; i++ ) {
+        dstY[i] = src[2*i + 1];
+    }
+    if ( dstUV ) {
+        for ( size_t i = 0; i < (width & ~1u); i++ ) {
+            dstUV[i] = src[2*i];
+        }
+    }
+}
+
+static void yuyvToYUV444Row_Scalar(const uint8_t *src, uint8_t *dst, size_t width) {
+    for ( size_t i = 0; i < width / 2; i++ ) {
+        const uint8_t u = src[1];
+        const uint8_t v = src[3];
+        dst[0] = src[0];
+        dst[1] = u;
+        dst[2] = v;
+        dst[3] = src[2];
+        dst[4] = u;
+        dst[5] = v;
+        src += 4;
+        dst += 6;
+    }
+}
+
+static void uyvyToYUV444Row_Scalar(const uint8_t *src, uint8_t *dst, size_t width) {
+    for ( size_t i = 0; i < width / 2; i++ ) {
+        const uint8_t u = src[0];
+        const uint8_t v = src[2];
+        dst[0] = src[1];
+        dst[1] = u;
+        dst[2] = v;
+        dst[3] = src[3];
+        dst[4] = u;
+        dst[5] = v;
+        src += 4;
+        dst += 6;
+    }
+}
+
+static void nv21ToYUV444Row_Scalar(const uint8_t *y, const uint8_t *vu, uint8_t *dst, size_t width) {
+    for ( size_t i = 0; i < width; i++ ) {
+        const uint8_t *c = vu + (i & ~1u);
+        dst[0] = y[i];
+        dst[1] = c[1];
+        dst[2] = c[0];
+        dst += 3;
+    }
+}
+
+static void interpolateRow_Scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                                  size_t width, int fraction) {
+    const int f1 = fraction;
+    const int f0 = 256 - fraction;
+
+    if ( f1 == 0 ) {
+        memcpy(dst, row0, width);
+        return;
+    }
+    if ( f0 == 0 ) {
+        memcpy(dst, row1, width);
+        return;
+    }
+
+    for ( size_t i = 0; i < width; i++ ) {
+        dst[i] = (uint8_t) ((row0[i] * f0 + row1[i] * f1 + 128) >> 8);
+    }
+}
+
+static void accumulateRow_Scalar(const uint8_t *src, uint16_t *sums, size_t width) {
+    for ( size_t i = 0; i < width; i++ ) {
+        sums[i] += src[i];
+    }
+}
+
+static const Kernels kScalarKernels = {
+    BACKEND_SCALAR,
+    "scalar",
+    swapUVRow_Scalar,
+    splitUVRow_Scalar,
+    mergeUVRow_Scalar,
+    yuyvToNV12Row_Scalar,
+    uyvyToNV12Row_Scalar,
+    yuyvToYUV444Row_Scalar,
+    uyvyToYUV444Row_Scalar,
+    nv21ToYUV444Row_Scalar,
+    interpolateRow_Scalar,
+    accumulateRow_Scalar,
+};
+
+/*--------------------NEON kernels-----------------------------*/
+
+#ifdef COLOR_CONVERT_HAVE_NEON
+
+static void swapUVRow_NEON(const uint8_t *src, uint8_t *dst, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 16 <= pairs; i += 16 ) {
+        uint8x16x2_t uv = vld2q_u8(src + 2*i);
+        uint8x16x2_t vu;
+        vu.val[0] = uv.val[1];
+        vu.val[1] = uv.val[0];
+        vst2q_u8(dst + 2*i, vu);
+    }
+    swapUVRow_Scalar(src + 2*i, dst + 2*i, pairs - i);
+}
+
+static void splitUVRow_NEON(const uint8_t *src, uint8_t *dstU, uint8_t *dstV, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 16 <= pairs; i += 16 ) {
+        uint8x16x2_t uv = vld2q_u8(src + 2*i);
+        vst1q_u8(dstU + i, uv.val[0]);
+        vst1q_u8(dstV + i, uv.val[1]);
+    }
+    splitUVRow_Scalar(src + 2*i, dstU + i, dstV + i, pairs - i);
+}
+
+static void mergeUVRow_NEON(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 16 <= pairs; i += 16 ) {
+        uint8x16x2_t uv;
+        uv.val[0] = vld1q_u8(srcU + i);
+        uv.val[1] = vld1q_u8(srcV + i);
+        vst2q_u8(dst + 2*i, uv);
+    }
+    mergeUVRow_Scalar(srcU + i, srcV + i, dst + 2*i, pairs - i);
+}
+
+static void yuyvToNV12Row_NEON(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    size_t i = 0;
+    if ( dstUV ) {
+        for ( ; i + 16 <= width; i += 16 ) {
+            uint8x16x2_t yc = vld2q_u8(src + 2*i);
+            vst1q_u8(dstY + i, yc.val[0]);
+            vst1q_u8(dstUV + i, yc.val[1]);
+        }
+        yuyvToNV12Row_Scalar(src + 2*i, dstY + i, dstUV + i, width - i);
+    } else {
+        for ( ; i + 16 <= width; i += 16 ) {
+            uint8x16x2_t yc = vld2q_u8(src + 2*i);
+            vst1q_u8(dstY + i, yc.val[0]);
+        }
+        yuyvToNV12Row_Scalar(src + 2*i, dstY + i, NULL, width - i);
+    }
+}
+
+static void uyvyToNV12Row_NEON(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    size_t i = 0;
+    if ( dstUV ) {
+        for ( ; i + 16 <= width; i += 16 ) {
+            uint8x16x2_t cy = vld2q_u8(src + 2*i);
+            vst1q_u8(dstY + i, cy.val[1]);
+            vst1q_u8(dstUV + i, cy.val[0]);
+        }
+        uyvyToNV12Row_Scalar(src + 2*i, dstY + i, dstUV + i, width - i);
+    } else {
+        for ( ; i + 16 <= width; i += 16 ) {
+            uint8x16x2_t cy = vld2q_u8(src + 2*i);
+            vst1q_u8(dstY + i, cy.val[1]);
+        }
+        uyvyToNV12Row_Scalar(src + 2*i, dstY + i, NULL, width - i);
+    }
+}
+
+// expands 8 chroma samples to 16 by repeating each one
+static inline uint8x16_t dupChroma_NEON(uint8x8_t c) {
+    uint8x8x2_t z = vzip_u8(c, c);
+    return vcombine_u8(z.val[0], z.val[1]);
+}
+
+static void yuyvToYUV444Row_NEON(const uint8_t *src, uint8_t *dst, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        // val[0] = y0 y2.., val[1] = u.., val[2] = y1 y3.., val[3] = v..
+        uint8x8x4_t p = vld4_u8(src + 2*i);
+        uint8x8x2_t y = vzip_u8(p.val[0], p.val[2]);
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(y.val[0], y.val[1]);
+        out.val[1] = dupChroma_NEON(p.val[1]);
+        out.val[2] = dupChroma_NEON(p.val[3]);
+        vst3q_u8(dst + 3*i, out);
+    }
+    yuyvToYUV444Row_Scalar(src + 2*i, dst + 3*i, width - i);
+}
+
+static void uyvyToYUV444Row_NEON(const uint8_t *src, uint8_t *dst, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        // val[0] = u.., val[1] = y0 y2.., val[2] = v.., val[3] = y1 y3..
+        uint8x8x4_t p = vld4_u8(src + 2*i);
+        uint8x8x2_t y = vzip_u8(p.val[1], p.val[3]);
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(y.val[0], y.val[1]);
+        out.val[1] = dupChroma_NEON(p.val[0]);
+        out.val[2] = dupChroma_NEON(p.val[2]);
+        vst3q_u8(dst + 3*i, out);
+    }
+    uyvyToYUV444Row_Scalar(src + 2*i, dst + 3*i, width - i);
+}
+
+static void nv21ToYUV444Row_NEON(const uint8_t *y, const uint8_t *vu, uint8_t *dst, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        uint8x8x2_t c = vld2_u8(vu + i);
+        uint8x16x3_t out;
+        out.val[0] = vld1q_u8(y + i);
+        out.val[1] = dupChroma_NEON(c.val[1]);
+        out.val[2] = dupChroma_NEON(c.val[0]);
+        vst3q_u8(dst + 3*i, out);
+    }
+    nv21ToYUV444Row_Scalar(y + i, vu + i, dst + 3*i, width - i);
+}
+
+static void interpolateRow_NEON(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                                size_t width, int fraction) {
+    if ( fraction == 0 || fraction == 256 ) {
+        interpolateRow_Scalar(row0, row1, dst, width, fraction);
+        return;
+    }
+
+    const uint8x8_t f0 = vdup_n_u8((uint8_t) (256 - fraction));
+    const uint8x8_t f1 = vdup_n_u8((uint8_t) fraction);
+    size_t i = 0;
+
+    for ( ; i + 16 <= width; i += 16 ) {
+        uint8x16_t a = vld1q_u8(row0 + i);
+        uint8x16_t b = vld1q_u8(row1 + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), f0), vget_low_u8(b), f1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), f0), vget_high_u8(b), f1);
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    interpolateRow_Scalar(row0 + i, row1 + i, dst + i, width - i, fraction);
+}
+
+static void accumulateRow_NEON(const uint8_t *src, uint16_t *sums, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        uint8x16_t s = vld1q_u8(src + i);
+        vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i), vget_low_u8(s)));
+        vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8), vget_high_u8(s)));
+    }
+    accumulateRow_Scalar(src + i, sums + i, width - i);
+}
+
+static const Kernels kNeonKernels = {
+    BACKEND_NEON,
+    "neon",
+    swapUVRow_NEON,
+    splitUVRow_NEON,
+    mergeUVRow_NEON,
+    yuyvToNV12Row_NEON,
+    uyvyToNV12Row_NEON,
+    yuyvToYUV444Row_NEON,
+    uyvyToYUV444Row_NEON,
+    nv21ToYUV444Row_NEON,
+    interpolateRow_NEON,
+    accumulateRow_NEON,
+};
+
+#endif // COLOR_CONVERT_HAVE_NEON
+
+/*--------------------SSE2 kernels-----------------------------*/
+
+#ifdef COLOR_CONVERT_HAVE_SSE2
+
+static void swapUVRow_SSE2(const uint8_t *src, uint8_t *dst, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 8 <= pairs; i += 8 ) {
+        __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i));
+        __m128i vu = _mm_or_si128(_mm_slli_epi16(uv, 8), _mm_srli_epi16(uv, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*i), vu);
+    }
+    swapUVRow_Scalar(src + 2*i, dst + 2*i, pairs - i);
+}
+
+// even bytes of two vectors packed into one
+static inline __m128i packEven_SSE2(__m128i a, __m128i b) {
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    return _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+}
+
+// odd bytes of two vectors packed into one
+static inline __m128i packOdd_SSE2(__m128i a, __m128i b) {
+    return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static void splitUVRow_SSE2(const uint8_t *src, uint8_t *dstU, uint8_t *dstV, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 16 <= pairs; i += 16 ) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + i), packEven_SSE2(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dstV + i), packOdd_SSE2(a, b));
+    }
+    splitUVRow_Scalar(src + 2*i, dstU + i, dstV + i, pairs - i);
+}
+
+static void mergeUVRow_SSE2(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, size_t pairs) {
+    size_t i = 0;
+    for ( ; i + 16 <= pairs; i += 16 ) {
+        __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcU + i));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcV + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*i), _mm_unpacklo_epi8(u, v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*i + 16), _mm_unpackhi_epi8(u, v));
+    }
+    mergeUVRow_Scalar(srcU + i, srcV + i, dst + 2*i, pairs - i);
+}
+
+static void yuyvToNV12Row_SSE2(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY + i), packEven_SSE2(a, b));
+        if ( dstUV ) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstUV + i), packOdd_SSE2(a, b));
+        }
+    }
+    yuyvToNV12Row_Scalar(src + 2*i, dstY + i, dstUV ? dstUV + i : NULL, width - i);
+}
+
+static void uyvyToNV12Row_SSE2(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width) {
+    size_t i = 0;
+    for ( ; i + 16 <= width; i += 16 ) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*i + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY + i), packOdd_SSE2(a, b));
+        if ( dstUV ) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstUV + i), packEven_SSE2(a, b));
+        }
+    }
+    uyvyToNV12Row_Scalar(src + 2*i, dstY + i, dstUV ? dstUV + i : NULL, width - i);
+}
+
+static void interpolateRow_SSE2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                                size_t width, int fraction) {
+    if ( fraction == 0 || fraction == 256 ) {
+        interpolateRow_Scalar(row0, row1, dst, width, fraction);
+        return;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i f0 = _mm_set1_epi16((short) (256 - fraction));
+    const __m128i f1 = _mm_set1_epi16((short) fraction);
+    size_t i = 0;
+
+    for ( ; i + 16 <= width; i += 16 ) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), f0),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), f1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), f0),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), f1));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    interpolateRow_Scalar(row0 + i, row1 + i, dst + i, width - i, fraction);
+}
+
+static void accumulateRow_SSE2(const uint8_t *src, uint16_t *sums, size_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for ( ; i + 16 <= width; i += 16 ) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i *lo = reinterpret_cast<__m128i*>(sums + i);
+        __m128i *hi = reinterpret_cast<__m128i*>(sums + i + 8);
+        _mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(s, zero)));
+        _mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(s, zero)));
+    }
+    accumulateRow_Scalar(src + i, sums + i, width - i);
+}
+
+// SSE2 has no byte shuffle, so there is no cheap way to produce the 3 byte
+// per pixel layout; the YUV444 kernels stay scalar on this backend.
+static const Kernels kSse2Kernels = {
+    BACKEND_SSE2,
+    "sse2",
+    swapUVRow_SSE2,
+    splitUVRow_SSE2,
+    mergeUVRow_SSE2,
+    yuyvToNV12Row_SSE2,
+    uyvyToNV12Row_SSE2,
+    yuyvToYUV444Row_Scalar,
+    uyvyToYUV444Row_Scalar,
+    nv21ToYUV444Row_Scalar,
+    interpolateRow_SSE2,
+    accumulateRow_SSE2,
+};
+
+#endif // COLOR_CONVERT_HAVE_SSE2
+
+/*--------------------Backend selection-----------------------------*/
+
+#ifdef COLOR_CONVERT_HAVE_NEON
+static bool cpuHasNeon() {
+#if defined(__aarch64__)
+    return true;
+#else
+    // the kernel reports "neon" in the Features line of /proc/cpuinfo
+    bool neon = false;
+    char line[512];
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+
+    if ( !cpuinfo ) {
+        return false;
+    }
+
+    while ( !neon && fgets(line, sizeof(line), cpuinfo) ) {
+        if ( strncmp(line, "Features", 8) == 0 ) {
+            neon = (strstr(line, " neon") != NULL);
+        }
+    }
+
+    fclose(cpuinfo);
+    return neon;
+#endif
+}
+#endif
+
+static const Kernels *gProbedKernels = &kScalarKernels;
+// published with release/acquire so concurrent first callers see the full table
+static const Kernels *gActiveKernels = NULL;
+static pthread_once_t gProbeOnce = PTHREAD_ONCE_INIT;
+
+static void probeBackend() {
+    const Kernels *probed = &kScalarKernels;
+
+#ifdef COLOR_CONVERT_HAVE_NEON
+    if ( cpuHasNeon() ) {
+        probed = &kNeonKernels;
+    }
+#endif
+
+#ifdef COLOR_CONVERT_HAVE_SSE2
+    // the compiler was already told SSE2 is part of the baseline
+    probed = &kSse2Kernels;
+#endif
+
+    gProbedKernels = probed;
+    __atomic_store_n(&gActiveKernels, probed, __ATOMIC_RELEASE);
+}
+
+const Kernels * kernelsFor(Backend backend) {
+    pthread_once(&gProbeOnce, probeBackend);
+
+    switch ( backend ) {
+        case BACKEND_AUTO:
+            return gProbedKernels;
+        case BACKEND_SCALAR:
+            return &kScalarKernels;
+#ifdef COLOR_CONVERT_HAVE_NEON
+        case BACKEND_NEON:
+            return (gProbedKernels == &kNeonKernels) ? &kNeonKernels : NULL;
+#endif
+#ifdef COLOR_CONVERT_HAVE_SSE2
+        case BACKEND_SSE2:
+            return &kSse2Kernels;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+const Kernels & kernels() {
+    const Kernels *active = __atomic_load_n(&gActiveKernels, __ATOMIC_ACQUIRE);
+
+    if ( !active ) {
+        pthread_once(&gProbeOnce, probeBackend);
+        active = __atomic_load_n(&gActiveKernels, __ATOMIC_ACQUIRE);
+    }
+
+    return *active;
+}
+
+bool setBackend(Backend backend) {
+    const Kernels *selected = kernelsFor(backend);
+
+    if ( !selected ) {
+        return false;
+    }
+
+    __atomic_store_n(&gActiveKernels, selected, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*--------------------Frame helpers-----------------------------*/
+
+void nv12ToNV21(const uint8_t *srcY, const uint8_t *srcUV, size_t srcStride,
+                uint8_t *dst, int width, int height) {
+    const Kernels &k = kernels();
+    uint8_t *dstUV = dst + width * height;
+
+    for ( int i = 0; i < height; i++ ) {
+        memcpy(dst, srcY, width);
+        srcY += srcStride;
+        dst += width;
+    }
+
+    for ( int i = 0; i < height / 2; i++ ) {
+        k.swapUVRow(srcUV, dstUV, width / 2);
+        srcUV += srcStride;
+        dstUV += width;
+    }
+}
+
+void nv12ToYV12(const uint8_t *srcY, const uint8_t *srcUV, size_t srcStride,
+                uint8_t *dst, int width, int height) {
+    const Kernels &k = kernels();
+    const size_t yStride = (width + 0xF) & ~0xF;
+    const size_t uvStride = (yStride / 2 + 0xF) & ~0xF;
+    const size_t ySize = yStride * height;
+    const size_t uvSize = uvStride * height / 2;
+
+    // YV12 stores the Cr plane first
+    uint8_t *dstV = dst + ySize;
+    uint8_t *dstU = dst + ySize + uvSize;
+
+    for ( int i = 0; i < height; i++ ) {
+        memcpy(dst, srcY, width);
+        srcY += srcStride;
+        dst += yStride;
+    }
+
+    for ( int i = 0; i < height / 2; i++ ) {
+        k.splitUVRow(srcUV, dstU, dstV, width / 2);
+        srcUV += srcStride;
+        dstU += uvStride;
+        dstV += uvStride;
+    }
+}
+
+void yuyvToNV12(const uint8_t *src, size_t srcStride,
+                uint8_t *dstY, uint8_t *dstUV, size_t dstStride,
+                int width, int height) {
+    const Kernels &k = kernels();
+
+    for ( int i = 0; i < height; i++ ) {
+        k.yuyvToNV12Row(src, dstY, (i & 1) ? NULL : dstUV, width);
+        if ( i & 1 ) {
+            dstUV += dstStride;
+        }
+        src += srcStride;
+        dstY += dstStride;
+    }
+}
+
+void uyvyToNV12(const uint8_t *src, size_t srcStride,
+                uint8_t *dstY, uint8_t *dstUV, size_t dstStride,
+                int width, int height) {
+    const Kernels &k = kernels();
+
+    for ( int i = 0; i < height; i++ ) {
+        k.uyvyToNV12Row(src, dstY, (i & 1) ? NULL : dstUV, width);
+        if ( i & 1 ) {
+            dstUV += dstStride;
+        }
+        src += srcStride;
+        dstY += dstStride;
+    }
+}
+
+} // namespace ColorConvert
+} // namespace Camera
+} // namespace Ti
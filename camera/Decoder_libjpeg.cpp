@@ -15,6 +15,7 @@
  */
 
 #include "Decoder_libjpeg.h"
+#include "ColorConvert.h"
 
 extern "C" {
     #include "jpeglib.h"
@@ -64,62 +65,117 @@ static unsigned char jpeg_odml_dht[0x1a6] = {
     0xf9, 0xfa
 };
 
+/* Markers the header walk in isDhtExist() cares about */
+static const unsigned char JPEG_MARKER_SOI = 0xd8;
+static const unsigned char JPEG_MARKER_EOI = 0xd9;
+static const unsigned char JPEG_MARKER_SOS = 0xda;
+static const unsigned char JPEG_MARKER_DHT = 0xc4;
+
+/* Handed to libjpeg when the frame ends before EOI, like jdatasrc.c does */
+static const JOCTET jpeg_fake_eoi[2] = { 0xff, JPEG_MARKER_EOI };
+
+/**
+ * Source manager reading a frame straight from the capture buffer.
+ *
+ * The input is a chain of up to two chunks read back to back. MJPEG frames
+ * without Huffman tables are served as jpeg_odml_dht (SOI + DHT) followed
+ * by the frame minus its own SOI, so libjpeg sees a complete JPEG without
+ * the frame ever being copied.
+ */
 struct libjpeg_source_mgr : jpeg_source_mgr {
-    libjpeg_source_mgr(unsigned char *buffer_ptr, int len);
+    libjpeg_source_mgr(unsigned char *buffer_ptr, int len, bool inject_dht);
     ~libjpeg_source_mgr();
 
-    unsigned char *mBufferPtr;
-    int mFilledLen;
+    enum { MAX_CHUNKS = 2 };
+
+    const JOCTET *mChunks[MAX_CHUNKS];
+    size_t mChunkLens[MAX_CHUNKS];
+    int mChunkCount;
+    int mNextChunk;
 };
 
 static void libjpeg_init_source(j_decompress_ptr cinfo) {
     libjpeg_source_mgr*  src = (libjpeg_source_mgr*)cinfo->src;
-    src->next_input_byte = (const JOCTET*)src->mBufferPtr;
+    src->next_input_byte = NULL;
     src->bytes_in_buffer = 0;
     src->current_offset = 0;
+    src->mNextChunk = 0;
 }
 
 static boolean libjpeg_seek_input_data(j_decompress_ptr cinfo, long byte_offset) {
     libjpeg_source_mgr* src = (libjpeg_source_mgr*)cinfo->src;
-    src->current_offset = byte_offset;
-    src->next_input_byte = (const JOCTET*)src->mBufferPtr + byte_offset;
-    src->bytes_in_buffer = 0;
-    return TRUE;
+    size_t chunk_start = 0;
+
+    if (byte_offset < 0) {
+        return FALSE;
+    }
+
+    for (int i = 0; i < src->mChunkCount; i++) {
+        const size_t chunk_end = chunk_start + src->mChunkLens[i];
+        if ((size_t)byte_offset < chunk_end) {
+            src->next_input_byte = src->mChunks[i] + (byte_offset - chunk_start);
+            src->bytes_in_buffer = chunk_end - byte_offset;
+            src->current_offset = chunk_end;
+            src->mNextChunk = i + 1;
+            return TRUE;
+        }
+        chunk_start = chunk_end;
+    }
+
+    return FALSE;
 }
 
 static boolean libjpeg_fill_input_buffer(j_decompress_ptr cinfo) {
     libjpeg_source_mgr* src = (libjpeg_source_mgr*)cinfo->src;
-    src->current_offset += src->mFilledLen;
-    src->next_input_byte = src->mBufferPtr;
-    src->bytes_in_buffer = src->mFilledLen;
+
+    if (src->mNextChunk < src->mChunkCount) {
+        const int chunk = src->mNextChunk++;
+        src->next_input_byte = src->mChunks[chunk];
+        src->bytes_in_buffer = src->mChunkLens[chunk];
+    } else {
+        // truncated frame, let libjpeg finish with gray blocks
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->next_input_byte = jpeg_fake_eoi;
+        src->bytes_in_buffer = sizeof(jpeg_fake_eoi);
+    }
+
+    src->current_offset += src->bytes_in_buffer;
     return TRUE;
 }
 
 static void libjpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
     libjpeg_source_mgr*  src = (libjpeg_source_mgr*)cinfo->src;
 
-    if (num_bytes > (long)src->bytes_in_buffer) {
-        CAMHAL_LOGEA("\n\n\n libjpeg_skip_input_data - num_bytes > (long)src->bytes_in_buffer \n\n\n");
-    } else {
-        src->next_input_byte += num_bytes;
-        src->bytes_in_buffer -= num_bytes;
+    if (num_bytes <= 0) {
+        return;
     }
-}
 
-static boolean libjpeg_resync_to_restart(j_decompress_ptr cinfo, int desired) {
-    libjpeg_source_mgr*  src = (libjpeg_source_mgr*)cinfo->src;
-    src->next_input_byte = (const JOCTET*)src->mBufferPtr;
-    src->bytes_in_buffer = 0;
-    return TRUE;
+    while (num_bytes > (long)src->bytes_in_buffer) {
+        num_bytes -= (long)src->bytes_in_buffer;
+        libjpeg_fill_input_buffer(cinfo);
+    }
+
+    src->next_input_byte += num_bytes;
+    src->bytes_in_buffer -= num_bytes;
 }
 
 static void libjpeg_term_source(j_decompress_ptr /*cinfo*/) {}
 
-libjpeg_source_mgr::libjpeg_source_mgr(unsigned char *buffer_ptr, int len) : mBufferPtr(buffer_ptr), mFilledLen(len) {
+libjpeg_source_mgr::libjpeg_source_mgr(unsigned char *buffer_ptr, int len, bool inject_dht)
+    : mChunkCount(0), mNextChunk(0) {
+    if (inject_dht && len > 2) {
+        mChunks[mChunkCount] = jpeg_odml_dht;
+        mChunkLens[mChunkCount++] = sizeof(jpeg_odml_dht);
+        buffer_ptr += 2;
+        len -= 2;
+    }
+    mChunks[mChunkCount] = buffer_ptr;
+    mChunkLens[mChunkCount++] = len;
+
     init_source = libjpeg_init_source;
     fill_input_buffer = libjpeg_fill_input_buffer;
     skip_input_data = libjpeg_skip_input_data;
-    resync_to_restart = libjpeg_resync_to_restart;
+    resync_to_restart = jpeg_resync_to_restart;
     term_source = libjpeg_term_source;
     seek_input_data = libjpeg_seek_input_data;
 }
@@ -128,37 +184,39 @@ libjpeg_source_mgr::~libjpeg_source_mgr() {}
 
 Decoder_libjpeg::Decoder_libjpeg()
 {
-    mWidth = 0;
-    mHeight = 0;
-    Y_Plane = NULL;
-    U_Plane = NULL;
-    V_Plane = NULL;
-    UV_Plane = NULL;
+    mScratch = NULL;
+    mScratchSize = 0;
+    mFrame = NULL;
+    mFrameSize = 0;
 }
 
 Decoder_libjpeg::~Decoder_libjpeg()
 {
     release();
+    free(mFrame);
 }
 
 void Decoder_libjpeg::release()
 {
-    if (Y_Plane) {
-        free(Y_Plane);
-        Y_Plane = NULL;
-    }
-    if (U_Plane) {
-        free(U_Plane);
-        U_Plane = NULL;
-    }
-    if (V_Plane) {
-        free(V_Plane);
-        V_Plane = NULL;
+    if (mScratch) {
+        free(mScratch);
+        mScratch = NULL;
     }
-    if (UV_Plane) {
-        free(UV_Plane);
-        UV_Plane = NULL;
+    mScratchSize = 0;
+}
+
+unsigned char *Decoder_libjpeg::reserveScratch(size_t size)
+{
+    if (size > mScratchSize) {
+        release();
+        mScratch = (unsigned char *)malloc(size);
+        if (mScratch == NULL) {
+            CAMHAL_LOGEB("Couldn't allocate %u bytes of decoder scratch", size);
+            return NULL;
+        }
+        mScratchSize = size;
     }
+    return mScratch;
 }
 
 int Decoder_libjpeg::readDHTSize()
@@ -167,19 +225,37 @@ int Decoder_libjpeg::readDHTSize()
 }
 
 // 0xFF 0xC4 - DHT (Define Huffman Table) marker
-// 0xFF 0xD9 - SOI (Start Of Image) marker
-// 0xFF 0xD9 - EOI (End Of Image) marker
-// This function return true if if found DHT
+// 0xFF 0xD8 - SOI (Start Of Image) marker
+// 0xFF 0xDA - SOS (Start Of Scan) marker
+// Walks the marker segments of the header and returns true if one of them
+// is a DHT. Tables can only precede the first scan, so the entropy coded
+// data is never looked at.
 bool Decoder_libjpeg::isDhtExist(unsigned char *jpeg_src,  int filled_len) {
-    if (filled_len <= 0) {
+    if (filled_len < 4 || jpeg_src[0] != 0xFF || jpeg_src[1] != JPEG_MARKER_SOI) {
         return false;
     }
 
-    for (int i = 1; i < filled_len; i++) {
-        if((jpeg_src[i - 1] == 0xFF) && (jpeg_src[i] == 0xC4)) {
+    int i = 2;
+    while (i + 4 <= filled_len) {
+        if (jpeg_src[i] != 0xFF) {
+            return false;
+        }
+
+        const unsigned char marker = jpeg_src[i + 1];
+        if (marker == 0xFF) {
+            // fill byte
+            i++;
+            continue;
+        }
+        if (marker == JPEG_MARKER_DHT) {
             CAMHAL_LOGD("Found DHT (Define Huffman Table) marker");
             return true;
         }
+        if (marker == JPEG_MARKER_SOS || marker == JPEG_MARKER_EOI) {
+            return false;
+        }
+
+        i += 2 + ((jpeg_src[i + 2] << 8) | jpeg_src[i + 3]);
     }
     return false;
 }
@@ -201,14 +277,43 @@ int Decoder_libjpeg::appendDHT(unsigned char *jpeg_src, int filled_len, unsigned
 
 
 bool Decoder_libjpeg::decode(unsigned char *jpeg_src, int filled_len, unsigned char *nv12_buffer, int stride)
+{
+    return decode(jpeg_src, filled_len, nv12_buffer, stride, 0, 0, 1);
+}
+
+int Decoder_libjpeg::scaleDenomFor(int src_width, int src_height, int dst_width, int dst_height)
+{
+    for (int denom = MAX_SCALE_DENOM; denom > 1; denom /= 2) {
+        if ((scaledSize(src_width, denom) >= dst_width) &&
+            (scaledSize(src_height, denom) >= dst_height)) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+int Decoder_libjpeg::scaledSize(int size, int scale_denom)
+{
+    // libjpeg rounds scaled dimensions up
+    return (size + scale_denom - 1) / scale_denom;
+}
+
+bool Decoder_libjpeg::decode(unsigned char *jpeg_src, int filled_len, unsigned char *nv12_buffer, int stride,
+                             int width, int height, int scale_denom)
 {
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
-    struct libjpeg_source_mgr s_mgr(jpeg_src, filled_len);
 
-    if (filled_len == 0)
+    if (filled_len <= 2)
         return false;
 
+    if ((scale_denom != 1) && (scale_denom != 2) && (scale_denom != 4) && (scale_denom != MAX_SCALE_DENOM)) {
+        CAMHAL_LOGEB("Unsupported scale 1/%d", scale_denom);
+        return false;
+    }
+
+    struct libjpeg_source_mgr s_mgr(jpeg_src, filled_len, !isDhtExist(jpeg_src, filled_len));
+
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
 
@@ -216,82 +321,214 @@ bool Decoder_libjpeg::decode(unsigned char *jpeg_src, int filled_len, unsigned c
     int status = jpeg_read_header(&cinfo, true);
     if (status != JPEG_HEADER_OK) {
         CAMHAL_LOGEA("jpeg header corrupted");
+        jpeg_destroy_decompress(&cinfo);
         return false;
     }
 
     cinfo.out_color_space = JCS_YCbCr;
     cinfo.raw_data_out = true;
+    // the IDCT produces the smaller picture directly
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale_denom;
     status = jpeg_start_decompress(&cinfo);
     if (!status){
         CAMHAL_LOGEA("jpeg_start_decompress failed");
+        jpeg_destroy_decompress(&cinfo);
         return false;
     }
 
-    if (mWidth == 0){
-        mWidth = cinfo.output_width;
-        mHeight = cinfo.output_height;
-        CAMHAL_LOGEA("w x h = %d x %d. stride=%d", cinfo.output_width, cinfo.output_height, stride);
+    const int decodedWidth = cinfo.output_width;
+    const int decodedHeight = cinfo.output_height;
+    bool ok;
+
+    if ((width <= 0) || (height <= 0) || ((decodedWidth == width) && (decodedHeight == height))) {
+        ok = readRawNV12(&cinfo, nv12_buffer, stride);
+    } else {
+        // decode at the scaled size, then fit the picture into the output
+        const int frameStride = (decodedWidth + 1) & ~1;
+        const size_t frameSize = frameStride * (decodedHeight + (decodedHeight + 1) / 2);
+
+        if (frameSize > mFrameSize) {
+            free(mFrame);
+            mFrameSize = 0;
+            mFrame = (unsigned char *)malloc(frameSize);
+            if (mFrame != NULL) {
+                mFrameSize = frameSize;
+            }
+        }
+
+        ok = (mFrame != NULL) && readRawNV12(&cinfo, mFrame, frameStride);
+
+        if (ok) {
+            ok = resizeNV12(mFrame, frameStride, decodedWidth, decodedHeight,
+                            nv12_buffer, stride, width, height);
+        }
     }
-    else if ((cinfo.output_width > mWidth) || (cinfo.output_height > mHeight)) {
-        CAMHAL_LOGEA(" Free the existing buffers so that they are reallocated for new w x h. Old WxH = %dx%d. New WxH = %dx%d",
-        mWidth, mHeight, cinfo.output_width, cinfo.output_height);
-        release();
-        mWidth = cinfo.output_width;
-        mHeight = cinfo.output_height;
+
+    if (ok) {
+        jpeg_finish_decompress(&cinfo);
     }
+    jpeg_destroy_decompress(&cinfo);
 
-    unsigned int decoded_uv_buffer_size = cinfo.output_width * cinfo.output_height / 2;
-    if (Y_Plane == NULL)Y_Plane = (unsigned char **)malloc(cinfo.output_height * sizeof(unsigned char *));
-    if (U_Plane == NULL)U_Plane = (unsigned char **)malloc(cinfo.output_height * sizeof(unsigned char *));
-    if (V_Plane == NULL)V_Plane = (unsigned char **)malloc(cinfo.output_height * sizeof(unsigned char *));
-    if (UV_Plane == NULL) UV_Plane = (unsigned char *)malloc(decoded_uv_buffer_size);
+    return ok;
+}
 
-    unsigned char **YUV_Planes[NUM_COMPONENTS_IN_YUV];
-    YUV_Planes[0] = Y_Plane;
-    YUV_Planes[1] = U_Plane;
-    YUV_Planes[2] = V_Plane;
+bool Decoder_libjpeg::resizeNV12(unsigned char *src, int src_stride, int src_width, int src_height,
+                                 unsigned char *dst, int dst_stride, int dst_width, int dst_height)
+{
+    structConvImage in, out;
+
+    in.uWidth = src_width;
+    in.uHeight = src_height;
+    in.uStride = src_stride;
+    in.eFormat = IC_FORMAT_YCbCr420_lp;
+    in.imgPtr = src;
+    in.clrPtr = src + src_stride * src_height;
+    in.uOffset = 0;
+
+    out.uWidth = dst_width;
+    out.uHeight = dst_height;
+    out.uStride = dst_stride;
+    out.eFormat = IC_FORMAT_YCbCr420_lp;
+    out.imgPtr = dst;
+    out.clrPtr = dst + dst_stride * dst_height;
+    out.uOffset = 0;
+
+    if (mScaler.configure(src_width, src_height, dst_width, dst_height) != NO_ERROR) {
+        CAMHAL_LOGEB("Can't scale %dx%d to %dx%d", src_width, src_height, dst_width, dst_height);
+        return false;
+    }
 
-    unsigned char *row = &nv12_buffer[0];
+    return mScaler.scale(&in, &out) == NO_ERROR;
+}
 
-    // Y Component
-    for (unsigned int j = 0; j < cinfo.output_height; j++, row += stride)
-        YUV_Planes[0][j] = row;
+/**
+ * Reads the raw planes of a started decompression into NV12.
+ *
+ * Luma rows are decoded straight into the output. Chroma is decoded one
+ * iMCU row at a time into a small scratch area that stays in cache and is
+ * interleaved into the NV12 chroma plane from there. Both 4:2:0 and 4:2:2
+ * sources are handled; for 4:2:2 the chroma of odd rows is dropped.
+ *
+ * With IDCT scaling libjpeg may hand out chroma at the luma resolution
+ * (4:2:0 at 1/2 and below comes out as 4:4:4), such rows are decimated
+ * horizontally before they are interleaved.
+ */
+bool Decoder_libjpeg::readRawNV12(jpeg_decompress_struct *cinfo, unsigned char *nv12_buffer, int stride)
+{
+    if (cinfo->num_components != NUM_COMPONENTS_IN_YUV) {
+        CAMHAL_LOGEB("Unsupported number of components %d", cinfo->num_components);
+        return false;
+    }
 
-    row = &UV_Plane[0];
+    jpeg_component_info *luma = &cinfo->comp_info[0];
+    jpeg_component_info *chroma = &cinfo->comp_info[1];
+    const int lumaRows = luma->v_samp_factor * luma->DCT_scaled_size;
+    const int chromaRows = chroma->v_samp_factor * chroma->DCT_scaled_size;
+    const int lumaCols = luma->h_samp_factor * luma->DCT_scaled_size;
+    const int chromaCols = chroma->h_samp_factor * chroma->DCT_scaled_size;
+
+    if ((cinfo->comp_info[2].h_samp_factor != chroma->h_samp_factor) ||
+        (cinfo->comp_info[2].v_samp_factor != chroma->v_samp_factor) ||
+        (cinfo->comp_info[2].DCT_scaled_size != chroma->DCT_scaled_size) ||
+        ((lumaCols != 2 * chromaCols) && (lumaCols != chromaCols)) ||
+        ((lumaRows != chromaRows) && (lumaRows != 2 * chromaRows)) ||
+        (lumaRows > MAX_RAW_ROWS)) {
+        CAMHAL_LOGEB("Unsupported sampling %dx%d/%dx%d",
+                     luma->h_samp_factor, luma->v_samp_factor,
+                     chroma->h_samp_factor, chroma->v_samp_factor);
+        return false;
+    }
 
-    // U Component
-    for (unsigned int j = 0; j < cinfo.output_height; j+=2, row += cinfo.output_width / 2){
-        YUV_Planes[1][j+0] = row;
-        YUV_Planes[1][j+1] = row;
+    const int width = cinfo->output_width;
+    const int height = cinfo->output_height;
+    const size_t pairs = (width + 1) / 2;
+    // libjpeg always writes whole blocks
+    const size_t lumaWidth = luma->width_in_blocks * luma->DCT_scaled_size;
+    const size_t chromaWidth = chroma->width_in_blocks * chroma->DCT_scaled_size;
+    const int vStep = lumaRows / chromaRows;
+    const bool decimateChroma = (lumaCols == chromaCols);
+
+    // luma goes through scratch only if the padded rows don't fit the stride
+    const bool directLuma = ((size_t)stride >= lumaWidth);
+
+    size_t scratchSize = lumaWidth + 2 * chromaRows * chromaWidth;
+    if (!directLuma) {
+        scratchSize += lumaRows * lumaWidth;
+    }
+    if (decimateChroma) {
+        scratchSize += 3 * pairs;
     }
 
-    // V Component
-    for (unsigned int j = 0; j < cinfo.output_height; j+=2, row += cinfo.output_width / 2){
-        YUV_Planes[2][j+0] = row;
-        YUV_Planes[2][j+1] = row;
+    unsigned char *scratch = reserveScratch(scratchSize);
+    if (scratch == NULL) {
+        return false;
     }
 
-    // Interleaving U and V
-    for (unsigned int i = 0; i < cinfo.output_height; i += 8) {
-        jpeg_read_raw_data(&cinfo, YUV_Planes, 8);
-        YUV_Planes[0] += 8;
-        YUV_Planes[1] += 8;
-        YUV_Planes[2] += 8;
+    // block rows below the picture land here instead of the chroma plane
+    unsigned char *sinkRow = scratch;
+    unsigned char *uRows = sinkRow + lumaWidth;
+    unsigned char *vRows = uRows + chromaRows * chromaWidth;
+    unsigned char *lumaRowsScratch = vRows + chromaRows * chromaWidth;
+    // even chroma samples of one row, odd ones are split off into the sink
+    unsigned char *evenU = lumaRowsScratch + (directLuma ? 0 : lumaRows * lumaWidth);
+    unsigned char *evenV = evenU + pairs;
+    unsigned char *oddSink = evenV + pairs;
+
+    JSAMPROW yPlane[MAX_RAW_ROWS];
+    JSAMPROW uPlane[MAX_RAW_ROWS];
+    JSAMPROW vPlane[MAX_RAW_ROWS];
+    JSAMPARRAY planes[NUM_COMPONENTS_IN_YUV] = { yPlane, uPlane, vPlane };
+
+    for (int i = 0; i < chromaRows; i++) {
+        uPlane[i] = uRows + i * chromaWidth;
+        vPlane[i] = vRows + i * chromaWidth;
     }
 
-    unsigned char *uv_ptr = nv12_buffer + (stride * cinfo.output_height);
-    unsigned char *u_ptr = UV_Plane;
-    unsigned char *v_ptr = UV_Plane + (decoded_uv_buffer_size / 2);
-    for(unsigned int i = 0; i < cinfo.output_height / 2; i++){
-        for(unsigned int j = 0; j < cinfo.output_width; j+=2){
-            *(uv_ptr + j) = *u_ptr; u_ptr++;
-            *(uv_ptr + j + 1) = *v_ptr; v_ptr++;
+    unsigned char *uvPlane = nv12_buffer + (stride * height);
+    const ColorConvert::Kernels &kernels = ColorConvert::kernels();
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        const int top = cinfo->output_scanline;
+
+        for (int i = 0; i < lumaRows; i++) {
+            if (top + i >= height) {
+                yPlane[i] = sinkRow;
+            } else if (directLuma) {
+                yPlane[i] = nv12_buffer + (top + i) * stride;
+            } else {
+                yPlane[i] = lumaRowsScratch + i * lumaWidth;
+            }
         }
-        uv_ptr = uv_ptr + stride;
-    }
 
-    jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
+        if (jpeg_read_raw_data(cinfo, planes, lumaRows) == 0) {
+            CAMHAL_LOGEA("jpeg_read_raw_data failed");
+            return false;
+        }
+
+        if (!directLuma) {
+            for (int i = 0; (i < lumaRows) && (top + i < height); i++) {
+                memcpy(nv12_buffer + (top + i) * stride, yPlane[i], width);
+            }
+        }
+
+        for (int i = 0; i < chromaRows; i++) {
+            const int row = top + i * vStep;
+            if (row >= height) {
+                break;
+            }
+            if (row & 1) {
+                continue;
+            }
+            if (decimateChroma) {
+                kernels.splitUVRow(uPlane[i], evenU, oddSink, pairs);
+                kernels.splitUVRow(vPlane[i], evenV, oddSink, pairs);
+                kernels.mergeUVRow(evenU, evenV, uvPlane + (row / 2) * stride, pairs);
+            } else {
+                kernels.mergeUVRow(uPlane[i], vPlane[i], uvPlane + (row / 2) * stride, pairs);
+            }
+        }
+    }
 
     return true;
 }
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file EncoderScheduler.cpp
+*
+* This file implements the bounded encode queue used for software JPEG.
+*
+*/
+
+#include "EncoderScheduler.h"
+
+namespace Ti {
+namespace Camera {
+
+EncoderScheduler::EncoderScheduler(int priority)
+    : mCapacity(0), mQueued(0), mPriority(priority), mExiting(true) {
+}
+
+EncoderScheduler::~EncoderScheduler() {
+    deinitialize();
+}
+
+status_t EncoderScheduler::initialize(int threads, size_t capacity) {
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    if ( !mThreads.isEmpty() ) {
+        return ALREADY_EXISTS;
+    }
+
+    if ( threads < 1 ) {
+        return BAD_VALUE;
+    }
+
+    mCapacity = max(capacity, (size_t) threads);
+    mExiting = false;
+
+    for ( int i = 0; i < threads; i++ ) {
+        android::sp<EncoderThread> thread = new EncoderThread(this);
+        if ( !thread.get() ) {
+            CAMHAL_LOGEA("Couldn't create encoder thread");
+            break;
+        }
+
+        status_t ret = thread->run("CameraEncoder", mPriority);
+        if ( ret != NO_ERROR ) {
+            CAMHAL_LOGEB("Couldn't run encoder thread %d", ret);
+            break;
+        }
+
+        mThreads.add(thread);
+    }
+
+    if ( mThreads.isEmpty() ) {
+        mExiting = true;
+        return NO_INIT;
+    }
+
+    CAMHAL_LOGDB("Encoder scheduler started with %d threads, capacity %d",
+                 mThreads.size(), mCapacity);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+void EncoderScheduler::deinitialize() {
+    LOG_FUNCTION_NAME;
+
+    android::Vector< android::sp<EncoderThread> > threads;
+
+    {
+        android::AutoMutex lock(mLock);
+        mExiting = true;
+    }
+
+    // the threads drain the queue, as canceled jobs, before they exit
+    flush();
+
+    {
+        android::AutoMutex lock(mLock);
+        threads = mThreads;
+        mThreads.clear();
+        mJobAvailable.broadcast();
+        mRoomAvailable.broadcast();
+    }
+
+    for ( size_t i = 0; i < threads.size(); i++ ) {
+        threads[i]->requestExitAndWait();
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+status_t EncoderScheduler::submit(const android::sp<Job> &job, Priority priority) {
+    if ( !job.get() || (priority < 0) || (priority >= PRIORITY_COUNT) ) {
+        return BAD_VALUE;
+    }
+
+    {
+        android::AutoMutex lock(mLock);
+
+        if ( !mExiting && (mQueued + mRunning.size() >= mCapacity) ) {
+            CAMHAL_LOGDB("Encoder queue full (%d jobs), holding the caller",
+                         mQueued + mRunning.size());
+            while ( !mExiting && (mQueued + mRunning.size() >= mCapacity) ) {
+                mRoomAvailable.wait(mLock);
+            }
+        }
+
+        if ( !mExiting ) {
+            mQueues[priority].add(job);
+            mQueued++;
+            mJobAvailable.signal();
+            return NO_ERROR;
+        }
+    }
+
+    CAMHAL_LOGEA("Encoder scheduler is not running, dropping job");
+    job->cancel();
+    job->process();
+
+    return NO_INIT;
+}
+
+void EncoderScheduler::flush() {
+    LOG_FUNCTION_NAME;
+
+    android::Vector< android::sp<Job> > dropped;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        for ( int i = 0; i < PRIORITY_COUNT; i++ ) {
+            dropped.appendVector(mQueues[i]);
+            mQueues[i].clear();
+        }
+        mQueued = 0;
+
+        for ( size_t i = 0; i < mRunning.size(); i++ ) {
+            mRunning[i]->cancel();
+        }
+
+        mRoomAvailable.broadcast();
+    }
+
+    for ( size_t i = 0; i < dropped.size(); i++ ) {
+        dropped[i]->cancel();
+        dropped[i]->process();
+    }
+
+    {
+        android::AutoMutex lock(mLock);
+        while ( !mRunning.isEmpty() ) {
+            mIdle.wait(mLock);
+        }
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+size_t EncoderScheduler::pending() const {
+    android::AutoMutex lock(mLock);
+    return mQueued + mRunning.size();
+}
+
+android::sp<EncoderScheduler::Job> EncoderScheduler::dequeue() {
+    for ( int i = 0; i < PRIORITY_COUNT; i++ ) {
+        if ( !mQueues[i].isEmpty() ) {
+            android::sp<Job> job = mQueues[i][0];
+            mQueues[i].removeAt(0);
+            mQueued--;
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+bool EncoderScheduler::threadLoop() {
+    android::sp<Job> job;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        job = dequeue();
+        if ( !job.get() ) {
+            if ( mExiting ) {
+                return false;
+            }
+            mJobAvailable.wait(mLock);
+            return true;
+        }
+
+        mRunning.add(job);
+    }
+
+    job->process();
+
+    {
+        android::AutoMutex lock(mLock);
+
+        for ( size_t i = 0; i < mRunning.size(); i++ ) {
+            if ( mRunning[i] == job ) {
+                mRunning.removeAt(i);
+                break;
+            }
+        }
+
+        mRoomAvailable.signal();
+        if ( mRunning.isEmpty() ) {
+            mIdle.broadcast();
+        }
+    }
+
+    return true;
+}
+
+} // namespace Camera
+} // namespace Ti
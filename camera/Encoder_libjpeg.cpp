@@ -25,6 +25,7 @@
 
 #include "Encoder_libjpeg.h"
 #include "NV12_resize.h"
+#include "ColorConvert.h"
 #include "TICameraParameters.h"
 
 #include <stdlib.h>
@@ -65,6 +66,7 @@ struct libjpeg_destination_mgr : jpeg_destination_mgr {
     uint8_t* buf;
     int bufsize;
     size_t jpegsize;
+    bool overflow;
 };
 
 static void libjpeg_init_destination (j_compress_ptr cinfo) {
@@ -73,6 +75,7 @@ static void libjpeg_init_destination (j_compress_ptr cinfo) {
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer = dest->bufsize;
     dest->jpegsize = 0;
+    dest->overflow = false;
 }
 
 static boolean libjpeg_empty_output_buffer(j_compress_ptr cinfo) {
@@ -80,6 +83,7 @@ static boolean libjpeg_empty_output_buffer(j_compress_ptr cinfo) {
 
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer = dest->bufsize;
+    dest->overflow = true;
     return TRUE; // ?
 }
 
@@ -97,148 +101,78 @@ libjpeg_destination_mgr::libjpeg_destination_mgr(uint8_t* input, int size) {
     this->bufsize = size;
 
     jpegsize = 0;
+    overflow = false;
 }
 
-/* private static functions */
-static void nv21_to_yuv(uint8_t* dst, uint8_t* y, uint8_t* uv, int width) {
-    if (!dst || !y || !uv) {
-        return;
-    }
+/**
+ * Destination for the slices of a parallel encode; grows on demand since
+ * the compressed size of a slice is not known up front.
+ */
+struct libjpeg_slice_destination : jpeg_destination_mgr {
+    libjpeg_slice_destination();
+    ~libjpeg_slice_destination();
 
-    while ((width--) > 0) {
-        uint8_t y0 = y[0];
-        uint8_t v0 = uv[0];
-        uint8_t u0 = *(uv+1);
-        dst[0] = y0;
-        dst[1] = u0;
-        dst[2] = v0;
-        dst += 3;
-        y++;
-        if(!(width % 2)) uv+=2;
-    }
+    uint8_t* buf;
+    size_t bufsize;
+    size_t jpegsize;
+    bool overflow;
+};
+
+static void libjpeg_slice_init_destination(j_compress_ptr cinfo) {
+    libjpeg_slice_destination* dest = (libjpeg_slice_destination*)cinfo->dest;
+
+    dest->next_output_byte = dest->buf;
+    dest->free_in_buffer = dest->bufsize;
+    dest->jpegsize = 0;
+    dest->overflow = false;
 }
 
-static void uyvy_to_yuv(uint8_t* dst, uint32_t* src, int width) {
-    if (!dst || !src) {
-        return;
+static boolean libjpeg_slice_empty_output_buffer(j_compress_ptr cinfo) {
+    libjpeg_slice_destination* dest = (libjpeg_slice_destination*)cinfo->dest;
+    const size_t size = dest->bufsize * 2;
+    uint8_t* buf = (uint8_t*) realloc(dest->buf, size);
+
+    if (!buf) {
+        // keep libjpeg going, the slice is dropped afterwards
+        dest->overflow = true;
+        dest->next_output_byte = dest->buf;
+        dest->free_in_buffer = dest->bufsize;
+        return TRUE;
     }
 
-    if (width % 2) {
-        return; // not supporting odd widths
-    }
-
-#ifdef ARCH_ARM_HAVE_NEON
-    // currently, neon routine only supports multiple of 16 width
-    if ((width % 16) == 0) {
-        int n = width;
-        asm volatile (
-        "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   blt 5f                                                      \n\t"
-        "0: @ 16 pixel swap                                             \n\t"
-        "   vld2.8  {q0, q1} , [%[src]]! @ q0 = uv q1 = y               \n\t"
-        "   vuzp.8 q0, q2                @ d0 = u d4 = v                \n\t"
-        "   vmov d1, d0                  @ q0 = u0u1u2..u0u1u2...       \n\t"
-        "   vmov d5, d4                  @ q2 = v0v1v2..v0v1v2...       \n\t"
-        "   vzip.8 d0, d1                @ q0 = u0u0u1u1u2u2...         \n\t"
-        "   vzip.8 d4, d5                @ q2 = v0v0v1v1v2v2...         \n\t"
-        "   vswp q0, q1                  @ now q0 = y q1 = u q2 = v     \n\t"
-        "   vst3.8  {d0,d2,d4},[%[dst]]!                                \n\t"
-        "   vst3.8  {d1,d3,d5},[%[dst]]!                                \n\t"
-        "   sub %[n], %[n], #16                                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   bge 0b                                                      \n\t"
-        "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-        "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-        : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
-        : [src_stride] "r" (width)
-        : "cc", "memory", "q0", "q1", "q2"
-        );
-    } else
-#endif
-    {
-        while ((width-=2) >= 0) {
-            uint8_t u0 = (src[0] >> 0) & 0xFF;
-            uint8_t y0 = (src[0] >> 8) & 0xFF;
-            uint8_t v0 = (src[0] >> 16) & 0xFF;
-            uint8_t y1 = (src[0] >> 24) & 0xFF;
-            dst[0] = y0;
-            dst[1] = u0;
-            dst[2] = v0;
-            dst[3] = y1;
-            dst[4] = u0;
-            dst[5] = v0;
-            dst += 6;
-            src++;
-        }
-    }
+    dest->next_output_byte = buf + dest->bufsize;
+    dest->free_in_buffer = size - dest->bufsize;
+    dest->buf = buf;
+    dest->bufsize = size;
+    return TRUE;
 }
 
-static void yuyv_to_yuv(uint8_t* dst, uint32_t* src, int width) {
-    if (!dst || !src) {
-        return;
-    }
+static void libjpeg_slice_term_destination(j_compress_ptr cinfo) {
+    libjpeg_slice_destination* dest = (libjpeg_slice_destination*)cinfo->dest;
+    dest->jpegsize = dest->bufsize - dest->free_in_buffer;
+}
 
-    if (width % 2) {
-        return; // not supporting odd widths
-    }
-
-#ifdef ARCH_ARM_HAVE_NEON
-    // currently, neon routine only supports multiple of 16 width
-    if ((width % 16) == 0) {
-        int n = width;
-        asm volatile (
-        "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   blt 5f                                                      \n\t"
-        "0: @ 16 pixel swap                                             \n\t"
-        "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-        "   vuzp.8 q1, q2                @ d2 = u d4 = v                \n\t"
-        "   vmov d3, d2                  @ q1 = u0u1u2..u0u1u2...       \n\t"
-        "   vmov d5, d4                  @ q2 = v0v1v2..v0v1v2...       \n\t"
-        "   vzip.8 d2, d3                @ q1 = u0u0u1u1u2u2...         \n\t"
-        "   vzip.8 d4, d5                @ q2 = v0v0v1v1v2v2...         \n\t"
-        "                                @ now q0 = y q1 = u q2 = v     \n\t"
-        "   vst3.8  {d0,d2,d4},[%[dst]]!                                \n\t"
-        "   vst3.8  {d1,d3,d5},[%[dst]]!                                \n\t"
-        "   sub %[n], %[n], #16                                         \n\t"
-        "   cmp %[n], #16                                               \n\t"
-        "   bge 0b                                                      \n\t"
-        "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-        "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-        : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
-        : [src_stride] "r" (width)
-        : "cc", "memory", "q0", "q1", "q2"
-        );
-    } else
-#endif
-    {
-        while ((width-=2) >= 0) {
-            uint8_t y0 = (src[0] >> 0) & 0xFF;
-            uint8_t u0 = (src[0] >> 8) & 0xFF;
-            uint8_t y1 = (src[0] >> 16) & 0xFF;
-            uint8_t v0 = (src[0] >> 24) & 0xFF;
-            dst[0] = y0;
-            dst[1] = u0;
-            dst[2] = v0;
-            dst[3] = y1;
-            dst[4] = u0;
-            dst[5] = v0;
-            dst += 6;
-            src++;
-        }
-    }
+libjpeg_slice_destination::libjpeg_slice_destination() {
+    this->init_destination = libjpeg_slice_init_destination;
+    this->empty_output_buffer = libjpeg_slice_empty_output_buffer;
+    this->term_destination = libjpeg_slice_term_destination;
+
+    buf = NULL;
+    bufsize = 0;
+    jpegsize = 0;
+    overflow = false;
+}
+
+libjpeg_slice_destination::~libjpeg_slice_destination() {
+    free(buf);
 }
 
-static void resize_nv12(Encoder_libjpeg::params* params, uint8_t* dst_buffer) {
+/* private static functions */
+static bool resize_nv12(Encoder_libjpeg::params* params, uint8_t* dst_buffer, NV12Scaler& scaler) {
     structConvImage o_img_ptr, i_img_ptr;
 
     if (!params || !dst_buffer) {
-        return;
+        return false;
     }
 
     //input
@@ -259,9 +193,661 @@ static void resize_nv12(Encoder_libjpeg::params* params, uint8_t* dst_buffer) {
     o_img_ptr.clrPtr = o_img_ptr.imgPtr + (o_img_ptr.uWidth * o_img_ptr.uHeight);
     o_img_ptr.uOffset = 0;
 
-    VT_resizeFrame_Video_opt2_lp(&i_img_ptr, &o_img_ptr, NULL, 0);
+    if (scaler.configure(i_img_ptr.uWidth, i_img_ptr.uHeight,
+                         o_img_ptr.uWidth, o_img_ptr.uHeight) != NO_ERROR) {
+        return false;
+    }
+
+    return scaler.scale(&i_img_ptr, &o_img_ptr) == NO_ERROR;
+}
+
+/**
+ * Source of libjpeg's raw data interface: hands out one iMCU row (16 luma
+ * and 8 chroma lines of a 4:2:0 image) per fill() call. Planar luma rows
+ * are passed straight from the frame when they cover whole DCT blocks,
+ * everything else is converted into a few scratch rows, padded to whole
+ * blocks by repeating the edge sample. Lines below the image repeat the
+ * last one, like libjpeg does for scanline input.
+ */
+class RawPlanes {
+public:
+    enum SourceFormat {
+        SOURCE_NONE,
+        SOURCE_NV21,
+        SOURCE_YUYV,
+        SOURCE_UYVY
+    };
+
+    enum {
+        LINES_PER_BATCH = 2 * DCTSIZE
+    };
+
+    RawPlanes();
+    ~RawPlanes();
+
+    static SourceFormat sourceFormat(const char* format);
+
+    // stride is in pixels; chroma is only used for NV21
+    status_t init(SourceFormat format, const uint8_t* luma, const uint8_t* chroma,
+                  int stride, int width, int height);
+
+    JSAMPIMAGE fill(int firstLine);
+
+private:
+    RawPlanes(const RawPlanes&);
+    RawPlanes& operator=(const RawPlanes&);
+
+    SourceFormat mFormat;
+    const uint8_t* mLuma;
+    const uint8_t* mChroma;
+    int mStride;
+    int mWidth;
+    int mHeight;
+    int mLumaWidth;
+    int mChromaWidth;
+    int mChromaPairs;
+    bool mLumaDirect;
+
+    uint8_t* mScratch;
+    size_t mScratchSize;
+    uint8_t* mInterleaved[2];
+    JSAMPROW mLumaRows[LINES_PER_BATCH];
+    JSAMPROW mCbRows[LINES_PER_BATCH / 2];
+    JSAMPROW mCrRows[LINES_PER_BATCH / 2];
+    JSAMPARRAY mPlanes[3];
+};
+
+static inline int alignTo(int value, int alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline void padRow(uint8_t* row, int width, int padded) {
+    if (padded > width) {
+        memset(row + width, row[width - 1], padded - width);
+    }
+}
+
+// Converts one packed 4:2:2 row of 'width' pixels to a luma row and an NV12
+// chroma row of (width + 1) / 2 pairs. The last macropixel of an odd width
+// row would run past the row, so its pixel takes the chroma on its left.
+static void packedRowToNV12(void (*toNV12)(const uint8_t*, uint8_t*, uint8_t*, size_t),
+                            bool yuyv, const uint8_t* src, uint8_t* dstY, uint8_t* dstUV,
+                            int width) {
+    const int even = width & ~1;
+
+    toNV12(src, dstY, dstUV, even);
+    if (width & 1) {
+        dstY[even] = src[2 * even + (yuyv ? 0 : 1)];
+        dstUV[even] = dstUV[even - 2];
+        dstUV[even + 1] = dstUV[even - 1];
+    }
+}
+
+RawPlanes::RawPlanes()
+    : mFormat(SOURCE_NONE), mLuma(NULL), mChroma(NULL), mStride(0),
+      mWidth(0), mHeight(0), mLumaWidth(0), mChromaWidth(0),
+      mChromaPairs(0), mLumaDirect(false), mScratch(NULL), mScratchSize(0) {
+    mPlanes[0] = mLumaRows;
+    mPlanes[1] = mCbRows;
+    mPlanes[2] = mCrRows;
+}
+
+RawPlanes::~RawPlanes() {
+    free(mScratch);
+}
+
+RawPlanes::SourceFormat RawPlanes::sourceFormat(const char* format) {
+    if (!format) {
+        return SOURCE_NONE;
+    } else if (strcmp(format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
+        return SOURCE_NV21;
+    } else if (strcmp(format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0) {
+        return SOURCE_YUYV;
+    } else if (strcmp(format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY) == 0) {
+        return SOURCE_UYVY;
+    }
+
+    return SOURCE_NONE;
+}
+
+status_t RawPlanes::init(SourceFormat format, const uint8_t* luma, const uint8_t* chroma,
+                         int stride, int width, int height) {
+    if ((format == SOURCE_NONE) || !luma || (width < 2) || (height < 2) || (stride < width)) {
+        return BAD_VALUE;
+    }
+
+    mFormat = format;
+    mLuma = luma;
+    mChroma = chroma;
+    mWidth = width;
+    mHeight = height;
+
+    // libjpeg reads whole DCT blocks of every component, so rows are
+    // padded to 16 luma / 8 chroma samples
+    mChromaPairs = (width + 1) / 2;
+    mLumaWidth = alignTo(width, 2 * DCTSIZE);
+    mChromaWidth = mLumaWidth / 2;
+
+    size_t scratchSize = LINES_PER_BATCH / 2 * mChromaWidth * 2;
+
+    if (format == SOURCE_NV21) {
+        mStride = stride;
+        mLumaDirect = ((width % DCTSIZE) == 0);
+        if (!mLumaDirect) {
+            scratchSize += LINES_PER_BATCH * mLumaWidth;
+        }
+    } else {
+        mStride = stride * 2;
+        mLumaDirect = false;
+        // luma rows plus two interleaved chroma rows for the vertical average
+        scratchSize += LINES_PER_BATCH * mLumaWidth + 2 * mLumaWidth;
+    }
+
+    // the scratch rows are kept for the next picture of the same or a smaller width
+    if (scratchSize > mScratchSize) {
+        uint8_t* scratch = (uint8_t*) malloc(scratchSize);
+        if (!scratch) {
+            return NO_MEMORY;
+        }
+        free(mScratch);
+        mScratch = scratch;
+        mScratchSize = scratchSize;
+    }
+
+    uint8_t* next = mScratch;
+    for (int i = 0; i < LINES_PER_BATCH / 2; i++) {
+        mCbRows[i] = next;
+        mCrRows[i] = next + mChromaWidth;
+        next += 2 * mChromaWidth;
+    }
+
+    for (int i = 0; i < LINES_PER_BATCH; i++) {
+        if (!mLumaDirect) {
+            mLumaRows[i] = next;
+            next += mLumaWidth;
+        } else {
+            mLumaRows[i] = NULL;
+        }
+    }
+
+    mInterleaved[0] = next;
+    mInterleaved[1] = next + mLumaWidth;
+
+    return NO_ERROR;
+}
+
+JSAMPIMAGE RawPlanes::fill(int firstLine) {
+    const ColorConvert::Kernels &kernels = ColorConvert::kernels();
+    const int chromaHeight = (mHeight + 1) / 2;
+
+    if (mFormat == SOURCE_NV21) {
+        for (int i = 0; i < LINES_PER_BATCH; i++) {
+            // lines below the image repeat the last one
+            const uint8_t* row = mLuma + min(firstLine + i, mHeight - 1) * mStride;
+            if (mLumaDirect) {
+                mLumaRows[i] = const_cast<uint8_t*>(row);
+            } else {
+                memcpy(mLumaRows[i], row, mWidth);
+                padRow(mLumaRows[i], mWidth, mLumaWidth);
+            }
+        }
+
+        for (int i = 0; i < LINES_PER_BATCH / 2; i++) {
+            const uint8_t* row = mChroma + min(firstLine / 2 + i, chromaHeight - 1) * mStride;
+            // VUVU.. : V goes to Cr
+            kernels.splitUVRow(row, mCrRows[i], mCbRows[i], mChromaPairs);
+            padRow(mCbRows[i], mChromaPairs, mChromaWidth);
+            padRow(mCrRows[i], mChromaPairs, mChromaWidth);
+        }
+    } else {
+        const bool yuyv = (mFormat == SOURCE_YUYV);
+        void (*toNV12)(const uint8_t*, uint8_t*, uint8_t*, size_t) =
+            yuyv ? kernels.yuyvToNV12Row : kernels.uyvyToNV12Row;
+
+        for (int i = 0; i < LINES_PER_BATCH / 2; i++) {
+            const int line = firstLine + 2 * i;
+            const uint8_t* row0 = mLuma + min(line, mHeight - 1) * mStride;
+            const uint8_t* row1 = mLuma + min(line + 1, mHeight - 1) * mStride;
+
+            packedRowToNV12(toNV12, yuyv, row0, mLumaRows[2 * i], mInterleaved[0], mWidth);
+            packedRowToNV12(toNV12, yuyv, row1, mLumaRows[2 * i + 1], mInterleaved[1], mWidth);
+            padRow(mLumaRows[2 * i], mWidth, mLumaWidth);
+            padRow(mLumaRows[2 * i + 1], mWidth, mLumaWidth);
+
+            // 4:2:2 -> 4:2:0 by averaging the chroma of both lines
+            kernels.interpolateRow(mInterleaved[0], mInterleaved[1], mInterleaved[0],
+                                   2 * mChromaPairs, 128);
+            kernels.splitUVRow(mInterleaved[0], mCbRows[i], mCrRows[i], mChromaPairs);
+            padRow(mCbRows[i], mChromaPairs, mChromaWidth);
+            padRow(mCrRows[i], mChromaPairs, mChromaWidth);
+        }
+    }
+
+    return mPlanes;
+}
+
+static void setup_compressor(jpeg_compress_struct* cinfo, int width, int height,
+                             int quality, unsigned int restart_interval, bool jfif) {
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_YCbCr;
+    cinfo->input_gamma = 1;
+
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, quality, TRUE);
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->restart_interval = restart_interval;
+    // EXIF wants its APP1 right behind SOI, without a JFIF APP0
+    cinfo->write_JFIF_header = jfif ? TRUE : FALSE;
+
+    // feed 4:2:0 planes directly, no color conversion or downsampling
+    cinfo->raw_data_in = TRUE;
+    cinfo->comp_info[0].h_samp_factor = 2;
+    cinfo->comp_info[0].v_samp_factor = 2;
+    cinfo->comp_info[1].h_samp_factor = 1;
+    cinfo->comp_info[1].v_samp_factor = 1;
+    cinfo->comp_info[2].h_samp_factor = 1;
+    cinfo->comp_info[2].v_samp_factor = 1;
+}
+
+// Compresses image lines [first_line, first_line + image_height). Returns
+// false if the encode got canceled.
+static bool compress_lines(jpeg_compress_struct* cinfo, RawPlanes& planes,
+                           int first_line, const volatile bool& cancel) {
+    jpeg_start_compress(cinfo, TRUE);
+
+    while ((cinfo->next_scanline < cinfo->image_height) && !cancel) {
+        jpeg_write_raw_data(cinfo, planes.fill(first_line + cinfo->next_scanline),
+                            RawPlanes::LINES_PER_BATCH);
+    }
+
+    // no need to finish encoding routine if we are prematurely stopping
+    // we will end up crashing in dest_mgr since data is incomplete;
+    // aborting keeps the compressor and its tables usable for the next picture
+    if (cancel) {
+        jpeg_abort_compress(cinfo);
+        return false;
+    }
+
+    jpeg_finish_compress(cinfo);
+    return true;
+}
+
+/**
+ * Returns the offset of the entropy coded data in a JPEG written by
+ * libjpeg and patches the frame height if 'height' is not 0. Returns 0 if
+ * no scan header is found.
+ */
+static size_t find_scan_data(uint8_t* jpeg, size_t size, int height) {
+    size_t pos = 2; // SOI
+
+    while (pos + 4 <= size) {
+        if (jpeg[pos] != 0xFF) {
+            return 0;
+        }
+
+        const uint8_t marker = jpeg[pos + 1];
+        const size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+        // SOFn: FF Cn Lh Ll P Yh Yl Xh Xl ...
+        if ((marker == 0xC0) && height && (pos + 7 <= size)) {
+            jpeg[pos + 5] = (uint8_t) (height >> 8);
+            jpeg[pos + 6] = (uint8_t) (height & 0xff);
+        }
+
+        pos += 2 + length;
+
+        if (marker == 0xDA) {
+            return (pos <= size) ? pos : 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * A compressor and the memory it works in, kept across pictures by
+ * EncoderContextPool. The compression object is created once; libjpeg keeps
+ * the quantization and Huffman tables in its permanent pool, so later
+ * pictures only rescale them.
+ */
+class EncoderContext {
+public:
+    EncoderContext() : mResizeBuffer(NULL), mResizeBufferSize(0) {
+        cinfo.err = jpeg_std_error(&mErr);
+        jpeg_create_compress(&cinfo);
+    }
+
+    ~EncoderContext() {
+        jpeg_destroy_compress(&cinfo);
+        free(mResizeBuffer);
+    }
+
+    // Returns at least 'size' bytes for the resized source, NULL on failure.
+    uint8_t* resizeBuffer(size_t size) {
+        if (size > mResizeBufferSize) {
+            uint8_t* buffer = (uint8_t*) malloc(size);
+            if (!buffer) {
+                return NULL;
+            }
+            free(mResizeBuffer);
+            mResizeBuffer = buffer;
+            mResizeBufferSize = size;
+        }
+        return mResizeBuffer;
+    }
+
+    // Makes sure the slice destination starts out with 'size' bytes.
+    bool reserveSlice(size_t size) {
+        if (size > sliceDest.bufsize) {
+            uint8_t* buffer = (uint8_t*) malloc(size);
+            if (!buffer) {
+                return false;
+            }
+            free(sliceDest.buf);
+            sliceDest.buf = buffer;
+            sliceDest.bufsize = size;
+        }
+        return true;
+    }
+
+    jpeg_compress_struct cinfo;
+    RawPlanes planes;
+    NV12Scaler scaler;
+    libjpeg_slice_destination sliceDest;
+
+private:
+    EncoderContext(const EncoderContext&);
+    EncoderContext& operator=(const EncoderContext&);
+
+    jpeg_error_mgr mErr;
+    uint8_t* mResizeBuffer;
+    size_t mResizeBufferSize;
+};
+
+// idle contexts and buffers beyond these are freed instead of kept
+static const size_t MAX_IDLE_ENCODER_CONTEXTS = 8;
+static const size_t MAX_IDLE_ENCODER_BUFFERS = 8;
+
+/**
+ * Precedes every buffer handed out by the pool; its size keeps the buffer
+ * itself aligned for any type.
+ */
+struct EncoderContextPool::BufferHeader {
+    union {
+        struct {
+            EncoderContextPool* pool;
+            size_t capacity;
+        } info;
+        uint64_t align[2];
+    };
+};
+
+EncoderContextPool::EncoderContextPool() {
+}
+
+EncoderContextPool::~EncoderContextPool() {
+    for (size_t i = 0; i < mIdle.size(); i++) {
+        delete mIdle[i];
+    }
+
+    for (size_t i = 0; i < mIdleBuffers.size(); i++) {
+        free(mIdleBuffers[i]);
+    }
+}
+
+EncoderContext* EncoderContextPool::acquire() {
+    {
+        android::AutoMutex lock(mLock);
+        if (!mIdle.isEmpty()) {
+            EncoderContext* context = mIdle.top();
+            mIdle.pop();
+            return context;
+        }
+    }
+
+    return new EncoderContext();
+}
+
+void* EncoderContextPool::acquireBuffer(size_t size) {
+    BufferHeader* header = NULL;
+
+    {
+        android::AutoMutex lock(mLock);
+        ssize_t best = -1;
+
+        // smallest idle buffer that fits
+        for (size_t i = 0; i < mIdleBuffers.size(); i++) {
+            const size_t capacity = mIdleBuffers[i]->info.capacity;
+            if ((capacity >= size) &&
+                ((best < 0) || (capacity < mIdleBuffers[best]->info.capacity))) {
+                best = i;
+            }
+        }
+
+        if (best >= 0) {
+            header = mIdleBuffers[best];
+            mIdleBuffers.removeAt(best);
+        }
+    }
+
+    if (!header) {
+        header = (BufferHeader*) malloc(sizeof(BufferHeader) + size);
+        if (!header) {
+            return NULL;
+        }
+        header->info.pool = this;
+        header->info.capacity = size;
+    }
+
+    incStrong(header);
+    return header + 1;
+}
+
+void EncoderContextPool::releaseBuffer(void* buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    BufferHeader* header = (BufferHeader*) buffer - 1;
+    EncoderContextPool* pool = header->info.pool;
+
+    pool->recycle(header);
+    pool->decStrong(header);
+}
+
+void EncoderContextPool::recycle(BufferHeader* header) {
+    android::AutoMutex lock(mLock);
+
+    if (mIdleBuffers.size() < MAX_IDLE_ENCODER_BUFFERS) {
+        mIdleBuffers.push(header);
+    } else {
+        free(header);
+    }
+}
+
+void EncoderContextPool::release(EncoderContext* context) {
+    if (!context) {
+        return;
+    }
+
+    {
+        android::AutoMutex lock(mLock);
+        if (mIdle.size() < MAX_IDLE_ENCODER_CONTEXTS) {
+            mIdle.push(context);
+            return;
+        }
+    }
+
+    delete context;
 }
 
+/**
+ * Compresses horizontal slices of one picture concurrently. Every slice is
+ * exactly one restart interval, so it starts with reset DC predictors and
+ * the slices' entropy coded data can be joined with RSTn markers into one
+ * baseline JPEG. Slice 0 is compressed straight into the destination and
+ * provides the headers, including DRI.
+ */
+class SliceEncoder : public WorkerPool::Job {
+public:
+    SliceEncoder(RawPlanes::SourceFormat format, const uint8_t* luma, const uint8_t* chroma,
+                 int stride, int width, int height, int quality,
+                 uint8_t* dst, int dst_size, bool jfif, EncoderContextPool& contexts,
+                 const volatile bool& cancel)
+        : mFormat(format), mLuma(luma), mChroma(chroma), mStride(stride),
+          mWidth(width), mHeight(height), mQuality(quality), mJfif(jfif),
+          mDest(dst, dst_size), mContextPool(contexts), mCancel(cancel),
+          mSlices(0), mSliceLines(0), mRestartInterval(0),
+          mSliceDone(NULL) { }
+
+    ~SliceEncoder() {
+        for (size_t i = 0; i < mContexts.size(); i++) {
+            mContextPool.release(mContexts[i]);
+        }
+        delete [] mSliceDone;
+    }
+
+    /**
+     * Splits the picture for up to 'concurrency' threads. Returns the
+     * number of slices, 1 if the picture is too small to be worth it.
+     */
+    int prepare(int concurrency) {
+        const int mcus_per_row = (mWidth + 15) / 16;
+        const int mcu_rows = (mHeight + 15) / 16;
+
+        int slices = min(concurrency, mcu_rows / MIN_SLICE_MCU_ROWS);
+        if (slices < 2) {
+            return 1;
+        }
+
+        // DRI holds the interval in 16 bits
+        const int slice_mcu_rows = min((mcu_rows + slices - 1) / slices, 0xffff / mcus_per_row);
+        if (slice_mcu_rows < 1) {
+            return 1;
+        }
+
+        mSlices = (mcu_rows + slice_mcu_rows - 1) / slice_mcu_rows;
+        mSliceLines = slice_mcu_rows * 16;
+        mRestartInterval = slice_mcu_rows * mcus_per_row;
+
+        mSliceDone = new bool[mSlices];
+        if (!mSliceDone) {
+            return 1;
+        }
+
+        for (int i = 0; i < mSlices; i++) {
+            EncoderContext* context = mContextPool.acquire();
+            if (!context) {
+                return 1;
+            }
+            mContexts.push(context);
+
+            // slice 0 goes straight to the destination
+            if ((i > 0) && !context->reserveSlice((size_t) mDest.bufsize / mSlices + 4096)) {
+                return 1;
+            }
+        }
+
+        return mSlices;
+    }
+
+    virtual void run(int index) {
+        EncoderContext* context = mContexts[index];
+        jpeg_compress_struct* cinfo = &context->cinfo;
+        const int first_line = index * mSliceLines;
+        const int lines = min(mSliceLines, mHeight - first_line);
+
+        mSliceDone[index] = false;
+
+        if (context->planes.init(mFormat, mLuma, mChroma, mStride, mWidth, mHeight) != NO_ERROR) {
+            return;
+        }
+
+        if (index == 0) {
+            cinfo->dest = &mDest;
+        } else {
+            cinfo->dest = &context->sliceDest;
+        }
+
+        setup_compressor(cinfo, mWidth, lines, mQuality, mRestartInterval, mJfif);
+        mSliceDone[index] = compress_lines(cinfo, context->planes, first_line, mCancel);
+    }
+
+    // Joins the slices behind slice 0; returns the JPEG size or 0.
+    size_t stitch() {
+        uint8_t* jpeg = mDest.buf;
+        const size_t capacity = mDest.bufsize;
+
+        for (int i = 0; i < mSlices; i++) {
+            if (!mSliceDone[i] || mContexts[i]->sliceDest.overflow) {
+                return 0;
+            }
+        }
+
+        if (mDest.overflow || (mDest.jpegsize < 4) || !find_scan_data(jpeg, mDest.jpegsize, mHeight)) {
+            CAMHAL_LOGEA("Encoder: first slice doesn't fit the destination");
+            return 0;
+        }
+
+        // drop EOI of slice 0
+        size_t size = mDest.jpegsize - 2;
+
+        for (int i = 1; i < mSlices; i++) {
+            uint8_t* slice = mContexts[i]->sliceDest.buf;
+            const size_t slice_size = mContexts[i]->sliceDest.jpegsize;
+            const size_t start = find_scan_data(slice, slice_size, 0);
+
+            if (!start || (slice_size < start + 2)) {
+                CAMHAL_LOGEB("Encoder: malformed slice %d", i);
+                return 0;
+            }
+
+            const size_t length = slice_size - 2 - start;
+            if (size + 2 + length + 2 > capacity) {
+                CAMHAL_LOGEA("Encoder: slices don't fit the destination");
+                return 0;
+            }
+
+            jpeg[size++] = 0xFF;
+            jpeg[size++] = (uint8_t) (0xD0 + ((i - 1) & 7)); // RSTn
+            memcpy(jpeg + size, slice + start, length);
+            size += length;
+        }
+
+        jpeg[size++] = 0xFF;
+        jpeg[size++] = 0xD9; // EOI
+
+        return size;
+    }
+
+private:
+    // below this many MCU rows per slice the setup cost outweighs the gain
+    enum { MIN_SLICE_MCU_ROWS = 8 };
+
+    SliceEncoder(const SliceEncoder&);
+    SliceEncoder& operator=(const SliceEncoder&);
+
+    const RawPlanes::SourceFormat mFormat;
+    const uint8_t* mLuma;
+    const uint8_t* mChroma;
+    const int mStride;
+    const int mWidth;
+    const int mHeight;
+    const int mQuality;
+    const bool mJfif;
+    libjpeg_destination_mgr mDest;
+    EncoderContextPool& mContextPool;
+    const volatile bool& mCancel;
+
+    int mSlices;
+    int mSliceLines;
+    unsigned int mRestartInterval;
+    android::Vector<EncoderContext*> mContexts;
+    bool* mSliceDone;
+};
+
 /* public static functions */
 const char* ExifElementsTable::degreesToExifOrientation(unsigned int degrees) {
     for (unsigned int i = 0; i < ARRAY_SIZE(degress_to_exif_lut); i++) {
@@ -357,6 +943,414 @@ void ExifElementsTable::saveJpeg(unsigned char* jpeg, size_t jpeg_size) {
     }
 }
 
+/*
+ * In place APP1 writer. Produces the same IFD layout jhead builds from the
+ * table (IFD0, Exif IFD, GPS IFD and IFD1 with the JPEG thumbnail), little
+ * endian, straight into the picture buffer.
+ */
+
+enum {
+    EXIF_TYPE_BYTE = 1,
+    EXIF_TYPE_ASCII = 2,
+    EXIF_TYPE_SHORT = 3,
+    EXIF_TYPE_LONG = 4,
+    EXIF_TYPE_RATIONAL = 5,
+    EXIF_TYPE_UNDEFINED = 7,
+    EXIF_TYPE_SRATIONAL = 10
+};
+
+enum ExifIfd {
+    EXIF_IFD_0,
+    EXIF_IFD_EXIF,
+    EXIF_IFD_GPS,
+    EXIF_IFD_1,
+    EXIF_IFD_COUNT
+};
+
+struct exif_tag_info {
+    bool gps;
+    uint16_t tag;
+    uint16_t type;
+    ExifIfd ifd;
+};
+
+// every tag ExifElementsTable can be given, keyed by the id jhead returns
+static const exif_tag_info exif_tags[] = {
+    { false, 0x0100, EXIF_TYPE_LONG,      EXIF_IFD_0 },    // ImageWidth
+    { false, 0x0101, EXIF_TYPE_LONG,      EXIF_IFD_0 },    // ImageLength
+    { false, 0x010F, EXIF_TYPE_ASCII,     EXIF_IFD_0 },    // Make
+    { false, 0x0110, EXIF_TYPE_ASCII,     EXIF_IFD_0 },    // Model
+    { false, 0x0112, EXIF_TYPE_SHORT,     EXIF_IFD_0 },    // Orientation
+    { false, 0x0132, EXIF_TYPE_ASCII,     EXIF_IFD_0 },    // DateTime
+    { false, 0x829A, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // ExposureTime
+    { false, 0x829D, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // FNumber
+    { false, 0x8822, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // ExposureProgram
+    { false, 0x8827, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // ISOSpeedRatings
+    { false, 0x9102, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // CompressedBitsPerPixel
+    { false, 0x9201, EXIF_TYPE_SRATIONAL, EXIF_IFD_EXIF }, // ShutterSpeedValue
+    { false, 0x9202, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // ApertureValue
+    { false, 0x9207, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // MeteringMode
+    { false, 0x9208, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // LightSource
+    { false, 0x9209, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // Flash
+    { false, 0x920A, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // FocalLength
+    { false, 0xA001, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // ColorSpace
+    { false, 0xA002, EXIF_TYPE_LONG,      EXIF_IFD_EXIF }, // ExifImageWidth
+    { false, 0xA003, EXIF_TYPE_LONG,      EXIF_IFD_EXIF }, // ExifImageLength
+    { false, 0xA217, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // SensingMethod
+    { false, 0xA401, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // CustomRendered
+    { false, 0xA403, EXIF_TYPE_SHORT,     EXIF_IFD_EXIF }, // WhiteBalance
+    { false, 0xA404, EXIF_TYPE_RATIONAL,  EXIF_IFD_EXIF }, // DigitalZoomRatio
+    { true,  0x0000, EXIF_TYPE_BYTE,      EXIF_IFD_GPS },  // GPSVersionID
+    { true,  0x0001, EXIF_TYPE_ASCII,     EXIF_IFD_GPS },  // GPSLatitudeRef
+    { true,  0x0002, EXIF_TYPE_RATIONAL,  EXIF_IFD_GPS },  // GPSLatitude
+    { true,  0x0003, EXIF_TYPE_ASCII,     EXIF_IFD_GPS },  // GPSLongitudeRef
+    { true,  0x0004, EXIF_TYPE_RATIONAL,  EXIF_IFD_GPS },  // GPSLongitude
+    { true,  0x0005, EXIF_TYPE_BYTE,      EXIF_IFD_GPS },  // GPSAltitudeRef
+    { true,  0x0006, EXIF_TYPE_RATIONAL,  EXIF_IFD_GPS },  // GPSAltitude
+    { true,  0x0007, EXIF_TYPE_RATIONAL,  EXIF_IFD_GPS },  // GPSTimeStamp
+    { true,  0x0012, EXIF_TYPE_ASCII,     EXIF_IFD_GPS },  // GPSMapDatum
+    { true,  0x001B, EXIF_TYPE_UNDEFINED, EXIF_IFD_GPS },  // GPSProcessingMethod
+    { true,  0x001D, EXIF_TYPE_ASCII,     EXIF_IFD_GPS },  // GPSDateStamp
+};
+
+static const uint16_t EXIF_TAG_DATETIME = 0x0132;
+static const uint16_t EXIF_TAG_EXIF_IFD = 0x8769;
+static const uint16_t EXIF_TAG_GPS_IFD = 0x8825;
+static const uint16_t EXIF_TAG_EXIF_VERSION = 0x9000;
+static const uint16_t EXIF_TAG_DATETIME_ORIGINAL = 0x9003;
+static const uint16_t EXIF_TAG_DATETIME_DIGITIZED = 0x9004;
+static const uint16_t EXIF_TAG_COMPRESSION = 0x0103;
+static const uint16_t EXIF_TAG_THUMBNAIL_OFFSET = 0x0201;
+static const uint16_t EXIF_TAG_THUMBNAIL_LENGTH = 0x0202;
+
+// room for the numbers parsed from one tag, 16 rationals
+static const size_t EXIF_MAX_VALUE = 128;
+static const int EXIF_MAX_IFD_ENTRIES = MAX_EXIF_TAGS_SUPPORTED + 4;
+
+struct exif_entry {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t size;
+    // strings and byte blobs point at their source, which outlives the
+    // write; numbers are parsed into 'value'
+    const uint8_t* data;
+    uint8_t value[EXIF_MAX_VALUE];
+
+    const uint8_t* bytes() const { return data ? data : value; }
+};
+
+struct exif_ifd {
+    exif_entry entries[EXIF_MAX_IFD_ENTRIES];
+    int count;
+    uint32_t offset;
+
+    // IFD itself: entry count, entries, next IFD offset
+    uint32_t tableSize() const { return 2 + 12 * count + 4; }
+
+    uint32_t dataSize() const {
+        uint32_t size = 0;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].size > 4) {
+                size += (entries[i].size + 1) & ~1;
+            }
+        }
+        return size;
+    }
+
+    exif_entry* add(uint16_t tag, uint16_t type) {
+        if (count >= EXIF_MAX_IFD_ENTRIES) {
+            return NULL;
+        }
+
+        // IFD entries have to be sorted by tag
+        int i = count++;
+        while ((i > 0) && (entries[i - 1].tag > tag)) {
+            entries[i] = entries[i - 1];
+            i--;
+        }
+
+        exif_entry* entry = &entries[i];
+        entry->tag = tag;
+        entry->type = type;
+        entry->count = 0;
+        entry->size = 0;
+        entry->data = NULL;
+        return entry;
+    }
+};
+
+static inline void put_le16(uint8_t* dst, uint32_t value) {
+    dst[0] = (uint8_t) value;
+    dst[1] = (uint8_t) (value >> 8);
+}
+
+static inline void put_le32(uint8_t* dst, uint32_t value) {
+    put_le16(dst, value);
+    put_le16(dst + 2, value >> 16);
+}
+
+static void set_exif_long(exif_entry* entry, uint32_t value) {
+    if (entry) {
+        entry->count = 1;
+        entry->size = 4;
+        entry->data = NULL;
+        put_le32(entry->value, value);
+    }
+}
+
+// 'data' is referenced, not copied, so values of any length go out whole
+static void set_exif_bytes(exif_entry* entry, const void* data, size_t length) {
+    if (entry) {
+        entry->data = (const uint8_t*) data;
+        entry->count = length;
+        entry->size = length;
+    }
+}
+
+// Parses the string form ExifElementsTable stores: comma separated
+// numbers, "num/den" for rationals, plain text otherwise.
+static void set_exif_value(exif_entry* entry, const char* value, size_t length) {
+    if (!entry) {
+        return;
+    }
+
+    if (entry->type == EXIF_TYPE_ASCII) {
+        // keep the terminating NUL, it is part of the count
+        set_exif_bytes(entry, value, strlen(value) + 1);
+        return;
+    }
+
+    if (entry->type == EXIF_TYPE_UNDEFINED) {
+        set_exif_bytes(entry, value, length);
+        return;
+    }
+
+    const char* pos = value;
+    while (*pos) {
+        char* end = NULL;
+        const uint32_t number = (uint32_t) strtoul(pos, &end, 10);
+        uint32_t denominator = 1;
+
+        if (end == pos) {
+            break;
+        }
+        if (*end == '/') {
+            pos = end + 1;
+            denominator = (uint32_t) strtoul(pos, &end, 10);
+        }
+
+        const size_t size = (entry->type == EXIF_TYPE_BYTE) ? 1 :
+                            (entry->type == EXIF_TYPE_SHORT) ? 2 :
+                            (entry->type == EXIF_TYPE_LONG) ? 4 : 8;
+        if (entry->size + size > EXIF_MAX_VALUE) {
+            CAMHAL_LOGEB("EXIF tag 0x%04x has more than %u bytes of numbers, dropping the rest",
+                         entry->tag, (unsigned int) EXIF_MAX_VALUE);
+            return;
+        }
+
+        uint8_t* dst = entry->value + entry->size;
+        switch (entry->type) {
+            case EXIF_TYPE_BYTE:
+                *dst = (uint8_t) number;
+                entry->size += 1;
+                break;
+            case EXIF_TYPE_SHORT:
+                put_le16(dst, number);
+                entry->size += 2;
+                break;
+            case EXIF_TYPE_LONG:
+                put_le32(dst, number);
+                entry->size += 4;
+                break;
+            default: // rationals
+                put_le32(dst, number);
+                put_le32(dst + 4, denominator);
+                entry->size += 8;
+                break;
+        }
+        entry->count++;
+
+        pos = end;
+        while (*pos == ',' || *pos == ' ') {
+            pos++;
+        }
+    }
+}
+
+// Writes one IFD and its data area at ifd.offset; offsets are relative to
+// the TIFF header at 'tiff'.
+static void write_exif_ifd(uint8_t* tiff, const exif_ifd& ifd, uint32_t next) {
+    uint8_t* table = tiff + ifd.offset;
+    uint32_t data = ifd.offset + ifd.tableSize();
+
+    put_le16(table, ifd.count);
+    table += 2;
+
+    for (int i = 0; i < ifd.count; i++) {
+        const exif_entry& entry = ifd.entries[i];
+
+        put_le16(table, entry.tag);
+        put_le16(table + 2, entry.type);
+        put_le32(table + 4, entry.count);
+
+        if (entry.size > 4) {
+            put_le32(table + 8, data);
+            memcpy(tiff + data, entry.bytes(), entry.size);
+            if (entry.size & 1) {
+                tiff[data + entry.size] = 0;
+            }
+            data += (entry.size + 1) & ~1;
+        } else {
+            memset(table + 8, 0, 4);
+            memcpy(table + 8, entry.bytes(), entry.size);
+        }
+
+        table += 12;
+    }
+
+    put_le32(table, next);
+}
+
+size_t ExifElementsTable::writeApp1(uint8_t* dst, size_t size,
+                                    const uint8_t* thumb, size_t thumb_size) const {
+    static const uint8_t exif_header[] = { 'E', 'x', 'i', 'f', 0, 0 };
+    static const size_t tiff_start = 4 + sizeof(exif_header); // marker, length
+    exif_ifd* ifds = NULL;
+    const char* datetime = NULL;
+    size_t datetime_length = 0;
+    uint32_t end = 0;
+
+    ifds = (exif_ifd*) calloc(EXIF_IFD_COUNT, sizeof(exif_ifd));
+    if (!ifds) {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < position; i++) {
+        const exif_tag_info* info = NULL;
+
+        for (unsigned int j = 0; j < ARRAY_SIZE(exif_tags); j++) {
+            if ((exif_tags[j].tag == table[i].Tag) && (exif_tags[j].gps == (bool) table[i].GpsTag)) {
+                info = &exif_tags[j];
+                break;
+            }
+        }
+
+        if (!info || !table[i].Value || (table[i].DataLength < 1)) {
+            CAMHAL_LOGDB("Skipping EXIF tag 0x%04x", table[i].Tag);
+            continue;
+        }
+
+        set_exif_value(ifds[info->ifd].add(info->tag, info->type), table[i].Value,
+                       table[i].DataLength - 1);
+
+        if (!info->gps && (info->tag == EXIF_TAG_DATETIME)) {
+            datetime = table[i].Value;
+            datetime_length = table[i].DataLength;
+        }
+    }
+
+    set_exif_bytes(ifds[EXIF_IFD_EXIF].add(EXIF_TAG_EXIF_VERSION, EXIF_TYPE_UNDEFINED), "0220", 4);
+    if (datetime) {
+        set_exif_value(ifds[EXIF_IFD_EXIF].add(EXIF_TAG_DATETIME_ORIGINAL, EXIF_TYPE_ASCII),
+                       datetime, datetime_length);
+        set_exif_value(ifds[EXIF_IFD_EXIF].add(EXIF_TAG_DATETIME_DIGITIZED, EXIF_TYPE_ASCII),
+                       datetime, datetime_length);
+    }
+
+    // sizes are final once the pointer entries exist, their values follow
+    exif_entry* exif_pointer = ifds[EXIF_IFD_0].add(EXIF_TAG_EXIF_IFD, EXIF_TYPE_LONG);
+    set_exif_long(exif_pointer, 0);
+    exif_entry* gps_pointer = NULL;
+    if (ifds[EXIF_IFD_GPS].count) {
+        gps_pointer = ifds[EXIF_IFD_0].add(EXIF_TAG_GPS_IFD, EXIF_TYPE_LONG);
+        set_exif_long(gps_pointer, 0);
+    }
+
+    exif_entry* thumb_offset = NULL;
+    if (thumb && thumb_size) {
+        exif_entry* compression = ifds[EXIF_IFD_1].add(EXIF_TAG_COMPRESSION, EXIF_TYPE_SHORT);
+        set_exif_value(compression, "6", 1); // JPEG
+        thumb_offset = ifds[EXIF_IFD_1].add(EXIF_TAG_THUMBNAIL_OFFSET, EXIF_TYPE_LONG);
+        set_exif_long(thumb_offset, 0);
+        set_exif_long(ifds[EXIF_IFD_1].add(EXIF_TAG_THUMBNAIL_LENGTH, EXIF_TYPE_LONG), thumb_size);
+    }
+
+    // TIFF header, then every IFD followed by its data
+    end = 8;
+    for (int i = 0; i < EXIF_IFD_COUNT; i++) {
+        if (ifds[i].count || (i == EXIF_IFD_0) || (i == EXIF_IFD_EXIF)) {
+            ifds[i].offset = end;
+            end += ifds[i].tableSize() + ifds[i].dataSize();
+        }
+    }
+
+    // the pointer entries are looked up again, adding entries moved them
+    for (int i = 0; i < ifds[EXIF_IFD_0].count; i++) {
+        exif_entry* entry = &ifds[EXIF_IFD_0].entries[i];
+        if (entry->tag == EXIF_TAG_EXIF_IFD) {
+            set_exif_long(entry, ifds[EXIF_IFD_EXIF].offset);
+        } else if (entry->tag == EXIF_TAG_GPS_IFD) {
+            set_exif_long(entry, ifds[EXIF_IFD_GPS].offset);
+        }
+    }
+
+    if (thumb_offset) {
+        for (int i = 0; i < ifds[EXIF_IFD_1].count; i++) {
+            if (ifds[EXIF_IFD_1].entries[i].tag == EXIF_TAG_THUMBNAIL_OFFSET) {
+                set_exif_long(&ifds[EXIF_IFD_1].entries[i], end);
+            }
+        }
+        end += thumb_size;
+    }
+
+    const size_t app1_size = tiff_start + end;
+    if (app1_size - 2 > 0xFFFF) {
+        CAMHAL_LOGEB("APP1 of %u bytes exceeds the segment limit", (unsigned int) app1_size);
+        free(ifds);
+        return 0;
+    }
+
+    // size query only
+    if (!dst) {
+        free(ifds);
+        return app1_size;
+    }
+
+    if (app1_size > size) {
+        CAMHAL_LOGEB("APP1 of %u bytes doesn't fit (%u available)",
+                     (unsigned int) app1_size, (unsigned int) size);
+        free(ifds);
+        return 0;
+    }
+
+    uint8_t* tiff = dst + tiff_start;
+
+    dst[0] = 0xFF;
+    dst[1] = 0xE1;
+    dst[2] = (uint8_t) ((app1_size - 2) >> 8);
+    dst[3] = (uint8_t) ((app1_size - 2) & 0xff);
+    memcpy(dst + 4, exif_header, sizeof(exif_header));
+
+    tiff[0] = 'I';
+    tiff[1] = 'I';
+    put_le16(tiff + 2, 42);
+    put_le32(tiff + 4, 8);
+
+    write_exif_ifd(tiff, ifds[EXIF_IFD_0], thumb_offset ? ifds[EXIF_IFD_1].offset : 0);
+    write_exif_ifd(tiff, ifds[EXIF_IFD_EXIF], 0);
+    if (ifds[EXIF_IFD_GPS].count) {
+        write_exif_ifd(tiff, ifds[EXIF_IFD_GPS], 0);
+    }
+    if (thumb_offset) {
+        write_exif_ifd(tiff, ifds[EXIF_IFD_1], 0);
+        memcpy(tiff + end - thumb_size, thumb, thumb_size);
+    }
+
+    free(ifds);
+    return app1_size;
+}
+
 /* public functions */
 ExifElementsTable::~ExifElementsTable() {
     int num_elements = gps_tag_count + exif_tag_count;
@@ -425,17 +1419,59 @@ status_t ExifElementsTable::insertElement(const char* tag, const char* value) {
 }
 
 /* private member functions */
-size_t Encoder_libjpeg::encode(params* input) {
-    jpeg_compress_struct    cinfo;
-    jpeg_error_mgr jerr;
-    jpeg_destination_mgr jdest;
-    uint8_t* src = NULL, *resize_src = NULL;
-    uint8_t* row_tmp = NULL;
-    uint8_t* row_src = NULL;
-    uint8_t* row_uv = NULL; // used only for NV12
+size_t Encoder_libjpeg::encodeWithExif(params* input) {
+    const uint8_t* thumb = NULL;
+    size_t thumb_size = 0;
+    size_t app1_size = 0;
+
+    if (!input || !input->dst || (input->dst_size < 1)) {
+        return encode(input);
+    }
+
+    if (mThumbnailInput && mThumbnailInput->dst && (mThumbnailInput->jpeg_size > 0)) {
+        thumb = mThumbnailInput->dst;
+        thumb_size = mThumbnailInput->jpeg_size;
+    }
+
+    app1_size = mExif->writeApp1(NULL, 0, thumb, thumb_size);
+    if (app1_size && thumb && (app1_size + 2 >= (size_t) input->dst_size)) {
+        // drop the thumbnail before giving up on the EXIF data
+        thumb = NULL;
+        thumb_size = 0;
+        app1_size = mExif->writeApp1(NULL, 0, NULL, 0);
+    }
+
+    if (!app1_size || (app1_size + 2 >= (size_t) input->dst_size)) {
+        CAMHAL_LOGEA("Encoder: no room for EXIF, leaving it to the caller");
+        return encode(input);
+    }
+
+    /*
+     * libjpeg writes its stream starting 'app1_size' bytes into dst. Its SOI
+     * then sits where APP1 ends, so SOI and APP1 are written afterwards in
+     * front of it and the complete file is contiguous.
+     */
+    if (encode(input, app1_size) == 0) {
+        return 0;
+    }
+
+    input->dst[0] = 0xFF;
+    input->dst[1] = 0xD8; // SOI
+    if (mExif->writeApp1(input->dst + 2, app1_size, thumb, thumb_size) != app1_size) {
+        input->jpeg_size = 0;
+    }
+
+    return input->jpeg_size;
+}
+
+size_t Encoder_libjpeg::encode(params* input, size_t header_size) {
+    android::sp<EncoderContextPool> contexts = mContextPool;
+    EncoderContext* context = NULL;
+    jpeg_compress_struct* cinfo = NULL;
+    uint8_t* src = NULL;
+    RawPlanes::SourceFormat format = RawPlanes::SOURCE_NONE;
     int out_width = 0, in_width = 0;
     int out_height = 0, in_height = 0;
-    int bpp = 2; // for uyvy
     int right_crop = 0, start_offset = 0;
 
     if (!input) {
@@ -450,25 +1486,44 @@ size_t Encoder_libjpeg::encode(params* input) {
     start_offset = input->start_offset;
     src = input->src;
     input->jpeg_size = 0;
+    input->header_size = header_size;
 
-    libjpeg_destination_mgr dest_mgr(input->dst, input->dst_size);
+    // an empty header space leaves dst and dst_size untouched
+    libjpeg_destination_mgr dest_mgr(input->dst + header_size, input->dst_size - (int) header_size);
 
     // param check...
     if ((in_width < 2) || (out_width < 2) || (in_height < 2) || (out_height < 2) ||
          (src == NULL) || (input->dst == NULL) || (input->quality < 1) || (input->src_size < 1) ||
-         (input->dst_size < 1) || (input->format == NULL)) {
+         (input->dst_size <= (int) header_size) || (input->format == NULL) ||
+         (right_crop < 0) || (right_crop > out_width - 2)) {
+        goto exit;
+    }
+
+    // without a shared pool the contexts only live for this picture
+    if (!contexts.get()) {
+        contexts = new EncoderContextPool();
+    }
+
+    context = contexts->acquire();
+    if (!context) {
+        CAMHAL_LOGEA("Encoder: couldn't allocate a compressor");
         goto exit;
     }
 
-    if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-        bpp = 1;
+    format = RawPlanes::sourceFormat(input->format);
+
+    if (format == RawPlanes::SOURCE_NV21) {
         if ((in_width != out_width) || (in_height != out_height)) {
-            resize_src = (uint8_t*) malloc(input->dst_size);
-            resize_nv12(input, resize_src);
-            if (resize_src) src = resize_src;
+            uint8_t* resize_src = context->resizeBuffer(out_width * out_height * 3 / 2);
+            if (!resize_src || !resize_nv12(input, resize_src, context->scaler)) {
+                // the source is in_width x in_height, compressing it at the
+                // output size would read past it
+                CAMHAL_LOGEA("Encoder: couldn't resize the source");
+                goto exit;
+            }
+            src = resize_src;
         }
-    } else if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV422I) &&
-               strcmp(input->format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY)) {
+    } else if (format == RawPlanes::SOURCE_NONE) {
         // we currently only support yuv422i and yuv420sp
         CAMHAL_LOGEB("Encoder: format not supported: %s", input->format);
         goto exit;
@@ -477,9 +1532,36 @@ size_t Encoder_libjpeg::encode(params* input) {
         goto exit;
     }
 
-    cinfo.err = jpeg_std_error(&jerr);
+    if (mWorkerPool.get() && (mWorkerPool->concurrency() > 1)) {
+        SliceEncoder slices(format, src + start_offset, src + out_width * out_height,
+                            out_width, out_width - right_crop, out_height, input->quality,
+                            dest_mgr.buf, dest_mgr.bufsize, header_size == 0, *contexts.get(),
+                            mCancelEncoding);
+        const int count = slices.prepare(mWorkerPool->concurrency());
+
+        if (count > 1) {
+            CAMHAL_LOGDB("encoding %dx%d in %d slices", out_width - right_crop, out_height, count);
+
+            mWorkerPool->execute(slices, count);
+            if (!mCancelEncoding) {
+                input->jpeg_size = slices.stitch();
+                if (input->jpeg_size) {
+                    input->jpeg_size += header_size;
+                }
+            }
+
+            contexts->release(context);
+            return input->jpeg_size;
+        }
+    }
+
+    if (context->planes.init(format, src + start_offset, src + out_width * out_height,
+                             out_width, out_width - right_crop, out_height) != NO_ERROR) {
+        CAMHAL_LOGEA("Encoder: couldn't allocate raw planes");
+        goto exit;
+    }
 
-    jpeg_create_compress(&cinfo);
+    cinfo = &context->cinfo;
 
     CAMHAL_LOGDB("encoding...  \n\t"
                  "width: %d    \n\t"
@@ -491,58 +1573,20 @@ size_t Encoder_libjpeg::encode(params* input) {
                  out_width, out_height, input->dst,
                  input->dst_size, src, input->format);
 
-    cinfo.dest = &dest_mgr;
-    cinfo.image_width = out_width - right_crop;
-    cinfo.image_height = out_height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_YCbCr;
-    cinfo.input_gamma = 1;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, input->quality, TRUE);
-    cinfo.dct_method = JDCT_IFAST;
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    row_tmp = (uint8_t*)malloc((out_width - right_crop) * 3);
-    row_src = src + start_offset;
-    row_uv = src + out_width * out_height * bpp;
+    cinfo->dest = &dest_mgr;
+    setup_compressor(cinfo, out_width - right_crop, out_height, input->quality, 0,
+                     header_size == 0);
+    compress_lines(cinfo, context->planes, 0, mCancelEncoding);
 
-    while ((cinfo.next_scanline < cinfo.image_height) && !mCancelEncoding) {
-        JSAMPROW row[1];    /* pointer to JSAMPLE row[s] */
-
-        // convert input yuv format to yuv444
-        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-            nv21_to_yuv(row_tmp, row_src, row_uv, out_width - right_crop);
-        } else if (strcmp(input->format, TICameraParameters::PIXEL_FORMAT_YUV422I_UYVY) == 0) {
-            uyvy_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
-        } else if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0) {
-            yuyv_to_yuv(row_tmp, (uint32_t*)row_src, out_width - right_crop);
-        }
-
-        row[0] = row_tmp;
-        jpeg_write_scanlines(&cinfo, row, 1);
-        row_src = row_src + out_width*bpp;
-
-        // move uv row if input format needs it
-        if (strcmp(input->format, android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
-            if (!(cinfo.next_scanline % 2))
-                row_uv = row_uv +  out_width * bpp;
-        }
+ exit:
+    if (context) {
+        contexts->release(context);
     }
 
-    // no need to finish encoding routine if we are prematurely stopping
-    // we will end up crashing in dest_mgr since data is incomplete
-    if (!mCancelEncoding)
-        jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-
-    if (resize_src) free(resize_src);
-    if (row_tmp) free(row_tmp);
-
- exit:
-    input->jpeg_size = dest_mgr.jpegsize;
-    return dest_mgr.jpegsize;
+    if (dest_mgr.jpegsize && !dest_mgr.overflow) {
+        input->jpeg_size = dest_mgr.jpegsize + header_size;
+    }
+    return input->jpeg_size;
 }
 
 } // namespace Camera
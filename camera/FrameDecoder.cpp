@@ -22,10 +22,13 @@ namespace Ti {
 namespace Camera {
 
 FrameDecoder::FrameDecoder()
-: mCameraHal(NULL), mState(DecoderState_Uninitialized) {
+: mCameraHal(NULL), mState(DecoderState_Uninitialized),
+  mFramesInFlight(0), mDecodeExiting(false) {
 }
 
 FrameDecoder::~FrameDecoder() {
+    android::AutoMutex lock(mLock);
+    stopDecodeThreads();
 }
 
 status_t FrameDecoder::start() {
@@ -38,6 +41,9 @@ status_t FrameDecoder::start() {
     }
     ret = doStart();
     if (ret == NO_ERROR) {
+        if ((mParams.decodeThreads > 1) && canDecodeConcurrently()) {
+            startDecodeThreads();
+        }
         mState = DecoderState_Running;
     }
 
@@ -53,6 +59,7 @@ void FrameDecoder::stop() {
         return;
     }
     mState = DecoderState_Requested_Stop;
+    stopDecodeThreads();
     doStop();
     mState = DecoderState_Stoppped;
 
@@ -82,6 +89,7 @@ void FrameDecoder::flush() {
     doFlush();
     mInQueue.clear();
     mOutQueue.clear();
+    mDeliveryOrder.clear();
 
 
     LOG_FUNCTION_NAME_EXIT;
@@ -139,6 +147,31 @@ status_t FrameDecoder::dequeueOutputBuffer(int &id) {
         return INVALID_OPERATION;
     }
 
+    if (isDecodingConcurrently()) {
+        // only the oldest frame may leave, later ones wait for it
+        if (mDeliveryOrder.isEmpty()) {
+            return INVALID_OPERATION;
+        }
+
+        int index = mDeliveryOrder[0];
+        android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(index);
+        android::AutoMutex bufferLock(out->getLock());
+        if (out->getStatus() != BufferStatus_OutFilled) {
+            return INVALID_OPERATION;
+        }
+
+        id = index;
+        out->setStatus(BufferStatus_Unknown);
+        mDeliveryOrder.removeAt(0);
+        for (size_t i = 0; i < mOutQueue.size(); i++) {
+            if (mOutQueue[i] == index) {
+                mOutQueue.removeAt(i);
+                break;
+            }
+        }
+        return NO_ERROR;
+    }
+
     for (size_t i = 0; i < mOutQueue.size(); i++) {
         int index = mOutQueue[i];
         android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(index);
@@ -166,10 +199,17 @@ status_t FrameDecoder::queueOutputBuffer(int index) {
         return INVALID_OPERATION;
     }
 
-    android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(index);
-    android::AutoMutex bufferLock(out->getLock());
-    out->setStatus(BufferStatus_OutQueued);
-    mOutQueue.push_back(index);
+    {
+        android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(index);
+        android::AutoMutex bufferLock(out->getLock());
+        out->setStatus(BufferStatus_OutQueued);
+        mOutQueue.push_back(index);
+    }
+
+    // a frame may have been waiting for an output buffer
+    if (isDecodingConcurrently()) {
+        scheduleDecodes();
+    }
 
     LOG_FUNCTION_NAME_EXIT;
     return NO_ERROR;
@@ -193,12 +233,169 @@ status_t FrameDecoder::queueInputBuffer(int id) {
     }
 
     // Since we got queued buffer - we can process it
-    doProcessInputBuffer();
+    if (isDecodingConcurrently()) {
+        scheduleDecodes();
+    } else {
+        doProcessInputBuffer();
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t FrameDecoder::startDecodeThreads() {
+    LOG_FUNCTION_NAME;
+
+    mDecodeExiting = false;
+    mFramesInFlight = 0;
+    mDecodeJobs.clear();
+    mDeliveryOrder.clear();
+
+    for (int i = 0; i < mParams.decodeThreads; i++) {
+        android::sp<DecodeThread> thread = new DecodeThread(this, i);
+        status_t ret = thread->run("CameraDecoder", android::PRIORITY_URGENT_DISPLAY);
+        if (ret != NO_ERROR) {
+            CAMHAL_LOGEB("Couldn't run decode thread %d", ret);
+            break;
+        }
+        mDecodeThreads.add(thread);
+    }
+
+    // a single thread would only add a hop, decode inline instead
+    if (mDecodeThreads.size() < 2) {
+        stopDecodeThreads();
+        return NO_INIT;
+    }
+
+    CAMHAL_LOGDB("Decoding up to %d frames at once", mDecodeThreads.size());
 
     LOG_FUNCTION_NAME_EXIT;
     return NO_ERROR;
 }
 
+void FrameDecoder::stopDecodeThreads() {
+    if (mDecodeThreads.isEmpty()) {
+        return;
+    }
+
+    mDecodeExiting = true;
+    while (mFramesInFlight > 0) {
+        mDecodeIdle.wait(mLock);
+    }
+    mDecodeAvailable.broadcast();
+
+    android::Vector< android::sp<DecodeThread> > threads = mDecodeThreads;
+    mDecodeThreads.clear();
+
+    mLock.unlock();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->requestExitAndWait();
+    }
+    mLock.lock();
+}
+
+void FrameDecoder::scheduleDecodes() {
+    while (!mDecodeExiting && (mFramesInFlight < (int)mDecodeThreads.size())) {
+        DecodeJob job;
+        job.inIndex = -1;
+        job.outIndex = -1;
+
+        for (size_t i = 0; (i < mInQueue.size()) && (job.inIndex < 0); i++) {
+            android::sp<MediaBuffer>& in = mInBuffers->editItemAt(mInQueue[i]);
+            android::AutoMutex bufferLock(in->getLock());
+            if (in->getStatus() == BufferStatus_InQueued) {
+                job.inIndex = mInQueue[i];
+            }
+        }
+
+        for (size_t i = 0; (i < mOutQueue.size()) && (job.outIndex < 0); i++) {
+            android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(mOutQueue[i]);
+            android::AutoMutex bufferLock(out->getLock());
+            if (out->getStatus() == BufferStatus_OutQueued) {
+                job.outIndex = mOutQueue[i];
+            }
+        }
+
+        if ((job.inIndex < 0) || (job.outIndex < 0)) {
+            return;
+        }
+
+        {
+            android::sp<MediaBuffer>& in = mInBuffers->editItemAt(job.inIndex);
+            android::AutoMutex bufferLock(in->getLock());
+            in->setStatus(BufferStatus_InWaitForEmpty);
+        }
+        {
+            android::sp<MediaBuffer>& out = mOutBuffers->editItemAt(job.outIndex);
+            android::AutoMutex bufferLock(out->getLock());
+            out->setStatus(BufferStatus_OutWaitForFill);
+        }
+
+        mDecodeJobs.push_back(job);
+        mDeliveryOrder.push_back(job.outIndex);
+        mFramesInFlight++;
+        mDecodeAvailable.signal();
+    }
+}
+
+bool FrameDecoder::decodeLoop(int slot) {
+    android::AutoMutex lock(mLock);
+
+    if (mDecodeJobs.isEmpty()) {
+        if (mDecodeExiting) {
+            return false;
+        }
+        mDecodeAvailable.wait(mLock);
+        return true;
+    }
+
+    const DecodeJob job = mDecodeJobs[0];
+    mDecodeJobs.removeAt(0);
+
+    android::sp<MediaBuffer> in = mInBuffers->itemAt(job.inIndex);
+    android::sp<MediaBuffer> out = mOutBuffers->itemAt(job.outIndex);
+
+    mLock.unlock();
+    const bool decoded = doDecodeFrame(*in.get(), *out.get(), slot);
+    mLock.lock();
+
+    nsecs_t timestamp = 0;
+    {
+        android::AutoMutex bufferLock(in->getLock());
+        timestamp = in->getTimestamp();
+        in->setStatus(BufferStatus_InDecoded);
+    }
+
+    if (!decoded) {
+        CAMHAL_LOGEB("Error while decoding frame from input %d", job.inIndex);
+        // drop the frame, the output is free again
+        for (size_t i = 0; i < mDeliveryOrder.size(); i++) {
+            if (mDeliveryOrder[i] == job.outIndex) {
+                mDeliveryOrder.removeAt(i);
+                break;
+            }
+        }
+    }
+
+    {
+        android::AutoMutex bufferLock(out->getLock());
+        if (decoded) {
+            out->setTimestamp(timestamp);
+            out->setStatus(BufferStatus_OutFilled);
+        } else {
+            out->setStatus(BufferStatus_OutQueued);
+        }
+    }
+
+    mFramesInFlight--;
+    scheduleDecodes();
+    if (mFramesInFlight == 0) {
+        mDecodeIdle.broadcast();
+    }
+
+    return true;
+}
+
 
 }   // namespace Camera
 }   // namespace Ti
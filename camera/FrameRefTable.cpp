@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameRefTable.cpp
+*
+* This file implements the lock-free frame reference counts.
+*
+*/
+
+#include <cutils/atomic.h>
+
+#include "FrameRefTable.h"
+
+namespace Ti {
+namespace Camera {
+
+FrameRefTable::FrameRefTable() {
+    memset(mSets, 0, sizeof(mSets));
+}
+
+int FrameRefTable::shiftFor(CameraFrame::FrameType frameType) {
+    switch ( frameType ) {
+        // image and raw frames are both capture buffer references
+        case CameraFrame::IMAGE_FRAME:
+        case CameraFrame::RAW_FRAME:
+            return 0;
+        case CameraFrame::SNAPSHOT_FRAME:
+            return COUNTER_BITS;
+        case CameraFrame::PREVIEW_FRAME_SYNC:
+            return 2 * COUNTER_BITS;
+        case CameraFrame::FRAME_DATA_SYNC:
+            return 3 * COUNTER_BITS;
+        case CameraFrame::VIDEO_FRAME_SYNC:
+            return 4 * COUNTER_BITS;
+        case CameraFrame::REPROCESS_INPUT_FRAME:
+            return 5 * COUNTER_BITS;
+        default:
+            return -1;
+    }
+}
+
+int FrameRefTable::sum(uint32_t refs) {
+    int res = 0;
+    while ( refs ) {
+        res += refs & COUNTER_MASK;
+        refs >>= COUNTER_BITS;
+    }
+    return res;
+}
+
+volatile int32_t * FrameRefTable::lookup(CameraBuffer *buffer) const {
+    if ( NULL == buffer ) {
+        return NULL;
+    }
+
+    for ( int i = 0; i < BUFFER_SET_COUNT; i++ ) {
+        Set &set = mSets[i];
+        // the count is published last by track(), so a non-zero count
+        // always comes with the buffers it belongs to
+        const int count = android_atomic_acquire_load(&set.count);
+        CameraBuffer *buffers = set.buffers;
+        if ( count <= 0 || buffer < buffers ) {
+            continue;
+        }
+
+        const size_t index = buffer - buffers;
+        if ( index < (size_t) count && index < MAX_BUFFERS_PER_SET ) {
+            return &set.refs[index];
+        }
+    }
+
+    return NULL;
+}
+
+status_t FrameRefTable::track(BufferSet set, CameraBuffer *buffers, int count,
+                              int queueable, CameraFrame::FrameType heldType) {
+    if ( set < 0 || set >= BUFFER_SET_COUNT || NULL == buffers || count <= 0 ) {
+        return BAD_VALUE;
+    }
+
+    if ( count > MAX_BUFFERS_PER_SET ) {
+        CAMHAL_LOGEB("Can't track %d buffers, at most %d are supported",
+                     count, MAX_BUFFERS_PER_SET);
+        return BAD_VALUE;
+    }
+
+    const int shift = shiftFor(heldType);
+    if ( shift < 0 && queueable < count ) {
+        CAMHAL_LOGEB("Frame type 0x%x is not reference counted", heldType);
+        return BAD_VALUE;
+    }
+
+    Set &s = mSets[set];
+    android_atomic_release_store(0, &s.count);
+    s.buffers = buffers;
+    for ( int i = 0; i < count; i++ ) {
+        s.refs[i] = (i < queueable) ? 0 : (1 << shift);
+    }
+    android_atomic_release_store(count, &s.count);
+
+    return NO_ERROR;
+}
+
+void FrameRefTable::untrack(BufferSet set) {
+    if ( set < 0 || set >= BUFFER_SET_COUNT ) {
+        return;
+    }
+
+    android_atomic_release_store(0, &mSets[set].count);
+}
+
+void FrameRefTable::reset(BufferSet set, CameraFrame::FrameType frameType) {
+    const int shift = shiftFor(frameType);
+    if ( set < 0 || set >= BUFFER_SET_COUNT || shift < 0 ) {
+        return;
+    }
+
+    Set &s = mSets[set];
+    const int count = android_atomic_acquire_load(&s.count);
+    for ( int i = 0; i < count; i++ ) {
+        android_atomic_and(~(COUNTER_MASK << shift), &s.refs[i]);
+    }
+}
+
+int FrameRefTable::size(BufferSet set) const {
+    if ( set < 0 || set >= BUFFER_SET_COUNT ) {
+        return 0;
+    }
+
+    return android_atomic_acquire_load(&mSets[set].count);
+}
+
+CameraBuffer * FrameRefTable::bufferAt(BufferSet set, int index) const {
+    if ( index < 0 || index >= size(set) ) {
+        return NULL;
+    }
+
+    return mSets[set].buffers + index;
+}
+
+int FrameRefTable::get(CameraBuffer *buffer, CameraFrame::FrameType frameType) const {
+    const int shift = shiftFor(frameType);
+    volatile const int32_t *word = lookup(buffer);
+
+    if ( shift < 0 || NULL == word ) {
+        return -1;
+    }
+
+    return (android_atomic_acquire_load(word) >> shift) & COUNTER_MASK;
+}
+
+int FrameRefTable::total(CameraBuffer *buffer) const {
+    volatile const int32_t *word = lookup(buffer);
+
+    if ( NULL == word ) {
+        return 0;
+    }
+
+    return sum(android_atomic_acquire_load(word));
+}
+
+bool FrameRefTable::isFree(CameraBuffer *buffer) const {
+    volatile const int32_t *word = lookup(buffer);
+
+    return ( NULL == word ) || ( 0 == android_atomic_acquire_load(word) );
+}
+
+status_t FrameRefTable::set(CameraBuffer *buffer, CameraFrame::FrameType frameType, int refCount) {
+    const int shift = shiftFor(frameType);
+    volatile int32_t *word = lookup(buffer);
+
+    if ( shift < 0 ) {
+        CAMHAL_LOGEB("Frame type 0x%x is not reference counted", frameType);
+        return BAD_VALUE;
+    }
+
+    if ( NULL == word ) {
+        CAMHAL_LOGEB("Buffer 0x%x is not tracked", (uint32_t) buffer);
+        return BAD_VALUE;
+    }
+
+    // the counter would wrap into its neighbour and the buffer would be
+    // handed back to the camera while subscribers still use it
+    if ( refCount > MAX_REF_COUNT ) {
+        CAMHAL_LOGEB("Ref count %d for frame type 0x%x overflows, at most %d are supported",
+                     refCount, frameType, MAX_REF_COUNT);
+        return BAD_VALUE;
+    }
+
+    const int32_t value = max(refCount, 0) << shift;
+    const int32_t mask = COUNTER_MASK << shift;
+    int32_t refs;
+    do {
+        refs = android_atomic_acquire_load(word);
+    } while ( android_atomic_release_cas(refs, (refs & ~mask) | value, word) );
+
+    return NO_ERROR;
+}
+
+int FrameRefTable::release(CameraBuffer *buffer, CameraFrame::FrameType frameType, bool allTypes) {
+    const int shift = shiftFor(frameType);
+    volatile int32_t *word = lookup(buffer);
+
+    if ( shift < 0 || NULL == word ) {
+        return -1;
+    }
+
+    int32_t refs;
+    int32_t left;
+    do {
+        refs = android_atomic_acquire_load(word);
+        if ( 0 == ((refs >> shift) & COUNTER_MASK) ) {
+            return -1;
+        }
+        left = refs - (1 << shift);
+    } while ( android_atomic_release_cas(refs, left, word) );
+
+    if ( allTypes ) {
+        return sum(left);
+    }
+
+    return (int) ((left >> shift) & COUNTER_MASK) + ((left & HOLD_BIT) ? 1 : 0);
+}
+
+bool FrameRefTable::hold(CameraBuffer *buffer) {
+    volatile int32_t *word = lookup(buffer);
+
+    if ( NULL == word ) {
+        return false;
+    }
+
+    return 0 == (android_atomic_or(HOLD_BIT, word) & HOLD_BIT);
+}
+
+int FrameRefTable::unhold(CameraBuffer *buffer) {
+    volatile int32_t *word = lookup(buffer);
+
+    if ( NULL == word ) {
+        return -1;
+    }
+
+    const int32_t refs = android_atomic_and(~HOLD_BIT, word);
+    if ( 0 == (refs & HOLD_BIT) ) {
+        return -1;
+    }
+
+    return sum(refs & ~HOLD_BIT);
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTracer.cpp
+*
+* This file implements the per-frame latency tracer.
+*
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "FrameTracer.h"
+
+namespace Ti {
+namespace Camera {
+
+// frames of the sensor and encoder stages still looked up by later stages
+static const int FRAME_SLOTS = 32;
+
+// upper bin edges in microseconds, the last bin takes everything above
+static const uint32_t BIN_EDGES[FrameTracer::HISTOGRAM_BINS - 1] = {
+    500, 1000, 2000, 4000, 6000, 8000, 10000, 12000, 16000, 20000,
+    25000, 33000, 40000, 50000, 66000, 100000, 133000, 200000, 500000
+};
+
+static const char * const STAGE_NAMES[FrameTracer::STAGE_COUNT] = {
+    "sensor",
+    "capture",
+    "dispatch",
+    "display",
+    "callback",
+    "encode-start",
+    "encode-end",
+};
+
+// the number of latest events printed by dump()
+static const size_t DUMP_EVENTS = 32;
+
+struct TraceEvent {
+    nsecs_t frame;
+    nsecs_t time;
+    int32_t stage;
+    int32_t latency;
+    int32_t tid;
+};
+
+struct TraceHistogram {
+    uint32_t bins[FrameTracer::HISTOGRAM_BINS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint64_t squares;
+};
+
+// written by its owner thread only
+struct TraceThread {
+    volatile int32_t owner;
+    volatile int32_t head;
+    uint32_t unmatched;
+    nsecs_t lastSensor;
+    TraceEvent events[FrameTracer::RING_SIZE];
+    TraceHistogram histograms[FrameTracer::STAGE_COUNT];
+};
+
+// odd 'seq' while a mark writes the slot
+struct TraceFrameTime {
+    volatile int32_t seq;
+    nsecs_t frame;
+    nsecs_t time;
+};
+
+static volatile int32_t gEnabled = 1;
+static volatile int32_t gDropped = 0;
+static TraceThread gThreads[FrameTracer::MAX_THREADS];
+static TraceFrameTime gSensorTimes[FRAME_SLOTS];
+static TraceFrameTime gEncodeTimes[FRAME_SLOTS];
+
+static pthread_once_t gKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+
+static void releaseThread(void *data) {
+    android_atomic_release_store(0, &static_cast<TraceThread *>(data)->owner);
+}
+
+static void createKey() {
+    pthread_key_create(&gKey, releaseThread);
+}
+
+static TraceThread * currentThread() {
+    pthread_once(&gKeyOnce, createKey);
+
+    TraceThread *thread = static_cast<TraceThread *>(pthread_getspecific(gKey));
+    if ( thread ) {
+        return thread;
+    }
+
+    // the slot keeps the statistics of the thread that had it before
+    const int32_t tid = gettid();
+    for ( int i = 0; i < FrameTracer::MAX_THREADS; i++ ) {
+        if ( 0 == android_atomic_acquire_cas(0, tid, &gThreads[i].owner) ) {
+            thread = &gThreads[i];
+            thread->lastSensor = 0;
+            pthread_setspecific(gKey, thread);
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+
+static int frameSlot(nsecs_t frame) {
+    // frame timestamps are evenly spaced, spread them before taking bits
+    return (int) (((uint64_t) frame * 0x9E3779B97F4A7C15ULL) >> 59) % FRAME_SLOTS;
+}
+
+static void publish(TraceFrameTime *table, nsecs_t frame, nsecs_t time) {
+    TraceFrameTime &slot = table[frameSlot(frame)];
+
+    // another mark writing the same slot wins, this frame goes unmatched
+    const int32_t seq = android_atomic_acquire_load(&slot.seq);
+    if ( ( seq & 1 ) || android_atomic_acquire_cas(seq, seq + 1, &slot.seq) ) {
+        return;
+    }
+
+    slot.frame = frame;
+    slot.time = time;
+    android_atomic_release_store(seq + 2, &slot.seq);
+}
+
+static nsecs_t lookup(const TraceFrameTime *table, nsecs_t frame) {
+    const TraceFrameTime &slot = table[frameSlot(frame)];
+
+    const int32_t seq = android_atomic_acquire_load(&slot.seq);
+    if ( seq & 1 ) {
+        return -1;
+    }
+
+    const nsecs_t slotFrame = slot.frame;
+    const nsecs_t time = slot.time;
+
+    // a newer frame took the slot while it was read
+    if ( ( android_atomic_release_load(&slot.seq) != seq ) || ( slotFrame != frame ) ) {
+        return -1;
+    }
+
+    return time;
+}
+
+static void addSample(TraceHistogram &histogram, uint32_t value) {
+    int bin = 0;
+    while ( bin < FrameTracer::HISTOGRAM_BINS - 1 && value > BIN_EDGES[bin] ) {
+        bin++;
+    }
+
+    histogram.bins[bin]++;
+    histogram.count++;
+    histogram.sum += value;
+    histogram.squares += (uint64_t) value * value;
+    histogram.max = max(histogram.max, value);
+}
+
+// upper edge of the bin holding the 'percent' percentile, in milliseconds
+static double percentile(const TraceHistogram &histogram, int percent) {
+    const uint64_t rank = ((uint64_t) histogram.count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for ( int bin = 0; bin < FrameTracer::HISTOGRAM_BINS - 1; bin++ ) {
+        seen += histogram.bins[bin];
+        if ( seen >= rank ) {
+            return min(BIN_EDGES[bin], histogram.max) / 1000.0;
+        }
+    }
+
+    return histogram.max / 1000.0;
+}
+
+static int compareEvents(const TraceEvent *lhs, const TraceEvent *rhs) {
+    if ( lhs->time == rhs->time ) {
+        return 0;
+    }
+    return ( lhs->time < rhs->time ) ? -1 : 1;
+}
+
+void FrameTracer::setEnabled(bool enable) {
+    android_atomic_release_store(enable ? 1 : 0, &gEnabled);
+}
+
+bool FrameTracer::isEnabled() {
+    return android_atomic_acquire_load(&gEnabled) != 0;
+}
+
+void FrameTracer::mark(Stage stage, nsecs_t frame) {
+    if ( !isEnabled() || frame <= 0 || stage < 0 || stage >= STAGE_COUNT ) {
+        return;
+    }
+
+    TraceThread *thread = currentThread();
+    if ( NULL == thread ) {
+        android_atomic_inc(&gDropped);
+        return;
+    }
+
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t latency = -1;
+    nsecs_t reference;
+
+    switch ( stage ) {
+        case STAGE_SENSOR:
+            publish(gSensorTimes, frame, now);
+            if ( thread->lastSensor > 0 && frame > thread->lastSensor ) {
+                latency = frame - thread->lastSensor;
+            }
+            thread->lastSensor = frame;
+            break;
+
+        case STAGE_CAPTURE:
+            // only the reference of the encode stages
+            publish(gSensorTimes, frame, now);
+            break;
+
+        case STAGE_ENCODE_START:
+            publish(gEncodeTimes, frame, now);
+            reference = lookup(gSensorTimes, frame);
+            latency = ( reference >= 0 ) ? now - reference : -1;
+            break;
+
+        case STAGE_ENCODE_END:
+            reference = lookup(gEncodeTimes, frame);
+            latency = ( reference >= 0 ) ? now - reference : -1;
+            break;
+
+        default:
+            reference = lookup(gSensorTimes, frame);
+            latency = ( reference >= 0 ) ? now - reference : -1;
+            break;
+    }
+
+    // microseconds, at most a little over half an hour
+    const int32_t latencyUs = ( latency >= 0 ) ? (int32_t) min(latency / 1000, (nsecs_t) 0x7FFFFFFF) : -1;
+    if ( latencyUs >= 0 ) {
+        addSample(thread->histograms[stage], latencyUs);
+    } else if ( STAGE_SENSOR != stage && STAGE_CAPTURE != stage ) {
+        thread->unmatched++;
+    }
+
+    const uint32_t head = thread->head;
+    TraceEvent &event = thread->events[head % RING_SIZE];
+    event.frame = frame;
+    event.time = now;
+    event.stage = stage;
+    event.latency = latencyUs;
+    event.tid = thread->owner;
+    android_atomic_release_store(head + 1, &thread->head);
+}
+
+void FrameTracer::reset() {
+    for ( int i = 0; i < MAX_THREADS; i++ ) {
+        TraceThread &thread = gThreads[i];
+        thread.unmatched = 0;
+        thread.lastSensor = 0;
+        memset(thread.histograms, 0, sizeof(thread.histograms));
+    }
+
+    memset(gSensorTimes, 0, sizeof(gSensorTimes));
+    memset(gEncodeTimes, 0, sizeof(gEncodeTimes));
+    android_atomic_release_store(0, &gDropped);
+}
+
+void FrameTracer::dump(int fd) {
+    TraceHistogram totals[STAGE_COUNT];
+    uint32_t unmatched = 0;
+    android::Vector<TraceEvent> events;
+
+    memset(totals, 0, sizeof(totals));
+
+    for ( int i = 0; i < MAX_THREADS; i++ ) {
+        const TraceThread &thread = gThreads[i];
+
+        for ( int stage = 0; stage < STAGE_COUNT; stage++ ) {
+            const TraceHistogram &histogram = thread.histograms[stage];
+            TraceHistogram &total = totals[stage];
+
+            for ( int bin = 0; bin < HISTOGRAM_BINS; bin++ ) {
+                total.bins[bin] += histogram.bins[bin];
+            }
+            total.count += histogram.count;
+            total.sum += histogram.sum;
+            total.squares += histogram.squares;
+            total.max = max(total.max, histogram.max);
+        }
+        unmatched += thread.unmatched;
+
+        // events older than a ring behind the head may have been overwritten
+        // while they were copied, the second head load drops those
+        const uint32_t head = android_atomic_acquire_load(&thread.head);
+        const uint32_t count = min(head, (uint32_t) RING_SIZE);
+        const size_t first = events.size();
+        for ( uint32_t n = head - count; n != head; n++ ) {
+            events.add(thread.events[n % RING_SIZE]);
+        }
+        const uint32_t overwritten = (uint32_t) android_atomic_release_load(&thread.head) - head;
+        events.removeItemsAt(first, min(overwritten, count));
+    }
+
+    android::String8 result;
+    result.appendFormat("Frame tracer: %s\n", isEnabled() ? "enabled" : "disabled");
+
+    const TraceHistogram &intervals = totals[STAGE_SENSOR];
+    if ( intervals.count > 0 ) {
+        const double mean = (double) intervals.sum / intervals.count;
+        const double variance = (double) intervals.squares / intervals.count - mean * mean;
+        result.appendFormat("  frame interval: %u frames, %.2f fps, mean %.2f ms, jitter %.2f ms, "
+                            "p50 %.1f ms, p99 %.1f ms, max %.2f ms\n",
+                            intervals.count, ( mean > 0 ) ? 1000000.0 / mean : 0.0, mean / 1000.0,
+                            sqrt(max(variance, 0.0)) / 1000.0, percentile(intervals, 50),
+                            percentile(intervals, 99), intervals.max / 1000.0);
+    }
+
+    result.append("  latency from sensor (encode-start from capture, encode-end from encode-start):\n");
+    for ( int stage = STAGE_DISPATCH; stage < STAGE_COUNT; stage++ ) {
+        const TraceHistogram &histogram = totals[stage];
+        if ( 0 == histogram.count ) {
+            result.appendFormat("    %-12s no samples\n", STAGE_NAMES[stage]);
+            continue;
+        }
+
+        result.appendFormat("    %-12s %6u samples, mean %.2f ms, p50 %.1f ms, p90 %.1f ms, "
+                            "p99 %.1f ms, max %.2f ms\n",
+                            STAGE_NAMES[stage], histogram.count,
+                            (double) histogram.sum / histogram.count / 1000.0,
+                            percentile(histogram, 50), percentile(histogram, 90),
+                            percentile(histogram, 99), histogram.max / 1000.0);
+    }
+
+    result.appendFormat("  unmatched marks: %u, marks without a thread slot: %u\n",
+                        unmatched, (uint32_t) android_atomic_acquire_load(&gDropped));
+
+    events.sort(compareEvents);
+    const size_t start = ( events.size() > DUMP_EVENTS ) ? events.size() - DUMP_EVENTS : 0;
+    result.append("  latest events:\n");
+    for ( size_t i = start; i < events.size(); i++ ) {
+        const TraceEvent &event = events[i];
+        const char *name = ( event.stage >= 0 && event.stage < STAGE_COUNT ) ?
+                STAGE_NAMES[event.stage] : "?";
+
+        result.appendFormat("    %lld.%06lld tid %5d %-12s frame %lld", (long long) (event.time / 1000000000LL),
+                            (long long) ((event.time / 1000) % 1000000LL), event.tid, name,
+                            (long long) event.frame);
+        if ( event.latency >= 0 ) {
+            result.appendFormat(" %+.2f ms", event.latency / 1000.0);
+        }
+        result.append("\n");
+    }
+
+    write(fd, result.string(), result.size());
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -15,275 +15,473 @@
  */
 
 #include "NV12_resize.h"
+#include "ColorConvert.h"
+#include "WorkerPool.h"
+
+#include <string.h>
 
 #ifdef LOG_TAG
 #undef LOG_TAG
 #endif
 #define LOG_TAG "NV12_resize"
 
-#define STRIDE 4096
+namespace Ti {
+namespace Camera {
 
-/*==========================================================================
-* Function Name  : VT_resizeFrame_Video_opt2_lp
-*
-* Description    : Resize a yuv frame.
-*
-* Input(s)       : input_img_ptr        -> Input Image Structure
-*                : output_img_ptr       -> Output Image Structure
-*                : cropout             -> crop structure
-*
-* Value Returned : mmBool               -> FALSE on error TRUE on success
-* NOTE:
-*            Not tested for crop funtionallity.
-*            faster version.
-============================================================================*/
-mmBool
-VT_resizeFrame_Video_opt2_lp(
-        structConvImage* i_img_ptr,      /* Points to the input image            */
-        structConvImage* o_img_ptr,      /* Points to the output image           */
-        IC_rect_type*  cropout,          /* how much to resize to in final image */
-        mmUint16 dummy                   /* Transparent pixel value              */
-        ) {
-    LOG_FUNCTION_NAME;
+// box filters accumulate into 16 bits: 257 * 255 still fits
+static const int kMaxBoxHeight = 257;
+
+static inline size_t alignScratch(size_t size) {
+    return (size + 15) & ~15;
+}
+
+static inline int divRoundUp(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+// below this many output rows per stripe the wakeups cost more than they save
+static const int kMinStripeRows = 32;
+
+NV12Scaler::NV12Scaler()
+    : mSrcWidth(0), mSrcHeight(0), mDstWidth(0), mDstHeight(0),
+      mMode(MODE_AUTO), mActiveMode(MODE_BILINEAR),
+      mReciprocals(NULL), mMaxArea(0),
+      mScratch(NULL), mScratchSize(0), mStripeScratchSize(0) {
+}
+
+NV12Scaler::~NV12Scaler() {
+    delete [] mReciprocals;
+    delete [] mScratch;
+}
+
+status_t NV12Scaler::allocate(Axis &axis, int count) {
+    if ( axis.count != count ) {
+        delete [] axis.index;
+        delete [] axis.weight;
+        axis.index = new int[count];
+        axis.weight = new uint16_t[count];
+        axis.count = count;
+    }
+
+    return (axis.index && axis.weight) ? NO_ERROR : NO_MEMORY;
+}
 
-    mmUint16 row,col;
-    mmUint32 resizeFactorX;
-    mmUint32 resizeFactorY;
-
-    mmUint16 x, y;
-
-    mmUchar* ptr8;
-    mmUchar *ptr8Cb, *ptr8Cr;
-
-    mmUint16 xf, yf;
-    mmUchar* inImgPtrY;
-    mmUchar* inImgPtrU;
-    mmUchar* inImgPtrV;
-    mmUint32 cox, coy, codx, cody;
-    mmUint16 idx,idy, idxC;
-
-    if ( i_img_ptr->uWidth == o_img_ptr->uWidth ) {
-        if ( i_img_ptr->uHeight == o_img_ptr->uHeight ) {
-            CAMHAL_LOGV("************************f(i_img_ptr->uHeight == o_img_ptr->uHeight) are same *********************\n");
-            CAMHAL_LOGV("************************(i_img_ptr->width == %d" , i_img_ptr->uWidth );
-            CAMHAL_LOGV("************************(i_img_ptr->uHeight == %d" , i_img_ptr->uHeight );
-            CAMHAL_LOGV("************************(o_img_ptr->width == %d" ,o_img_ptr->uWidth );
-            CAMHAL_LOGV("************************(o_img_ptr->uHeight == %d" , o_img_ptr->uHeight );
+void NV12Scaler::buildBilinear(Axis &axis, int src, int dst) {
+    for ( int i = 0; i < dst; i++ ) {
+        // sample at the pixel centres: srcPos = (dstPos + 0.5) * src / dst - 0.5,
+        // in 16.16 fixed point and rounded to the nearest 1/256 of a pixel
+        int64_t pos = (((int64_t) (2 * i + 1) * src) << 16) / (2 * dst) - 0x8000 + 0x80;
+        if ( pos < 0 ) {
+            pos = 0;
         }
+
+        int index = (int) (pos >> 16);
+        int fraction = (int) ((pos >> 8) & 0xff);
+
+        // keep index + 1 inside the source
+        if ( index >= src - 1 ) {
+            index = src - 2;
+            fraction = 256;
+        }
+
+        axis.index[i] = index;
+        axis.weight[i] = (uint16_t) fraction;
     }
+}
 
-    if ( !i_img_ptr || !i_img_ptr->imgPtr || !o_img_ptr || !o_img_ptr->imgPtr ) {
-        CAMHAL_LOGE("Image Point NULL");
-        return false;
+void NV12Scaler::buildArea(Axis &axis, int src, int dst) {
+    for ( int i = 0; i < dst; i++ ) {
+        const int first = (int) (((int64_t) i * src) / dst);
+        const int last = (int) (((int64_t) (i + 1) * src) / dst);
+
+        axis.index[i] = first;
+        axis.weight[i] = (uint16_t) ((last > first) ? (last - first) : 1);
     }
+}
 
-    inImgPtrY = (mmUchar *) i_img_ptr->imgPtr + i_img_ptr->uOffset;
-    inImgPtrU = (mmUchar *) i_img_ptr->clrPtr + i_img_ptr->uOffset/2;
-    inImgPtrV = (mmUchar*)inImgPtrU + 1;
+status_t NV12Scaler::configure(int srcWidth, int srcHeight, int dstWidth, int dstHeight, Mode mode) {
+    LOG_FUNCTION_NAME;
 
-    if ( !cropout ) {
-        cox = 0;
-        coy = 0;
-        codx = o_img_ptr->uWidth;
-        cody = o_img_ptr->uHeight;
-    } else {
-        cox = cropout->x;
-        coy = cropout->y;
-        codx = cropout->uWidth;
-        cody = cropout->uHeight;
+    if ( (srcWidth == mSrcWidth) && (srcHeight == mSrcHeight) &&
+         (dstWidth == mDstWidth) && (dstHeight == mDstHeight) &&
+         (mode == mMode) ) {
+        return NO_ERROR;
     }
-    idx = i_img_ptr->uWidth;
-    idy = i_img_ptr->uHeight;
 
-    /* make sure valid input size */
-    if ( idx < 1 || idy < 1 || i_img_ptr->uStride < 1 ) {
-        CAMHAL_LOGE("idx or idy less then 1 idx = %d idy = %d stride = %d", idx, idy, i_img_ptr->uStride);
-        return false;
+    // the chroma plane needs two samples in each direction to interpolate
+    if ( (srcWidth < 4) || (srcHeight < 4) || (dstWidth < 2) || (dstHeight < 2) ) {
+        CAMHAL_LOGEB("Unsupported geometry %dx%d -> %dx%d", srcWidth, srcHeight, dstWidth, dstHeight);
+        mSrcWidth = mSrcHeight = mDstWidth = mDstHeight = 0;
+        return BAD_VALUE;
     }
 
-    resizeFactorX = ((idx-1)<<9) / codx;
-    resizeFactorY = ((idy-1)<<9) / cody;
+    // the chroma plane rounds both sizes down, so its boxes can be larger
+    const int maxBoxWidth = max(divRoundUp(srcWidth, dstWidth),
+                                divRoundUp(srcWidth / 2, dstWidth / 2));
+    const int maxBoxHeight = max(divRoundUp(srcHeight, dstHeight),
+                                 divRoundUp(srcHeight / 2, dstHeight / 2));
+    const bool areaPossible = (srcWidth >= dstWidth) && (srcHeight >= dstHeight) &&
+                              (maxBoxHeight <= kMaxBoxHeight);
+
+    Mode active = MODE_BILINEAR;
+    if ( areaPossible ) {
+        if ( mode == MODE_AREA ) {
+            active = MODE_AREA;
+        } else if ( (mode == MODE_AUTO) && (srcWidth >= 2 * dstWidth) && (srcHeight >= 2 * dstHeight) ) {
+            active = MODE_AREA;
+        }
+    }
 
-    if( i_img_ptr->eFormat != IC_FORMAT_YCbCr420_lp ||
-            o_img_ptr->eFormat != IC_FORMAT_YCbCr420_lp ) {
-        CAMHAL_LOGE("eFormat not supported");
-        return false;
+    if ( (allocate(mLumaCols, dstWidth) != NO_ERROR) ||
+         (allocate(mLumaRows, dstHeight) != NO_ERROR) ||
+         (allocate(mChromaCols, dstWidth / 2) != NO_ERROR) ||
+         (allocate(mChromaRows, dstHeight / 2) != NO_ERROR) ) {
+        mSrcWidth = mSrcHeight = mDstWidth = mDstHeight = 0;
+        return NO_MEMORY;
     }
 
-    ptr8 = (mmUchar*)o_img_ptr->imgPtr + cox + coy*o_img_ptr->uWidth;
-
-    ////////////////////////////for Y//////////////////////////
-    for ( row = 0; row < cody; row++ ) {
-        mmUchar *pu8Yrow1 = NULL;
-        mmUchar *pu8Yrow2 = NULL;
-        y  = (mmUint16) ((mmUint32) (row*resizeFactorY) >> 9);
-        yf = (mmUchar)  ((mmUint32)((row*resizeFactorY) >> 6) & 0x7);
-        pu8Yrow1 = inImgPtrY + (y) * i_img_ptr->uStride;
-        pu8Yrow2 = pu8Yrow1 + i_img_ptr->uStride;
-
-        for ( col = 0; col < codx; col++ ) {
-            mmUchar in11, in12, in21, in22;
-            mmUchar *pu8ptr1 = NULL;
-            mmUchar *pu8ptr2 = NULL;
-            mmUchar w;
-            mmUint16 accum_1;
-            //mmUint32 accum_W;
-
-            x  = (mmUint16) ((mmUint32)  (col*resizeFactorX) >> 9);
-            xf = (mmUchar)  ((mmUint32) ((col*resizeFactorX) >> 6) & 0x7);
-
-            //accum_W = 0;
-            accum_1 =  0;
-
-            pu8ptr1 = pu8Yrow1 + (x);
-            pu8ptr2 = pu8Yrow2 + (x);
-
-            /* A pixel */
-            //in = *(inImgPtrY + (y)*idx + (x));
-            in11 = *(pu8ptr1);
-
-            w = bWeights[xf][yf][0];
-            accum_1 = (w * in11);
-            //accum_W += (w);
-
-            /* B pixel */
-            //in = *(inImgPtrY + (y)*idx + (x+1));
-            in12 = *(pu8ptr1+1);
-            w = bWeights[xf][yf][1];
-            accum_1 += (w * in12);
-            //accum_W += (w);
-
-            /* C pixel */
-            //in = *(inImgPtrY + (y+1)*idx + (x));
-            in21 = *(pu8ptr2);
-            w = bWeights[xf][yf][3];
-            accum_1 += (w * in21);
-            //accum_W += (w);
-
-            /* D pixel */
-            //in = *(inImgPtrY + (y+1)*idx + (x+1));
-            in22 = *(pu8ptr2+1);
-            w = bWeights[xf][yf][2];
-            accum_1 += (w * in22);
-            //accum_W += (w);
-
-            /* divide by sum of the weights */
-            //accum_1 /= (accum_W);
-            //accum_1 = (accum_1/64);
-            accum_1 = (accum_1>>6);
-            *ptr8 = (mmUchar)accum_1 ;
-
-            ptr8++;
+    delete [] mReciprocals;
+    mReciprocals = NULL;
+    mMaxArea = 0;
+
+    if ( active == MODE_AREA ) {
+        buildArea(mLumaCols, srcWidth, dstWidth);
+        buildArea(mLumaRows, srcHeight, dstHeight);
+        buildArea(mChromaCols, srcWidth / 2, dstWidth / 2);
+        buildArea(mChromaRows, srcHeight / 2, dstHeight / 2);
+
+        // (1 << 24) / area keeps sum * reciprocal within 32 bits
+        mMaxArea = maxBoxWidth * maxBoxHeight;
+        mReciprocals = new uint32_t[mMaxArea + 1];
+        if ( !mReciprocals ) {
+            mSrcWidth = mSrcHeight = mDstWidth = mDstHeight = 0;
+            return NO_MEMORY;
         }
-        ptr8 = ptr8 + (o_img_ptr->uStride - codx);
+        mReciprocals[0] = 0;
+        for ( int i = 1; i <= mMaxArea; i++ ) {
+            mReciprocals[i] = (1u << 24) / i;
+        }
+    } else {
+        buildBilinear(mLumaCols, srcWidth, dstWidth);
+        buildBilinear(mLumaRows, srcHeight, dstHeight);
+        buildBilinear(mChromaCols, srcWidth / 2, dstWidth / 2);
+        buildBilinear(mChromaRows, srcHeight / 2, dstHeight / 2);
     }
-    ////////////////////////////for Y//////////////////////////
 
-    ///////////////////////////////for Cb-Cr//////////////////////
+    // two filtered rows and one row of box sums
+    mStripeScratchSize = 2 * alignScratch(dstWidth) + alignScratch(srcWidth * sizeof(uint16_t));
+    if ( allocateScratch(1) != NO_ERROR ) {
+        mSrcWidth = mSrcHeight = mDstWidth = mDstHeight = 0;
+        return NO_MEMORY;
+    }
 
-    ptr8Cb = (mmUchar*)o_img_ptr->clrPtr + cox + coy*o_img_ptr->uWidth;
+    mSrcWidth = srcWidth;
+    mSrcHeight = srcHeight;
+    mDstWidth = dstWidth;
+    mDstHeight = dstHeight;
+    mMode = mode;
+    mActiveMode = active;
 
-    ptr8Cr = (mmUchar*)(ptr8Cb+1);
+    CAMHAL_LOGDB("NV12 scaler %dx%d -> %dx%d, %s", srcWidth, srcHeight, dstWidth, dstHeight,
+                 (active == MODE_AREA) ? "area" : "bilinear");
 
-    idxC = (idx>>1);
-    for ( row = 0; row < (((cody)>>1)); row++ ) {
-        mmUchar *pu8Cbr1 = NULL;
-        mmUchar *pu8Cbr2 = NULL;
-        mmUchar *pu8Crr1 = NULL;
-        mmUchar *pu8Crr2 = NULL;
+    LOG_FUNCTION_NAME_EXIT;
 
-        y  = (mmUint16) ((mmUint32) (row*resizeFactorY) >> 9);
-        yf = (mmUchar)  ((mmUint32)((row*resizeFactorY) >> 6) & 0x7);
+    return NO_ERROR;
+}
 
-        pu8Cbr1 = inImgPtrU + (y) * i_img_ptr->uStride;
-        pu8Cbr2 = pu8Cbr1 + i_img_ptr->uStride;
-        pu8Crr1 = inImgPtrV + (y) * i_img_ptr->uStride;
-        pu8Crr2 = pu8Crr1 + i_img_ptr->uStride;
+status_t NV12Scaler::allocateScratch(int stripes) {
+    const size_t scratchSize = stripes * mStripeScratchSize;
 
-        for ( col = 0; col < (((codx)>>1)); col++ ) {
-            mmUchar in11, in12, in21, in22;
-            mmUchar *pu8Cbc1 = NULL;
-            mmUchar *pu8Cbc2 = NULL;
-            mmUchar *pu8Crc1 = NULL;
-            mmUchar *pu8Crc2 = NULL;
+    if ( scratchSize > mScratchSize ) {
+        uint8_t *scratch = new uint8_t[scratchSize];
+        if ( !scratch ) {
+            return NO_MEMORY;
+        }
+        delete [] mScratch;
+        mScratch = scratch;
+        mScratchSize = scratchSize;
+    }
 
-            mmUchar w;
-            mmUint16 accum_1Cb, accum_1Cr;
-            //mmUint32 accum_WCb, accum_WCr;
+    return NO_ERROR;
+}
 
-            x  = (mmUint16) ((mmUint32)  (col*resizeFactorX) >> 9);
-            xf = (mmUchar)  ((mmUint32) ((col*resizeFactorX) >> 6) & 0x7);
+NV12Scaler::Scratch NV12Scaler::scratchFor(int stripe) const {
+    uint8_t *base = mScratch + stripe * mStripeScratchSize;
+    const size_t rowSize = alignScratch(mDstWidth);
 
-            //accum_WCb = accum_WCr =  0;
-            accum_1Cb = accum_1Cr =  0;
+    Scratch scratch;
+    scratch.rows[0] = base;
+    scratch.rows[1] = base + rowSize;
+    scratch.rowIndex[0] = scratch.rowIndex[1] = -1;
+    scratch.sums = reinterpret_cast<uint16_t*>(base + 2 * rowSize);
 
-            pu8Cbc1 = pu8Cbr1 + (x*2);
-            pu8Cbc2 = pu8Cbr2 + (x*2);
-            pu8Crc1 = pu8Crr1 + (x*2);
-            pu8Crc2 = pu8Crr2 + (x*2);
+    return scratch;
+}
 
-            /* A pixel */
-            w = bWeights[xf][yf][0];
+/**
+ * One horizontal stripe of the output: an even number of luma rows and the
+ * chroma rows that belong to them.
+ */
+class NV12Scaler::StripeJob : public WorkerPool::Job {
+public:
+    StripeJob(const NV12Scaler &scaler, int stripes,
+              const uint8_t *srcY, const uint8_t *srcUV, int srcStride,
+              uint8_t *dstY, uint8_t *dstUV, int dstStride)
+        : mScaler(scaler), mStripes(stripes),
+          mSrcY(srcY), mSrcUV(srcUV), mSrcStride(srcStride),
+          mDstY(dstY), mDstUV(dstUV), mDstStride(dstStride) { }
+
+    virtual void run(int index) {
+        const int height = mScaler.mDstHeight;
+        const int first = ((height * index / mStripes) & ~1);
+        const int last = (index == mStripes - 1) ? height : ((height * (index + 1) / mStripes) & ~1);
+        const int chromaLast = (index == mStripes - 1) ? height / 2 : last / 2;
+
+        Scratch scratch = mScaler.scratchFor(index);
+
+        mScaler.scalePlane(mSrcY, mSrcStride, mScaler.mSrcWidth, mDstY, mDstStride, mScaler.mDstWidth,
+                           mScaler.mLumaCols, mScaler.mLumaRows, 1, first, last, scratch);
+        mScaler.scalePlane(mSrcUV, mSrcStride, mScaler.mSrcWidth / 2, mDstUV, mDstStride, mScaler.mDstWidth / 2,
+                           mScaler.mChromaCols, mScaler.mChromaRows, 2, first / 2, chromaLast, scratch);
+    }
 
-            in11 = *(pu8Cbc1);
-            accum_1Cb = (w * in11);
-            //    accum_WCb += (w);
+private:
+    const NV12Scaler &mScaler;
+    const int mStripes;
+    const uint8_t *mSrcY;
+    const uint8_t *mSrcUV;
+    const int mSrcStride;
+    uint8_t *mDstY;
+    uint8_t *mDstUV;
+    const int mDstStride;
+};
+
+void NV12Scaler::filterRow(const uint8_t *src, uint8_t *dst, int dstWidth,
+                           const Axis &cols, int pixelSize) const {
+    if ( pixelSize == 1 ) {
+        for ( int x = 0; x < dstWidth; x++ ) {
+            const uint8_t *s = src + cols.index[x];
+            const int f = cols.weight[x];
+            dst[x] = (uint8_t) ((s[0] * (256 - f) + s[1] * f + 128) >> 8);
+        }
+    } else {
+        for ( int x = 0; x < dstWidth; x++ ) {
+            const uint8_t *s = src + 2 * cols.index[x];
+            const int f = cols.weight[x];
+            dst[0] = (uint8_t) ((s[0] * (256 - f) + s[2] * f + 128) >> 8);
+            dst[1] = (uint8_t) ((s[1] * (256 - f) + s[3] * f + 128) >> 8);
+            dst += 2;
+        }
+    }
+}
 
-            in11 = *(pu8Crc1);
-            accum_1Cr = (w * in11);
-            //accum_WCr += (w);
+void NV12Scaler::averageRow(const uint16_t *sums, uint8_t *dst, int dstWidth,
+                            const Axis &cols, int boxHeight, int pixelSize) const {
+    for ( int x = 0; x < dstWidth; x++ ) {
+        const int boxWidth = cols.weight[x];
+        const uint32_t reciprocal = mReciprocals[boxWidth * boxHeight];
+        const uint16_t *s = sums + cols.index[x] * pixelSize;
+
+        for ( int c = 0; c < pixelSize; c++ ) {
+            uint32_t sum = 0;
+            for ( int k = 0; k < boxWidth; k++ ) {
+                sum += s[k * pixelSize + c];
+            }
+            *dst++ = (uint8_t) ((sum * reciprocal + (1u << 23)) >> 24);
+        }
+    }
+}
 
-            /* B pixel */
-            w = bWeights[xf][yf][1];
+void NV12Scaler::scalePlane(const uint8_t *src, int srcStride, int srcWidth,
+                            uint8_t *dst, int dstStride, int dstWidth,
+                            const Axis &cols, const Axis &rows, int pixelSize,
+                            int firstRow, int lastRow, Scratch &scratch) const {
+    const ColorConvert::Kernels &kernels = ColorConvert::kernels();
+    const size_t srcBytes = srcWidth * pixelSize;
+    const size_t dstBytes = dstWidth * pixelSize;
+
+    dst += firstRow * dstStride;
+
+    if ( mActiveMode == MODE_AREA ) {
+        for ( int y = firstRow; y < lastRow; y++ ) {
+            const int boxHeight = rows.weight[y];
+            const uint8_t *s = src + rows.index[y] * srcStride;
+
+            memset(scratch.sums, 0, srcBytes * sizeof(uint16_t));
+            for ( int k = 0; k < boxHeight; k++ ) {
+                kernels.accumulateRow(s, scratch.sums, srcBytes);
+                s += srcStride;
+            }
+
+            averageRow(scratch.sums, dst, dstWidth, cols, boxHeight, pixelSize);
+            dst += dstStride;
+        }
+        return;
+    }
 
-            in12 = *(pu8Cbc1+2);
-            accum_1Cb += (w * in12);
-            //accum_WCb += (w);
+    scratch.rowIndex[0] = scratch.rowIndex[1] = -1;
 
-            in12 = *(pu8Crc1+2);
-            accum_1Cr += (w * in12);
-            //accum_WCr += (w);
+    for ( int y = firstRow; y < lastRow; y++ ) {
+        const int index = rows.index[y];
+        const int fraction = rows.weight[y];
 
-            /* C pixel */
-            w = bWeights[xf][yf][3];
+        // reuse horizontally filtered rows from the previous output row
+        if ( (scratch.rowIndex[1] == index) || (scratch.rowIndex[0] == index + 1) ) {
+            uint8_t *row = scratch.rows[0];
+            int rowIndex = scratch.rowIndex[0];
+            scratch.rows[0] = scratch.rows[1];
+            scratch.rowIndex[0] = scratch.rowIndex[1];
+            scratch.rows[1] = row;
+            scratch.rowIndex[1] = rowIndex;
+        }
 
-            in21 = *(pu8Cbc2);
-            accum_1Cb += (w * in21);
-            //accum_WCb += (w);
+        if ( (fraction != 256) && (scratch.rowIndex[0] != index) ) {
+            filterRow(src + index * srcStride, scratch.rows[0], dstWidth, cols, pixelSize);
+            scratch.rowIndex[0] = index;
+        }
 
-            in21 = *(pu8Crc2);
-            accum_1Cr += (w * in21);
-            //accum_WCr += (w);
+        if ( (fraction != 0) && (scratch.rowIndex[1] != index + 1) ) {
+            filterRow(src + (index + 1) * srcStride, scratch.rows[1], dstWidth, cols, pixelSize);
+            scratch.rowIndex[1] = index + 1;
+        }
 
-            /* D pixel */
-            w = bWeights[xf][yf][2];
+        kernels.interpolateRow(scratch.rows[0], scratch.rows[1], dst, dstBytes, fraction);
+        dst += dstStride;
+    }
+}
 
-            in22 = *(pu8Cbc2+2);
-            accum_1Cb += (w * in22);
-            //accum_WCb += (w);
+status_t NV12Scaler::scale(const structConvImage *in, structConvImage *out,
+                           const IC_rect_type *rect, WorkerPool *pool) {
+    LOG_FUNCTION_NAME;
+
+    if ( !in || !in->imgPtr || !in->clrPtr || !out || !out->imgPtr || !out->clrPtr ) {
+        CAMHAL_LOGEA("Image Point NULL");
+        return BAD_VALUE;
+    }
 
-            in22 = *(pu8Crc2+2);
-            accum_1Cr += (w * in22);
-            //accum_WCr += (w);
+    if ( (in->eFormat != IC_FORMAT_YCbCr420_lp) || (out->eFormat != IC_FORMAT_YCbCr420_lp) ) {
+        CAMHAL_LOGEA("eFormat not supported");
+        return BAD_VALUE;
+    }
 
-            /* divide by sum of the weights */
-            //accum_1Cb /= (accum_WCb);
-            accum_1Cb = (accum_1Cb>>6);
-            *ptr8Cb = (mmUchar)accum_1Cb ;
+    IC_rect_type full;
+    if ( !rect ) {
+        full.x = 0;
+        full.y = 0;
+        full.uWidth = out->uWidth;
+        full.uHeight = out->uHeight;
+        rect = &full;
+    }
 
-            accum_1Cr = (accum_1Cr >> 6);
-            *ptr8Cr = (mmUchar)accum_1Cr ;
+    if ( (in->uWidth != mSrcWidth) || (in->uHeight != mSrcHeight) ||
+         ((int) rect->uWidth != mDstWidth) || ((int) rect->uHeight != mDstHeight) ) {
+        CAMHAL_LOGEB("Scaler configured for %dx%d -> %dx%d, got %dx%d -> %ux%u",
+                     mSrcWidth, mSrcHeight, mDstWidth, mDstHeight,
+                     in->uWidth, in->uHeight, rect->uWidth, rect->uHeight);
+        return BAD_VALUE;
+    }
 
-            ptr8Cb++;
-            ptr8Cr++;
+    if ( (in->uStride < in->uWidth) || (out->uStride < out->uWidth) ) {
+        CAMHAL_LOGEB("Stride smaller than width: in %d/%d, out %d/%d",
+                     in->uStride, in->uWidth, out->uStride, out->uWidth);
+        return BAD_VALUE;
+    }
 
-            ptr8Cb++;
-            ptr8Cr++;
+    // NV12 chroma covers 2x2 luma blocks, an odd origin would shift chroma
+    // by one pixel against luma
+    if ( (rect->x & 1) || (rect->y & 1) ||
+         (rect->x + rect->uWidth > (mmUint32) out->uWidth) ||
+         (rect->y + rect->uHeight > (mmUint32) out->uHeight) ) {
+        CAMHAL_LOGEB("Invalid destination rectangle %u,%u %ux%u in %dx%d",
+                     rect->x, rect->y, rect->uWidth, rect->uHeight, out->uWidth, out->uHeight);
+        return BAD_VALUE;
+    }
+
+    const int srcStride = in->uStride;
+    const int dstStride = out->uStride;
+
+    // uOffset addresses the top left luma sample of the input crop; the
+    // chroma plane has half the rows but the same stride
+    const int xOff = in->uOffset % srcStride;
+    const int yOff = in->uOffset / srcStride;
+
+    if ( (in->uOffset < 0) || (xOff & 1) || (yOff & 1) || (xOff + in->uWidth > srcStride) ) {
+        CAMHAL_LOGEB("Invalid source crop offset %d (x %d, y %d) for %dx%d, stride %d",
+                     in->uOffset, xOff, yOff, in->uWidth, in->uHeight, srcStride);
+        return BAD_VALUE;
+    }
+
+    const uint8_t *srcY = in->imgPtr + in->uOffset;
+    const uint8_t *srcUV = in->clrPtr + (yOff / 2) * srcStride + xOff;
+
+    uint8_t *dstY = out->imgPtr + rect->y * dstStride + rect->x;
+    uint8_t *dstUV = out->clrPtr + (rect->y / 2) * dstStride + rect->x;
+
+    int stripes = 1;
+    if ( pool ) {
+        stripes = max(1, min(pool->concurrency(), mDstHeight / kMinStripeRows));
+        if ( allocateScratch(stripes) != NO_ERROR ) {
+            stripes = 1;
         }
-        ptr8Cb = ptr8Cb + (o_img_ptr->uStride-codx);
-        ptr8Cr = ptr8Cr + (o_img_ptr->uStride-codx);
     }
-    ///////////////////For Cb- Cr////////////////////////////////////////
+
+    StripeJob job(*this, stripes, srcY, srcUV, srcStride, dstY, dstUV, dstStride);
+
+    if ( stripes > 1 ) {
+        pool->execute(job, stripes);
+    } else {
+        job.run(0);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
+
+/*==========================================================================
+* Function Name  : VT_resizeFrame_Video_opt2_lp
+*
+* Description    : Resize a yuv frame.
+*
+* Input(s)       : input_img_ptr        -> Input Image Structure
+*                : output_img_ptr       -> Output Image Structure
+*                : cropout             -> crop structure
+*
+* Value Returned : mmBool               -> FALSE on error TRUE on success
+* NOTE:
+*            Wrapper around NV12Scaler that builds the tables on every
+*            call. Callers converting a stream of frames with the same
+*            geometry should keep an NV12Scaler instead.
+============================================================================*/
+mmBool
+VT_resizeFrame_Video_opt2_lp(
+        structConvImage* i_img_ptr,      /* Points to the input image            */
+        structConvImage* o_img_ptr,      /* Points to the output image           */
+        IC_rect_type*  cropout,          /* how much to resize to in final image */
+        mmUint16 dummy                   /* Transparent pixel value              */
+        ) {
+    LOG_FUNCTION_NAME;
+
+    if ( !i_img_ptr || !i_img_ptr->imgPtr || !o_img_ptr || !o_img_ptr->imgPtr ) {
+        CAMHAL_LOGE("Image Point NULL");
+        return false;
+    }
+
+    Ti::Camera::NV12Scaler scaler;
+    const int dstWidth = cropout ? (int) cropout->uWidth : o_img_ptr->uWidth;
+    const int dstHeight = cropout ? (int) cropout->uHeight : o_img_ptr->uHeight;
+
+    if ( scaler.configure(i_img_ptr->uWidth, i_img_ptr->uHeight, dstWidth, dstHeight) != Ti::NO_ERROR ) {
+        return false;
+    }
+
+    if ( scaler.scale(i_img_ptr, o_img_ptr, cropout) != Ti::NO_ERROR ) {
+        return false;
+    }
 
     CAMHAL_LOGV("success");
     return true;
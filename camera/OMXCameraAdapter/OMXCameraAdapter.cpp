@@ -23,6 +23,7 @@
 
 #include "CameraHal.h"
 #include "OMXCameraAdapter.h"
+#include "CapabilitiesCache.h"
 #ifndef USES_LEGACY_DOMX_DCC
 #include "OMXDCC.h"
 #endif
@@ -130,6 +131,28 @@ status_t OMXCameraAdapter::initialize(CameraProperties::Properties* caps)
 
     mComponentState = OMX_StateLoaded;
 
+#ifndef USES_LEGACY_DOMX_DCC
+    // once per process: with cached capabilities no probe has loaded it
+    {
+    DCCHandler dcc_handler;
+    dcc_handler.loadDCC(mCameraAdapterParameters.mHandleComp);
+    }
+#endif
+
+    // capabilities loaded from the cache describe the firmware they were
+    // probed on; the cache can't ask the firmware without bringing the
+    // component up, so a new firmware is caught here and the next media
+    // server start probes again
+    if ( NULL != caps ) {
+        android::String8 version;
+        if ( ( getFirmwareVersion(mCameraAdapterParameters.mHandleComp, version) == NO_ERROR ) &&
+             ( version != caps->get(CameraProperties::FIRMWARE_VERSION) ) ) {
+            CAMHAL_LOGI("Camera firmware %s, capabilities are from %s, dropping the cache",
+                        version.string(), caps->get(CameraProperties::FIRMWARE_VERSION));
+            CapabilitiesCache().invalidate();
+        }
+    }
+
     CAMHAL_LOGVB("OMX_GetHandle -0x%x sensor_index = %lu", eError, mSensorIndex);
     initDccFileDataSave(&mCameraAdapterParameters.mHandleComp, mCameraAdapterParameters.mPrevPortIndex);
 
@@ -1876,7 +1899,7 @@ status_t OMXCameraAdapter::switchToLoaded(bool bPortEnableRequired) {
 
             {
                 android::AutoMutex lock(mPreviewDataBufferLock);
-                mPreviewDataBuffersAvailable.clear();
+                mFrameRefs.untrack(FrameRefTable::PREVIEW_DATA_SET);
             }
 
         }
@@ -1919,7 +1942,7 @@ EXIT:
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        mFrameRefs.untrack(FrameRefTable::PREVIEW_SET);
     }
     performCleanupAfterError();
     LOG_FUNCTION_NAME_EXIT;
@@ -2468,7 +2491,7 @@ EXIT:
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        mFrameRefs.untrack(FrameRefTable::PREVIEW_SET);
     }
     performCleanupAfterError();
     LOG_FUNCTION_NAME_EXIT;
@@ -2502,7 +2525,7 @@ status_t OMXCameraAdapter::stopPreview() {
     {
         android::AutoMutex lock(mPreviewBufferLock);
         ///Clear all the available preview buffers
-        mPreviewBuffersAvailable.clear();
+        mFrameRefs.untrack(FrameRefTable::PREVIEW_SET);
     }
 
     switchToLoaded();
@@ -3376,7 +3399,8 @@ OMX_ERRORTYPE OMXCameraAdapterFillBufferDone(OMX_IN OMX_HANDLETYPE hComponent,
         msg.command = OMXCameraAdapter::OMXCallbackHandler::CAMERA_FILL_BUFFER_DONE;
         msg.arg1 = ( void * ) hComponent;
         msg.arg2 = ( void * ) pBuffHeader;
-        adapter->mOMXCallbackHandler->put(&msg);
+        // filled buffers go ahead of focus status updates
+        adapter->mOMXCallbackHandler->put(&msg, Utils::MessageQueue::PRIORITY_HIGH);
         }
 
     return eError;
@@ -3861,8 +3885,6 @@ status_t OMXCameraAdapter::sendCallBacks(CameraFrame frame, OMX_IN OMX_BUFFERHEA
       return -EINVAL;
     }
 
-  android::AutoMutex lock(mSubscriberLock);
-
   //frame.mFrameType = typeOfFrame;
   frame.mFrameMask = mask;
   frame.mBuffer = (CameraBuffer *)pBuffHeader->pAppPrivate;
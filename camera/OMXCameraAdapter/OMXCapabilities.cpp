@@ -2421,6 +2421,25 @@ bool OMXCameraAdapter::_dumpOmxTiCap(const int sensorId, const OMX_TI_CAPTYPE &
  * public exposed function declarations
  *****************************************/
 
+status_t OMXCameraAdapter::getFirmwareVersion(OMX_HANDLETYPE handle, android::String8 &version)
+{
+    OMX_CONFIG_ISPINFO ispInfo;
+
+    OMX_INIT_STRUCT_PTR (&ispInfo, OMX_CONFIG_ISPINFO);
+    ispInfo.nPortIndex = OMX_ALL;
+
+    const OMX_ERRORTYPE eError = OMX_GetConfig(handle, (OMX_INDEXTYPE) OMX_TI_IndexConfigISPInfo, &ispInfo);
+    if ( OMX_ErrorNone != eError ) {
+        CAMHAL_LOGEB("Error during ISP info query 0x%x", eError);
+        return Utils::ErrorUtils::omxToAndroidError(eError);
+    }
+
+    const char *ducatiVersion = reinterpret_cast<const char *>(ispInfo.cDucatiVersion);
+    version.setTo(ducatiVersion, strnlen(ducatiVersion, sizeof(ispInfo.cDucatiVersion)));
+
+    return NO_ERROR;
+}
+
 status_t OMXCameraAdapter::getCaps(const int sensorId, CameraProperties::Properties* params, OMX_HANDLETYPE handle)
 {
     status_t ret = NO_ERROR;
@@ -2497,6 +2516,14 @@ status_t OMXCameraAdapter::getCaps(const int sensorId, CameraProperties::Propert
         ret = insertCapabilities(params, *caps);
     }
 
+    // cached capabilities are checked against it when the camera opens
+    if ( NO_ERROR == ret ) {
+        android::String8 version;
+        if ( getFirmwareVersion(handle, version) == NO_ERROR ) {
+            params->set(CameraProperties::FIRMWARE_VERSION, version.string());
+        }
+    }
+
     CAMHAL_LOGDB("sen mount id=%u", (unsigned int)caps->tSenMounting.nSenId);
     CAMHAL_LOGDB("facing id=%u", (unsigned int)caps->tSenMounting.eFacing);
 
@@ -1894,16 +1894,13 @@ status_t OMXCameraAdapter::UseBuffersCapture(CameraBuffer * bufArr, int num)
             initVectorShot();
         }
 
-        mCaptureBuffersAvailable.clear();
-        for (unsigned int i = 0; i < imgCaptureData->mMaxQueueable; i++ ) {
-            mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 0);
-        }
-
         // initial ref count for undeqeueued buffers is 1 since buffer provider
         // is still holding on to it
-        for (unsigned int i = imgCaptureData->mMaxQueueable; i < imgCaptureData->mNumBufs; i++ ) {
-            mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 1);
-        }
+        ret = mFrameRefs.track(FrameRefTable::CAPTURE_SET,
+                               mCaptureBuffers,
+                               imgCaptureData->mNumBufs,
+                               imgCaptureData->mMaxQueueable,
+                               CameraFrame::IMAGE_FRAME);
     }
 
     if ( NO_ERROR == ret )
@@ -0,0 +1,938 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ReplayCameraAdapter.cpp
+*
+* This file plays a recording back through the Camera Hardware Interface.
+*
+*/
+
+#include "ReplayCameraAdapter.h"
+#include "CameraHal.h"
+#include "TICameraParameters.h"
+#include "DebugUtils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cutils/properties.h>
+#include "ColorConvert.h"
+
+namespace Ti {
+namespace Camera {
+
+//stride of the tiler preview buffers, used when a buffer doesn't report one
+#define PREVIEW_TILER_STRIDE 4096
+
+//how long an unpaced replay waits for a buffer before checking for stop
+#define BUFFER_WAIT_TIMEOUT 100000000
+
+#define DEFAULT_REPLAY_SIZE "640x480"
+#define DEFAULT_REPLAY_FPS "30"
+
+static const uint8_t JPEG_MARKER_START = 0xFF;
+static const uint8_t JPEG_MARKER_SOI = 0xD8;
+static const uint8_t JPEG_MARKER_EOI = 0xD9;
+static const uint8_t JPEG_MARKER_SOS = 0xDA;
+
+struct FormatName {
+    ReplaySource::Format format;
+    const char *name;
+};
+
+// names accepted by camera.replay.format, then used as file extensions
+static const FormatName FORMAT_NAMES[] = {
+    { ReplaySource::FORMAT_YUYV, "yuyv" },
+    { ReplaySource::FORMAT_YUYV, "yuv422i" },
+    { ReplaySource::FORMAT_YUYV, "yuy2" },
+    { ReplaySource::FORMAT_NV12, "nv12" },
+    { ReplaySource::FORMAT_NV12, "yuv420sp" },
+    { ReplaySource::FORMAT_MJPEG, "mjpeg" },
+    { ReplaySource::FORMAT_MJPEG, "mjpg" },
+    { ReplaySource::FORMAT_MJPEG, "jpg" },
+};
+
+static ReplaySource::Format formatFromName(const char *name) {
+    if ( NULL == name ) {
+        return ReplaySource::FORMAT_UNKNOWN;
+    }
+
+    for ( size_t i = 0; i < sizeof(FORMAT_NAMES) / sizeof(FORMAT_NAMES[0]); i++ ) {
+        if ( strcasecmp(name, FORMAT_NAMES[i].name) == 0 ) {
+            return FORMAT_NAMES[i].format;
+        }
+    }
+
+    return ReplaySource::FORMAT_UNKNOWN;
+}
+
+/**
+ * Length of the JPEG picture at the start of 'data', 0 if there is none.
+ *
+ * The marker segments are skipped by their length up to the start of scan,
+ * so thumbnails embedded in APPn segments don't end the picture early. In
+ * the entropy coded data a 0xFF byte is stuffed or starts a restart marker,
+ * the first EOI found there ends the picture.
+ */
+static size_t jpegLength(const uint8_t *data, size_t size) {
+    if ( size < 4 || data[0] != JPEG_MARKER_START || data[1] != JPEG_MARKER_SOI ) {
+        return 0;
+    }
+
+    size_t pos = 2;
+    while ( pos + 4 <= size ) {
+        if ( data[pos] != JPEG_MARKER_START ) {
+            return 0;
+        }
+
+        const uint8_t marker = data[pos + 1];
+        if ( marker == JPEG_MARKER_START ) {
+            // fill byte
+            pos++;
+            continue;
+        }
+
+        pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if ( marker == JPEG_MARKER_SOS ) {
+            break;
+        }
+    }
+
+    for ( ; pos + 1 < size; pos++ ) {
+        if ( data[pos] == JPEG_MARKER_START && data[pos + 1] == JPEG_MARKER_EOI ) {
+            return pos + 2;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * NV12 -> YUYV, the chroma of a row pair is used for both rows.
+ */
+static void nv12ToYUYV(const uint8_t *srcY, const uint8_t *srcUV, size_t srcStride,
+                       uint8_t *dst, int width, int height) {
+    for ( int row = 0; row < height; row++ ) {
+        const uint8_t *y = srcY + row * srcStride;
+        const uint8_t *uv = srcUV + (row / 2) * srcStride;
+
+        for ( int col = 0; col + 1 < width; col += 2 ) {
+            dst[0] = y[col];
+            dst[1] = uv[col];
+            dst[2] = y[col + 1];
+            dst[3] = uv[col + 1];
+            dst += 4;
+        }
+    }
+}
+
+/*--------------------ReplaySource-----------------------------*/
+
+ReplaySource::ReplaySource()
+    : mFormat(FORMAT_UNKNOWN), mWidth(0), mHeight(0), mFps(0), mData(NULL), mSize(0)
+{
+}
+
+ReplaySource::~ReplaySource()
+{
+    close();
+}
+
+status_t ReplaySource::readConfig()
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("camera.replay.file", value, "");
+    if ( value[0] == '\0' ) {
+        return NAME_NOT_FOUND;
+    }
+    mPath.setTo(value);
+
+    property_get("camera.replay.format", value, "");
+    if ( value[0] != '\0' ) {
+        mFormat = formatFromName(value);
+    } else {
+        const char *extension = strrchr(mPath.string(), '.');
+        mFormat = formatFromName(extension ? extension + 1 : NULL);
+    }
+
+    if ( FORMAT_UNKNOWN == mFormat ) {
+        CAMHAL_LOGEB("Unknown format of the recording %s", mPath.string());
+        return BAD_VALUE;
+    }
+
+    property_get("camera.replay.size", value, DEFAULT_REPLAY_SIZE);
+    if ( !CameraHal::parsePair(value, &mWidth, &mHeight, 'x') ||
+         mWidth <= 0 || mHeight <= 0 || (mWidth & 1) || (mHeight & 1) ) {
+        CAMHAL_LOGEB("Invalid size of the recording %s", value);
+        return BAD_VALUE;
+    }
+
+    property_get("camera.replay.fps", value, DEFAULT_REPLAY_FPS);
+    mFps = atoi(value);
+    if ( mFps < 0 ) {
+        CAMHAL_LOGEB("Invalid frame rate of the recording %s", value);
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+status_t ReplaySource::open()
+{
+    status_t ret = NO_ERROR;
+    struct stat st;
+
+    LOG_FUNCTION_NAME;
+
+    close();
+
+    ret = readConfig();
+    if ( NO_ERROR != ret ) {
+        return ret;
+    }
+
+    const int fd = ::open(mPath.string(), O_RDONLY);
+    if ( fd < 0 ) {
+        CAMHAL_LOGEB("Can't open the recording %s: %s", mPath.string(), strerror(errno));
+        return NAME_NOT_FOUND;
+    }
+
+    if ( fstat(fd, &st) != 0 || st.st_size <= 0 ) {
+        CAMHAL_LOGEB("Recording %s is empty", mPath.string());
+        ::close(fd);
+        return BAD_VALUE;
+    }
+
+    // frames are read straight from the page cache, file I/O stays out of the timings
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if ( MAP_FAILED == data ) {
+        CAMHAL_LOGEB("Can't map the recording %s: %s", mPath.string(), strerror(errno));
+        return NO_MEMORY;
+    }
+
+    mData = static_cast<uint8_t *>(data);
+    mSize = st.st_size;
+
+    switch ( mFormat ) {
+        case FORMAT_YUYV:
+            ret = indexRawFrames(mWidth * mHeight * 2);
+            break;
+        case FORMAT_NV12:
+            ret = indexRawFrames(mWidth * mHeight * 3 / 2);
+            break;
+        default:
+            ret = indexJpegFrames();
+            break;
+    }
+
+    if ( NO_ERROR != ret ) {
+        close();
+    } else {
+        CAMHAL_LOGDB("Replaying %d frames %dx%d at %d fps from %s",
+                     mFrames.size(), mWidth, mHeight, mFps, mPath.string());
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+void ReplaySource::close()
+{
+    if ( NULL != mData ) {
+        munmap(mData, mSize);
+        mData = NULL;
+        mSize = 0;
+    }
+
+    mFrames.clear();
+}
+
+status_t ReplaySource::indexRawFrames(size_t frameSize)
+{
+    Segment segment;
+
+    if ( mSize % frameSize ) {
+        CAMHAL_LOGW("Recording %s ends with a partial frame", mPath.string());
+    }
+
+    segment.length = frameSize;
+    for ( segment.offset = 0; segment.offset + frameSize <= mSize; segment.offset += frameSize ) {
+        mFrames.push_back(segment);
+    }
+
+    if ( mFrames.isEmpty() ) {
+        CAMHAL_LOGEB("Recording %s holds no %u byte frame", mPath.string(), frameSize);
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+status_t ReplaySource::indexJpegFrames()
+{
+    Segment segment;
+    size_t pos = 0;
+
+    while ( pos + 1 < mSize ) {
+        // skip anything between the pictures
+        if ( mData[pos] != JPEG_MARKER_START || mData[pos + 1] != JPEG_MARKER_SOI ) {
+            pos++;
+            continue;
+        }
+
+        segment.offset = pos;
+        segment.length = jpegLength(mData + pos, mSize - pos);
+        if ( 0 == segment.length ) {
+            CAMHAL_LOGW("Recording %s ends with a partial picture", mPath.string());
+            break;
+        }
+
+        mFrames.push_back(segment);
+        pos += segment.length;
+    }
+
+    if ( mFrames.isEmpty() ) {
+        CAMHAL_LOGEB("Recording %s holds no JPEG picture", mPath.string());
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+const uint8_t * ReplaySource::frame(int index, size_t &length) const
+{
+    if ( mFrames.isEmpty() || index < 0 ) {
+        length = 0;
+        return NULL;
+    }
+
+    const Segment &segment = mFrames[index % mFrames.size()];
+    length = segment.length;
+
+    return mData + segment.offset;
+}
+
+/*--------------------ReplayCameraAdapter-----------------------------*/
+
+ReplayCameraAdapter::ReplayCameraAdapter(size_t sensor_index)
+    : mPreviewing(false), mCapturing(false),
+      mPreviewBufs(NULL), mPreviewBufferCount(0),
+      mCaptureBufs(NULL), mCaptureBufferCount(0), mCaptureBufferCountQueueable(0),
+      mFrameIndex(0), mNextFrameTime(0), mFramePeriod(0),
+      mFramesSent(0), mFramesDropped(0),
+      mSensorIndex(sensor_index)
+{
+    LOG_FUNCTION_NAME;
+
+    mFramesWithEncoder = 0;
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+ReplayCameraAdapter::~ReplayCameraAdapter()
+{
+    LOG_FUNCTION_NAME;
+
+    mSource.close();
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+status_t ReplayCameraAdapter::initialize(CameraProperties::Properties* caps)
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    ret = mSource.open();
+    if ( NO_ERROR != ret ) {
+        CAMHAL_LOGEA("Error while adapter initialization: recording not available");
+        goto EXIT;
+    }
+
+    mFramePeriod = mSource.fps() ? s2ns(1) / mSource.fps() : 0;
+
+    // Initialize flags
+    mPreviewing = false;
+    mRecording = false;
+    mCapturing = false;
+
+EXIT:
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
+status_t ReplayCameraAdapter::setParameters(const android::CameraParameters &params)
+{
+    int width, height;
+
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    params.getPreviewSize(&width, &height);
+    if ( width != mSource.width() || height != mSource.height() ) {
+        // only the recorded size is advertised
+        CAMHAL_LOGW("Preview size %dx%d differs from the recorded %dx%d",
+                     width, height, mSource.width(), mSource.height());
+    }
+
+    // Udpate the current parameter set
+    mParams = params;
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+void ReplayCameraAdapter::getParameters(android::CameraParameters& params)
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+    // Return the current parameter set
+    params = mParams;
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+///API to give the buffers to Adapter
+status_t ReplayCameraAdapter::useBuffers(CameraMode mode, CameraBuffer *bufArr, int num, size_t length, unsigned int queueable)
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    switch(mode)
+        {
+        case CAMERA_PREVIEW:
+        case CAMERA_VIDEO:
+            // video frames are sent from the preview buffers
+            ret = UseBuffersPreview(bufArr, num, queueable);
+            break;
+
+        case CAMERA_IMAGE_CAPTURE:
+            ret = UseBuffersCapture(bufArr, num, queueable);
+            break;
+
+        default:
+            break;
+        }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return ret;
+}
+
+status_t ReplayCameraAdapter::UseBuffersPreview(CameraBuffer *bufArr, int num, unsigned int queueable)
+{
+    LOG_FUNCTION_NAME;
+
+    if ( NULL == bufArr || num <= 0 ) {
+        return BAD_VALUE;
+    }
+
+    // the base adapter tracks the preview set, the buffers past the
+    // queueable ones stay with the buffer provider until returned
+    mPreviewBufs = bufArr;
+    mPreviewBufferCount = num;
+
+    mFreeBuffers.clear();
+    for ( int i = 0; i < num && i < (int) queueable; i++ ) {
+        mFreeBuffers.push_back(i);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::UseBuffersCapture(CameraBuffer *bufArr, int num, unsigned int queueable)
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    if ( NULL == bufArr || num <= 0 ) {
+        return BAD_VALUE;
+    }
+
+    // initial ref count for undeqeueued buffers is 1 since buffer provider
+    // is still holding on to it
+    ret = mFrameRefs.track(FrameRefTable::CAPTURE_SET, bufArr, num,
+                           queueable, CameraFrame::IMAGE_FRAME);
+    if ( NO_ERROR == ret ) {
+        mCaptureBufs = bufArr;
+        mCaptureBufferCount = num;
+        mCaptureBufferCountQueueable = queueable;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
+status_t ReplayCameraAdapter::fillThisBuffer(CameraBuffer *frameBuf, CameraFrame::FrameType frameType)
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    if ( frameType == CameraFrame::IMAGE_FRAME ) {
+        // Signal end of image capture
+        if ( NULL != mEndImageCaptureCallback ) {
+            mLock.unlock();
+            mEndImageCaptureCallback(mEndCaptureData);
+            mLock.lock();
+        }
+        return NO_ERROR;
+    }
+
+    if ( NULL == mPreviewBufs || frameBuf < mPreviewBufs ||
+         frameBuf >= mPreviewBufs + mPreviewBufferCount ) {
+        CAMHAL_LOGEB("Buffer 0x%x is not a preview buffer", (uint32_t) frameBuf);
+        return BAD_VALUE;
+    }
+
+    const int index = frameBuf - mPreviewBufs;
+    if ( mFreeBuffers.indexOf(index) < 0 ) {
+        mFreeBuffers.push_back(index);
+        mFrameCondition.signal();
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::startPreview()
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    if ( mPreviewing ) {
+        return NO_ERROR;
+    }
+
+    if ( NULL == mPreviewBufs ) {
+        CAMHAL_LOGEA("Preview buffers not registered");
+        return NO_INIT;
+    }
+
+    // every preview plays the recording from its start
+    mFrameIndex = 0;
+    mFramesSent = 0;
+    mFramesDropped = 0;
+    mFramesWithEncoder = 0;
+    mNextFrameTime = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    //Update the flag to indicate we are previewing
+    mPreviewing = true;
+    mPreviewThread = new PreviewThread(this);
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::stopPreview()
+{
+    android::sp<PreviewThread> thread;
+
+    LOG_FUNCTION_NAME;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        if ( !mPreviewing ) {
+            return NO_INIT;
+        }
+
+        mPreviewing = false;
+        mFrameCondition.broadcast();
+        thread = mPreviewThread;
+        mPreviewThread.clear();
+
+        CAMHAL_LOGDB("Replayed %d frames, %d dropped for lack of buffers",
+                     mFramesSent, mFramesDropped);
+    }
+
+    // the thread takes mLock while it runs
+    thread->requestExitAndWait();
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::takePicture()
+{
+    status_t ret = NO_ERROR;
+    CameraBuffer *buffer = NULL;
+    const uint8_t *data = NULL;
+    size_t length = 0;
+    int width = 0, height = 0;
+    CameraFrame frame;
+
+    LOG_FUNCTION_NAME;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        if ( mCapturing ) {
+            CAMHAL_LOGEA("Already Capture in Progress...");
+            return BAD_VALUE;
+        }
+
+        if ( NULL == mCaptureBufs || mCaptureBufferCountQueueable <= 0 ) {
+            CAMHAL_LOGEA("Capture buffers not registered");
+            return NO_INIT;
+        }
+
+        mCapturing = true;
+
+        // the latest frame sent, as a sensor would hand out
+        data = mSource.frame(max(mFrameIndex - 1, 0), length);
+        buffer = mCaptureBufs;
+        width = mSource.width();
+        height = mSource.height();
+    }
+
+    ret = fillCaptureBuffer(data, length, buffer, width, height);
+    if ( NO_ERROR == ret ) {
+        frame.mFrameType = CameraFrame::IMAGE_FRAME;
+        frame.mBuffer = buffer;
+        frame.mLength = width * height * 2;
+        frame.mWidth = width;
+        frame.mHeight = height;
+        frame.mAlignment = width * 2;
+        frame.mOffset = 0;
+        frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        frame.mFrameMask = (unsigned int)CameraFrame::IMAGE_FRAME;
+        frame.mQuirks |= CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG;
+        frame.mQuirks |= CameraFrame::FORMAT_YUV422I_YUYV;
+
+        ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
+        if ( NO_ERROR == ret ) {
+            ret = sendFrameToSubscribers(&frame);
+        }
+    }
+
+    if ( NO_ERROR != ret ) {
+        CAMHAL_LOGEB("Capture from the recording failed %d", ret);
+        android::AutoMutex lock(mLock);
+        mCapturing = false;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
+status_t ReplayCameraAdapter::stopImageCapture()
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    //Release image buffers
+    if ( NULL != mReleaseImageBuffersCallback ) {
+        mReleaseImageBuffersCallback(mReleaseData);
+    }
+    mFrameRefs.untrack(FrameRefTable::CAPTURE_SET);
+    mCaptureBufs = NULL;
+    mCaptureBufferCount = 0;
+    mCaptureBufferCountQueueable = 0;
+
+    mCapturing = false;
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::autoFocus()
+{
+    LOG_FUNCTION_NAME;
+
+    //A recording is always in focus
+    notifyFocusSubscribers(CameraHalEvent::FOCUS_STATUS_SUCCESS);
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::getFrameSize(size_t &width, size_t &height)
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    width = mSource.width();
+    height = mSource.height();
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::getFrameDataSize(size_t &dataFrameSize, size_t bufferCount)
+{
+    // We don't support meta data, so simply return
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::getPictureBufferSize(CameraFrame &frame, size_t bufferCount)
+{
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    // captures are YUV422i of the recorded size
+    frame.mWidth = mSource.width();
+    frame.mHeight = mSource.height();
+    frame.mLength = frame.mWidth * frame.mHeight * 2;
+    frame.mAlignment = frame.mWidth * 2;
+
+    LOG_FUNCTION_NAME_EXIT;
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::fillPreviewBuffer(const uint8_t *data, size_t length, CameraBuffer *buffer,
+                                                int width, int height, int stride)
+{
+    uint8_t *dstY = static_cast<uint8_t *>(buffer->mapped);
+    uint8_t *dstUV = dstY + stride * height;
+
+    switch ( mSource.format() ) {
+        case ReplaySource::FORMAT_YUYV:
+            ColorConvert::yuyvToNV12(data, width * 2, dstY, dstUV, stride, width, height);
+            break;
+
+        case ReplaySource::FORMAT_NV12: {
+            const uint8_t *srcUV = data + width * height;
+            for ( int row = 0; row < height; row++ ) {
+                memcpy(dstY + row * stride, data + row * width, width);
+            }
+            for ( int row = 0; row < height / 2; row++ ) {
+                memcpy(dstUV + row * stride, srcUV + row * width, width);
+            }
+            break;
+        }
+
+        case ReplaySource::FORMAT_MJPEG:
+            // the decoder only reads the picture
+            if ( !mDecoder.decode(const_cast<uint8_t *>(data), length, dstY, stride,
+                                  width, height, 1) ) {
+                return UNKNOWN_ERROR;
+            }
+            break;
+
+        default:
+            return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+status_t ReplayCameraAdapter::fillCaptureBuffer(const uint8_t *data, size_t length, CameraBuffer *buffer,
+                                                int width, int height)
+{
+    uint8_t *dst = static_cast<uint8_t *>(buffer->opaque);
+
+    switch ( mSource.format() ) {
+        case ReplaySource::FORMAT_YUYV:
+            memcpy(dst, data, width * height * 2);
+            break;
+
+        case ReplaySource::FORMAT_NV12:
+            nv12ToYUYV(data, data + width * height, width, dst, width, height);
+            break;
+
+        case ReplaySource::FORMAT_MJPEG: {
+            // decoded as NV12 aside, the preview thread owns mDecoder
+            Decoder_libjpeg decoder;
+            android::Vector<uint8_t> nv12;
+            nv12.insertAt((uint8_t) 0, 0, width * height * 3 / 2);
+            if ( !decoder.decode(const_cast<uint8_t *>(data), length, nv12.editArray(), width,
+                                 width, height, 1) ) {
+                return UNKNOWN_ERROR;
+            }
+            nv12ToYUYV(nv12.array(), nv12.array() + width * height, width, dst, width, height);
+            break;
+        }
+
+        default:
+            return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+/* Preview Thread */
+// ---------------------------------------------------------------------------
+
+bool ReplayCameraAdapter::previewThread()
+{
+    status_t ret = NO_ERROR;
+    CameraFrame frame;
+    CameraBuffer *buffer = NULL;
+    const uint8_t *data = NULL;
+    size_t length = 0;
+    int width, height, stride;
+    int frameIndex;
+    bool recording;
+
+    {
+        android::AutoMutex lock(mLock);
+
+        for ( ;; ) {
+            if ( !mPreviewing ) {
+                return false;
+            }
+
+            const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if ( now < mNextFrameTime ) {
+                mFrameCondition.waitRelative(mLock, mNextFrameTime - now);
+                continue;
+            }
+
+            if ( !mFreeBuffers.isEmpty() ) {
+                break;
+            }
+
+            if ( mFramePeriod > 0 ) {
+                // every buffer is downstream, the sensor would drop this frame
+                mFramesDropped++;
+                mFrameIndex++;
+                mNextFrameTime += mFramePeriod;
+            } else {
+                mFrameCondition.waitRelative(mLock, BUFFER_WAIT_TIMEOUT);
+            }
+        }
+
+        buffer = mPreviewBufs + mFreeBuffers[0];
+        mFreeBuffers.removeAt(0);
+
+        frameIndex = mFrameIndex++;
+        data = mSource.frame(frameIndex, length);
+        mNextFrameTime += mFramePeriod;
+        recording = mRecording;
+    }
+
+    width = mSource.width();
+    height = mSource.height();
+    stride = (buffer->stride > 0) ? buffer->stride : PREVIEW_TILER_STRIDE;
+
+    ret = fillPreviewBuffer(data, length, buffer, width, height, stride);
+    if ( NO_ERROR == ret ) {
+        frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
+        frame.mBuffer = buffer;
+        frame.mLength = width * height * 3 / 2;
+        frame.mWidth = width;
+        frame.mHeight = height;
+        frame.mAlignment = stride;
+        frame.mOffset = 0;
+        frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        frame.mFrameMask = (unsigned int)CameraFrame::PREVIEW_FRAME_SYNC;
+
+        if ( recording ) {
+            frame.mFrameMask |= (unsigned int)CameraFrame::VIDEO_FRAME_SYNC;
+            __atomic_fetch_add(&mFramesWithEncoder, 1, __ATOMIC_RELAXED);
+        }
+
+        ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
+        if ( NO_ERROR == ret ) {
+            ret = sendFrameToSubscribers(&frame);
+        }
+    } else {
+        CAMHAL_LOGEB("Frame %d of the recording is corrupted", frameIndex);
+    }
+
+    android::AutoMutex lock(mLock);
+    if ( NO_ERROR == ret ) {
+        mFramesSent++;
+    } else if ( mFreeBuffers.indexOf(buffer - mPreviewBufs) < 0 ) {
+        // nobody took the frame, the buffer is still ours
+        mFreeBuffers.push_back(buffer - mPreviewBufs);
+    }
+
+    return true;
+}
+
+extern "C" CameraAdapter* ReplayCameraAdapter_Factory(size_t sensor_index)
+{
+    CameraAdapter *adapter = NULL;
+
+    LOG_FUNCTION_NAME;
+
+    adapter = new ReplayCameraAdapter(sensor_index);
+    if ( adapter ) {
+        CAMHAL_LOGDB("New Replay Camera adapter instance created for sensor %d", sensor_index);
+    } else {
+        CAMHAL_LOGEB("Replay Camera adapter create failed for sensor index = %d!", sensor_index);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return adapter;
+}
+
+extern "C" status_t ReplayCameraAdapter_Capabilities(
+        CameraProperties::Properties * const properties_array,
+        const int starting_camera, const int max_camera, int & supportedCameras)
+{
+    status_t ret = NO_ERROR;
+    ReplaySource source;
+
+    LOG_FUNCTION_NAME;
+
+    supportedCameras = 0;
+
+    if ( !properties_array ) {
+        CAMHAL_LOGEB("invalid param: properties = 0x%p", properties_array);
+        LOG_FUNCTION_NAME_EXIT;
+        return BAD_VALUE;
+    }
+
+    if ( starting_camera >= max_camera ) {
+        LOG_FUNCTION_NAME_EXIT;
+        return NO_ERROR;
+    }
+
+    // no recording configured is not an error, there just is no replay camera
+    if ( source.open() == NO_ERROR ) {
+        ret = ReplayCameraAdapter::getCaps(starting_camera, properties_array + starting_camera, source);
+        if ( NO_ERROR == ret ) {
+            supportedCameras = 1;
+        } else {
+            CAMHAL_LOGEA("Error while getting capabilities.");
+        }
+    }
+
+    CAMHAL_LOGDB("Number of replay cameras = %d", supportedCameras);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
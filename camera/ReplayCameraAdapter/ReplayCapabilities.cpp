@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ReplayCapabilities.cpp
+*
+* This file implements the capabilities of the replay camera.
+*
+*/
+
+#include "CameraHal.h"
+#include "ReplayCameraAdapter.h"
+#include "ErrorUtils.h"
+#include "TICameraParameters.h"
+
+namespace Ti {
+namespace Camera {
+
+//rate advertised for a recording replayed as fast as possible
+#define UNPACED_FRAMERATE 30
+
+//Camera defaults
+const char ReplayCameraAdapter::DEFAULT_PICTURE_FORMAT[] = "jpeg";
+const char ReplayCameraAdapter::DEFAULT_PREVIEW_FORMAT[] = "yuv420sp";
+const char ReplayCameraAdapter::DEFAULT_NUM_PREV_BUFS[] = "6";
+const char ReplayCameraAdapter::DEFAULT_FOCUS_MODE[] = "infinity";
+
+status_t ReplayCameraAdapter::getCaps(const int sensorId, CameraProperties::Properties* params,
+                                      const ReplaySource &source)
+{
+    char size[MAX_PROP_VALUE_LENGTH];
+    char fps[MAX_PROP_VALUE_LENGTH];
+    char range[MAX_PROP_VALUE_LENGTH];
+
+    LOG_FUNCTION_NAME;
+
+    if ( NULL == params || !source.isOpen() ) {
+        return BAD_VALUE;
+    }
+
+    const int rate = source.fps() ? source.fps() : UNPACED_FRAMERATE;
+
+    // the recording has one size and one rate, frames are not scaled
+    snprintf(size, sizeof(size), "%dx%d", source.width(), source.height());
+    snprintf(fps, sizeof(fps), "%d", rate);
+    snprintf(range, sizeof(range), "%d,%d", rate * CameraHal::VFR_SCALE, rate * CameraHal::VFR_SCALE);
+
+    params->set(CameraProperties::SUPPORTED_PREVIEW_FORMATS, DEFAULT_PREVIEW_FORMAT);
+    params->set(CameraProperties::SUPPORTED_PREVIEW_SIZES, size);
+    params->set(CameraProperties::SUPPORTED_PREVIEW_SUBSAMPLED_SIZES, size);
+    params->set(CameraProperties::SUPPORTED_PICTURE_SIZES, size);
+    params->set(CameraProperties::SUPPORTED_PICTURE_FORMATS, DEFAULT_PICTURE_FORMAT);
+    params->set(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES, fps);
+    params->set(CameraProperties::FRAMERATE_RANGE_SUPPORTED,
+                (android::String8("(") + range + ")").string());
+    params->set(CameraProperties::SUPPORTED_FOCUS_MODES, DEFAULT_FOCUS_MODE);
+
+    params->set(CameraProperties::PREVIEW_FORMAT, DEFAULT_PREVIEW_FORMAT);
+    params->set(CameraProperties::PICTURE_FORMAT, DEFAULT_PICTURE_FORMAT);
+    params->set(CameraProperties::PICTURE_SIZE, size);
+    params->set(CameraProperties::PREVIEW_SIZE, size);
+    params->set(CameraProperties::PREVIEW_FRAME_RATE, fps);
+    params->set(CameraProperties::REQUIRED_PREVIEW_BUFS, DEFAULT_NUM_PREV_BUFS);
+    params->set(CameraProperties::FOCUS_MODE, DEFAULT_FOCUS_MODE);
+    params->set(CameraProperties::CAMERA_NAME, REPLAY_CAMERA_NAME);
+    params->set(CameraProperties::JPEG_THUMBNAIL_SIZE, "320x240");
+    params->set(CameraProperties::JPEG_QUALITY, "90");
+    params->set(CameraProperties::JPEG_THUMBNAIL_QUALITY, "50");
+    params->set(CameraProperties::FRAMERATE_RANGE, range);
+    params->set(CameraProperties::S3D_PRV_FRAME_LAYOUT, "none");
+    params->set(CameraProperties::SUPPORTED_EXPOSURE_MODES, "auto");
+    params->set(CameraProperties::SUPPORTED_ISO_VALUES, "auto");
+    params->set(CameraProperties::SUPPORTED_ANTIBANDING, "auto");
+    params->set(CameraProperties::SUPPORTED_EFFECTS, "none");
+    params->set(CameraProperties::SUPPORTED_IPP_MODES, "ldc-nsf");
+    params->set(CameraProperties::FACING_INDEX, TICameraParameters::FACING_BACK);
+    params->set(CameraProperties::ORIENTATION_INDEX, 0);
+    params->set(CameraProperties::SENSOR_ORIENTATION, "0");
+    params->set(CameraProperties::VSTAB, android::CameraParameters::FALSE);
+    params->set(CameraProperties::VNF, android::CameraParameters::FALSE);
+
+    //For compatibility
+    params->set(CameraProperties::SUPPORTED_ZOOM_RATIOS, "0");
+    params->set(CameraProperties::SUPPORTED_ZOOM_STAGES, "0");
+    params->set(CameraProperties::ZOOM, "0");
+    params->set(CameraProperties::ZOOM_SUPPORTED, "true");
+
+    CAMHAL_LOGDB("Replay camera %d: %s at %s fps", sensorId, size, fps);
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -20,61 +20,79 @@
 namespace Ti {
 namespace Camera {
 
-SwFrameDecoder::SwFrameDecoder()
-: mjpegWithHdrSize(0), mJpegWithHeaderBuffer(NULL) {
+SwFrameDecoder::SwFrameDecoder() {
 }
 
 SwFrameDecoder::~SwFrameDecoder() {
-    delete [] mJpegWithHeaderBuffer;
-    mJpegWithHeaderBuffer = NULL;
+    // decode threads must be gone before the decoders they use
+    stop();
+    releaseDecoders();
+}
+
+void SwFrameDecoder::releaseDecoders() {
+    for (size_t i = 0; i < mJpgdecoders.size(); i++) {
+        delete mJpgdecoders[i];
+    }
+    mJpgdecoders.clear();
 }
 
 
 void SwFrameDecoder::doConfigure(const DecoderParameters& params) {
     LOG_FUNCTION_NAME;
 
-    mjpegWithHdrSize = (mParams.width * mParams.height / 2) +
-            mJpgdecoder.readDHTSize();
-    if (mJpegWithHeaderBuffer != NULL) {
-        delete [] mJpegWithHeaderBuffer;
-        mJpegWithHeaderBuffer = NULL;
+    // frames are decoded in place, missing DHTs are fed to libjpeg by the
+    // decoder's source manager, so only the per thread state is needed
+    const size_t count = max(params.decodeThreads, 1);
+
+    while (mJpgdecoders.size() > count) {
+        delete mJpgdecoders.top();
+        mJpgdecoders.pop();
+    }
+    while (mJpgdecoders.size() < count) {
+        mJpgdecoders.push_back(new Decoder_libjpeg());
     }
-    mJpegWithHeaderBuffer = new unsigned char[mjpegWithHdrSize];
 
     LOG_FUNCTION_NAME_EXIT;
 }
 
 
+bool SwFrameDecoder::doDecodeFrame(MediaBuffer& in, MediaBuffer& out, int slot) {
+    CameraBuffer* buffer = reinterpret_cast<CameraBuffer*>(out.buffer);
+
+    int stride = buffer->stride;
+    if (stride <= 0) {
+        stride = (mParams.outputStride > 0) ? mParams.outputStride : mParams.width;
+    }
+
+    return mJpgdecoders[slot]->decode(reinterpret_cast<unsigned char*>(in.buffer), in.filledLen,
+                                      reinterpret_cast<unsigned char*>(buffer->mapped), stride,
+                                      mParams.width, mParams.height, mParams.scaleDenom);
+}
+
+
 void SwFrameDecoder::doProcessInputBuffer() {
     LOG_FUNCTION_NAME;
-    nsecs_t timestamp = 0;
-
-    CAMHAL_LOGV("Will add header to MJPEG");
-    int final_jpg_sz = 0;
-    {
-        int inIndex = mInQueue.itemAt(0);
-        android::sp<MediaBuffer>& inBuffer = mInBuffers->editItemAt(inIndex);
-        android::AutoMutex lock(inBuffer->getLock());
-        timestamp = inBuffer->getTimestamp();
-        final_jpg_sz = mJpgdecoder.appendDHT(
-                reinterpret_cast<unsigned char*>(inBuffer->buffer),
-                inBuffer->filledLen, mJpegWithHeaderBuffer, mjpegWithHdrSize);
-        inBuffer->setStatus(BufferStatus_InDecoded);
-    }
-    CAMHAL_LOGV("Added header to MJPEG");
-    {
-        int outIndex = mOutQueue.itemAt(0);
-        android::sp<MediaBuffer>& outBuffer = mOutBuffers->editItemAt(outIndex);
-        android::AutoMutex lock(outBuffer->getLock());
-        CameraBuffer* buffer = reinterpret_cast<CameraBuffer*>(outBuffer->buffer);
-        if (!mJpgdecoder.decode(mJpegWithHeaderBuffer, final_jpg_sz,
-                reinterpret_cast<unsigned char*>(buffer->mapped), 4096)) {
-            CAMHAL_LOGEA("Error while decoding JPEG");
-            return;
-        }
-        outBuffer->setTimestamp(timestamp);
-        outBuffer->setStatus(BufferStatus_OutFilled);
+
+    int inIndex = mInQueue.itemAt(0);
+    int outIndex = mOutQueue.itemAt(0);
+    android::sp<MediaBuffer>& inBuffer = mInBuffers->editItemAt(inIndex);
+    android::sp<MediaBuffer>& outBuffer = mOutBuffers->editItemAt(outIndex);
+
+    // the input stays locked until libjpeg is done reading it
+    android::AutoMutex inLock(inBuffer->getLock());
+    android::AutoMutex outLock(outBuffer->getLock());
+
+    const bool decoded = doDecodeFrame(*inBuffer.get(), *outBuffer.get(), 0);
+
+    inBuffer->setStatus(BufferStatus_InDecoded);
+
+    if (!decoded) {
+        CAMHAL_LOGEA("Error while decoding JPEG");
+        return;
     }
+
+    outBuffer->setTimestamp(inBuffer->getTimestamp());
+    outBuffer->setStatus(BufferStatus_OutFilled);
     CAMHAL_LOGV("JPEG decoded!");
 
     LOG_FUNCTION_NAME_EXIT;
@@ -26,6 +26,8 @@
 #include "CameraHal.h"
 #include "TICameraParameters.h"
 #include "DebugUtils.h"
+#include <ctype.h>
+#include <dirent.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,9 +41,9 @@
 #include <linux/videodev.h>
 #include <cutils/properties.h>
 #include "DecoderFactory.h"
+#include "ColorConvert.h"
 
 #define UNLIKELY( exp ) (__builtin_expect( (exp) != 0, false ))
-static int mDebugFps = 0;
 
 #define Q16_OFFSET 16
 
@@ -53,29 +55,34 @@ namespace Camera {
 //frames skipped before recalculating the framerate
 #define FPS_PERIOD 30
 
+//stride of the tiler preview buffers, used when a buffer doesn't report one
+#define PREVIEW_TILER_STRIDE 4096
+
+//upper bound of MJPEG frames decoded at once by the SW decoder
+#define MAX_DECODE_THREADS 4
+
+//raw frames waiting for conversion before the oldest one is dropped
+#define CONVERT_QUEUE_DEPTH 2
+
+//dispatched frames between two logs of the pipeline statistics
+#define PIPELINE_STATS_PERIOD 300
+
 //Proto Types
 static void convertYUV422i_yuyvTouyvy(uint8_t *src, uint8_t *dest, size_t size );
 static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, int width, int height );
 static void convertYUV422ToNV12(unsigned char *src, unsigned char *dest, int width, int height );
 
-android::Mutex gV4LAdapterLock;
-char device[15];
-
-static void debugShowFPS()
+void V4LCameraAdapter::debugShowFPS()
 {
-    static int mFrameCount = 0;
-    static int mLastFrameCount = 0;
-    static nsecs_t mLastFpsTime = 0;
-    static float mFps = 0;
     if(mDebugFps) {
         mFrameCount++;
         if ((mFrameCount % 30 == 0)) {
             nsecs_t now = systemTime();
-            nsecs_t diff = now - mLastFpsTime;
-            mFps = ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
-            mLastFpsTime = now;
+            nsecs_t diff = now - mLastFPSTime;
+            mFPS = ((mFrameCount - mLastFrameCount) * float(s2ns(1))) / diff;
+            mLastFPSTime = now;
             mLastFrameCount = mFrameCount;
-            CAMHAL_LOGE("Camera %d Frames, %f FPS", mFrameCount, mFps);
+            CAMHAL_LOGE("Camera %s: %d Frames, %f FPS", mDevicePath.string(), mFrameCount, mFPS);
         }
     }
 }
@@ -163,6 +170,19 @@ status_t V4LCameraAdapter::v4lInitMmap(int& count, int width, int height) {
         params.height = height;
         params.inputBufferCount = count;
         params.outputBufferCount = count;
+        params.outputStride = PREVIEW_TILER_STRIDE;
+        // one frame per core; decoders that can't run in parallel ignore it
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        params.decodeThreads = (cpus > 1) ? min((int) cpus, MAX_DECODE_THREADS) : 1;
+        // the driver may have negotiated frames larger than the preview,
+        // let the IDCT drop as much of the difference as it can
+        if (mPixelFormat == V4L2_PIX_FMT_MJPEG) {
+            const int frameWidth = mVideoInfo->format.fmt.pix.width;
+            const int frameHeight = mVideoInfo->format.fmt.pix.height;
+            params.scaleDenom = Decoder_libjpeg::scaleDenomFor(frameWidth, frameHeight, width, height);
+            CAMHAL_LOGDB("MJPEG frames %dx%d, preview %dx%d, decoding at 1/%d",
+                         frameWidth, frameHeight, width, height, params.scaleDenom);
+        }
         mDecoder->configure(params);
     }
 
@@ -367,7 +387,7 @@ status_t V4LCameraAdapter::initialize(CameraProperties::Properties* caps)
     android::AutoMutex lock(mLock);
 
     property_get("debug.camera.showfps", value, "0");
-    mDebugFps = atoi(value);
+    mDebugFps = atoi(value) != 0;
 
     int ret = NO_ERROR;
 
@@ -378,8 +398,16 @@ status_t V4LCameraAdapter::initialize(CameraProperties::Properties* caps)
         goto EXIT;
     }
 
-    if ((mCameraHandle = open(device, O_RDWR | O_NONBLOCK) ) == -1) {
-        CAMHAL_LOGEB("Error while opening handle to V4L2 Camera: %s", strerror(errno));
+    // every adapter drives its own device, found when the cameras were enumerated
+    mDevicePath = caps ? caps->get(CameraProperties::CAMERA_DEVICE_PATH) : "";
+    if (mDevicePath.isEmpty()) {
+        CAMHAL_LOGEB("No V4L2 device for camera %d", mSensorIndex);
+        ret = BAD_VALUE;
+        goto EXIT;
+    }
+
+    if ((mCameraHandle = open(mDevicePath.string(), O_RDWR | O_NONBLOCK) ) == -1) {
+        CAMHAL_LOGEB("Error while opening handle to V4L2 Camera %s: %s", mDevicePath.string(), strerror(errno));
         ret = BAD_VALUE;
         goto EXIT;
     }
@@ -408,6 +436,7 @@ status_t V4LCameraAdapter::initialize(CameraProperties::Properties* caps)
     mVideoInfo->isStreaming = false;
     mRecording = false;
     mCapturing = false;
+
 EXIT:
     LOG_FUNCTION_NAME_EXIT;
     return ret;
@@ -511,14 +540,21 @@ status_t V4LCameraAdapter::setParameters(const android::CameraParameters &params
 {
     status_t ret = NO_ERROR;
     int width, height;
+    int pictureWidth = 0, pictureHeight = 0;
     int minFps = 0, maxFps = 0;
 
     LOG_FUNCTION_NAME;
 
+    // preview frames at the picture size can be the picture, otherwise
+    // holding them only takes buffers away from the camera; flushing the
+    // history returns buffers through fillThisBuffer(), so outside mLock
+    params.getPreviewSize(&width, &height);
+    params.getPictureSize(&pictureWidth, &pictureHeight);
+    enableFrameHistory((width == pictureWidth) && (height == pictureHeight));
+
     android::AutoMutex lock(mLock);
 
     if(!mPreviewing && !mCapturing) {
-        params.getPreviewSize(&width, &height);
         CAMHAL_LOGDB("Width * Height %d x %d format 0x%x", width, height, mPixelFormat);
         ret = v4lSetFormat( width, height, mPixelFormat);
         if (ret < 0) {
@@ -610,15 +646,12 @@ status_t V4LCameraAdapter::UseBuffersCapture(CameraBuffer *bufArr, int num) {
         CAMHAL_LOGDB("capture- buff [%d] = 0x%x ",i, mCaptureBufs.keyAt(i));
     }
 
-    mCaptureBuffersAvailable.clear();
-    for (int i = 0; i < mCaptureBufferCountQueueable; i++ ) {
-        mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 0);
-    }
-
     // initial ref count for undeqeueued buffers is 1 since buffer provider
     // is still holding on to it
-    for (int i = mCaptureBufferCountQueueable; i < num; i++ ) {
-        mCaptureBuffersAvailable.add(&mCaptureBuffers[i], 1);
+    ret = mFrameRefs.track(FrameRefTable::CAPTURE_SET, mCaptureBuffers, num,
+                           mCaptureBufferCountQueueable, CameraFrame::IMAGE_FRAME);
+    if (ret != NO_ERROR) {
+        goto EXIT;
     }
 
     // Update the preview buffer count
@@ -684,6 +717,35 @@ status_t V4LCameraAdapter::takePicture() {
         return BAD_VALUE;
     }
 
+    // Zero shutter lag: with preview at the picture size a held preview
+    // frame is the picture and streaming goes on.
+    mParams.getPictureSize(&width, &height);
+    if (mPreviewing && !mCaptureBufs.isEmpty()) {
+        int previewWidth = 0, previewHeight = 0;
+        mParams.getPreviewSize(&previewWidth, &previewHeight);
+
+        if ((previewWidth == width) && (previewHeight == height)) {
+            buffer = mCaptureBufs.keyAt(0);
+            mCapturing = true;
+            mLock.unlock();
+            ret = takeHistoryPicture(buffer, width, height);
+            mLock.lock();
+
+            if ((ret != NOT_ENOUGH_DATA) && (ret != INVALID_OPERATION)) {
+                // on success stopImageCapture() may already have run
+                if (ret != NO_ERROR) {
+                    mCapturing = false;
+                }
+                LOG_FUNCTION_NAME_EXIT;
+                return ret;
+            }
+
+            CAMHAL_LOGDB("No history frame for the picture (%d), capturing a new one", ret);
+            mCapturing = false;
+            ret = NO_ERROR;
+        }
+    }
+
     mPreviewing = false;
     mLock.unlock();
 
@@ -696,6 +758,11 @@ status_t V4LCameraAdapter::takePicture() {
         }
     }
 
+    // preview frames in flight refer to buffers about to be unmapped
+    flushPipeline();
+    // held frames go back to V4L before streaming restarts with all buffers
+    flushFrameHistory();
+
     if (isNeedToUseDecoder()) {
         mDecoder->stop();
         mDecoder->flush();
@@ -819,6 +886,56 @@ EXIT:
     return ret;
 }
 
+status_t V4LCameraAdapter::takeHistoryPicture(CameraBuffer *buffer, int width, int height)
+{
+    status_t ret = NO_ERROR;
+    CameraFrame history;
+    CameraFrame frame;
+
+    LOG_FUNCTION_NAME;
+
+    ret = takeHistoryFrame(systemTime(SYSTEM_TIME_MONOTONIC), history);
+    if (ret != NO_ERROR) {
+        return ret;
+    }
+
+    if (((int) history.mWidth != width) || ((int) history.mHeight != height)) {
+        CAMHAL_LOGDB("History frame is %dx%d, picture %dx%d",
+                     history.mWidth, history.mHeight, width, height);
+        releaseHistoryFrame(history.mBuffer);
+        return INVALID_OPERATION;
+    }
+
+    // preview buffers are NV12 with the Tiler stride, the encoder takes
+    // tightly packed NV21; the preview buffer is free again right after
+    const uint8_t *y = reinterpret_cast<const uint8_t*>(history.mBuffer->mapped) + history.mOffset;
+    ColorConvert::nv12ToNV21(y, y + history.mAlignment * history.mHeight, history.mAlignment,
+                             reinterpret_cast<uint8_t*>(buffer->opaque), width, height);
+    releaseHistoryFrame(history.mBuffer);
+
+    CAMHAL_LOGDA("::sending history frame to encoder::");
+    frame.mFrameType = CameraFrame::IMAGE_FRAME;
+    frame.mBuffer = buffer;
+    frame.mLength = width * height * 3 / 2;
+    frame.mWidth = width;
+    frame.mHeight = height;
+    frame.mAlignment = width;
+    frame.mOffset = 0;
+    frame.mTimestamp = history.mTimestamp;
+    frame.mFrameMask = (unsigned int)CameraFrame::IMAGE_FRAME;
+    frame.mQuirks |= CameraFrame::ENCODE_RAW_YUV420SP_TO_JPEG;
+
+    ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGDB("Error in setInitFrameRefCount %d", ret);
+    } else {
+        ret = sendFrameToSubscribers(&frame);
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
 status_t V4LCameraAdapter::stopImageCapture()
 {
     status_t ret = NO_ERROR;
@@ -897,6 +1014,10 @@ status_t V4LCameraAdapter::startPreview()
     }
     ret = v4lStartStreaming();
 
+    if (ret == NO_ERROR) {
+        ret = startPipeline();
+    }
+
     // Create and start preview thread for receiving buffers from V4L Camera
     if(!mCapturing) {
         mPreviewThread = new PreviewThread(this);
@@ -931,6 +1052,13 @@ status_t V4LCameraAdapter::stopPreview()
         mDecoder->stop();
         mDecoder->flush();
     }
+
+    // the conversion reads the V4L buffers, it has to stop before they are
+    // unmapped; the stages may need mLock to finish their frame
+    mLock.unlock();
+    stopPipeline();
+    mLock.lock();
+
     ret = v4lStopStreaming(mPreviewBufferCount);
     if (ret < 0) {
         CAMHAL_LOGEB("StopStreaming: FAILED: %s", strerror(errno));
@@ -1163,7 +1291,8 @@ void V4LCameraAdapter::setupWorkingMode() {
 
 V4LCameraAdapter::V4LCameraAdapter(size_t sensor_index, CameraHal* hal)
     :mPixelFormat(DEFAULT_PIXEL_FORMAT), mFrameRate(0), mCameraHal(hal),
-     mSkipFramesCount(0)
+     mSkipFramesCount(0), mPipelineRunning(false), mConverting(false),
+     mPipelineDrops(0)
 {
     LOG_FUNCTION_NAME;
 
@@ -1171,6 +1300,15 @@ V4LCameraAdapter::V4LCameraAdapter(size_t sensor_index, CameraHal* hal)
 
     // Nothing useful to do in the constructor
     mFramesWithEncoder = 0;
+    memset(mStageStats, 0, sizeof(mStageStats));
+    mSensorIndex = sensor_index;
+    mCameraHandle = -1;
+    mVideoInfo = NULL;
+    mDebugFps = false;
+    mFrameCount = 0;
+    mLastFrameCount = 0;
+    mLastFPSTime = 0;
+    mFPS = 0;
     mDecoder = 0;
     nQueued = 0;
     nDequeued = 0;
@@ -1187,8 +1325,12 @@ V4LCameraAdapter::~V4LCameraAdapter()
 {
     LOG_FUNCTION_NAME;
 
+    stopPipeline();
+
     // Close the camera handle and free the video info structure
-    close(mCameraHandle);
+    if (mCameraHandle >= 0) {
+        close(mCameraHandle);
+    }
 
     if (mVideoInfo)
       {
@@ -1228,7 +1370,6 @@ static void convertYUV422i_yuyvTouyvy(uint8_t *src, uint8_t *dest, size_t size )
 static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, int width, int height ) {
     //convert YUV422I to YUV420 NV12 format and copies directly to preview buffers (Tiler memory).
     int stride = 4096;
-    unsigned char *bf = src;
     unsigned char *dst_y = dest;
     unsigned char *dst_uv = dest + ( height * stride);
 #ifdef PPM_PER_FRAME_CONVERSION
@@ -1239,61 +1380,7 @@ static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, in
 
     LOG_FUNCTION_NAME;
 
-    if (width % 16 ) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++) {
-                *dst_y = *bf;
-                dst_y++;
-                bf = bf + 2;
-            }
-            dst_y += (stride - width);
-        }
-
-        bf = src;
-        bf++;  //UV sample
-        for(int i = 0; i < height/2; i++) {
-            for(int j=0; j<width; j++) {
-                *dst_uv = *bf;
-                dst_uv++;
-                bf = bf + 2;
-            }
-            bf = bf + width*2;
-            dst_uv = dst_uv + (stride - width);
-        }
-    } else {
-        //neon conversion
-        for(int i = 0; i < height; i++) {
-            int n = width;
-            int skip = i & 0x1;       // skip uv elements for the odd rows
-            asm volatile (
-                "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   blt 5f                                                      \n\t"
-                "0: @ 16 pixel copy                                             \n\t"
-                "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-                "                                @ now q0 = y q1 = uv           \n\t"
-                "   vst1.32   {d0,d1}, [%[dst_y]]!                              \n\t"
-                "   cmp    %[skip], #0                                          \n\t"
-                "   bne 1f                                                      \n\t"
-                "   vst1.32  {d2,d3},[%[dst_uv]]!                               \n\t"
-                "1: @ skip odd rows for UV                                      \n\t"
-                "   sub %[n], %[n], #16                                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   bge 0b                                                      \n\t"
-                "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                : [dst_y] "+r" (dst_y), [dst_uv] "+r" (dst_uv), [src] "+r" (src), [n] "+r" (n)
-                : [src_stride] "r" (width), [skip] "r" (skip)
-                : "cc", "memory", "q0", "q1", "q2", "d0", "d1", "d2", "d3"
-            );
-            dst_y = dst_y + (stride - width);
-            if (skip == 0) {
-                dst_uv = dst_uv + (stride - width);
-            }
-        } //end of for()
-    }
+    ColorConvert::yuyvToNV12(src, width * 2, dst_y, dst_uv, stride, width, height);
 
 #ifdef PPM_PER_FRAME_CONVERSION
     ppm_diff += (systemTime() - ppm_start);
@@ -1313,61 +1400,12 @@ static void convertYUV422ToNV12Tiler(unsigned char *src, unsigned char *dest, in
 
 static void convertYUV422ToNV12(unsigned char *src, unsigned char *dest, int width, int height ) {
     //convert YUV422I to YUV420 NV12 format.
-    unsigned char *bf = src;
     unsigned char *dst_y = dest;
     unsigned char *dst_uv = dest + (width * height);
 
     LOG_FUNCTION_NAME;
 
-    if (width % 16 ) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++) {
-                *dst_y = *bf;
-                dst_y++;
-                bf = bf + 2;
-            }
-        }
-
-        bf = src;
-        bf++;  //UV sample
-        for(int i = 0; i < height/2; i++) {
-            for(int j=0; j<width; j++) {
-                *dst_uv = *bf;
-                dst_uv++;
-                bf = bf + 2;
-            }
-            bf = bf + width*2;
-        }
-    } else {
-        //neon conversion
-        for(int i = 0; i < height; i++) {
-            int n = width;
-            int skip = i & 0x1;       // skip uv elements for the odd rows
-            asm volatile (
-                "   pld [%[src], %[src_stride], lsl #2]                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   blt 5f                                                      \n\t"
-                "0: @ 16 pixel copy                                             \n\t"
-                "   vld2.8  {q0, q1} , [%[src]]! @ q0 = yyyy.. q1 = uvuv..      \n\t"
-                "                                @ now q0 = y q1 = uv           \n\t"
-                "   vst1.32   {d0,d1}, [%[dst_y]]!                              \n\t"
-                "   cmp    %[skip], #0                                          \n\t"
-                "   bne 1f                                                      \n\t"
-                "   vst1.32  {d2,d3},[%[dst_uv]]!                               \n\t"
-                "1: @ skip odd rows for UV                                      \n\t"
-                "   sub %[n], %[n], #16                                         \n\t"
-                "   cmp %[n], #16                                               \n\t"
-                "   bge 0b                                                      \n\t"
-                "5: @ end                                                       \n\t"
-#ifdef NEEDS_ARM_ERRATA_754319_754320
-                "   vmov s0,s0  @ add noop for errata item                      \n\t"
-#endif
-                : [dst_y] "+r" (dst_y), [dst_uv] "+r" (dst_uv), [src] "+r" (src), [n] "+r" (n)
-                : [src_stride] "r" (width), [skip] "r" (skip)
-                : "cc", "memory", "q0", "q1", "q2", "d0", "d1", "d2", "d3"
-            );
-        }
-    }
+    ColorConvert::yuyvToNV12(src, width * 2, dst_y, dst_uv, width, width, height);
 
     LOG_FUNCTION_NAME_EXIT;
 }
@@ -1384,16 +1422,17 @@ void V4LCameraAdapter::returnOutputBuffer(int index)
     LOG_FUNCTION_NAME;
 
     size_t width, height;
-    int stride = 4096;
+    int stride = PREVIEW_TILER_STRIDE;
     CameraFrame frame;
 
     getFrameSize(width, height);
 
-    android::Mutex::Autolock slock(mSubscriberLock);
-
     android::sp<MediaBuffer>& buffer = mOutBuffers.editItemAt(index);
 
     CameraBuffer* cbuffer = static_cast<CameraBuffer*>(buffer->buffer);
+    if (cbuffer->stride > 0) {
+        stride = cbuffer->stride;
+    }
 
     frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
     frame.mBuffer = cbuffer;
@@ -1403,6 +1442,8 @@ void V4LCameraAdapter::returnOutputBuffer(int index)
     } else {
         frame.mLength = CameraHal::calculateBufferSize(mParams.getPreviewFormat(), width, height);
     }
+    frame.mWidth = width;
+    frame.mHeight = height;
     frame.mAlignment = stride;
     frame.mOffset = buffer->getOffset();
     frame.mTimestamp = buffer->getTimestamp();
@@ -1444,12 +1485,10 @@ int V4LCameraAdapter::previewThread()
 {
     status_t ret = NO_ERROR;
     int width, height;
-    CameraFrame frame;
-    void *y_uv[2];
     int index = 0;
     int filledLen = 0;
-    int stride = 4096;
     char *fp = NULL;
+    PipelineFrame frame;
 
     mParams.getPreviewSize(&width, &height);
 
@@ -1464,12 +1503,17 @@ int V4LCameraAdapter::previewThread()
     }
 
     {
-        android::Mutex::Autolock lock(mSubscriberLock);
-        if ( mFrameSubscribers.size() == 0 ) {
+        SubscribersRef subscribers(this);
+        if ( subscribers->mFrame.size() == 0 ) {
             return BAD_VALUE;
         }
     }
 
+    // This thread only dequeues: conversion and delivery run on their own
+    // threads, so a slow frame doesn't hold the next VIDIOC_DQBUF back.
+    frame.width = width;
+    frame.height = height;
+
     if (isNeedToUseDecoder()){
 
         CAMHAL_LOGV("########### Decoder ###########");
@@ -1485,7 +1529,15 @@ int V4LCameraAdapter::previewThread()
         }
 
         while (NO_ERROR == mDecoder->dequeueOutputBuffer(outIndex)) {
-            returnOutputBuffer(outIndex);
+            frame.index = outIndex;
+            frame.decoded = true;
+            frame.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+            frame.queued = frame.timestamp;
+
+            android::AutoMutex lock(mPipelineLock);
+            if (mPipelineRunning) {
+                queueForDispatch(frame);
+            }
         }
 
         CAMHAL_LOGV("########### End Decode ###########");
@@ -1501,12 +1553,6 @@ int V4LCameraAdapter::previewThread()
         }
         CAMHAL_LOGD("GOT IN frame with ID=%d",index);
 
-        CameraBuffer *buffer = mPreviewBufs[index];
-        if (mPixelFormat == V4L2_PIX_FMT_YUYV) {
-            convertYUV422ToNV12Tiler(reinterpret_cast<unsigned char*>(fp), reinterpret_cast<unsigned char*>(buffer->mapped), width, height);
-        }
-        CAMHAL_LOGVB("##...index= %d.;camera buffer= 0x%x; mapped= 0x%x.",index, buffer, buffer->mapped);
-
 #ifdef SAVE_RAW_FRAMES
         unsigned char* nv12_buff = (unsigned char*) malloc(width*height*3/2);
         //Convert yuv422i to yuv420sp(NV12) & dump the frame to a file
@@ -1515,72 +1561,375 @@ int V4LCameraAdapter::previewThread()
         free (nv12_buff);
 #endif
 
-        android::Mutex::Autolock lock(mSubscriberLock);
+        frame.index = index;
+        frame.decoded = false;
+        frame.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        queueForConversion(frame);
+    }
 
-        frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
-        frame.mBuffer = buffer;
-        frame.mLength = width*height*3/2;
-        frame.mAlignment = stride;
-        frame.mOffset = 0;
-        frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
-        frame.mFrameMask = (unsigned int)CameraFrame::PREVIEW_FRAME_SYNC;
+EXIT:
 
-        if (mRecording)
-        {
-            frame.mFrameMask |= (unsigned int)CameraFrame::VIDEO_FRAME_SYNC;
-            mFramesWithEncoder++;
+    return ret;
+}
+
+/* Pipeline stages */
+// ---------------------------------------------------------------------------
+
+status_t V4LCameraAdapter::startPipeline()
+{
+    status_t ret = NO_ERROR;
+
+    LOG_FUNCTION_NAME;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        if (mPipelineRunning) {
+            return NO_ERROR;
         }
 
-        ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
-        if (ret != NO_ERROR) {
-            CAMHAL_LOGDB("Error in setInitFrameRefCount %d", ret);
-        } else {
-            ret = sendFrameToSubscribers(&frame);
+        mConvertQueue.clear();
+        mDispatchQueue.clear();
+        memset(mStageStats, 0, sizeof(mStageStats));
+        mPipelineDrops = 0;
+        mPipelineRunning = true;
+
+        // MJPEG and H264 frames are converted by the decoder
+        if (!isNeedToUseDecoder()) {
+            mConvertThread = new StageThread(this, &V4LCameraAdapter::convertThread);
+            ret = mConvertThread->run("CameraConvertThread", android::PRIORITY_URGENT_DISPLAY);
+        }
+
+        if (ret == NO_ERROR) {
+            mDispatchThread = new StageThread(this, &V4LCameraAdapter::dispatchThread);
+            ret = mDispatchThread->run("CameraDispatchThread", android::PRIORITY_URGENT_DISPLAY);
         }
     }
 
-EXIT:
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGEB("Couldn't start the preview pipeline: %d", ret);
+        stopPipeline();
+    }
 
+    LOG_FUNCTION_NAME_EXIT;
     return ret;
 }
 
+void V4LCameraAdapter::stopPipeline()
+{
+    android::sp<StageThread> convertThread;
+    android::sp<StageThread> dispatchThread;
+
+    LOG_FUNCTION_NAME;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        if (!mPipelineRunning && !mConvertThread.get() && !mDispatchThread.get()) {
+            return;
+        }
+
+        mPipelineRunning = false;
+        mConvertAvailable.broadcast();
+        mDispatchAvailable.broadcast();
+
+        convertThread = mConvertThread;
+        dispatchThread = mDispatchThread;
+        mConvertThread.clear();
+        mDispatchThread.clear();
+    }
+
+    if (convertThread.get()) {
+        convertThread->requestExitAndWait();
+    }
+    if (dispatchThread.get()) {
+        dispatchThread->requestExitAndWait();
+    }
+
+    // one summary per preview session, kept in production builds
+    logPipelineStats(true);
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+        // the buffers come back with the stream restart
+        mConvertQueue.clear();
+        mDispatchQueue.clear();
+        mConverting = false;
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+void V4LCameraAdapter::flushPipeline()
+{
+    android::AutoMutex lock(mPipelineLock);
+
+    mConvertQueue.clear();
+    while (mConverting) {
+        mConvertIdle.wait(mPipelineLock);
+    }
+    mDispatchQueue.clear();
+}
+
+void V4LCameraAdapter::queueForConversion(const PipelineFrame &frame)
+{
+    int dropped = -1;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        if (!mPipelineRunning) {
+            dropped = frame.index;
+        } else {
+            if (mConvertQueue.size() >= CONVERT_QUEUE_DEPTH) {
+                // conversion is behind: keep the driver fed with buffers and
+                // the preview fresh by giving up the oldest frame
+                dropped = mConvertQueue[0].index;
+                mConvertQueue.removeAt(0);
+                mPipelineDrops++;
+            }
+
+            PipelineFrame queued = frame;
+            queued.queued = systemTime(SYSTEM_TIME_MONOTONIC);
+            accountStage(PIPELINE_CAPTURE, frame, frame.timestamp, queued.queued);
+            mConvertQueue.add(queued);
+            mConvertAvailable.signal();
+        }
+    }
+
+    if (dropped >= 0) {
+        CAMHAL_LOGV("Dropping frame with ID=%d ahead of conversion", dropped);
+        returnBufferToV4L(dropped);
+    }
+}
+
+void V4LCameraAdapter::queueForDispatch(const PipelineFrame &frame)
+{
+    // at most one entry per preview buffer, it can't grow past NB_BUFFER
+    mDispatchQueue.add(frame);
+    mDispatchAvailable.signal();
+}
+
+bool V4LCameraAdapter::convertThread()
+{
+    PipelineFrame frame;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        while (mPipelineRunning && mConvertQueue.isEmpty()) {
+            mConvertAvailable.wait(mPipelineLock);
+        }
+        if (!mPipelineRunning) {
+            return false;
+        }
+
+        frame = mConvertQueue[0];
+        mConvertQueue.removeAt(0);
+        mConverting = true;
+    }
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    CameraBuffer *buffer = mPreviewBufs[frame.index];
+    convertYUV422ToNV12Tiler(reinterpret_cast<unsigned char*>(mVideoInfo->mem[frame.index]),
+                             reinterpret_cast<unsigned char*>(buffer->mapped),
+                             frame.width, frame.height);
+    CAMHAL_LOGVB("##...index= %d.;camera buffer= 0x%x; mapped= 0x%x.", frame.index, buffer, buffer->mapped);
+
+    const nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        accountStage(PIPELINE_CONVERT, frame, start, end);
+        mConverting = false;
+        mConvertIdle.broadcast();
+
+        // a flush during the conversion drops the frame as well
+        if (mPipelineRunning) {
+            frame.queued = end;
+            queueForDispatch(frame);
+        }
+    }
+
+    return true;
+}
+
+bool V4LCameraAdapter::dispatchThread()
+{
+    PipelineFrame frame;
+    bool logStats = false;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        while (mPipelineRunning && mDispatchQueue.isEmpty()) {
+            mDispatchAvailable.wait(mPipelineLock);
+        }
+        if (!mPipelineRunning) {
+            return false;
+        }
+
+        frame = mDispatchQueue[0];
+        mDispatchQueue.removeAt(0);
+    }
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (frame.decoded) {
+        returnOutputBuffer(frame.index);
+    } else {
+        sendPreviewFrame(frame);
+    }
+
+    const nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+        accountStage(PIPELINE_DISPATCH, frame, start, end);
+        logStats = (mStageStats[PIPELINE_DISPATCH].frames % PIPELINE_STATS_PERIOD) == 0;
+    }
+
+    if (logStats) {
+        logPipelineStats(false);
+    }
+
+    return true;
+}
+
+void V4LCameraAdapter::sendPreviewFrame(const PipelineFrame &pipelineFrame)
+{
+    CameraFrame frame;
+    int stride = PREVIEW_TILER_STRIDE;
+
+    frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
+    frame.mBuffer = mPreviewBufs[pipelineFrame.index];
+    frame.mLength = pipelineFrame.width * pipelineFrame.height * 3 / 2;
+    frame.mWidth = pipelineFrame.width;
+    frame.mHeight = pipelineFrame.height;
+    frame.mAlignment = stride;
+    frame.mOffset = 0;
+    frame.mTimestamp = pipelineFrame.timestamp;
+    frame.mFrameMask = (unsigned int)CameraFrame::PREVIEW_FRAME_SYNC;
+
+    if (mRecording)
+    {
+        frame.mFrameMask |= (unsigned int)CameraFrame::VIDEO_FRAME_SYNC;
+        mFramesWithEncoder++;
+    }
+
+    int ret = setInitFrameRefCount(frame.mBuffer, frame.mFrameMask);
+    if (ret != NO_ERROR) {
+        CAMHAL_LOGDB("Error in setInitFrameRefCount %d", ret);
+    } else {
+        ret = sendFrameToSubscribers(&frame);
+    }
+}
+
+void V4LCameraAdapter::accountStage(PipelineStage stage, const PipelineFrame &frame,
+                                    nsecs_t start, nsecs_t end)
+{
+    StageStats &stats = mStageStats[stage];
+    const nsecs_t busy = end - start;
+
+    stats.frames++;
+    stats.busy += busy;
+    if (busy > stats.maxBusy) {
+        stats.maxBusy = busy;
+    }
+    if (stage != PIPELINE_CAPTURE) {
+        stats.wait += start - frame.queued;
+    }
+}
+
+void V4LCameraAdapter::logPipelineStats(bool summary)
+{
+    static const char *STAGE_NAMES[PIPELINE_STAGE_COUNT] = { "capture", "convert", "dispatch" };
+    android::String8 line;
+
+    {
+        android::AutoMutex lock(mPipelineLock);
+
+        if (!mStageStats[PIPELINE_CAPTURE].frames) {
+            return;
+        }
+
+        line.appendFormat("Camera %d pipeline:", mSensorIndex);
+        for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+            const StageStats &stats = mStageStats[i];
+            if (!stats.frames) {
+                continue;
+            }
+
+            line.appendFormat(" %s %d frames, %.2f ms avg, %.2f ms max, %.2f ms queued avg;",
+                              STAGE_NAMES[i], stats.frames,
+                              stats.busy / (stats.frames * 1e6), stats.maxBusy / 1e6,
+                              stats.wait / (stats.frames * 1e6));
+        }
+        line.appendFormat(" %d frames dropped ahead of conversion", mPipelineDrops);
+    }
+
+    if (summary) {
+        CAMHAL_LOGI("%s", line.string());
+    } else {
+        CAMHAL_LOGDB("%s", line.string());
+    }
+}
+
+//device nodes are ordered by number so camera ids don't depend on readdir()
+static int compareDeviceNames(const android::String8 *a, const android::String8 *b) {
+    const size_t prefix = strlen(DEVICE_PATH) + strlen("video");
+    return atoi(a->string() + prefix) - atoi(b->string() + prefix);
+}
+
 //scan for video devices
-void detectVideoDevice(char** video_device_list, int& num_device) {
-    char dir_path[20];
-    char* filename;
-    char** dev_list = video_device_list;
+static void detectVideoDevices(android::Vector<android::String8> &devices) {
     DIR *d;
     struct dirent *dir;
-    int index = 0;
 
-    strcpy(dir_path, DEVICE_PATH);
-    d = opendir(dir_path);
+    devices.clear();
+
+    d = opendir(DEVICE_PATH);
     if(d) {
         //read each entry in the /dev/ and find if there is videox entry.
         while ((dir = readdir(d)) != NULL) {
-            filename = dir->d_name;
-            if (strncmp(filename, DEVICE_NAME, 5) == 0) {
-                strcpy(dev_list[index],DEVICE_PATH);
-                strncat(dev_list[index],filename,sizeof(DEVICE_NAME));
-                index++;
+            const char *filename = dir->d_name;
+            if (strncmp(filename, "video", 5) == 0 && isdigit(filename[5])) {
+                devices.add(android::String8(DEVICE_PATH) + filename);
             }
        } //end of while()
        closedir(d);
-       num_device = index;
 
-       for(int i=0; i<index; i++){
-           CAMHAL_LOGDB("Video device list::dev_list[%d]= %s",i,dev_list[i]);
+       devices.sort(compareDeviceNames);
+
+       for(size_t i = 0; i < devices.size(); i++){
+           CAMHAL_LOGDB("Video device list::dev_list[%d]= %s", i, devices[i].string());
        }
     }
 }
 
+//true for nodes streaming video frames; metadata and output nodes of the
+//same device report the capabilities of the whole device in 'capabilities'
+static bool isCaptureDevice(const struct v4l2_capability &cap) {
+    uint32_t caps = cap.capabilities;
+
+#ifdef V4L2_CAP_DEVICE_CAPS
+    if (caps & V4L2_CAP_DEVICE_CAPS) {
+        caps = cap.device_caps;
+    }
+#endif
+
+    return (caps & V4L2_CAP_VIDEO_CAPTURE) && (caps & V4L2_CAP_STREAMING);
+}
+
 extern "C" CameraAdapter* V4LCameraAdapter_Factory(size_t sensor_index, CameraHal* hal)
 {
     CameraAdapter *adapter = NULL;
-    android::AutoMutex lock(gV4LAdapterLock);
 
     LOG_FUNCTION_NAME;
 
+    // adapters share no state, each camera gets its own device, threads and buffers
     adapter = new V4LCameraAdapter(sensor_index, hal);
     if ( adapter ) {
         CAMHAL_LOGDB("New V4L Camera adapter instance created for sensor %d",sensor_index);
@@ -1599,18 +1948,15 @@ extern "C" status_t V4LCameraAdapter_Capabilities(
 {
     status_t ret = NO_ERROR;
     struct v4l2_capability cap;
-    int tempHandle = NULL;
+    int tempHandle = -1;
     int num_cameras_supported = 0;
-    char device_list[5][15];
-    char* video_device_list[5];
-    int num_v4l_devices = 0;
+    android::Vector<android::String8> devices;
     int sensorId = 0;
     CameraProperties::Properties* properties = NULL;
 
     LOG_FUNCTION_NAME;
 
     supportedCameras = 0;
-    memset((void*)&cap, 0, sizeof(v4l2_capability));
 
     if (!properties_array) {
         CAMHAL_LOGEB("invalid param: properties = 0x%p", properties_array);
@@ -1618,61 +1964,61 @@ extern "C" status_t V4LCameraAdapter_Capabilities(
         return BAD_VALUE;
     }
 
-    for (int i = 0; i < 5; i++) {
-        video_device_list[i] = device_list[i];
-    }
     //look for the connected video devices
-    detectVideoDevice(video_device_list, num_v4l_devices);
-
-    for (int i = 0; i < num_v4l_devices; i++) {
-        if ( (starting_camera + num_cameras_supported) < max_camera) {
-            sensorId = starting_camera + num_cameras_supported;
+    detectVideoDevices(devices);
 
-            CAMHAL_LOGDB("Opening device[%d] = %s..",i, video_device_list[i]);
-            if ((tempHandle = open(video_device_list[i], O_RDWR)) == -1) {
-                CAMHAL_LOGEB("Error while opening handle to V4L2 Camera(%s): %s",video_device_list[i], strerror(errno));
-                continue;
-            }
+    for (size_t i = 0; i < devices.size(); i++) {
+        if ( (starting_camera + num_cameras_supported) >= max_camera) {
+            // raise TI_CAMERAHAL_MAX_CAMERAS_SUPPORTED for more
+            CAMHAL_LOGEB("No room left for camera %s and %d more, %d cameras supported",
+                         devices[i].string(), devices.size() - i - 1, max_camera);
+            break;
+        }
 
-            ret = ioctl (tempHandle, VIDIOC_QUERYCAP, &cap);
-            if (ret < 0) {
-                CAMHAL_LOGEA("Error when querying the capabilities of the V4L Camera");
-                close(tempHandle);
-                continue;
-            }
+        sensorId = starting_camera + num_cameras_supported;
+        const char *path = devices[i].string();
 
-            //check for video capture devices
-            if ((cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) == 0) {
-                CAMHAL_LOGEA("Error while adapter initialization: video capture not supported.");
-                close(tempHandle);
-                continue;
-            }
+        CAMHAL_LOGDB("Opening device[%d] = %s..", i, path);
+        if ((tempHandle = open(path, O_RDWR)) == -1) {
+            CAMHAL_LOGEB("Error while opening handle to V4L2 Camera(%s): %s", path, strerror(errno));
+            continue;
+        }
 
-            strcpy(device, video_device_list[i]);
-            properties = properties_array + starting_camera + num_cameras_supported;
+        memset(&cap, 0, sizeof(v4l2_capability));
+        ret = ioctl (tempHandle, VIDIOC_QUERYCAP, &cap);
+        if (ret < 0) {
+            CAMHAL_LOGEB("Error when querying the capabilities of the V4L Camera %s", path);
+            close(tempHandle);
+            continue;
+        }
 
-            //fetch capabilities for this camera
-            ret = V4LCameraAdapter::getCaps( sensorId, properties, tempHandle );
-            if (ret < 0) {
-                CAMHAL_LOGEA("Error while getting capabilities.");
-                close(tempHandle);
-                continue;
-            }
+        //check for video capture devices
+        if (!isCaptureDevice(cap)) {
+            CAMHAL_LOGDB("Skipping %s: no streaming video capture", path);
+            close(tempHandle);
+            continue;
+        }
 
-            num_cameras_supported++;
+        properties = properties_array + sensorId;
 
+        //fetch capabilities for this camera
+        ret = V4LCameraAdapter::getCaps( sensorId, properties, tempHandle );
+        close(tempHandle);
+        if (ret < 0) {
+            CAMHAL_LOGEB("Error while getting capabilities of %s.", path);
+            continue;
         }
-        //For now exit this loop once a valid video capture device is found.
-        //TODO: find all V4L capture devices and it capabilities
-        break;
+
+        properties->set(CameraProperties::CAMERA_DEVICE_PATH, path);
+        CAMHAL_LOGDB("Camera %d is %s (%s)", sensorId, path, cap.card);
+
+        num_cameras_supported++;
     }//end of for() loop
 
     supportedCameras = num_cameras_supported;
     CAMHAL_LOGDB("Number of V4L cameras detected =%d", num_cameras_supported);
 
-EXIT:
     LOG_FUNCTION_NAME_EXIT;
-    close(tempHandle);
     return NO_ERROR;
 }
 
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file WorkerPool.cpp
+*
+* This file implements the fork/join pool shared by the image processing paths.
+*
+*/
+
+#include "WorkerPool.h"
+
+#include <unistd.h>
+
+namespace Ti {
+namespace Camera {
+
+// more threads than this only adds wakeup latency on the targets we run on
+static const int kMaxWorkerThreads = 8;
+
+WorkerPool::WorkerPool(int priority)
+    : mPriority(priority), mExiting(false) {
+}
+
+WorkerPool::~WorkerPool() {
+    deinitialize();
+}
+
+status_t WorkerPool::initialize(int threads) {
+    LOG_FUNCTION_NAME;
+
+    android::AutoMutex lock(mLock);
+
+    if ( !mThreads.isEmpty() ) {
+        return ALREADY_EXISTS;
+    }
+
+    if ( threads <= 0 ) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 1) ? (int) cpus - 1 : 0;
+    }
+    threads = min(threads, kMaxWorkerThreads);
+
+    mExiting = false;
+
+    for ( int i = 0; i < threads; i++ ) {
+        android::sp<WorkerThread> thread = new WorkerThread(this);
+        if ( !thread.get() ) {
+            CAMHAL_LOGEA("Couldn't create worker thread");
+            break;
+        }
+
+        status_t ret = thread->run("CameraWorker", mPriority);
+        if ( ret != NO_ERROR ) {
+            CAMHAL_LOGEB("Couldn't run worker thread %d", ret);
+            break;
+        }
+
+        mThreads.add(thread);
+    }
+
+    // a pool without threads still works, every job runs on the caller
+    CAMHAL_LOGDB("Worker pool started with %d threads", mThreads.size());
+
+    LOG_FUNCTION_NAME_EXIT;
+
+    return NO_ERROR;
+}
+
+void WorkerPool::deinitialize() {
+    LOG_FUNCTION_NAME;
+
+    android::Vector< android::sp<WorkerThread> > threads;
+
+    {
+        android::AutoMutex lock(mLock);
+        mExiting = true;
+        threads = mThreads;
+        mThreads.clear();
+        mWorkAvailable.broadcast();
+    }
+
+    for ( size_t i = 0; i < threads.size(); i++ ) {
+        threads[i]->requestExitAndWait();
+    }
+
+    LOG_FUNCTION_NAME_EXIT;
+}
+
+int WorkerPool::concurrency() const {
+    android::AutoMutex lock(mLock);
+    return mThreads.size() + 1;
+}
+
+WorkerPool::Batch * WorkerPool::claim(int &index) {
+    if ( mBatches.isEmpty() ) {
+        return NULL;
+    }
+
+    Batch *batch = mBatches[0];
+    index = batch->next++;
+    if ( batch->next == batch->count ) {
+        mBatches.removeAt(0);
+    }
+
+    return batch;
+}
+
+void WorkerPool::finish(Batch *batch) {
+    if ( --batch->pending == 0 ) {
+        batch->done.signal();
+    }
+}
+
+bool WorkerPool::workerLoop() {
+    android::AutoMutex lock(mLock);
+
+    int index = 0;
+    Batch *batch = claim(index);
+
+    if ( !batch ) {
+        if ( mExiting ) {
+            return false;
+        }
+        mWorkAvailable.wait(mLock);
+        return true;
+    }
+
+    mLock.unlock();
+    batch->job->run(index);
+    mLock.lock();
+
+    finish(batch);
+
+    return true;
+}
+
+status_t WorkerPool::execute(Job &job, int count) {
+    if ( count <= 0 ) {
+        return BAD_VALUE;
+    }
+
+    if ( count == 1 ) {
+        job.run(0);
+        return NO_ERROR;
+    }
+
+    Batch batch;
+    batch.job = &job;
+    batch.count = count;
+    batch.next = 0;
+    batch.pending = count;
+
+    android::AutoMutex lock(mLock);
+
+    mBatches.add(&batch);
+    if ( !mThreads.isEmpty() ) {
+        mWorkAvailable.broadcast();
+    }
+
+    // take parts of our own batch until the pool has claimed the rest
+    while ( batch.next < batch.count ) {
+        const int index = batch.next++;
+        if ( batch.next == batch.count ) {
+            for ( size_t i = 0; i < mBatches.size(); i++ ) {
+                if ( mBatches[i] == &batch ) {
+                    mBatches.removeAt(i);
+                    break;
+                }
+            }
+        }
+
+        mLock.unlock();
+        job.run(index);
+        mLock.lock();
+
+        finish(&batch);
+    }
+
+    while ( batch.pending > 0 ) {
+        batch.done.wait(mLock);
+    }
+
+    return NO_ERROR;
+}
+
+} // namespace Camera
+} // namespace Ti
@@ -20,6 +20,7 @@
 #define BASE_CAMERA_ADAPTER_H
 
 #include "CameraHal.h"
+#include "FrameRefTable.h"
 
 namespace Ti {
 namespace Camera {
@@ -70,6 +71,8 @@ public:
     //Retrieves the next Adapter state
     virtual AdapterState getNextState();
 
+    virtual bool isFrameHistoryEnabled();
+
     virtual status_t setSharedAllocator(camera_request_memory shmem_alloc) { mSharedAllocator = shmem_alloc; return NO_ERROR; };
 
     // Rolls the state machine back to INTIALIZED_STATE from the current state
@@ -176,21 +179,87 @@ protected:
     status_t resetFrameRefCount(CameraFrame &frame);
 
     //A couple of helper functions
-    void setFrameRefCountByType(CameraBuffer* frameBuf, CameraFrame::FrameType frameType, int refCount);
+    status_t setFrameRefCountByType(CameraBuffer* frameBuf, CameraFrame::FrameType frameType, int refCount);
     int getFrameRefCount(CameraBuffer* frameBuf);
     int getFrameRefCountByType(CameraBuffer* frameBuf, CameraFrame::FrameType frameType);
     int setInitFrameRefCount(CameraBuffer* buf, unsigned int mask);
     static const char* getLUTvalue_translateHAL(int Value, LUTtypeHAL LUT);
 
+    /**
+     * Zero shutter lag frame history.
+     *
+     * Adapters whose preview frames are full pictures enable the history;
+     * the latest preview frames sent are then held in mFrameRefs, so they
+     * stay out of the camera after their subscribers return them. The depth
+     * comes from persist.camera.zsl.history and is bounded by the preview
+     * buffers the camera can spare.
+     *
+     * takeHistoryFrame() hands out the frame closest to 'shutter' and
+     * removes it from the history; it stays held until the caller is done
+     * with it and calls releaseHistoryFrame().
+     */
+    void enableFrameHistory(bool enable);
+    status_t takeHistoryFrame(nsecs_t shutter, CameraFrame &frame);
+    void releaseHistoryFrame(CameraBuffer *buffer);
+    void flushFrameHistory();
+
 // private member functions
 private:
     status_t __sendFrameToSubscribers(CameraFrame* frame,
-                                      android::KeyedVector<int, frame_callback> *subscribers,
+                                      const android::KeyedVector<int, frame_callback> *subscribers,
                                       CameraFrame::FrameType frameType);
     status_t rollbackToPreviousState();
+    void addToHistory(const CameraFrame &frame);
 
 // protected data types and variables
 protected:
+    /**
+     * Subscribers of every frame and event type at one point in time.
+     *
+     * A published instance is never modified. enableMsgType() and
+     * disableMsgType() build a copy, change it and publish the copy;
+     * KeyedVector copies share their storage until written, so only the
+     * list that changes is duplicated. Frame dispatch takes a strong
+     * reference on the current instance and iterates it without a lock;
+     * a replaced instance is freed when its last dispatcher drops it.
+     */
+    struct Subscribers : public android::RefBase {
+        Subscribers() { }
+        Subscribers(const Subscribers &other);
+
+        android::KeyedVector<int, frame_callback> mFrame;
+        android::KeyedVector<int, frame_callback> mSnapshot;
+        android::KeyedVector<int, frame_callback> mFrameData;
+        android::KeyedVector<int, frame_callback> mVideo;
+        android::KeyedVector<int, frame_callback> mVideoIn;
+        android::KeyedVector<int, frame_callback> mImage;
+        android::KeyedVector<int, frame_callback> mRaw;
+        android::KeyedVector<int, event_callback> mFocus;
+        android::KeyedVector<int, event_callback> mZoom;
+        android::KeyedVector<int, event_callback> mShutter;
+        android::KeyedVector<int, event_callback> mMetadata;
+
+    private:
+        Subscribers & operator=(const Subscribers &);
+    };
+
+    //Keeps the subscribers current at construction alive for its scope
+    class SubscribersRef {
+    public:
+        SubscribersRef(const BaseCameraAdapter *adapter);
+        const Subscribers * operator->() const { return mSubscribers.get(); }
+    private:
+        SubscribersRef(const SubscribersRef &);
+        SubscribersRef & operator=(const SubscribersRef &);
+
+        android::sp<const Subscribers> mSubscribers;
+    };
+
+    friend class SubscribersRef;
+
+    //Replaces the published subscribers, called with mSubscriberLock held
+    void publishSubscribers(Subscribers *subscribers);
+
     enum FrameState {
         STOPPED = 0,
         RUNNING
@@ -219,65 +288,61 @@ protected:
 
 #endif
 
-    mutable android::Mutex mReturnFrameLock;
-
     //Lock protecting the Adapter state
     mutable android::Mutex mLock;
     AdapterState mAdapterState;
     AdapterState mNextState;
 
-    //Different frame subscribers get stored using these
-    android::KeyedVector<int, frame_callback> mFrameSubscribers;
-    android::KeyedVector<int, frame_callback> mSnapshotSubscribers;
-    android::KeyedVector<int, frame_callback> mFrameDataSubscribers;
-    android::KeyedVector<int, frame_callback> mVideoSubscribers;
-    android::KeyedVector<int, frame_callback> mVideoInSubscribers;
-    android::KeyedVector<int, frame_callback> mImageSubscribers;
-    android::KeyedVector<int, frame_callback> mRawSubscribers;
-    android::KeyedVector<int, event_callback> mFocusSubscribers;
-    android::KeyedVector<int, event_callback> mZoomSubscribers;
-    android::KeyedVector<int, event_callback> mShutterSubscribers;
-    android::KeyedVector<int, event_callback> mMetadataSubscribers;
+    //Currently published subscribers, holds one strong reference
+    Subscribers *mSubscribers;
+    //Dispatchers between loading mSubscribers and referencing it
+    mutable volatile int32_t mSubscriberReaders;
+    //Replaced subscribers a dispatcher may still be about to reference
+    android::Vector<Subscribers *> mRetiredSubscribers;
 
     //Preview buffer management data
     CameraBuffer *mPreviewBuffers;
     int mPreviewBufferCount;
     size_t mPreviewBuffersLength;
-    android::KeyedVector<CameraBuffer *, int> mPreviewBuffersAvailable;
     mutable android::Mutex mPreviewBufferLock;
 
-    //Snapshot buffer management data
-    android::KeyedVector<CameraBuffer *, int> mSnapshotBuffersAvailable;
-    mutable android::Mutex mSnapshotBufferLock;
-
     //Video buffer management data
     CameraBuffer *mVideoBuffers;
-    android::KeyedVector<CameraBuffer *, int> mVideoBuffersAvailable;
     int mVideoBuffersCount;
     size_t mVideoBuffersLength;
     mutable android::Mutex mVideoBufferLock;
 
     //Image buffer management data
     CameraBuffer *mCaptureBuffers;
-    android::KeyedVector<CameraBuffer *, int> mCaptureBuffersAvailable;
     int mCaptureBuffersCount;
     size_t mCaptureBuffersLength;
     mutable android::Mutex mCaptureBufferLock;
 
     //Metadata buffermanagement
     CameraBuffer *mPreviewDataBuffers;
-    android::KeyedVector<CameraBuffer *, int> mPreviewDataBuffersAvailable;
     int mPreviewDataBuffersCount;
     size_t mPreviewDataBuffersLength;
     mutable android::Mutex mPreviewDataBufferLock;
 
     //Video input buffer management data (used for reproc pipe)
     CameraBuffer *mVideoInBuffers;
-    android::KeyedVector<CameraBuffer *, int> mVideoInBuffersAvailable;
     mutable android::Mutex mVideoInBufferLock;
 
+    //Reference counts of all buffers above, snapshots use the preview buffers
+    FrameRefTable mFrameRefs;
+
+    //Preview frames held for zero shutter lag captures, oldest first
+    android::Mutex mHistoryLock;
+    android::Vector<CameraFrame> mHistory;
+    //Written under mHistoryLock, also read without it for every frame
+    volatile int32_t mHistoryEnabled;
+    int mHistoryDepth;
+    //Preview buffers that can be held without starving the camera
+    int mHistoryLimit;
+
     Utils::MessageQueue mFrameQ;
     Utils::MessageQueue mAdapterQ;
+    //Serializes subscription changes, dispatch doesn't take it
     mutable android::Mutex mSubscriberLock;
     ErrorNotifier *mErrorNotifier;
     release_image_buffers_callback mReleaseImageBuffersCallback;
@@ -298,6 +363,7 @@ protected:
 #endif
 
     android::KeyedVector<void *, CameraFrame *> mFrameQueue;
+    mutable android::Mutex mFrameQueueLock;
 };
 
 } // namespace Camera
@@ -59,6 +59,9 @@
 #include "Semaphore.h"
 #include "CameraProperties.h"
 #include "SensorListener.h"
+#include "WorkerPool.h"
+#include "EncoderContextPool.h"
+#include "EncoderScheduler.h"
 
 //temporarily define format here
 #define HAL_PIXEL_FORMAT_TI_NV12 0x100
@@ -121,6 +124,7 @@ extern const char * const kRawImagesOutputDirPath;
 extern const char * const kYuvImagesOutputDirPath;
 #endif
 #define V4L_CAMERA_NAME_USB     "USBCAMERA"
+#define REPLAY_CAMERA_NAME      "REPLAYCAMERA"
 #define OMX_CAMERA_NAME_OV      "OV5640"
 #define OMX_CAMERA_NAME_SONY    "IMX060"
 #ifdef MOTOROLA_CAMERA
@@ -135,6 +139,8 @@ class CameraHal;
 class CameraFrame;
 class CameraHalEvent;
 class DisplayFrame;
+class NV12Scaler;
+struct RuntimeParameter;
 
 class FpsRange {
 public:
@@ -405,6 +411,7 @@ class CameraFrame
         HAS_EXIF_DATA = 0x1 << 1,
         FORMAT_YUV422I_YUYV = 0x1 << 2,
         FORMAT_YUV422I_UYVY = 0x1 << 3,
+        ENCODE_RAW_YUV420SP_TO_JPEG = 0x1 << 4,
     };
 
     //default contrustor
@@ -667,7 +674,9 @@ public:
         {
         NOTIFIER_CMD_PROCESS_EVENT,
         NOTIFIER_CMD_PROCESS_FRAME,
-        NOTIFIER_CMD_PROCESS_ERROR
+        NOTIFIER_CMD_PROCESS_ERROR,
+        ///Zoom progress, only the latest queued one is delivered
+        NOTIFIER_CMD_PROCESS_ZOOM_EVENT
         };
 
     enum NotifierState
@@ -705,12 +714,16 @@ public:
     //API for enabling/disabling measurement data
     void setMeasurements(bool enable);
 
+    ///Threads used to split image processing such as video frame scaling
+    void setWorkerPool(const android::sp<WorkerPool> &pool);
+
     //thread loops
     bool notificationThread();
 
     ///Notification callback functions
     static void frameCallbackRelay(CameraFrame* caFrame);
     static void eventCallbackRelay(CameraHalEvent* chEvt);
+    static void discardEvent(Utils::Message *msg);
     void frameCallback(CameraFrame* caFrame);
     void eventCallback(CameraHalEvent* chEvt);
     void flushAndReturnFrames();
@@ -734,6 +747,7 @@ public:
     status_t useMetaDataBufferMode(bool enable);
 
     void EncoderDoneCb(void*, void*, CameraFrame::FrameType type, void* cookie1, void* cookie2, void *cookie3);
+    void EncoderCanceledCb(void* cookie1, void* cookie2);
 
     void useVideoBuffers(bool useVideoBuffers);
 
@@ -834,6 +848,13 @@ private:
     int mVideoWidth;
     int mVideoHeight;
 
+    // preview to video resize, tables kept across frames
+    NV12Scaler *mVideoScaler;
+    android::sp<WorkerPool> mWorkerPool;
+    // compressors and buffers reused by the software JPEG path
+    android::sp<EncoderContextPool> mEncoderContexts;
+    android::sp<EncoderScheduler> mEncoderScheduler;
+
     bool mExternalLocking;
 
 };
@@ -1005,6 +1026,10 @@ public:
     //Retrieves the next Adapter state
     virtual AdapterState getNextState() = 0;
 
+    // Whether pictures come from the held preview frames, in which case
+    // preview keeps streaming through the capture
+    virtual bool isFrameHistoryEnabled() = 0;
+
     // Receive orientation events from CameraHal
     virtual void onOrientationEvent(uint32_t orientation, uint32_t tilt) = 0;
 
@@ -1389,6 +1414,12 @@ private:
     bool isParameterValid(int param, const char *supportedParams);
     status_t doesSetParameterNeedUpdate(const char *new_param, const char *old_params, bool &update);
 
+    //Full validation and handling of every parameter, see setParameters()
+    int applyParameters(const android::CameraParameters& params);
+    int applyRuntimeParameters(const android::CameraParameters& params,
+                               const android::Vector<const RuntimeParameter *>& changed);
+    unsigned int parameterState();
+
     /** Initialize default parameters */
     void initDefaultParameters();
 
@@ -1501,9 +1532,17 @@ private:
 
     android::sp<SensorListener> mSensorListener;
 
+    ///Shared by the image processing paths, created once per HAL instance
+    android::sp<WorkerPool> mWorkerPool;
+
     void* mCameraAdapterHandle;
 
     android::CameraParameters mParameters;
+    //Parameters of the last full setParameters(), the mParameters and the
+    //state it left; lets later calls handle only the keys that changed
+    android::String8 mAppliedParameters;
+    android::String8 mResultParameters;
+    unsigned int mAppliedState;
     bool mPreviewRunning;
     bool mPreviewStateOld;
     bool mRecordingEnabled;
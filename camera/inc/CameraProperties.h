@@ -22,6 +22,7 @@
 
 #include <utils/KeyedVector.h>
 #include <utils/String8.h>
+#include <utils/Vector.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <errno.h>
@@ -36,9 +37,12 @@ namespace Ti {
 namespace Camera {
 
 #ifndef MAX_CAMERAS_SUPPORTED
-#define MAX_CAMERAS_SUPPORTED 3
+#define MAX_CAMERAS_SUPPORTED 8
+#endif
+// OMX cameras share the ISP, at most one of them is open whatever this says
+#ifndef MAX_SIMUL_CAMERAS_SUPPORTED
+#define MAX_SIMUL_CAMERAS_SUPPORTED 4
 #endif
-#define MAX_SIMUL_CAMERAS_SUPPORTED 1
 #define MAX_PROP_NAME_LENGTH 50
 #define MAX_PROP_VALUE_LENGTH 2048
 
@@ -55,6 +59,8 @@ enum OperatingMode {
     MODE_MAX
 };
 
+class CapabilitiesCache;
+
 // Class that handles the Camera Properties
 class CameraProperties
 {
@@ -63,6 +69,10 @@ public:
     static const char CAMERA_NAME[];
     static const char CAMERA_SENSOR_INDEX[];
     static const char CAMERA_SENSOR_ID[];
+    // device node of a V4L camera
+    static const char CAMERA_DEVICE_PATH[];
+    // camera firmware the capabilities were queried from
+    static const char FIRMWARE_VERSION[];
     static const char ORIENTATION_INDEX[];
     static const char FACING_INDEX[];
     static const char SUPPORTED_PREVIEW_SIZES[];
@@ -187,6 +197,38 @@ public:
 
     static const char CAP_MODE_VALUES[];
 
+    // Properties CameraHal checks on every setParameters(). They are parsed
+    // once when set and kept next to their strings, so checking a value
+    // against them is an array lookup and a scan of parsed entries.
+    enum PropertyKey {
+        PROP_CAMERA_NAME = 0,
+        PROP_SUPPORTED_PREVIEW_SIZES,
+        PROP_SUPPORTED_PREVIEW_SUBSAMPLED_SIZES,
+        PROP_SUPPORTED_PREVIEW_TOPBOTTOM_SIZES,
+        PROP_SUPPORTED_PREVIEW_SIDEBYSIDE_SIZES,
+        PROP_SUPPORTED_PREVIEW_FORMATS,
+        PROP_SUPPORTED_PICTURE_SIZES,
+        PROP_SUPPORTED_PICTURE_SUBSAMPLED_SIZES,
+        PROP_SUPPORTED_PICTURE_TOPBOTTOM_SIZES,
+        PROP_SUPPORTED_PICTURE_SIDEBYSIDE_SIZES,
+        PROP_SUPPORTED_PICTURE_FORMATS,
+        PROP_SUPPORTED_IPP_MODES,
+        PROP_SUPPORTED_FOCUS_MODES,
+        PROP_SUPPORTED_EXPOSURE_MODES,
+        PROP_SUPPORTED_WHITE_BALANCE,
+        PROP_SUPPORTED_ANTIBANDING,
+        PROP_SUPPORTED_ISO_VALUES,
+        PROP_SUPPORTED_SCENE_MODES,
+        PROP_SUPPORTED_FLASH_MODES,
+        PROP_SUPPORTED_EFFECTS,
+        PROP_VNF_SUPPORTED,
+        PROP_VSTAB_SUPPORTED,
+        PROP_SUPPORTED_GBCE,
+        PROP_SUPPORTED_GLBCE,
+        PROP_MECHANICAL_MISALIGNMENT_CORRECTION_SUPPORTED,
+        PROPERTY_KEY_COUNT
+    };
+
     CameraProperties();
     ~CameraProperties();
 
@@ -195,7 +237,7 @@ public:
     {
         public:
 
-            Properties()
+            Properties() : mCurrentMode(MODE_HIGH_QUALITY)
             {
             }
 
@@ -207,6 +249,16 @@ public:
             void set(const char *prop, int value);
             const char* get(const char * prop) const;
             int getInt(const char * prop) const;
+
+            // typed access, see PropertyKey
+            const char* get(PropertyKey key) const;
+            // "true" properties
+            bool isEnabled(PropertyKey key) const;
+            // value is one of the entries of a comma separated list
+            bool hasValue(PropertyKey key, const char *value) const;
+            // WxH is one of the entries of a size list
+            bool hasSize(PropertyKey key, int width, int height) const;
+
             void setSensorIndex(int idx);
             void setMode(OperatingMode mode);
             OperatingMode getMode() const;
@@ -217,8 +269,24 @@ public:
             const char* valueAt(const unsigned int) const;
 
         private:
+            // reads and restores every operating mode at once
+            friend class CapabilitiesCache;
+
+            struct TypedValue {
+                TypedValue() : enabled(false) {}
+
+                android::String8 value;
+                bool enabled;
+                // list entries, sizes as width and height pairs
+                android::Vector<android::String8> entries;
+                android::Vector<int> sizes;
+            };
+
+            void parse(PropertyKey key, const char *value);
+
             OperatingMode mCurrentMode;
             android::DefaultKeyedVector<android::String8, android::String8> mProperties[MODE_MAX];
+            TypedValue mTyped[MODE_MAX][PROPERTY_KEY_COUNT];
 
     };
 
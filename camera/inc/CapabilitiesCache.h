@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CapabilitiesCache.h
+*
+* On disk cache of the probed camera capabilities.
+*
+*/
+
+#ifndef CAMERA_CAPABILITIES_CACHE_H
+#define CAMERA_CAPABILITIES_CACHE_H
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "CameraProperties.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Stores the properties of every probed camera in a binary file, so the
+ * next media server start can skip bringing up the camera component just
+ * to ask it for capabilities.
+ *
+ * The file starts with a format version and the identity of the system it
+ * was written on: the build fingerprint, the GNU build id of the HAL
+ * library itself, so a HAL pushed onto an unchanged system is caught too,
+ * the size and time stamp of the camera firmware image and the number,
+ * total size and latest time stamp of the DCC tuning files. Each camera
+ * record is keyed by its sensor index and sensor id and carries the
+ * properties of all operating modes, including the firmware version the
+ * component reported. A CRC32 covers the whole file; any mismatch makes
+ * load() fail and the caller probe again.
+ *
+ * The firmware version can only be asked from a running component, so it
+ * is checked when a camera opens, which invalidates the cache if the
+ * firmware changed behind an image of the same size and time stamp.
+ *
+ * Setting the property "persist.camera.capscache" to 0 disables the cache.
+ */
+class CapabilitiesCache
+{
+public:
+    static const char DEFAULT_PATH[];
+
+    explicit CapabilitiesCache(const char *path = DEFAULT_PATH);
+
+    bool isEnabled() const;
+
+    /**
+     * Fills properties[0 .. count) from the cache. On failure the
+     * properties are left empty and count is 0.
+     */
+    status_t load(CameraProperties::Properties *properties, int maxCameras, int &count);
+
+    // Replaces the cache with properties[0 .. count).
+    status_t store(const CameraProperties::Properties *properties, int count);
+
+    // Removes the cache file; the next load() fails.
+    void invalidate();
+
+private:
+    typedef android::Vector<uint8_t> Buffer;
+
+    enum {
+        // hex of a build id of up to 31 bytes
+        HAL_BUILD_ID_MAX = 64
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;
+        uint32_t crc;
+        uint32_t cameraCount;
+        uint32_t firmwareSize;
+        int64_t firmwareTime;
+        uint32_t dccCount;
+        uint32_t dccSize;
+        int64_t dccTime;
+        char build[PROPERTY_VALUE_MAX];
+        char halBuild[HAL_BUILD_ID_MAX];
+    };
+
+    void fillIdentity(Header &header) const;
+
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+    static void write(Buffer &buffer, uint32_t value);
+    static void write(Buffer &buffer, const android::String8 &value);
+    static bool read(const Buffer &buffer, size_t &offset, uint32_t &value);
+    static bool read(const Buffer &buffer, size_t &offset, android::String8 &value);
+
+    static void encode(Buffer &buffer, const CameraProperties::Properties &properties);
+    static bool decode(const Buffer &buffer, size_t &offset, CameraProperties::Properties &properties);
+
+    android::String8 mPath;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_CAPABILITIES_CACHE_H
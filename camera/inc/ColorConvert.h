@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ColorConvert.h
+*
+* Pixel format conversion and resampling row kernels shared by the camera HAL.
+*
+* Every kernel exists in a scalar version and, where the target allows it,
+* in NEON and SSE2 versions. The backend is picked once at runtime from the
+* CPU features, so the same binary runs on every SoC and the kernels can be
+* exercised on x86 build hosts. SIMD versions handle any width; the
+* remainder that does not fill a vector is finished by the scalar code.
+*
+* This header deliberately depends on nothing but the C library so the
+* kernels can be built outside of the HAL (benchmarks, host tests).
+*
+*/
+
+#ifndef CAMERA_COLOR_CONVERT_H
+#define CAMERA_COLOR_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Ti {
+namespace Camera {
+namespace ColorConvert {
+
+enum Backend {
+    BACKEND_AUTO,
+    BACKEND_SCALAR,
+    BACKEND_NEON,
+    BACKEND_SSE2,
+    BACKEND_MAX
+};
+
+/**
+ * Row kernels. 'width' is always in pixels, chroma kernels take the number
+ * of interleaved chroma pairs (width / 2 for 4:2:x formats).
+ */
+struct Kernels {
+    Backend backend;
+    const char *name;
+
+    // UVUV.. -> VUVU..
+    void (*swapUVRow)(const uint8_t *src, uint8_t *dst, size_t pairs);
+
+    // UVUV.. -> UU.. + VV..
+    void (*splitUVRow)(const uint8_t *src, uint8_t *dstU, uint8_t *dstV, size_t pairs);
+
+    // UU.. + VV.. -> UVUV..
+    void (*mergeUVRow)(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dst, size_t pairs);
+
+    // one YUYV/UYVY row -> Y row and, if dstUV is not NULL, NV12 chroma row
+    void (*yuyvToNV12Row)(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width);
+    void (*uyvyToNV12Row)(const uint8_t *src, uint8_t *dstY, uint8_t *dstUV, size_t width);
+
+    // one YUYV/UYVY row -> packed YUV444 (Y, Cb, Cr per pixel)
+    void (*yuyvToYUV444Row)(const uint8_t *src, uint8_t *dst, size_t width);
+    void (*uyvyToYUV444Row)(const uint8_t *src, uint8_t *dst, size_t width);
+
+    // one Y row plus its NV21 chroma row -> packed YUV444
+    void (*nv21ToYUV444Row)(const uint8_t *y, const uint8_t *vu, uint8_t *dst, size_t width);
+
+    // dst = (row0 * (256 - fraction) + row1 * fraction) / 256, fraction in [0, 256]
+    void (*interpolateRow)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                           size_t width, int fraction);
+
+    // sums[i] += src[i], used by box filters; callers keep the row count <= 257
+    void (*accumulateRow)(const uint8_t *src, uint16_t *sums, size_t width);
+};
+
+/**
+ * Returns the kernels of the active backend. The first call probes the CPU,
+ * later calls are a single load.
+ */
+const Kernels & kernels();
+
+/**
+ * Forces a backend; BACKEND_AUTO restores the probed one. Returns false and
+ * keeps the current selection if the backend is not available in this
+ * build or on this CPU. Meant for benchmarks and verification only.
+ */
+bool setBackend(Backend backend);
+
+/**
+ * Returns the kernels of a given backend or NULL if it is not available.
+ */
+const Kernels * kernelsFor(Backend backend);
+
+/*--------------------Frame helpers-----------------------------*/
+
+/**
+ * NV12 with arbitrary source stride -> tightly packed NV21.
+ */
+void nv12ToNV21(const uint8_t *srcY, const uint8_t *srcUV, size_t srcStride,
+                uint8_t *dst, int width, int height);
+
+/**
+ * NV12 with arbitrary source stride -> YV12 with the Android 16 byte aligned
+ * luma and chroma strides.
+ */
+void nv12ToYV12(const uint8_t *srcY, const uint8_t *srcUV, size_t srcStride,
+                uint8_t *dst, int width, int height);
+
+/**
+ * YUYV/UYVY -> NV12. Chroma of even rows is kept, odd rows are dropped.
+ * srcStride and dstStride are in bytes; dstUV must start a plane laid out
+ * with dstStride as well.
+ */
+void yuyvToNV12(const uint8_t *src, size_t srcStride,
+                uint8_t *dstY, uint8_t *dstUV, size_t dstStride,
+                int width, int height);
+void uyvyToNV12(const uint8_t *src, size_t srcStride,
+                uint8_t *dstY, uint8_t *dstUV, size_t dstStride,
+                int width, int height);
+
+} // namespace ColorConvert
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_COLOR_CONVERT_H
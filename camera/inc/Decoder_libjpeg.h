@@ -18,6 +18,7 @@
 #define ANDROID_CAMERA_HARDWARE_DECODER_LIBJPEG_H
 
 #include "CameraHal.h"
+#include "NV12_resize.h"
 
 extern "C" {
 #include "jhead.h"
@@ -27,6 +28,7 @@ extern "C" {
 
 }
 
+struct jpeg_decompress_struct;
 
 namespace Ti {
 namespace Camera {
@@ -42,13 +44,35 @@ public:
     static int appendDHT(unsigned char *jpeg_src, int filled_len, unsigned char *jpeg_with_dht_buffer, int buff_size);
     bool decode(unsigned char *jpeg_src, int filled_len, unsigned char *nv12_buffer, int stride);
 
+    /**
+     * Decodes at 1/scale_denom of the coded size (1, 2, 4 or 8) using
+     * libjpeg's scaled IDCT. If the decoded picture is not width x height
+     * it is resampled into the output; 0 keeps the decoded size.
+     */
+    bool decode(unsigned char *jpeg_src, int filled_len, unsigned char *nv12_buffer, int stride,
+                int width, int height, int scale_denom);
+
+    // Largest scale denominator whose output still covers dst_width x dst_height.
+    static int scaleDenomFor(int src_width, int src_height, int dst_width, int dst_height);
+    static int scaledSize(int size, int scale_denom);
+
 private:
+    // rows of one iMCU row of a component with up to 2x vertical sampling
+    enum { MAX_RAW_ROWS = 16 };
+    enum { MAX_SCALE_DENOM = 8 };
+
     void release();
-    unsigned char **Y_Plane;
-    unsigned char **U_Plane;
-    unsigned char **V_Plane;
-    unsigned char *UV_Plane;
-    unsigned int mWidth, mHeight;
+    unsigned char *reserveScratch(size_t size);
+    bool readRawNV12(jpeg_decompress_struct *cinfo, unsigned char *nv12_buffer, int stride);
+    bool resizeNV12(unsigned char *src, int src_stride, int src_width, int src_height,
+                    unsigned char *dst, int dst_stride, int dst_width, int dst_height);
+
+    unsigned char *mScratch;
+    size_t mScratchSize;
+    // decoded picture waiting to be resampled into the output
+    unsigned char *mFrame;
+    size_t mFrameSize;
+    NV12Scaler mScaler;
 };
 
 } // namespace Camera
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file EncoderContextPool.h
+*
+* Reusable state of the libjpeg encoder. The implementation lives in
+* Encoder_libjpeg.cpp next to the compressor it manages.
+*
+*/
+
+#ifndef ENCODER_CONTEXT_POOL_H
+#define ENCODER_CONTEXT_POOL_H
+
+#include <utils/threads.h>
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include "Common.h"
+
+namespace Ti {
+namespace Camera {
+
+class EncoderContext;
+
+/**
+ * Keeps libjpeg compressors together with their scratch memory (raw plane
+ * rows, resize tables and buffer, slice buffers) between pictures, so a
+ * burst doesn't allocate and fault in the same memory for every shot.
+ * Buffers grow to the largest picture seen and stay that size.
+ *
+ * It also recycles the plain buffers a capture needs around the encoder,
+ * such as parameter blocks and thumbnail destinations.
+ */
+class EncoderContextPool : public android::RefBase
+{
+public:
+    EncoderContextPool();
+    virtual ~EncoderContextPool();
+
+    // Returns an idle context or a new one; NULL when out of memory.
+    EncoderContext * acquire();
+    void release(EncoderContext *context);
+
+    /**
+     * Returns a buffer of at least 'size' bytes, NULL when out of memory.
+     * The buffer keeps the pool alive until it is handed back with
+     * releaseBuffer(), which may happen on any thread.
+     */
+    void * acquireBuffer(size_t size);
+    static void releaseBuffer(void *buffer);
+
+private:
+    struct BufferHeader;
+
+    EncoderContextPool(const EncoderContextPool &);
+    EncoderContextPool & operator=(const EncoderContextPool &);
+
+    void recycle(BufferHeader *header);
+
+    android::Mutex mLock;
+    android::Vector<EncoderContext *> mIdle;
+    android::Vector<BufferHeader *> mIdleBuffers;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // ENCODER_CONTEXT_POOL_H
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file EncoderScheduler.h
+*
+* Fixed set of threads running the software JPEG encodes of the HAL.
+*
+*/
+
+#ifndef CAMERA_ENCODER_SCHEDULER_H
+#define CAMERA_ENCODER_SCHEDULER_H
+
+#include <utils/threads.h>
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include "Common.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Runs encode jobs on a fixed number of threads from a bounded queue.
+ *
+ * submit() blocks while the scheduler already holds 'capacity' jobs, queued
+ * or running. Every job pins a captured frame and its output buffer, so
+ * this caps the memory a burst can take and pushes back on the capture
+ * path, which stops getting its buffers back, instead of piling up work.
+ *
+ * Jobs are picked by priority first and in submission order within a
+ * priority. Every submitted job runs exactly once: flush() and
+ * deinitialize() cancel jobs and then run them, so their completion
+ * callbacks still release what they hold.
+ */
+class EncoderScheduler : public android::RefBase
+{
+public:
+    enum Priority {
+        PRIORITY_HIGH,  // single shots, someone waits for the picture
+        PRIORITY_LOW,   // burst frames
+        PRIORITY_COUNT
+    };
+
+    class Job : public virtual android::RefBase {
+    public:
+        virtual ~Job() {}
+
+        // Does the work; returns early if cancel() was called before or during.
+        virtual void process() = 0;
+        virtual void cancel() = 0;
+    };
+
+    // Encode threads run at 'priority', below the display and preview
+    // threads by default so software encodes don't delay preview.
+    explicit EncoderScheduler(int priority = android::PRIORITY_DEFAULT);
+    virtual ~EncoderScheduler();
+
+    /**
+     * Starts 'threads' encode threads accepting up to 'capacity' jobs;
+     * 'capacity' is raised to 'threads' if smaller.
+     */
+    status_t initialize(int threads, size_t capacity);
+
+    // Cancels everything and stops the threads; later jobs are refused.
+    void deinitialize();
+
+    /**
+     * Queues a job, waiting for room if the scheduler is full. A job that
+     * can't be accepted is canceled and processed on the caller's thread,
+     * and an error is returned.
+     */
+    status_t submit(const android::sp<Job> &job, Priority priority);
+
+    // Cancels queued and running jobs and waits until all of them finished.
+    void flush();
+
+    // Jobs queued or running.
+    size_t pending() const;
+
+private:
+    class EncoderThread : public android::Thread {
+    public:
+        EncoderThread(EncoderScheduler *scheduler)
+            : Thread(false), mScheduler(scheduler) { }
+        virtual bool threadLoop() {
+            return mScheduler->threadLoop();
+        }
+    private:
+        EncoderScheduler *mScheduler;
+    };
+
+    friend class EncoderThread;
+
+    EncoderScheduler(const EncoderScheduler &);
+    EncoderScheduler & operator=(const EncoderScheduler &);
+
+    bool threadLoop();
+    // Removes the next job by priority; called with mLock held.
+    android::sp<Job> dequeue();
+
+    mutable android::Mutex mLock;
+    android::Condition mJobAvailable;
+    android::Condition mRoomAvailable;
+    android::Condition mIdle;
+    android::Vector< android::sp<Job> > mQueues[PRIORITY_COUNT];
+    android::Vector< android::sp<Job> > mRunning;
+    android::Vector< android::sp<EncoderThread> > mThreads;
+    size_t mCapacity;
+    size_t mQueued;
+    const int mPriority;
+    bool mExiting;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_ENCODER_SCHEDULER_H
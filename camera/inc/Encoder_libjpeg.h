@@ -36,8 +36,7 @@ extern "C" {
 }
 
 #include "CameraHal.h"
-
-#define CANCEL_TIMEOUT 5000000 // 5 seconds
+#include "FrameTracer.h"
 
 namespace Ti {
 namespace Camera {
@@ -109,6 +108,14 @@ class ExifElementsTable {
         void insertExifToJpeg(unsigned char* jpeg, size_t jpeg_size);
         status_t insertExifThumbnailImage(const char*, int);
         void saveJpeg(unsigned char* picture, size_t jpeg_size);
+        /**
+         * Serializes the table and an optional JPEG thumbnail as a complete
+         * APP1 segment (marker included) at 'dst'. Returns the segment size,
+         * or 0 if it does not fit 'size' bytes. A NULL 'dst' only returns
+         * the size the segment will have.
+         */
+        size_t writeApp1(uint8_t* dst, size_t size,
+                         const uint8_t* thumb, size_t thumb_size) const;
         static const char* degreesToExifOrientation(unsigned int);
         static void stringToRational(const char*, unsigned int*, unsigned int*);
         static bool isAsciiTag(const char* tag);
@@ -123,7 +130,7 @@ class ExifElementsTable {
 #endif
 };
 
-class Encoder_libjpeg : public android::Thread {
+class Encoder_libjpeg : public EncoderScheduler::Job {
     /* public member types and variables */
     public:
         struct params {
@@ -140,6 +147,7 @@ class Encoder_libjpeg : public android::Thread {
             int start_offset;
             const char* format;
             size_t jpeg_size;
+            size_t header_size; // bytes of dst ahead of the scan data written by the encoder
          };
     /* public member functions */
     public:
@@ -150,76 +158,91 @@ class Encoder_libjpeg : public android::Thread {
                         void* cookie1,
                         void* cookie2,
                         void* cookie3, void *cookie4)
-            : android::Thread(false), mMainInput(main_jpeg), mThumbnailInput(tn_jpeg), mCb(cb),
+            : mMainInput(main_jpeg), mThumbnailInput(tn_jpeg), mCb(cb),
               mCancelEncoding(false), mCookie1(cookie1), mCookie2(cookie2), mCookie3(cookie3), mCookie4(cookie4),
-              mType(type), mThumb(NULL) {
-            this->incStrong(this);
-            mCancelSem.Create(0);
+              mType(type), mExif(NULL), mFrameTimestamp(0) {
         }
 
         ~Encoder_libjpeg() {
             CAMHAL_LOGVB("~Encoder_libjpeg(%p)", this);
         }
 
-        virtual bool threadLoop() {
-            size_t size = 0;
-            if (mThumbnailInput) {
-                // start thread to encode thumbnail
-                mThumb = new Encoder_libjpeg(mThumbnailInput, NULL, NULL, mType, NULL, NULL, NULL, NULL);
-                mThumb->run();
+        /**
+         * Encodes the thumbnail, then the main image, and reports both to
+         * the callback. A canceled encoder skips the work but still calls
+         * back, with 'canceled' set, so the owner can release the cookies.
+         */
+        virtual void process() {
+            FrameTracer::mark(FrameTracer::STAGE_ENCODE_START, mFrameTimestamp);
+
+            if (!mCancelEncoding && mThumbnailInput) {
+                // thumbnail first: it is small, and with EXIF it goes into
+                // APP1 ahead of the main image
+                encode(mThumbnailInput);
             }
 
-            // encode our main image
-            size = encode(mMainInput);
-
-            // signal cancel semaphore incase somebody is waiting
-            mCancelSem.Signal();
+            if (!mCancelEncoding) {
+                if (mExif) {
+                    encodeWithExif(mMainInput);
+                } else {
+                    encode(mMainInput);
+                }
+            }
 
-            // check if it is main jpeg thread
-            if(mThumb.get()) {
-                // wait until tn jpeg thread exits.
-                mThumb->join();
-                mThumb.clear();
-                mThumb = NULL;
+            if (!mCancelEncoding) {
+                FrameTracer::mark(FrameTracer::STAGE_ENCODE_END, mFrameTimestamp);
             }
 
             if(mCb) {
                 mCb(mMainInput, mThumbnailInput, mType, mCookie1, mCookie2, mCookie3, mCookie4, mCancelEncoding);
             }
-
-            // encoder thread runs, self-destructs, and then exits
-            this->decStrong(this);
-            return false;
         }
 
-        void cancel() {
+        virtual void cancel() {
            mCancelEncoding = true;
-           if (mThumb.get()) {
-               mThumb->cancel();
-               mCancelSem.WaitTimeout(CANCEL_TIMEOUT);
-           }
         }
 
-        void getCookies(void **cookie1, void **cookie2, void **cookie3) {
-            if (cookie1) *cookie1 = mCookie1;
-            if (cookie2) *cookie2 = mCookie2;
-            if (cookie3) *cookie3 = mCookie3;
+        // Lets the main image be compressed in parallel slices; call before submitting
+        void setWorkerPool(const android::sp<WorkerPool>& pool) {
+            mWorkerPool = pool;
+        }
+
+        // Compressors and buffers to reuse; call before submitting
+        void setContextPool(const android::sp<EncoderContextPool>& pool) {
+            mContextPool = pool;
+        }
+
+        /**
+         * Writes SOI and the EXIF APP1 segment, thumbnail included, in
+         * front of the main image so the result needs no further copies.
+         * The table is not owned; call before submitting.
+         */
+        void setExif(const ExifElementsTable* exif) {
+            mExif = exif;
+        }
+
+        // Timestamp of the source frame, traced by FrameTracer; call before submitting
+        void setFrameTimestamp(nsecs_t timestamp) {
+            mFrameTimestamp = timestamp;
         }
 
     private:
         params* mMainInput;
         params* mThumbnailInput;
         encoder_libjpeg_callback_t mCb;
-        bool mCancelEncoding;
+        volatile bool mCancelEncoding;
         void* mCookie1;
         void* mCookie2;
         void* mCookie3;
         void* mCookie4;
         CameraFrame::FrameType mType;
-        android::sp<Encoder_libjpeg> mThumb;
-        Utils::Semaphore mCancelSem;
+        android::sp<WorkerPool> mWorkerPool;
+        android::sp<EncoderContextPool> mContextPool;
+        const ExifElementsTable* mExif;
+        nsecs_t mFrameTimestamp;
 
-        size_t encode(params*);
+        size_t encode(params*, size_t header_size = 0);
+        size_t encodeWithExif(params*);
 };
 
 } // namespace Camera
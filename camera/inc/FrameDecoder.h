@@ -104,10 +104,21 @@ private:
 };
 
 struct DecoderParameters {
+    DecoderParameters()
+    : width(0), height(0), inputBufferCount(0), outputBufferCount(0),
+      outputStride(0), decodeThreads(0), scaleDenom(1) {
+    }
+
     int width;
     int height;
     int inputBufferCount;
     int outputBufferCount;
+    // stride of output buffers that don't carry their own
+    int outputStride;
+    // frames decoded at once by decoders supporting it, <= 1 decodes inline
+    int decodeThreads;
+    // IDCT downscaling of input frames larger than width x height (1, 2, 4, 8)
+    int scaleDenom;
 };
 
 class FrameDecoder {
@@ -152,6 +163,18 @@ protected:
     virtual void doFlush() = 0;
     virtual void doRelease() = 0;
 
+    /**
+     * Frame-parallel decoding. Decoders returning true from
+     * canDecodeConcurrently() get doDecodeFrame() called from
+     * mParams.decodeThreads threads, each with its own 'slot' in
+     * [0, decodeThreads), instead of doProcessInputBuffer(). It runs
+     * without any lock held; the in and out buffers are owned by the call
+     * until it returns. Output buffers are still handed out in the order
+     * their input buffers were queued.
+     */
+    virtual bool canDecodeConcurrently() const { return false; }
+    virtual bool doDecodeFrame(MediaBuffer& in, MediaBuffer& out, int slot) { return false; }
+
     DecoderParameters mParams;
 
     android::Vector<int> mInQueue;
@@ -163,8 +186,47 @@ protected:
     CameraHal* mCameraHal;
 
 private:
+    struct DecodeJob {
+        int inIndex;
+        int outIndex;
+    };
+
+    class DecodeThread : public android::Thread {
+    public:
+        DecodeThread(FrameDecoder* decoder, int slot)
+        : Thread(false), mDecoder(decoder), mSlot(slot) {
+        }
+        virtual bool threadLoop() {
+            return mDecoder->decodeLoop(mSlot);
+        }
+    private:
+        FrameDecoder* mDecoder;
+        int mSlot;
+    };
+
+    friend class DecodeThread;
+
+    bool isDecodingConcurrently() const {
+        return !mDecodeThreads.isEmpty();
+    }
+    status_t startDecodeThreads();
+    // Waits for frames in flight and joins the threads; called with mLock held.
+    void stopDecodeThreads();
+    // Pairs queued inputs with free outputs; called with mLock held.
+    void scheduleDecodes();
+    bool decodeLoop(int slot);
+
     DecoderState mState;
     android::Mutex mLock;
+
+    android::Vector< android::sp<DecodeThread> > mDecodeThreads;
+    android::Vector<DecodeJob> mDecodeJobs;
+    // outputs of frames in flight, in capture order
+    android::Vector<int> mDeliveryOrder;
+    android::Condition mDecodeAvailable;
+    android::Condition mDecodeIdle;
+    int mFramesInFlight;
+    bool mDecodeExiting;
 };
 
 }  // namespace Camera
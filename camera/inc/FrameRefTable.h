@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameRefTable.h
+*
+* Per-buffer frame reference counts of the camera adapters.
+*
+*/
+
+#ifndef CAMERA_FRAME_REF_TABLE_H
+#define CAMERA_FRAME_REF_TABLE_H
+
+#include "CameraHal.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Reference counts of the buffers an adapter sends to its subscribers.
+ *
+ * Buffers are tracked per set (preview, capture, ...) as the arrays the
+ * adapter was given, so finding the counts of a buffer is a range check
+ * and an index. Each buffer owns one 32 bit word holding a small counter
+ * per frame type and a hold flag; all updates are android_atomic_*
+ * read-modify-writes of that word and no lock is taken on the frame
+ * return path. The thread whose release takes
+ * the counters to zero is the only one that sees zero, so it alone hands
+ * the buffer back to the camera.
+ *
+ * track() and untrack() are configuration calls. They must not race with
+ * each other on the same set, but may run while frames of other sets are
+ * returned.
+ */
+class FrameRefTable
+{
+public:
+    enum BufferSet {
+        PREVIEW_SET = 0,
+        PREVIEW_DATA_SET,
+        CAPTURE_SET,
+        VIDEO_SET,
+        VIDEO_IN_SET,
+        BUFFER_SET_COUNT
+    };
+
+    enum {
+        MAX_BUFFERS_PER_SET = 32,
+        MAX_REF_COUNT = 31
+    };
+
+    FrameRefTable();
+
+    /**
+     * Starts tracking buffers[0 .. count). The first 'queueable' buffers
+     * start without references, the others with one reference of
+     * 'heldType' since the buffer provider still holds on to them.
+     */
+    status_t track(BufferSet set, CameraBuffer *buffers, int count,
+                   int queueable, CameraFrame::FrameType heldType);
+
+    // Forgets every buffer of the set.
+    void untrack(BufferSet set);
+
+    // Clears the counter of 'frameType' on every buffer of the set.
+    void reset(BufferSet set, CameraFrame::FrameType frameType);
+
+    int size(BufferSet set) const;
+    CameraBuffer * bufferAt(BufferSet set, int index) const;
+
+    // Returns the references of 'frameType' held on 'buffer', -1 if the
+    // buffer or the frame type is not tracked.
+    int get(CameraBuffer *buffer, CameraFrame::FrameType frameType) const;
+
+    // Returns the references of all frame types held on 'buffer'.
+    int total(CameraBuffer *buffer) const;
+
+    status_t set(CameraBuffer *buffer, CameraFrame::FrameType frameType, int refCount);
+
+    /**
+     * Drops one reference of 'frameType'. Returns the references still held
+     * of 'frameType', or of all frame types if 'allTypes' is set, or -1 if
+     * there was no reference to drop. A hold counts as one reference either
+     * way.
+     */
+    int release(CameraBuffer *buffer, CameraFrame::FrameType frameType, bool allTypes);
+
+    /**
+     * Keeps 'buffer' from the camera independently of its frame references,
+     * as the frame history does. A buffer is held at most once; returns
+     * false if it is not tracked or already held.
+     */
+    bool hold(CameraBuffer *buffer);
+
+    // Drops the hold on 'buffer'. Returns the references left of all frame
+    // types, -1 if the buffer was not held.
+    int unhold(CameraBuffer *buffer);
+
+    // True if no frame type holds a reference on 'buffer'; a single load.
+    bool isFree(CameraBuffer *buffer) const;
+
+private:
+    enum {
+        COUNTER_BITS = 5,
+        COUNTER_MASK = (1 << COUNTER_BITS) - 1,
+        // above the counters of all frame types
+        HOLD_BIT = 1 << (6 * COUNTER_BITS)
+    };
+
+    struct Set {
+        CameraBuffer *buffers;
+        volatile int32_t count;
+        volatile int32_t refs[MAX_BUFFERS_PER_SET];
+    };
+
+    FrameRefTable(const FrameRefTable &);
+    FrameRefTable & operator=(const FrameRefTable &);
+
+    // Bit offset of the counter of 'frameType', -1 if the type is not counted.
+    static int shiftFor(CameraFrame::FrameType frameType);
+    static int sum(uint32_t refs);
+
+    volatile int32_t * lookup(CameraBuffer *buffer) const;
+
+    mutable Set mSets[BUFFER_SET_COUNT];
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_FRAME_REF_TABLE_H
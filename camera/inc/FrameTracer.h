@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTracer.h
+*
+* Per-frame latency tracing of the camera pipeline.
+*
+*/
+
+#ifndef CAMERA_FRAME_TRACER_H
+#define CAMERA_FRAME_TRACER_H
+
+#include <utils/Timers.h>
+
+#include "Common.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Records when a frame passes fixed points of the pipeline and keeps
+ * latency histograms per point, cheap enough to stay on in production.
+ *
+ * Frames are identified by their timestamp. A mark takes the monotonic
+ * clock and writes to state owned by the calling thread only: a ring of
+ * the latest events and the histograms. No lock is taken; dump() reads
+ * the other threads' state without synchronizing with them and may see a
+ * sample torn between two counters, which is fine for statistics.
+ *
+ * Latencies are measured from the STAGE_SENSOR mark of the same frame,
+ * STAGE_ENCODE_START from the STAGE_CAPTURE mark of the captured frame and
+ * STAGE_ENCODE_END from STAGE_ENCODE_START. The
+ * STAGE_SENSOR histogram holds the interval between consecutive frames,
+ * its spread is the frame rate jitter.
+ */
+class FrameTracer
+{
+public:
+    enum Stage {
+        // preview frame handed to the adapter by the camera
+        STAGE_SENSOR = 0,
+        // captured image or raw frame handed to the adapter by the camera
+        STAGE_CAPTURE,
+        // frame delivered to every subscriber of the adapter
+        STAGE_DISPATCH,
+        // frame queued to the preview window
+        STAGE_DISPLAY,
+        // preview or video data callback returned
+        STAGE_CALLBACK,
+        STAGE_ENCODE_START,
+        STAGE_ENCODE_END,
+        STAGE_COUNT
+    };
+
+    enum {
+        MAX_THREADS = 16,
+        RING_SIZE = 128,
+        HISTOGRAM_BINS = 20
+    };
+
+    static void setEnabled(bool enable);
+    static bool isEnabled();
+
+    static void mark(Stage stage, nsecs_t frame);
+
+    // Clears the statistics, call while no frames are flowing.
+    static void reset();
+
+    // Prints the histograms and the latest events to 'fd'.
+    static void dump(int fd);
+
+private:
+    FrameTracer();
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_FRAME_TRACER_H
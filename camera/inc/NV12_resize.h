@@ -17,6 +17,8 @@
 #ifndef NV12_RESIZE_H_
 #define NV12_RESIZE_H_
 
+#include <stdint.h>
+
 #include "Common.h"
 
 typedef unsigned char  mmBool;
@@ -56,32 +58,6 @@ typedef struct {
     mmInt32 second;
 } TmDateTime;
 
-const mmUint8 bWeights[8][8][4] = {
-  {{64, 0, 0, 0}, {56, 0, 0, 8}, {48, 0, 0,16}, {40, 0, 0,24},
-   {32, 0, 0,32}, {24, 0, 0,40}, {16, 0, 0,48}, { 8, 0, 0,56}},
-
-  {{56, 8, 0, 0}, {49, 7, 1, 7}, {42, 6, 2,14}, {35, 5, 3,21},
-   {28, 4, 4,28}, {21, 3, 5,35}, {14, 2, 6,42}, { 7, 1, 7,49}},
-
-  {{48,16, 0, 0}, {42,14, 2, 6}, {36,12,4 ,12}, {30,10,6 ,18},
-   {24, 8, 8,24}, {18, 6,10,30}, {12,4 ,12,36}, { 6, 2,14,42}},
-
-  {{40,24,0 ,0 }, {35,21, 3, 5}, {30,18, 6,10}, {25,15, 9,15},
-   {20,12,12,20}, {15, 9,15,25}, {10, 6,18,30}, { 5, 3,21,35}},
-
-  {{32,32, 0,0 }, {28,28, 4, 4}, {24,24, 8, 8}, {20,20,12,12},
-   {16,16,16,16}, {12,12,20,20}, { 8, 8,24,24}, { 4, 4,28,28}},
-
-  {{24,40,0 ,0 }, {21,35, 5, 3}, {18,30,10, 6}, {15,25,15, 9},
-   {12,20,20,12}, { 9,15,25,15}, { 6,10,30,18}, { 3, 5,35,21}},
-
-  {{16,48, 0,0 }, {14,42, 6, 2}, {12,36,12, 4}, {10,30,18, 6},
-   {8 ,24,24,8 }, { 6,18,30,10}, { 4,12,36,12}, { 2, 6,42,14}},
-
-  {{ 8,56, 0,0 }, { 7,49, 7, 1}, { 6,42,14, 2}, { 5,35,21, 3},
-   { 4,28,28,4 }, { 3,21,35, 5}, { 2,14,42, 6}, { 1,7 ,49, 7}}
-};
-
 typedef enum {
     IC_FORMAT_NONE,
     IC_FORMAT_RGB565,
@@ -121,8 +97,9 @@ typedef struct IC_crop_struct {
 *
 * Value Returned : mmBool               -> FALSE on error TRUE on success
 * NOTE:
-*            Not tested for crop funtionallity.
-*            faster version.
+*            Wrapper around NV12Scaler that builds the tables on every
+*            call. Callers converting a stream of frames with the same
+*            geometry should keep an NV12Scaler instead.
 ============================================================================*/
 mmBool
 VT_resizeFrame_Video_opt2_lp(
@@ -132,4 +109,120 @@ VT_resizeFrame_Video_opt2_lp(
         mmUint16 dummy                         /* Transparent pixel value              */
         );
 
+namespace Ti {
+namespace Camera {
+
+class WorkerPool;
+
+/**
+ * Table driven NV12 scaler.
+ *
+ * configure() precomputes the source coordinates and the 8 bit
+ * interpolation weights of every output row and column for one geometry;
+ * scale() then only walks those tables. Every source row is filtered
+ * horizontally once and cached, the vertical blend runs over whole rows
+ * with the SIMD kernels from ColorConvert.
+ *
+ * MODE_AREA averages every source pixel under the output pixel instead of
+ * sampling four of them, which avoids aliasing on large downscales such as
+ * thumbnails. MODE_AUTO picks it for downscales of 2x and more.
+ *
+ * Given a WorkerPool, scale() splits the output into horizontal stripes
+ * that are processed in parallel; each stripe has its own scratch rows, so
+ * the result is identical to the single threaded one.
+ */
+class NV12Scaler {
+public:
+    enum Mode {
+        MODE_AUTO,
+        MODE_BILINEAR,
+        MODE_AREA
+    };
+
+    NV12Scaler();
+    ~NV12Scaler();
+
+    /**
+     * Builds the tables for a srcWidth x srcHeight -> dstWidth x dstHeight
+     * conversion. Cheap when called again with the same geometry.
+     */
+    status_t configure(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+                       Mode mode = MODE_AUTO);
+
+    /**
+     * Scales 'in' into 'out'. 'rect' is the destination rectangle inside
+     * 'out'; NULL means the whole output image. The configured geometry
+     * must match the input size and the rectangle size. The input crop is
+     * given by in->uOffset (top left luma sample) and the input size; both
+     * crops must start on even coordinates so luma and chroma stay aligned.
+     * 'pool' is optional and spreads the work over its threads.
+     */
+    status_t scale(const structConvImage *in, structConvImage *out,
+                   const IC_rect_type *rect = NULL, WorkerPool *pool = NULL);
+
+    Mode mode() const { return mActiveMode; }
+
+private:
+    struct Axis {
+        Axis() : index(NULL), weight(NULL), count(0) {}
+        ~Axis() { delete [] index; delete [] weight; }
+
+        // source start; bilinear fraction or box length for area mode
+        int *index;
+        uint16_t *weight;
+        int count;
+    };
+
+    struct Scratch {
+        uint8_t *rows[2];
+        int rowIndex[2];
+        uint16_t *sums;
+    };
+
+    class StripeJob;
+
+    NV12Scaler(const NV12Scaler &);
+    NV12Scaler & operator=(const NV12Scaler &);
+
+    status_t allocateScratch(int stripes);
+    Scratch scratchFor(int stripe) const;
+
+    static void buildBilinear(Axis &axis, int src, int dst);
+    static void buildArea(Axis &axis, int src, int dst);
+    static status_t allocate(Axis &axis, int count);
+
+    void scalePlane(const uint8_t *src, int srcStride, int srcWidth,
+                    uint8_t *dst, int dstStride, int dstWidth,
+                    const Axis &cols, const Axis &rows, int pixelSize,
+                    int firstRow, int lastRow, Scratch &scratch) const;
+    void filterRow(const uint8_t *src, uint8_t *dst, int dstWidth,
+                   const Axis &cols, int pixelSize) const;
+    void averageRow(const uint16_t *sums, uint8_t *dst, int dstWidth,
+                    const Axis &cols, int boxHeight, int pixelSize) const;
+
+    int mSrcWidth;
+    int mSrcHeight;
+    int mDstWidth;
+    int mDstHeight;
+    Mode mMode;
+    Mode mActiveMode;
+
+    Axis mLumaCols;
+    Axis mLumaRows;
+    Axis mChromaCols;
+    Axis mChromaRows;
+
+    // fixed point reciprocals of the box areas for MODE_AREA
+    uint32_t *mReciprocals;
+    int mMaxArea;
+
+    // one block of filtered rows and box sums per stripe
+    uint8_t *mScratch;
+    size_t mScratchSize;
+    size_t mStripeScratchSize;
+};
+
+} // namespace Camera
+} // namespace Ti
+
 #endif //#define NV12_RESIZE_H_
@@ -414,6 +414,8 @@ public:
 
     // Function to get and populate caps from handle
     static status_t getCaps(int sensorId, CameraProperties::Properties* props, OMX_HANDLETYPE handle);
+    // Version string of the firmware running the camera component
+    static status_t getFirmwareVersion(OMX_HANDLETYPE handle, android::String8 &version);
     static const char* getLUTvalue_OMXtoHAL(int OMXValue, LUTtype LUT);
     static int getMultipleLUTvalue_OMXtoHAL(int OMXValue, LUTtype LUT, char * supported);
     static int getLUTvalue_HALtoOMX(const char * HalValue, LUTtype LUT);
@@ -860,6 +862,8 @@ public:
             : Thread(false), mCameraAdapter(ca)
         {
             mIsProcessed = true;
+            // only the latest focus status matters, the handler reads it back
+            mCommandMsgQ.setCoalescing(CAMERA_FOCUS_STATUS);
         }
 
         virtual bool threadLoop() {
@@ -868,10 +872,11 @@ public:
             return ret;
         }
 
-        status_t put(Utils::Message* msg){
+        status_t put(Utils::Message* msg,
+                     Utils::MessageQueue::Priority priority = Utils::MessageQueue::PRIORITY_NORMAL){
             android::AutoMutex lock(mLock);
             mIsProcessed = false;
-            return mCommandMsgQ.put(msg);
+            return mCommandMsgQ.put(msg, priority);
         }
 
         void clearCommandQ()
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ReplayCameraAdapter.h
+*
+* Camera adapter serving recorded frames instead of a sensor.
+*
+*/
+
+#ifndef REPLAY_CAMERA_ADAPTER_H
+#define REPLAY_CAMERA_ADAPTER_H
+
+#include "CameraHal.h"
+#include "BaseCameraAdapter.h"
+#include "DebugUtils.h"
+#include "Decoder_libjpeg.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * A recording mapped in memory and split into frames.
+ *
+ * Raw recordings hold YUYV or NV12 frames of one size back to back, MJPEG
+ * recordings hold complete JPEG pictures back to back. The recording is
+ * described by system properties:
+ *
+ *   camera.replay.file     path of the recording, no replay camera if unset
+ *   camera.replay.format   yuyv, nv12 or mjpeg, guessed from the file
+ *                          extension if unset
+ *   camera.replay.size     size of the frames, 640x480 if unset
+ *   camera.replay.fps      delivery rate, 0 delivers a frame as soon as a
+ *                          buffer is free; 30 if unset
+ */
+class ReplaySource
+{
+public:
+    enum Format {
+        FORMAT_UNKNOWN = 0,
+        FORMAT_YUYV,
+        FORMAT_NV12,
+        FORMAT_MJPEG
+    };
+
+    ReplaySource();
+    ~ReplaySource();
+
+    // Maps the recording named by the properties and indexes its frames.
+    status_t open();
+    void close();
+
+    bool isOpen() const { return NULL != mData; }
+
+    Format format() const { return mFormat; }
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    int fps() const { return mFps; }
+    const char * path() const { return mPath.string(); }
+
+    int frameCount() const { return mFrames.size(); }
+
+    // Data of the frame 'index' modulo the frame count, the recording loops.
+    const uint8_t * frame(int index, size_t &length) const;
+
+private:
+    struct Segment {
+        size_t offset;
+        size_t length;
+    };
+
+    status_t readConfig();
+    status_t indexRawFrames(size_t frameSize);
+    status_t indexJpegFrames();
+
+    android::String8 mPath;
+    Format mFormat;
+    int mWidth;
+    int mHeight;
+    int mFps;
+
+    uint8_t *mData;
+    size_t mSize;
+    android::Vector<Segment> mFrames;
+};
+
+/**
+ * Camera adapter which plays a ReplaySource back as its sensor.
+ *
+ * Frames go through the same buffer and reference counting paths as with
+ * the V4L adapter: preview buffers are filled with NV12 and sent as
+ * preview frames, and also as video frames while recording; a capture
+ * sends the latest frame as YUYV to be encoded to JPEG. This exercises
+ * the whole HAL, display, callbacks and encoders, without camera hardware.
+ *
+ * When every preview buffer is downstream at the time of a frame, the
+ * frame is dropped as a sensor would do; with an unpaced recording the
+ * next frame waits for a buffer instead.
+ */
+class ReplayCameraAdapter : public BaseCameraAdapter
+{
+public:
+
+    ReplayCameraAdapter(size_t sensor_index);
+    ~ReplayCameraAdapter();
+
+    ///Initialzes the camera adapter creates any resources required
+    virtual status_t initialize(CameraProperties::Properties*);
+
+    //APIs to configure Camera adapter and get the current parameter set
+    virtual status_t setParameters(const android::CameraParameters& params);
+    virtual void getParameters(android::CameraParameters& params);
+
+    static status_t getCaps(const int sensorId, CameraProperties::Properties* params,
+                            const ReplaySource &source);
+
+protected:
+
+//----------Parent class method implementation------------------------------------
+    virtual status_t startPreview();
+    virtual status_t stopPreview();
+    virtual status_t takePicture();
+    virtual status_t stopImageCapture();
+    virtual status_t autoFocus();
+    virtual status_t useBuffers(CameraMode mode, CameraBuffer *bufArr, int num, size_t length, unsigned int queueable);
+    virtual status_t fillThisBuffer(CameraBuffer *frameBuf, CameraFrame::FrameType frameType);
+    virtual status_t getFrameSize(size_t &width, size_t &height);
+    virtual status_t getPictureBufferSize(CameraFrame &frame, size_t bufferCount);
+    virtual status_t getFrameDataSize(size_t &dataFrameSize, size_t bufferCount);
+//-----------------------------------------------------------------------------
+
+private:
+
+    class PreviewThread : public android::Thread {
+            ReplayCameraAdapter* mAdapter;
+        public:
+            PreviewThread(ReplayCameraAdapter* hw) :
+                    Thread(false), mAdapter(hw) { }
+            virtual void onFirstRef() {
+                run("CameraReplayThread", android::PRIORITY_URGENT_DISPLAY);
+            }
+            virtual bool threadLoop() {
+                // quits once preview stops
+                return mAdapter->previewThread();
+            }
+        };
+
+    bool previewThread();
+
+    status_t UseBuffersPreview(CameraBuffer *bufArr, int num, unsigned int queueable);
+    status_t UseBuffersCapture(CameraBuffer *bufArr, int num, unsigned int queueable);
+
+    status_t fillPreviewBuffer(const uint8_t *data, size_t length, CameraBuffer *buffer,
+                               int width, int height, int stride);
+    status_t fillCaptureBuffer(const uint8_t *data, size_t length, CameraBuffer *buffer,
+                               int width, int height);
+
+private:
+    //camera defaults
+    static const char DEFAULT_PREVIEW_FORMAT[];
+    static const char DEFAULT_NUM_PREV_BUFS[];
+    static const char DEFAULT_PICTURE_FORMAT[];
+    static const char DEFAULT_FOCUS_MODE[];
+
+    ReplaySource mSource;
+
+    android::CameraParameters mParams;
+
+    bool mPreviewing;
+    bool mCapturing;
+    mutable android::Mutex mLock;
+    // signalled when a preview buffer comes back or preview stops
+    android::Condition mFrameCondition;
+
+    // protected by mLock
+    android::sp<PreviewThread> mPreviewThread;
+
+    CameraBuffer *mPreviewBufs;
+    int mPreviewBufferCount;
+    // indices of the preview buffers owned by the adapter
+    android::Vector<int> mFreeBuffers;
+
+    CameraBuffer *mCaptureBufs;
+    int mCaptureBufferCount;
+    int mCaptureBufferCountQueueable;
+
+    // next frame of the recording and when it is due
+    int mFrameIndex;
+    nsecs_t mNextFrameTime;
+    nsecs_t mFramePeriod;
+
+    int mFramesSent;
+    int mFramesDropped;
+
+    // used by the preview thread only
+    Decoder_libjpeg mDecoder;
+
+    int mSensorIndex;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif //REPLAY_CAMERA_ADAPTER_H
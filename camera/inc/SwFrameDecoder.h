@@ -36,10 +36,14 @@ protected:
     virtual void doFlush() { }
     virtual void doRelease() { }
 
+    virtual bool canDecodeConcurrently() const { return true; }
+    virtual bool doDecodeFrame(MediaBuffer& in, MediaBuffer& out, int slot);
+
 private:
-    int mjpegWithHdrSize;
-    Decoder_libjpeg mJpgdecoder;
-    unsigned char* mJpegWithHeaderBuffer;
+    void releaseDecoders();
+
+    // one decoder per decode slot, libjpeg state is not shared
+    android::Vector<Decoder_libjpeg*> mJpgdecoders;
 };
 
 }  // namespace Camera
@@ -39,9 +39,7 @@ namespace Camera {
 #define DEFAULT_CAPTURE_FORMAT V4L2_PIX_FMT_YUYV
 
 #define NB_BUFFER 10
-#define DEVICE "/dev/videoxx"
 #define DEVICE_PATH "/dev/"
-#define DEVICE_NAME "videoxx"
 
 typedef int V4L_HANDLETYPE;
 
@@ -160,13 +158,76 @@ private:
             }
         };
 
+    /**
+     * Thread of one pipeline stage, runs 'loop' until it returns false.
+     */
+    class StageThread : public android::Thread {
+            V4LCameraAdapter* mAdapter;
+            bool (V4LCameraAdapter::*mLoop)();
+        public:
+            StageThread(V4LCameraAdapter* hw, bool (V4LCameraAdapter::*loop)()) :
+                    Thread(false), mAdapter(hw), mLoop(loop) { }
+            virtual bool threadLoop() {
+                return (mAdapter->*mLoop)();
+            }
+        };
+
+    enum PipelineStage {
+        // VIDIOC_DQBUF, on the preview thread
+        PIPELINE_CAPTURE = 0,
+        // YUYV to NV12 into the preview buffer
+        PIPELINE_CONVERT,
+        // reference counting and delivery to the subscribers
+        PIPELINE_DISPATCH,
+        PIPELINE_STAGE_COUNT
+    };
+
+    // A frame travelling between two stages.
+    struct PipelineFrame {
+        // V4L buffer, or decoder output buffer when 'decoded'
+        int index;
+        bool decoded;
+        int width;
+        int height;
+        // dequeue time, the frame timestamp
+        nsecs_t timestamp;
+        // when it entered its current queue
+        nsecs_t queued;
+    };
+
+    struct StageStats {
+        int frames;
+        // time spent processing frames, and the longest frame
+        nsecs_t busy;
+        nsecs_t maxBusy;
+        // time frames waited in the queue ahead of the stage
+        nsecs_t wait;
+    };
+
     //Used for calculation of the average frame rate during preview
     status_t recalculateFPS();
+    //Logs the frame rate every 30 frames when debug.camera.showfps is set
+    void debugShowFPS();
 
     char * GetFrame(int &index, int &filledLen);
 
     int previewThread();
 
+    status_t startPipeline();
+    void stopPipeline();
+    // Drops the frames in flight and waits for the conversion in progress.
+    void flushPipeline();
+    void queueForConversion(const PipelineFrame &frame);
+    void queueForDispatch(const PipelineFrame &frame);
+    bool convertThread();
+    bool dispatchThread();
+    void sendPreviewFrame(const PipelineFrame &frame);
+    // Called with mPipelineLock held.
+    void accountStage(PipelineStage stage, const PipelineFrame &frame, nsecs_t start, nsecs_t end);
+    // The summary at the end of preview is logged at info level, the
+    // periodic logs during preview only in debug builds.
+    void logPipelineStats(bool summary);
+
 private:
     //capabilities data
     static const CapPixelformat mPixelformats [];
@@ -202,6 +263,8 @@ private:
     status_t v4lStopStreaming(int nBufferCount);
     status_t v4lSetFormat(int, int, uint32_t);
     status_t restartPreview();
+    // Sends the history frame closest to now as the picture, called without mLock.
+    status_t takeHistoryPicture(CameraBuffer *buffer, int width, int height);
     status_t applyFpsValue();
     status_t returnBufferToV4L(int id);
     void returnOutputBuffer(int index);
@@ -229,6 +292,9 @@ private:
     float mFPS, mLastFPS;
 
     int mSensorIndex;
+    // device node of this camera, from the capabilities
+    android::String8 mDevicePath;
+    bool mDebugFps;
 
     // protected by mLock
     android::sp<PreviewThread>   mPreviewThread;
@@ -254,6 +320,22 @@ private:
 
     CameraHal* mCameraHal;
     int mSkipFramesCount;
+
+    // capture, conversion and dispatch stages; the queues are protected
+    // by mPipelineLock
+    android::Mutex mPipelineLock;
+    android::sp<StageThread> mConvertThread;
+    android::sp<StageThread> mDispatchThread;
+    android::Vector<PipelineFrame> mConvertQueue;
+    android::Vector<PipelineFrame> mDispatchQueue;
+    android::Condition mConvertAvailable;
+    android::Condition mDispatchAvailable;
+    android::Condition mConvertIdle;
+    bool mPipelineRunning;
+    bool mConverting;
+
+    StageStats mStageStats[PIPELINE_STAGE_COUNT];
+    int mPipelineDrops;
 };
 
 } // namespace Camera
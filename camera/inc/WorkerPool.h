@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file WorkerPool.h
+*
+* Small persistent thread pool used to split image processing work
+* (resizing, encoding) across the CPU cores.
+*
+*/
+
+#ifndef CAMERA_WORKER_POOL_H
+#define CAMERA_WORKER_POOL_H
+
+#include <utils/threads.h>
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include "Common.h"
+
+namespace Ti {
+namespace Camera {
+
+/**
+ * Fork/join pool with a fixed number of threads created once by the HAL.
+ *
+ * execute() splits a Job into 'count' independent parts and returns when
+ * all of them are done. The calling thread works on its own job as well,
+ * so a job always makes progress even if every pool thread is busy with
+ * jobs submitted by other callers, and nested or concurrent execute()
+ * calls cannot deadlock.
+ */
+class WorkerPool : public android::RefBase
+{
+public:
+    class Job {
+    public:
+        virtual ~Job() {}
+
+        // Processes part 'index' of [0, count); called concurrently.
+        virtual void run(int index) = 0;
+    };
+
+    // Worker threads run at 'priority', below the display and preview
+    // threads by default so scaling and encoding don't delay preview.
+    explicit WorkerPool(int priority = android::PRIORITY_DEFAULT);
+    virtual ~WorkerPool();
+
+    /**
+     * Starts 'threads' worker threads; 0 picks one less than the number of
+     * online CPUs, since the caller takes a share of every job.
+     */
+    status_t initialize(int threads = 0);
+
+    // Stops and joins all worker threads. Pending jobs are finished first.
+    void deinitialize();
+
+    /**
+     * Runs job.run(0) .. job.run(count - 1) and waits for completion.
+     */
+    status_t execute(Job &job, int count);
+
+    // Number of parts that can run at the same time, caller included.
+    int concurrency() const;
+
+private:
+    struct Batch {
+        Job *job;
+        int count;
+        int next;
+        int pending;
+        android::Condition done;
+    };
+
+    class WorkerThread : public android::Thread {
+    public:
+        WorkerThread(WorkerPool *pool)
+            : Thread(false), mPool(pool) { }
+        virtual bool threadLoop() {
+            return mPool->workerLoop();
+        }
+    private:
+        WorkerPool *mPool;
+    };
+
+    friend class WorkerThread;
+
+    WorkerPool(const WorkerPool &);
+    WorkerPool & operator=(const WorkerPool &);
+
+    bool workerLoop();
+    // Claims the next part of the head batch; called with mLock held.
+    Batch * claim(int &index);
+    // Marks one part of 'batch' finished; called with mLock held.
+    void finish(Batch *batch);
+
+    mutable android::Mutex mLock;
+    android::Condition mWorkAvailable;
+    android::Vector<Batch *> mBatches;
+    android::Vector< android::sp<WorkerThread> > mThreads;
+    const int mPriority;
+    bool mExiting;
+};
+
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_WORKER_POOL_H
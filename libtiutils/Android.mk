@@ -49,6 +49,11 @@ ifdef TI_UTILS_MESSAGE_QUEUE_DEBUG_ENABLED
     LOCAL_CFLAGS += -DMSGQ_DEBUG
 endif
 
+ifdef TI_UTILS_MESSAGE_QUEUE_USE_PIPE
+    # Move messages through a pipe instead of the lock-free ring
+    LOCAL_CFLAGS += -DMSGQ_USE_PIPE
+endif
+
 ifdef TI_UTILS_MESSAGE_QUEUE_DEBUG_FUNCTION_NAMES
     # Enable function enter/exit logging
     LOCAL_CFLAGS += -DTI_UTILS_FUNCTION_LOGGER_ENABLE
@@ -16,11 +16,17 @@
 
 
 #include <errno.h>
+#include <sched.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/poll.h>
 #include <unistd.h>
 #include <utils/Errors.h>
+#include <utils/threads.h>
+
+#ifndef MSGQ_USE_PIPE
+#include <sys/eventfd.h>
+#endif
 
 
 
@@ -32,6 +38,249 @@
 namespace Ti {
 namespace Utils {
 
+/**
+   Bounded multi-producer lane with a sequence number per slot. A slot is
+   free for the producer claiming position 'pos' when its sequence equals
+   'pos' and holds a message for the consumer claiming 'pos' when it equals
+   'pos + 1'. 'pending' counts published messages not yet reserved by a
+   consumer.
+ */
+struct MessageLane
+{
+    enum {
+        CAPACITY = 1024 // power of two, in line with what a pipe buffers
+    };
+
+    struct Slot {
+        volatile uint32_t sequence;
+        // index of the coalescing entry holding the payload, or -1
+        int coalesced;
+        Message msg;
+    };
+
+    Slot slots[CAPACITY];
+    volatile uint32_t enqueuePos;
+    volatile uint32_t dequeuePos;
+    volatile int32_t pending;
+
+    MessageLane() : enqueuePos(0), dequeuePos(0), pending(0) {
+        for ( uint32_t i = 0; i < CAPACITY; i++ ) {
+            slots[i].sequence = i;
+        }
+    }
+
+    void push(const Message *msg, int coalesced) {
+        uint32_t pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+        Slot *slot;
+
+        for ( ;; ) {
+            slot = &slots[pos & (CAPACITY - 1)];
+            const int32_t diff = (int32_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+
+            if ( 0 == diff ) {
+                if ( __atomic_compare_exchange_n(&enqueuePos, &pos, pos + 1, true,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+                    break;
+                }
+            } else {
+                if ( diff < 0 ) {
+                    // full, wait for the consumer like a full pipe would
+                    sched_yield();
+                }
+                pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+            }
+        }
+
+        slot->coalesced = coalesced;
+        slot->msg = *msg;
+        __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&pending, 1, __ATOMIC_RELEASE);
+    }
+
+    bool reserve() {
+        int32_t count = __atomic_load_n(&pending, __ATOMIC_ACQUIRE);
+        while ( count > 0 ) {
+            if ( __atomic_compare_exchange_n(&pending, &count, count - 1, true,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Takes the next message after a successful reserve().
+    void take(Message *msg, int &coalesced) {
+        const uint32_t pos = __atomic_fetch_add(&dequeuePos, 1, __ATOMIC_RELAXED);
+        Slot *slot = &slots[pos & (CAPACITY - 1)];
+
+        // reserved messages are published or about to be
+        while ( __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1 ) {
+            sched_yield();
+        }
+
+        coalesced = slot->coalesced;
+        *msg = slot->msg;
+        __atomic_store_n(&slot->sequence, pos + CAPACITY, __ATOMIC_RELEASE);
+    }
+};
+
+/**
+   Ring backend of MessageQueue: one lane per priority plus the coalescing
+   entries. 'pending' counts the messages of all lanes not yet reserved by
+   a consumer; its 0 -> 1 and 1 -> 0 transitions post and consume one count
+   on the semaphore mode eventfd, so the descriptor is readable exactly when
+   the queue holds messages.
+
+   A coalesced command has at most one message queued. Its payload lives in
+   the entry rather than in the lane, so a later put() replaces the payload
+   of the queued message instead of queueing another one.
+ */
+struct MessageRing
+{
+    enum {
+        MAX_COALESCED_COMMANDS = 8
+    };
+
+    struct Coalesced {
+        unsigned int command;
+        MessageQueue::DiscardCallback discard;
+        android::Mutex lock;
+        bool queued;
+        Message latest;
+    };
+
+    MessageLane lanes[MessageQueue::PRIORITY_COUNT];
+    Coalesced coalesced[MAX_COALESCED_COMMANDS];
+    volatile int32_t coalescedCount;
+    volatile int32_t pending;
+
+    MessageRing() : coalescedCount(0), pending(0) { }
+
+    int findCoalesced(unsigned int command) const {
+        const int count = __atomic_load_n(&coalescedCount, __ATOMIC_ACQUIRE);
+        for ( int i = 0; i < count; i++ ) {
+            if ( coalesced[i].command == command ) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    android::status_t setCoalescing(unsigned int command, MessageQueue::DiscardCallback discard) {
+        const int index = findCoalesced(command);
+        if ( 0 <= index ) {
+            coalesced[index].discard = discard;
+            return android::NO_ERROR;
+        }
+
+        const int count = __atomic_load_n(&coalescedCount, __ATOMIC_ACQUIRE);
+        if ( MAX_COALESCED_COMMANDS <= count ) {
+            return android::NO_MEMORY;
+        }
+
+        coalesced[count].command = command;
+        coalesced[count].discard = discard;
+        coalesced[count].queued = false;
+        __atomic_store_n(&coalescedCount, count + 1, __ATOMIC_RELEASE);
+
+        return android::NO_ERROR;
+    }
+
+    void put(const Message *msg, MessageQueue::Priority priority, int fd) {
+        const int index = findCoalesced(msg->command);
+
+        if ( 0 <= index ) {
+            Coalesced &entry = coalesced[index];
+            Message superseded;
+            bool queued;
+            {
+                android::AutoMutex lock(entry.lock);
+                queued = entry.queued;
+                superseded = entry.latest;
+                entry.latest = *msg;
+                entry.queued = true;
+            }
+
+            if ( queued ) {
+                // the queued message now carries this payload
+                if ( entry.discard ) {
+                    entry.discard(&superseded);
+                }
+                return;
+            }
+        }
+
+        lanes[priority].push(msg, index);
+
+        if ( 0 == __atomic_fetch_add(&pending, 1, __ATOMIC_ACQ_REL) ) {
+            const uint64_t one = 1;
+            while ( (write(fd, &one, sizeof(one)) < 0) && (EINTR == errno) ) {
+            }
+        }
+    }
+
+    android::status_t get(Message *msg, int fd) {
+        int32_t count = __atomic_load_n(&pending, __ATOMIC_ACQUIRE);
+
+        // reserve one of the published messages, sleep while there is none
+        for ( ;; ) {
+            if ( count > 0 ) {
+                if ( __atomic_compare_exchange_n(&pending, &count, count - 1, true,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+                    break;
+                }
+                continue;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if ( (poll(&pfd, 1, -1) < 0) && (EINTR != errno) ) {
+                MSGQ_LOGEB("poll() error: %s", strerror(errno));
+                return android::UNKNOWN_ERROR;
+            }
+            count = __atomic_load_n(&pending, __ATOMIC_ACQUIRE);
+        }
+
+        if ( 1 == count ) {
+            // took the last one; the matching post may still be on its way,
+            // in which case this read waits for it
+            uint64_t value;
+            while ( (read(fd, &value, sizeof(value)) < 0) && (EINTR == errno) ) {
+            }
+        }
+
+        // lanes count their messages before the queue does, so a reservation
+        // always finds a lane to take from
+        MessageLane *lane = NULL;
+        while ( NULL == lane ) {
+            for ( int i = 0; i < MessageQueue::PRIORITY_COUNT; i++ ) {
+                if ( lanes[i].reserve() ) {
+                    lane = &lanes[i];
+                    break;
+                }
+            }
+        }
+
+        int index;
+        lane->take(msg, index);
+
+        if ( 0 <= index ) {
+            Coalesced &entry = coalesced[index];
+            android::AutoMutex lock(entry.lock);
+            *msg = entry.latest;
+            entry.queued = false;
+        }
+
+        return android::NO_ERROR;
+    }
+
+    bool isEmpty() const {
+        return __atomic_load_n(&pending, __ATOMIC_ACQUIRE) <= 0;
+    }
+};
+
 /**
    @brief Constructor for the message queue class
 
@@ -45,6 +294,24 @@ MessageQueue::MessageQueue()
     int fds[2] = {-1,-1};
     android::status_t stat;
 
+    mRing = NULL;
+
+#ifndef MSGQ_USE_PIPE
+    const int fd = eventfd(0, EFD_SEMAPHORE);
+    if ( 0 <= fd )
+        {
+        mRing = new MessageRing();
+        this->fd_read = fd;
+        this->fd_write = -1;
+        mHasMsg = false;
+
+        LOG_FUNCTION_NAME_EXIT;
+        return;
+        }
+
+    MSGQ_LOGEB("Error while creating eventfd: %s, using a pipe", strerror(errno));
+#endif
+
     stat = pipe(fds);
 
     if ( 0 > stat )
@@ -85,6 +352,8 @@ MessageQueue::~MessageQueue()
         close(this->fd_write);
         }
 
+    delete mRing;
+
     LOG_FUNCTION_NAME_EXIT;
 }
 
@@ -115,6 +384,24 @@ android::status_t MessageQueue::get(Message* msg)
         return android::NO_INIT;
         }
 
+    if ( mRing )
+        {
+        android::status_t ret = mRing->get(msg, this->fd_read);
+        if ( android::NO_ERROR != ret )
+            {
+            LOG_FUNCTION_NAME_EXIT;
+            return ret;
+            }
+
+        MSGQ_LOGDB("MQ.get(%d,%p,%p,%p,%p)", msg->command, msg->arg1,msg->arg2,msg->arg3,msg->arg4);
+
+        mHasMsg = false;
+
+        LOG_FUNCTION_NAME_EXIT;
+
+        return 0;
+        }
+
     char* p = (char*) msg;
     size_t read_bytes = 0;
 
@@ -165,6 +452,13 @@ void MessageQueue::setInFd(int fd)
 {
     LOG_FUNCTION_NAME;
 
+    if ( mRing )
+        {
+        MSGQ_LOGEA("read descriptor of a ring backed message queue can't be replaced");
+        LOG_FUNCTION_NAME_EXIT;
+        return;
+        }
+
     if ( -1 != this->fd_read )
         {
         close(this->fd_read);
@@ -179,13 +473,14 @@ void MessageQueue::setInFd(int fd)
    @brief Queue a message
 
    @param msg Message structure to hold the message to be retrieved
+   @param priority Lane of the message, ignored by the pipe backend
    @return android::NO_ERROR On success
    @return android::BAD_VALUE if the message pointer is NULL
    @return android::NO_INIT If the file write descriptor is not set
    @return android::UNKNOWN_ERROR if the write operation fromthe file write descriptor fails
  */
 
-android::status_t MessageQueue::put(Message* msg)
+android::status_t MessageQueue::put(Message* msg, Priority priority)
 {
     LOG_FUNCTION_NAME;
 
@@ -199,6 +494,23 @@ android::status_t MessageQueue::put(Message* msg)
         return android::BAD_VALUE;
         }
 
+    if ( mRing )
+        {
+        if ( (priority < 0) || (PRIORITY_COUNT <= priority) )
+            {
+            MSGQ_LOGEB("invalid priority %d", priority);
+            LOG_FUNCTION_NAME_EXIT;
+            return android::BAD_VALUE;
+            }
+
+        MSGQ_LOGDB("MQ.put(%d,%p,%p,%p,%p)", msg->command, msg->arg1,msg->arg2,msg->arg3,msg->arg4);
+
+        mRing->put(msg, priority, this->fd_read);
+
+        LOG_FUNCTION_NAME_EXIT;
+        return 0;
+        }
+
     if(!this->fd_write)
         {
         MSGQ_LOGEA("write descriptor not initialized for message queue");
@@ -232,6 +544,37 @@ android::status_t MessageQueue::put(Message* msg)
 }
 
 
+/**
+   @brief Coalesce the queued messages of a command
+
+   At most one message of the command stays queued; a newer message takes
+   the place of the queued one and the discard callback, if any, releases
+   the payload it replaced. Must be set up before messages are exchanged.
+
+   @param command Command to coalesce
+   @param discard Called with the superseded message, may be NULL
+   @return android::NO_ERROR On success
+   @return android::NO_MEMORY If too many commands are coalesced already
+   @return android::INVALID_OPERATION If the queue uses the pipe backend
+ */
+android::status_t MessageQueue::setCoalescing(unsigned int command, DiscardCallback discard)
+{
+    LOG_FUNCTION_NAME;
+
+    if ( !mRing )
+        {
+        MSGQ_LOGEA("coalescing needs the ring backend");
+        LOG_FUNCTION_NAME_EXIT;
+        return android::INVALID_OPERATION;
+        }
+
+    android::status_t ret = mRing->setCoalescing(command, discard);
+
+    LOG_FUNCTION_NAME_EXIT;
+    return ret;
+}
+
+
 /**
    @brief Returns if the message queue is empty or not
 
@@ -243,6 +586,14 @@ bool MessageQueue::isEmpty()
 {
     LOG_FUNCTION_NAME;
 
+    if ( mRing )
+        {
+        mHasMsg = !mRing->isEmpty();
+
+        LOG_FUNCTION_NAME_EXIT;
+        return !mHasMsg;
+        }
+
     struct pollfd pfd;
 
     pfd.fd = this->fd_read;
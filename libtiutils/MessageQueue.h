@@ -47,11 +47,39 @@ struct Message
     int64_t     id;
 };
 
-///Message queue implementation
+struct MessageRing;
+
+/**
+ * Message queue implementation.
+ *
+ * Messages are copied into a bounded lock-free ring and an eventfd only
+ * signals the transitions between empty and non-empty, so a burst of
+ * messages costs at most one write and one read syscall. Builds with
+ * TI_UTILS_MESSAGE_QUEUE_USE_PIPE keep the original pipe transport, which
+ * is also used if the ring can't be created. Both backends block in get()
+ * until a message arrives and expose a pollable descriptor through
+ * getInFd(), so waitForMsg() works on either.
+ *
+ * The ring delivers PRIORITY_HIGH messages ahead of PRIORITY_NORMAL ones,
+ * keeping FIFO order within a priority. Commands registered through
+ * setCoalescing() have at most one message queued: putting another one
+ * replaces the payload of the queued message, and the superseded payload
+ * is handed to the discard callback. The pipe backend delivers everything
+ * in FIFO order and does not support coalescing.
+ */
 class MessageQueue
 {
 public:
 
+    enum Priority {
+        PRIORITY_HIGH = 0,
+        PRIORITY_NORMAL,
+        PRIORITY_COUNT
+    };
+
+    ///Releases the payload of a coalesced message replaced by a newer one
+    typedef void (*DiscardCallback)(Message *superseded);
+
     MessageQueue();
     ~MessageQueue();
 
@@ -65,7 +93,10 @@ public:
     void setInFd(int fd);
 
     ///Queue a message
-    android::status_t put(Message*);
+    android::status_t put(Message*, Priority priority = PRIORITY_NORMAL);
+
+    ///Coalesce queued messages of a command; call before the queue is used
+    android::status_t setCoalescing(unsigned int command, DiscardCallback discard = 0);
 
     ///Returns if the message queue is empty or not
     bool isEmpty();
@@ -87,6 +118,7 @@ private:
     int fd_read;
     int fd_write;
     bool mHasMsg;
+    MessageRing *mRing;
 };
 
 } // namespace Utils
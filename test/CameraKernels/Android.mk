@@ -0,0 +1,74 @@
+LOCAL_PATH:= $(call my-dir)
+
+# Benchmark and golden output check of the camera HAL image kernels.
+# The kernels are built from the HAL sources, so the test runs without
+# the camera module and on any target.
+
+include $(CLEAR_VARS)
+
+CAMERA_KERNELS_HAL_PATH := ../../camera
+
+LOCAL_SRC_FILES:= \
+	kernel_bench.cpp \
+	kernel_bench_pixel.cpp \
+	kernel_bench_jpeg.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/ColorConvert.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/NV12_resize.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/WorkerPool.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/Encoder_libjpeg.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/EncoderScheduler.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/Decoder_libjpeg.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/FrameTracer.cpp \
+	$(CAMERA_KERNELS_HAL_PATH)/TICameraParameters.cpp
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/../../camera/inc \
+	$(LOCAL_PATH)/../../include \
+	$(LOCAL_PATH)/../../hwc \
+	$(LOCAL_PATH)/../../libtiutils \
+	external/jpeg \
+	external/jhead
+
+ifdef ANDROID_API_JB_OR_LATER
+LOCAL_C_INCLUDES += \
+	frameworks/native/include/media/hardware
+else
+LOCAL_C_INCLUDES += \
+	frameworks/base/include/media/stagefright
+endif
+
+LOCAL_SHARED_LIBRARIES:= \
+	libutils \
+	libcutils \
+	liblog \
+	libui \
+	libtiutils \
+	libcamera_client \
+	libjpeg
+
+ifeq ($(shell test $(PLATFORM_SDK_VERSION) -ge 19 || echo 1),)
+ifeq ($(shell test $(PLATFORM_SDK_VERSION) -ge 21 || echo 1),)
+LOCAL_SHARED_LIBRARIES += \
+	libjhead
+else ifneq ($(filter 4.4.3 4.4.4,$(PLATFORM_VERSION)),)
+LOCAL_SHARED_LIBRARIES += \
+	libjhead
+else
+LOCAL_SHARED_LIBRARIES += \
+	libexif
+endif
+else
+LOCAL_SHARED_LIBRARIES += \
+	libexif
+endif
+
+LOCAL_MODULE:= camera_kernels_bench
+LOCAL_MODULE_TAGS:= tests
+
+LOCAL_CFLAGS += -Wall -fno-short-enums -O2 $(ANDROID_API_CFLAGS) -DLOG_TAG=\"CameraKernels\"
+
+ifdef ARCH_ARM_HAVE_NEON
+LOCAL_CFLAGS += -DARCH_ARM_HAVE_NEON
+endif
+
+include $(BUILD_HEAPTRACKED_EXECUTABLE)
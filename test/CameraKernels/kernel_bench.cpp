@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file kernel_bench.cpp
+*
+* Runs the kernel cases, reports their throughput and checks their outputs.
+*
+* Usage: camera_kernels_bench [-f filter] [-t seconds] [-n iterations] [-l] [-u]
+*   -f  only run the cases whose name contains 'filter'
+*   -t  minimum time spent timing each case and backend, 0.5 by default
+*   -n  minimum number of timed runs, 3 by default
+*   -l  list the cases and exit
+*   -u  print the hashes in kernel_bench_golden.h format and exit
+*
+* Exits with 1 if any output differs from its golden hash, from another
+* backend or fails the case's own checks.
+*
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ColorConvert.h"
+#include "kernel_bench.h"
+
+namespace Ti {
+namespace Camera {
+namespace Bench {
+
+struct GoldenHash {
+    const char *name;
+    uint64_t hash;
+};
+
+#include "kernel_bench_golden.h"
+
+static const ColorConvert::Backend BACKENDS[] = {
+    ColorConvert::BACKEND_SCALAR,
+    ColorConvert::BACKEND_NEON,
+    ColorConvert::BACKEND_SSE2,
+};
+
+uint64_t hashPlane(uint64_t hash, const uint8_t *data, int width, int height, size_t stride) {
+    for ( int row = 0; row < height; row++ ) {
+        const uint8_t *p = data + row * stride;
+        for ( int i = 0; i < width; i++ ) {
+            hash ^= p[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
+
+void fillPattern(uint8_t *data, int width, int height, size_t stride, uint32_t seed) {
+    uint32_t lcg = seed * 2654435761u + 1;
+
+    for ( int row = 0; row < height; row++ ) {
+        uint8_t *p = data + row * stride;
+        for ( int i = 0; i < width; i++ ) {
+            lcg = lcg * 1103515245u + 12345u;
+            // diagonal ramp plus up to +-8 of noise
+            const int value = ((i + row) * 255) / (width + height) + seed * 37 +
+                              (int) ((lcg >> 16) & 0xF) - 8;
+            p[i] = (uint8_t) (value & 0xFF);
+        }
+    }
+}
+
+double psnr(const uint8_t *a, size_t strideA, const uint8_t *b, size_t strideB,
+            int width, int height) {
+    double error = 0;
+
+    for ( int row = 0; row < height; row++ ) {
+        for ( int i = 0; i < width; i++ ) {
+            const int d = (int) a[row * strideA + i] - (int) b[row * strideB + i];
+            error += d * d;
+        }
+    }
+
+    if ( error == 0 ) {
+        return 99;
+    }
+
+    return 10 * log10(255.0 * 255.0 * width * height / error);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const GoldenHash * goldenFor(const char *name) {
+    for ( size_t i = 0; i < sizeof(GOLDEN_HASHES) / sizeof(GOLDEN_HASHES[0]); i++ ) {
+        if ( GOLDEN_HASHES[i].name && strcmp(GOLDEN_HASHES[i].name, name) == 0 ) {
+            return &GOLDEN_HASHES[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(const char *self) {
+    fprintf(stderr, "Usage: %s [-f filter] [-t seconds] [-n iterations] [-l] [-u]\n", self);
+}
+
+static int benchMain(int argc, char **argv) {
+    const char *filter = NULL;
+    double minTime = 0.5;
+    int minRuns = 3;
+    bool list = false;
+    bool update = false;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "f:t:n:lu")) != -1 ) {
+        switch ( opt ) {
+            case 'f': filter = optarg; break;
+            case 't': minTime = atof(optarg); break;
+            case 'n': minRuns = atoi(optarg); break;
+            case 'l': list = true; break;
+            case 'u': update = true; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    CaseList cases;
+    addPixelCases(cases);
+    addJpegCases(cases);
+
+    int failures = 0;
+
+    if ( !list && !update ) {
+        printf("%-44s %-7s %10s %9s %9s  %s\n", "case", "backend", "ms/run", "MPix/s", "MB/s", "result");
+    }
+
+    for ( size_t c = 0; c < cases.size(); c++ ) {
+        Case *test = cases[c];
+
+        if ( filter && !strstr(test->name(), filter) ) {
+            continue;
+        }
+
+        if ( list ) {
+            printf("%s\n", test->name());
+            continue;
+        }
+
+        if ( !test->setup() ) {
+            printf("%-44s %-7s %10s %9s %9s  FAIL setup\n", test->name(), "-", "-", "-", "-");
+            failures++;
+            continue;
+        }
+
+        const GoldenHash *golden = goldenFor(test->name());
+        // outputs of the other backends must match the first one
+        const char *firstBackend = NULL;
+        uint64_t first = 0;
+
+        for ( size_t b = 0; b < sizeof(BACKENDS) / sizeof(BACKENDS[0]); b++ ) {
+            const ColorConvert::Kernels *kernels = ColorConvert::kernelsFor(BACKENDS[b]);
+            if ( !kernels || !ColorConvert::setBackend(BACKENDS[b]) ) {
+                continue;
+            }
+
+            // the first run is the checked one, and warms up caches and tables
+            const bool ran = test->run();
+            const uint64_t hash = test->hash();
+            char result[160] = "ok";
+            char why[128] = "";
+
+            if ( update ) {
+                if ( test->hasStableHash() ) {
+                    printf("    { \"%s\", 0x%016llxULL },\n", test->name(), (unsigned long long) hash);
+                }
+                break;
+            }
+
+            if ( !ran ) {
+                snprintf(result, sizeof(result), "FAIL run");
+            } else if ( firstBackend && hash != first ) {
+                snprintf(result, sizeof(result), "FAIL differs from %s", firstBackend);
+            } else if ( test->hasStableHash() && !golden ) {
+                snprintf(result, sizeof(result), "FAIL no golden hash, got %016llx",
+                         (unsigned long long) hash);
+            } else if ( test->hasStableHash() && golden->hash != hash ) {
+                snprintf(result, sizeof(result), "FAIL hash %016llx, golden %016llx",
+                         (unsigned long long) hash, (unsigned long long) golden->hash);
+            } else if ( !test->verify(why, sizeof(why)) ) {
+                snprintf(result, sizeof(result), "FAIL %s", why);
+            } else if ( why[0] ) {
+                snprintf(result, sizeof(result), "ok %s", why);
+            }
+
+            if ( !firstBackend ) {
+                first = hash;
+                firstBackend = kernels->name;
+            }
+
+            int runs = 0;
+            const double start = now();
+            double elapsed = 0;
+            do {
+                test->run();
+                runs++;
+                elapsed = now() - start;
+            } while ( runs < minRuns || elapsed < minTime );
+
+            const double perRun = elapsed / runs;
+            printf("%-44s %-7s %10.3f %9.1f %9.1f  %s\n", test->name(), kernels->name,
+                   perRun * 1e3, test->pixels() / perRun * 1e-6, test->bytes() / perRun * 1e-6,
+                   result);
+            fflush(stdout);
+
+            if ( strncmp(result, "FAIL", 4) == 0 ) {
+                failures++;
+            }
+        }
+    }
+
+    ColorConvert::setBackend(ColorConvert::BACKEND_AUTO);
+
+    for ( size_t c = 0; c < cases.size(); c++ ) {
+        delete cases[c];
+    }
+
+    if ( !list && !update ) {
+        printf("%d failure(s)\n", failures);
+    }
+
+    return failures ? 1 : 0;
+}
+
+} // namespace Bench
+} // namespace Camera
+} // namespace Ti
+
+int main(int argc, char **argv) {
+    return Ti::Camera::Bench::benchMain(argc, argv);
+}
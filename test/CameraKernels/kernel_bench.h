@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file kernel_bench.h
+*
+* Benchmark and verification cases for the CPU image kernels of the camera HAL.
+*
+*/
+
+#ifndef CAMERA_KERNEL_BENCH_H
+#define CAMERA_KERNEL_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Vector.h>
+
+namespace Ti {
+namespace Camera {
+namespace Bench {
+
+/**
+ * One kernel on one geometry.
+ *
+ * setup() allocates the buffers and fills the input with a deterministic
+ * pattern, run() processes it once. The output of a run is summarized by
+ * hash(); for cases with a stable output it is compared with the hash
+ * checked in to kernel_bench_golden.h. Every case is run with each
+ * ColorConvert backend available and must give the same output with all.
+ */
+class Case {
+public:
+    virtual ~Case() {}
+
+    // Unique name, "<kernel>/<geometry>/s<stride>"; the golden hash key.
+    virtual const char * name() const = 0;
+
+    // Pixels produced and bytes moved by one run, for the throughput.
+    virtual size_t pixels() const = 0;
+    virtual size_t bytes() const = 0;
+
+    virtual bool setup() = 0;
+    virtual bool run() = 0;
+
+    virtual uint64_t hash() const = 0;
+
+    /**
+     * Checks of the output beyond the hash, 'why' gets a short reason on
+     * failure.
+     */
+    virtual bool verify(char *why, size_t size) const { return true; }
+
+    /**
+     * False when the output depends on the library build rather than on
+     * HAL code, such as libjpeg's, and can't be compared to a checked-in
+     * hash; verify() must then judge the output.
+     */
+    virtual bool hasStableHash() const { return true; }
+};
+
+typedef android::Vector<Case *> CaseList;
+
+void addPixelCases(CaseList &cases);
+void addJpegCases(CaseList &cases);
+
+/*--------------------Helpers for the cases-----------------------------*/
+
+// FNV-1a over 'height' rows of 'width' bytes, padding between rows is skipped.
+uint64_t hashPlane(uint64_t hash, const uint8_t *data, int width, int height, size_t stride);
+
+static const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+
+/**
+ * Fills rows of 'width' bytes with a smooth gradient and some noise, the
+ * same for every build. 'seed' makes planes differ from each other.
+ */
+void fillPattern(uint8_t *data, int width, int height, size_t stride, uint32_t seed);
+
+// Peak signal to noise ratio of two planes in dB; 99 if they are identical.
+double psnr(const uint8_t *a, size_t strideA, const uint8_t *b, size_t strideB,
+            int width, int height);
+
+} // namespace Bench
+} // namespace Camera
+} // namespace Ti
+
+#endif // CAMERA_KERNEL_BENCH_H
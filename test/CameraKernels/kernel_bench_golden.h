@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file kernel_bench_golden.h
+*
+* Expected output hashes of the cases with a stable output, included by
+* kernel_bench.cpp. Regenerate with 'camera_kernels_bench -u' after an
+* intended change of a kernel's output, and review the cases that moved.
+*
+*/
+
+static const GoldenHash GOLDEN_HASHES[] = {
+    { "yuyv-to-nv12/320x240/s320", 0x1c7e9fc32565b43eULL },
+    { "yuyv-to-nv12/320x240/s4096", 0x1c7e9fc32565b43eULL },
+    { "yuyv-to-nv12/640x480/s640", 0x1dad2a4f5ec549e2ULL },
+    { "yuyv-to-nv12/640x480/s4096", 0x1dad2a4f5ec549e2ULL },
+    { "yuyv-to-nv12/1280x720/s1280", 0x54967dbd84185288ULL },
+    { "yuyv-to-nv12/1280x720/s4096", 0x54967dbd84185288ULL },
+    { "yuyv-to-nv12/1920x1080/s1920", 0x7afd9e0c8fb14e74ULL },
+    { "yuyv-to-nv12/1920x1080/s4096", 0x7afd9e0c8fb14e74ULL },
+    { "nv12-to-nv21/320x240/s320", 0x1727012104fdfe8aULL },
+    { "nv12-to-nv21/320x240/s4096", 0x1727012104fdfe8aULL },
+    { "nv12-to-nv21/640x480/s640", 0xc3fb1ae615f07da5ULL },
+    { "nv12-to-nv21/640x480/s4096", 0xc3fb1ae615f07da5ULL },
+    { "nv12-to-nv21/1280x720/s1280", 0xe4bac1dd429c0585ULL },
+    { "nv12-to-nv21/1280x720/s4096", 0xe4bac1dd429c0585ULL },
+    { "nv12-to-nv21/1920x1080/s1920", 0xa7a2bb07c5ad7b86ULL },
+    { "nv12-to-nv21/1920x1080/s4096", 0xa7a2bb07c5ad7b86ULL },
+    { "nv12-to-yv12/320x240/s320", 0x8b5787fbd71f376cULL },
+    { "nv12-to-yv12/320x240/s4096", 0x8b5787fbd71f376cULL },
+    { "nv12-to-yv12/640x480/s640", 0x6131de07c1e2c611ULL },
+    { "nv12-to-yv12/640x480/s4096", 0x6131de07c1e2c611ULL },
+    { "nv12-to-yv12/1280x720/s1280", 0xce30f613600a7e39ULL },
+    { "nv12-to-yv12/1280x720/s4096", 0xce30f613600a7e39ULL },
+    { "nv12-to-yv12/1920x1080/s1920", 0x2a45a30072bab0eeULL },
+    { "nv12-to-yv12/1920x1080/s4096", 0x2a45a30072bab0eeULL },
+    { "vt-resize/1280x720-320x240/s1280", 0xf6514d03ccf327dbULL },
+    { "nv12-scaler/1280x720-320x240/s1280", 0xf6514d03ccf327dbULL },
+    { "nv12-scaler-pool/1280x720-320x240/s1280", 0xf6514d03ccf327dbULL },
+    { "vt-resize/640x480-320x240/s640", 0x04ecc0a4f0377ab8ULL },
+    { "nv12-scaler/640x480-320x240/s640", 0x04ecc0a4f0377ab8ULL },
+    { "nv12-scaler-pool/640x480-320x240/s640", 0x04ecc0a4f0377ab8ULL },
+    { "vt-resize/1920x1080-1280x720/s1920", 0x7ad692153e20f541ULL },
+    { "nv12-scaler/1920x1080-1280x720/s1920", 0x7ad692153e20f541ULL },
+    { "nv12-scaler-pool/1920x1080-1280x720/s1920", 0x7ad692153e20f541ULL },
+    { "vt-resize/320x240-640x480/s320", 0x6a66ca592cc5dfddULL },
+    { "nv12-scaler/320x240-640x480/s320", 0x6a66ca592cc5dfddULL },
+    { "nv12-scaler-pool/320x240-640x480/s320", 0x6a66ca592cc5dfddULL },
+};
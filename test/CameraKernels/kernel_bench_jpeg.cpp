@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file kernel_bench_jpeg.cpp
+*
+* Cases for the software JPEG encoder and the MJPEG decoder.
+*
+* The compressed data depends on the libjpeg the test is linked with, so
+* these cases have no golden hash: the output is decoded again and its
+* luma compared with the source instead. The hash is still compared
+* between ColorConvert backends, which must not change a single byte.
+*
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Encoder_libjpeg.h"
+#include "Decoder_libjpeg.h"
+#include "EncoderContextPool.h"
+#include "WorkerPool.h"
+#include "kernel_bench.h"
+
+namespace Ti {
+namespace Camera {
+namespace Bench {
+
+static const int JPEG_QUALITY = 90;
+
+// lowest luma PSNR accepted after a round trip at JPEG_QUALITY
+static const double MIN_PSNR = 30.0;
+
+struct JpegSize {
+    int width;
+    int height;
+};
+
+static const JpegSize JPEG_SIZES[] = {
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+};
+
+/**
+ * Encodes a tightly packed yuv420sp or yuv422i picture synchronously,
+ * returns the size of the JPEG or 0.
+ */
+static size_t encodePicture(uint8_t *src, const char *format, int width, int height,
+                            uint8_t *dst, size_t dstSize,
+                            const android::sp<EncoderContextPool> &contexts,
+                            const android::sp<WorkerPool> &pool) {
+    Encoder_libjpeg::params params;
+
+    memset(&params, 0, sizeof(params));
+    params.src = src;
+    params.src_size = (strcmp(format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0) ?
+                      width * height * 2 : width * height * 3 / 2;
+    params.dst = dst;
+    params.dst_size = dstSize;
+    params.quality = JPEG_QUALITY;
+    params.in_width = width;
+    params.in_height = height;
+    params.out_width = width;
+    params.out_height = height;
+    params.format = format;
+
+    Encoder_libjpeg encoder(&params, NULL, NULL, CameraFrame::IMAGE_FRAME,
+                            NULL, NULL, NULL, NULL);
+    encoder.setContextPool(contexts);
+    if ( pool.get() ) {
+        encoder.setWorkerPool(pool);
+    }
+    encoder.process();
+
+    return params.jpeg_size;
+}
+
+/**
+ * Decodes 'jpeg' and returns the PSNR of its luma against 'luma'.
+ */
+static double roundTripPsnr(const uint8_t *jpeg, size_t size, const uint8_t *luma,
+                            int width, int height) {
+    Decoder_libjpeg decoder;
+    uint8_t *nv12 = new uint8_t[width * height * 3 / 2];
+    double result = 0;
+
+    if ( decoder.decode(const_cast<uint8_t *>(jpeg), size, nv12, width, width, height, 1) ) {
+        result = psnr(nv12, width, luma, width, width, height);
+    }
+
+    delete [] nv12;
+    return result;
+}
+
+/*--------------------Encoder-----------------------------*/
+
+/**
+ * Software JPEG encode of a capture, as done for the V4L and replay
+ * adapters' pictures and for video snapshots. The pool variant compresses
+ * in restart interval slices on a WorkerPool.
+ */
+class JpegEncodeCase : public Case {
+public:
+    JpegEncodeCase(int width, int height, const char *format, bool parallel)
+        : mWidth(width), mHeight(height), mFormat(format), mParallel(parallel),
+          mSource(NULL), mLuma(NULL), mJpeg(NULL), mJpegSize(0) {
+        const bool yuyv = (strcmp(format, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0);
+        mSourceSize = yuyv ? width * height * 2 : width * height * 3 / 2;
+        // far more than any JPEG of the pattern at JPEG_QUALITY
+        mJpegCapacity = width * height * 2;
+        snprintf(mName, sizeof(mName), "jpeg-encode%s-%s/%dx%d/s%d", parallel ? "-pool" : "",
+                 format, width, height, yuyv ? width * 2 : width);
+    }
+
+    virtual ~JpegEncodeCase() {
+        if ( mPool.get() ) {
+            mPool->deinitialize();
+        }
+        delete [] mSource;
+        delete [] mLuma;
+        delete [] mJpeg;
+    }
+
+    virtual const char * name() const { return mName; }
+    virtual size_t pixels() const { return mWidth * mHeight; }
+    virtual size_t bytes() const { return mSourceSize + mJpegSize; }
+    virtual bool hasStableHash() const { return false; }
+
+    virtual bool setup() {
+        if ( !mSource ) {
+            mSource = new uint8_t[mSourceSize];
+            mLuma = new uint8_t[mWidth * mHeight];
+            mJpeg = new uint8_t[mJpegCapacity];
+            mContexts = new EncoderContextPool();
+        }
+
+        if ( mParallel && !mPool.get() ) {
+            mPool = new WorkerPool();
+            if ( NO_ERROR != mPool->initialize() ) {
+                return false;
+            }
+        }
+
+        if ( strcmp(mFormat, android::CameraParameters::PIXEL_FORMAT_YUV422I) == 0 ) {
+            fillPattern(mSource, mWidth * 2, mHeight, mWidth * 2, 1);
+            for ( int i = 0; i < mWidth * mHeight; i++ ) {
+                mLuma[i] = mSource[i * 2];
+            }
+        } else {
+            fillPattern(mSource, mWidth, mHeight, mWidth, 1);
+            fillPattern(mSource + mWidth * mHeight, mWidth, mHeight / 2, mWidth, 2);
+            memcpy(mLuma, mSource, mWidth * mHeight);
+        }
+
+        return true;
+    }
+
+    virtual bool run() {
+        mJpegSize = encodePicture(mSource, mFormat, mWidth, mHeight, mJpeg, mJpegCapacity,
+                                  mContexts, mPool);
+        return mJpegSize > 0;
+    }
+
+    virtual uint64_t hash() const {
+        return hashPlane(HASH_SEED, mJpeg, mJpegSize, 1, 0);
+    }
+
+    virtual bool verify(char *why, size_t size) const {
+        const double value = roundTripPsnr(mJpeg, mJpegSize, mLuma, mWidth, mHeight);
+        snprintf(why, size, "psnr %.1f", value);
+        return value >= MIN_PSNR;
+    }
+
+private:
+    char mName[64];
+    int mWidth;
+    int mHeight;
+    const char *mFormat;
+    bool mParallel;
+
+    uint8_t *mSource;
+    size_t mSourceSize;
+    // luma of the source, the reference for the round trip
+    uint8_t *mLuma;
+
+    uint8_t *mJpeg;
+    size_t mJpegCapacity;
+    size_t mJpegSize;
+
+    android::sp<EncoderContextPool> mContexts;
+    android::sp<WorkerPool> mPool;
+};
+
+/*--------------------Decoder-----------------------------*/
+
+/**
+ * MJPEG frame to NV12, as done for USB cameras; a scale denominator above
+ * 1 uses libjpeg's scaled IDCT for frames larger than the preview.
+ */
+class JpegDecodeCase : public Case {
+public:
+    JpegDecodeCase(int width, int height, int scaleDenom)
+        : mWidth(width), mHeight(height), mScaleDenom(scaleDenom),
+          mOutWidth(width / scaleDenom), mOutHeight(height / scaleDenom),
+          mJpeg(NULL), mJpegSize(0), mOutput(NULL), mReference(NULL) {
+        snprintf(mName, sizeof(mName), "jpeg-decode/%dx%d-%dx%d/s%d", width, height,
+                 mOutWidth, mOutHeight, mOutWidth);
+    }
+
+    virtual ~JpegDecodeCase() {
+        delete [] mJpeg;
+        delete [] mOutput;
+        delete [] mReference;
+    }
+
+    virtual const char * name() const { return mName; }
+    virtual size_t pixels() const { return mOutWidth * mOutHeight; }
+    virtual size_t bytes() const { return mJpegSize + mOutWidth * mOutHeight * 3 / 2; }
+    virtual bool hasStableHash() const { return false; }
+
+    virtual bool setup() {
+        if ( mJpeg ) {
+            memset(mOutput, 0, mOutWidth * mOutHeight * 3 / 2);
+            return true;
+        }
+
+        const size_t capacity = mWidth * mHeight * 2;
+        uint8_t *source = new uint8_t[mWidth * mHeight * 3 / 2];
+
+        fillPattern(source, mWidth, mHeight, mWidth, 1);
+        fillPattern(source + mWidth * mHeight, mWidth, mHeight / 2, mWidth, 2);
+
+        mJpeg = new uint8_t[capacity];
+        mJpegSize = encodePicture(source, android::CameraParameters::PIXEL_FORMAT_YUV420SP,
+                                  mWidth, mHeight, mJpeg, capacity,
+                                  new EncoderContextPool(), NULL);
+
+        // luma of the source averaged down to the output size
+        mReference = new uint8_t[mOutWidth * mOutHeight];
+        for ( int row = 0; row < mOutHeight; row++ ) {
+            for ( int i = 0; i < mOutWidth; i++ ) {
+                int sum = 0;
+                for ( int y = 0; y < mScaleDenom; y++ ) {
+                    const uint8_t *p = source + (row * mScaleDenom + y) * mWidth + i * mScaleDenom;
+                    for ( int x = 0; x < mScaleDenom; x++ ) {
+                        sum += p[x];
+                    }
+                }
+                const int area = mScaleDenom * mScaleDenom;
+                mReference[row * mOutWidth + i] = (sum + area / 2) / area;
+            }
+        }
+
+        delete [] source;
+
+        mOutput = new uint8_t[mOutWidth * mOutHeight * 3 / 2];
+        memset(mOutput, 0, mOutWidth * mOutHeight * 3 / 2);
+
+        return mJpegSize > 0;
+    }
+
+    virtual bool run() {
+        return mDecoder.decode(mJpeg, mJpegSize, mOutput, mOutWidth,
+                               mOutWidth, mOutHeight, mScaleDenom);
+    }
+
+    virtual uint64_t hash() const {
+        return hashPlane(HASH_SEED, mOutput, mOutWidth * mOutHeight * 3 / 2, 1, 0);
+    }
+
+    virtual bool verify(char *why, size_t size) const {
+        const double value = psnr(mOutput, mOutWidth, mReference, mOutWidth,
+                                  mOutWidth, mOutHeight);
+        snprintf(why, size, "psnr %.1f", value);
+        return value >= MIN_PSNR;
+    }
+
+private:
+    char mName[64];
+    int mWidth;
+    int mHeight;
+    int mScaleDenom;
+    int mOutWidth;
+    int mOutHeight;
+
+    uint8_t *mJpeg;
+    size_t mJpegSize;
+    uint8_t *mOutput;
+    // source luma at the output size
+    uint8_t *mReference;
+
+    Decoder_libjpeg mDecoder;
+};
+
+void addJpegCases(CaseList &cases) {
+    for ( size_t i = 0; i < sizeof(JPEG_SIZES) / sizeof(JPEG_SIZES[0]); i++ ) {
+        const JpegSize &size = JPEG_SIZES[i];
+        cases.add(new JpegEncodeCase(size.width, size.height,
+                                     android::CameraParameters::PIXEL_FORMAT_YUV420SP, false));
+        cases.add(new JpegEncodeCase(size.width, size.height,
+                                     android::CameraParameters::PIXEL_FORMAT_YUV422I, false));
+    }
+
+    // slices only pay off on captures
+    cases.add(new JpegEncodeCase(1920, 1080, android::CameraParameters::PIXEL_FORMAT_YUV420SP, true));
+
+    for ( size_t i = 0; i < sizeof(JPEG_SIZES) / sizeof(JPEG_SIZES[0]); i++ ) {
+        const JpegSize &size = JPEG_SIZES[i];
+        cases.add(new JpegDecodeCase(size.width, size.height, 1));
+    }
+
+    // 1080p MJPEG shown on a 960x540 preview
+    cases.add(new JpegDecodeCase(1920, 1080, 2));
+}
+
+} // namespace Bench
+} // namespace Camera
+} // namespace Ti
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file kernel_bench_pixel.cpp
+*
+* Cases for the pixel format conversions and the NV12 scaler.
+*
+* The geometries are the ones the HAL sees: preview sizes with tightly
+* packed buffers and with the 4096 byte stride of the TILER buffers the
+* adapters and the display use.
+*
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ColorConvert.h"
+#include "NV12_resize.h"
+#include "WorkerPool.h"
+#include "kernel_bench.h"
+
+namespace Ti {
+namespace Camera {
+namespace Bench {
+
+// stride of the TILER 1D buffers
+static const size_t TILER_STRIDE = 4096;
+
+struct Size {
+    int width;
+    int height;
+};
+
+static const Size SIZES[] = {
+    { 320, 240 },
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+};
+
+/**
+ * Buffers of a case, released with it.
+ */
+class BufferCase : public Case {
+public:
+    BufferCase() : mInput(NULL), mOutput(NULL) {
+        mName[0] = '\0';
+    }
+
+    virtual ~BufferCase() {
+        delete [] mInput;
+        delete [] mOutput;
+    }
+
+    virtual const char * name() const { return mName; }
+
+protected:
+    bool allocate(size_t inputSize, size_t outputSize) {
+        if ( !mInput ) {
+            mInput = new uint8_t[inputSize];
+            mOutput = new uint8_t[outputSize];
+        }
+
+        // output padding must not depend on what ran before
+        memset(mOutput, 0, outputSize);
+
+        return mInput && mOutput;
+    }
+
+    char mName[64];
+    uint8_t *mInput;
+    uint8_t *mOutput;
+};
+
+/*--------------------YUYV -> NV12-----------------------------*/
+
+/**
+ * YUYV frame of a V4L device to NV12, as done for the preview buffers.
+ */
+class YuyvToNV12Case : public BufferCase {
+public:
+    YuyvToNV12Case(int width, int height, size_t dstStride)
+        : mWidth(width), mHeight(height), mDstStride(dstStride) {
+        snprintf(mName, sizeof(mName), "yuyv-to-nv12/%dx%d/s%u", width, height,
+                 (unsigned int) dstStride);
+    }
+
+    virtual size_t pixels() const { return mWidth * mHeight; }
+    virtual size_t bytes() const { return mWidth * mHeight * 2 + mWidth * mHeight * 3 / 2; }
+
+    virtual bool setup() {
+        if ( !allocate(mWidth * mHeight * 2, mDstStride * mHeight * 3 / 2) ) {
+            return false;
+        }
+
+        fillPattern(mInput, mWidth * 2, mHeight, mWidth * 2, 1);
+        return true;
+    }
+
+    virtual bool run() {
+        ColorConvert::yuyvToNV12(mInput, mWidth * 2, mOutput, uvPlane(), mDstStride,
+                                 mWidth, mHeight);
+        return true;
+    }
+
+    virtual uint64_t hash() const {
+        uint64_t hash = hashPlane(HASH_SEED, mOutput, mWidth, mHeight, mDstStride);
+        return hashPlane(hash, uvPlane(), mWidth, mHeight / 2, mDstStride);
+    }
+
+    virtual bool verify(char *why, size_t size) const {
+        for ( int row = 0; row < mHeight; row++ ) {
+            const uint8_t *src = mInput + row * mWidth * 2;
+            const uint8_t *y = mOutput + row * mDstStride;
+            const uint8_t *uv = uvPlane() + (row / 2) * mDstStride;
+
+            for ( int i = 0; i < mWidth; i++ ) {
+                // chroma comes from the even rows
+                if ( y[i] != src[i * 2] || (!(row & 1) && uv[i] != src[i * 2 + 1]) ) {
+                    snprintf(why, size, "pixel %d,%d", i, row);
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    uint8_t * uvPlane() const { return mOutput + mDstStride * mHeight; }
+
+    int mWidth;
+    int mHeight;
+    size_t mDstStride;
+};
+
+/*--------------------NV12 -> NV21 / YV12-----------------------------*/
+
+/**
+ * NV12 preview buffer to a tightly packed NV21 preview callback, the copy
+ * AppCallbackNotifier makes for every preview frame.
+ */
+class Nv12ToNV21Case : public BufferCase {
+public:
+    Nv12ToNV21Case(int width, int height, size_t srcStride)
+        : mWidth(width), mHeight(height), mSrcStride(srcStride) {
+        snprintf(mName, sizeof(mName), "nv12-to-nv21/%dx%d/s%u", width, height,
+                 (unsigned int) srcStride);
+    }
+
+    virtual size_t pixels() const { return mWidth * mHeight; }
+    virtual size_t bytes() const { return mWidth * mHeight * 3; }
+
+    virtual bool setup() {
+        if ( !allocate(mSrcStride * mHeight * 3 / 2, mWidth * mHeight * 3 / 2) ) {
+            return false;
+        }
+
+        fillPattern(mInput, mWidth, mHeight, mSrcStride, 1);
+        fillPattern(srcUV(), mWidth, mHeight / 2, mSrcStride, 2);
+        return true;
+    }
+
+    virtual bool run() {
+        ColorConvert::nv12ToNV21(mInput, srcUV(), mSrcStride, mOutput, mWidth, mHeight);
+        return true;
+    }
+
+    virtual uint64_t hash() const {
+        return hashPlane(HASH_SEED, mOutput, mWidth * mHeight * 3 / 2, 1, 0);
+    }
+
+    virtual bool verify(char *why, size_t size) const {
+        const uint8_t *vu = mOutput + mWidth * mHeight;
+
+        for ( int row = 0; row < mHeight; row++ ) {
+            if ( memcmp(mOutput + row * mWidth, mInput + row * mSrcStride, mWidth) ) {
+                snprintf(why, size, "luma row %d", row);
+                return false;
+            }
+        }
+
+        for ( int row = 0; row < mHeight / 2; row++ ) {
+            const uint8_t *uv = srcUV() + row * mSrcStride;
+            for ( int i = 0; i < mWidth; i += 2 ) {
+                if ( vu[row * mWidth + i] != uv[i + 1] || vu[row * mWidth + i + 1] != uv[i] ) {
+                    snprintf(why, size, "chroma %d,%d", i / 2, row);
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    uint8_t * srcUV() const { return mInput + mSrcStride * mHeight; }
+
+    int mWidth;
+    int mHeight;
+    size_t mSrcStride;
+};
+
+/**
+ * NV12 preview buffer to a YV12 preview callback with Android's strides,
+ * the copy AppCallbackNotifier makes for every preview frame.
+ */
+class Nv12ToYV12Case : public BufferCase {
+public:
+    Nv12ToYV12Case(int width, int height, size_t srcStride)
+        : mWidth(width), mHeight(height), mSrcStride(srcStride) {
+        mYStride = (width + 0xF) & ~0xF;
+        mUVStride = (mYStride / 2 + 0xF) & ~0xF;
+        snprintf(mName, sizeof(mName), "nv12-to-yv12/%dx%d/s%u", width, height,
+                 (unsigned int) srcStride);
+    }
+
+    virtual size_t pixels() const { return mWidth * mHeight; }
+    virtual size_t bytes() const { return mWidth * mHeight * 3; }
+
+    virtual bool setup() {
+        if ( !allocate(mSrcStride * mHeight * 3 / 2,
+                       mYStride * mHeight + mUVStride * mHeight) ) {
+            return false;
+        }
+
+        fillPattern(mInput, mWidth, mHeight, mSrcStride, 1);
+        fillPattern(srcUV(), mWidth, mHeight / 2, mSrcStride, 2);
+        return true;
+    }
+
+    virtual bool run() {
+        ColorConvert::nv12ToYV12(mInput, srcUV(), mSrcStride, mOutput, mWidth, mHeight);
+        return true;
+    }
+
+    virtual uint64_t hash() const {
+        uint64_t hash = hashPlane(HASH_SEED, mOutput, mWidth, mHeight, mYStride);
+        hash = hashPlane(hash, vPlane(), mWidth / 2, mHeight / 2, mUVStride);
+        return hashPlane(hash, uPlane(), mWidth / 2, mHeight / 2, mUVStride);
+    }
+
+    virtual bool verify(char *why, size_t size) const {
+        for ( int row = 0; row < mHeight; row++ ) {
+            if ( memcmp(mOutput + row * mYStride, mInput + row * mSrcStride, mWidth) ) {
+                snprintf(why, size, "luma row %d", row);
+                return false;
+            }
+        }
+
+        for ( int row = 0; row < mHeight / 2; row++ ) {
+            const uint8_t *uv = srcUV() + row * mSrcStride;
+            for ( int i = 0; i < mWidth / 2; i++ ) {
+                if ( uPlane()[row * mUVStride + i] != uv[i * 2] ||
+                     vPlane()[row * mUVStride + i] != uv[i * 2 + 1] ) {
+                    snprintf(why, size, "chroma %d,%d", i, row);
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    uint8_t * srcUV() const { return mInput + mSrcStride * mHeight; }
+    // YV12 stores the Cr plane first
+    uint8_t * vPlane() const { return mOutput + mYStride * mHeight; }
+    uint8_t * uPlane() const { return vPlane() + mUVStride * mHeight / 2; }
+
+    int mWidth;
+    int mHeight;
+    size_t mSrcStride;
+    size_t mYStride;
+    size_t mUVStride;
+};
+
+/*--------------------NV12 scaling-----------------------------*/
+
+/**
+ * NV12 to NV12 of another size, either through the VT_resizeFrame wrapper,
+ * which builds its tables on every call as the one-off callers do, or
+ * through a configured NV12Scaler as the video snapshot path does, with
+ * and without a worker pool. All three must give the same output.
+ */
+class ResizeCase : public BufferCase {
+public:
+    enum Variant {
+        VARIANT_WRAPPER,
+        VARIANT_SCALER,
+        VARIANT_SCALER_POOL
+    };
+
+    ResizeCase(int srcWidth, int srcHeight, int dstWidth, int dstHeight, Variant variant)
+        : mSrcWidth(srcWidth), mSrcHeight(srcHeight),
+          mDstWidth(dstWidth), mDstHeight(dstHeight), mVariant(variant) {
+        static const char *NAMES[] = { "vt-resize", "nv12-scaler", "nv12-scaler-pool" };
+        snprintf(mName, sizeof(mName), "%s/%dx%d-%dx%d/s%d", NAMES[variant],
+                 srcWidth, srcHeight, dstWidth, dstHeight, srcWidth);
+    }
+
+    virtual ~ResizeCase() {
+        if ( mPool.get() ) {
+            mPool->deinitialize();
+        }
+    }
+
+    virtual size_t pixels() const { return mDstWidth * mDstHeight; }
+    virtual size_t bytes() const {
+        return (mSrcWidth * mSrcHeight + mDstWidth * mDstHeight) * 3 / 2;
+    }
+
+    virtual bool setup() {
+        if ( !allocate(mSrcWidth * mSrcHeight * 3 / 2, mDstWidth * mDstHeight * 3 / 2) ) {
+            return false;
+        }
+
+        fillPattern(mInput, mSrcWidth, mSrcHeight, mSrcWidth, 1);
+        fillPattern(mInput + mSrcWidth * mSrcHeight, mSrcWidth, mSrcHeight / 2, mSrcWidth, 2);
+
+        describe(mIn, mInput, mSrcWidth, mSrcHeight);
+        describe(mOut, mOutput, mDstWidth, mDstHeight);
+
+        if ( VARIANT_SCALER_POOL == mVariant && !mPool.get() ) {
+            mPool = new WorkerPool();
+            if ( NO_ERROR != mPool->initialize() ) {
+                return false;
+            }
+        }
+
+        return VARIANT_WRAPPER == mVariant ||
+               NO_ERROR == mScaler.configure(mSrcWidth, mSrcHeight, mDstWidth, mDstHeight);
+    }
+
+    virtual bool run() {
+        if ( VARIANT_WRAPPER == mVariant ) {
+            IC_rect_type crop = { 0, 0, (mmUint32) mDstWidth, (mmUint32) mDstHeight };
+            return VT_resizeFrame_Video_opt2_lp(&mIn, &mOut, &crop, 0);
+        }
+
+        return NO_ERROR == mScaler.scale(&mIn, &mOut, NULL, mPool.get());
+    }
+
+    virtual uint64_t hash() const {
+        return hashPlane(HASH_SEED, mOutput, mDstWidth * mDstHeight * 3 / 2, 1, 0);
+    }
+
+private:
+    static void describe(structConvImage &image, uint8_t *data, int width, int height) {
+        image.uWidth = width;
+        image.uHeight = height;
+        image.uStride = width;
+        image.eFormat = IC_FORMAT_YCbCr420_lp;
+        image.imgPtr = data;
+        image.clrPtr = data + width * height;
+        image.uOffset = 0;
+    }
+
+    int mSrcWidth;
+    int mSrcHeight;
+    int mDstWidth;
+    int mDstHeight;
+    Variant mVariant;
+
+    structConvImage mIn;
+    structConvImage mOut;
+    NV12Scaler mScaler;
+    android::sp<WorkerPool> mPool;
+};
+
+struct Resize {
+    Size src;
+    Size dst;
+};
+
+static const Resize RESIZES[] = {
+    // video snapshot thumbnails and previews of the capture size
+    { { 1280, 720 }, { 320, 240 } },
+    { { 640, 480 }, { 320, 240 } },
+    { { 1920, 1080 }, { 1280, 720 } },
+    // upscale of a small sensor mode
+    { { 320, 240 }, { 640, 480 } },
+};
+
+void addPixelCases(CaseList &cases) {
+    for ( size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++ ) {
+        const Size &size = SIZES[i];
+        cases.add(new YuyvToNV12Case(size.width, size.height, size.width));
+        cases.add(new YuyvToNV12Case(size.width, size.height, TILER_STRIDE));
+    }
+
+    for ( size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++ ) {
+        const Size &size = SIZES[i];
+        cases.add(new Nv12ToNV21Case(size.width, size.height, size.width));
+        cases.add(new Nv12ToNV21Case(size.width, size.height, TILER_STRIDE));
+    }
+
+    for ( size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++ ) {
+        const Size &size = SIZES[i];
+        cases.add(new Nv12ToYV12Case(size.width, size.height, size.width));
+        cases.add(new Nv12ToYV12Case(size.width, size.height, TILER_STRIDE));
+    }
+
+    for ( size_t i = 0; i < sizeof(RESIZES) / sizeof(RESIZES[0]); i++ ) {
+        const Resize &resize = RESIZES[i];
+        cases.add(new ResizeCase(resize.src.width, resize.src.height,
+                                 resize.dst.width, resize.dst.height,
+                                 ResizeCase::VARIANT_WRAPPER));
+        cases.add(new ResizeCase(resize.src.width, resize.src.height,
+                                 resize.dst.width, resize.dst.height,
+                                 ResizeCase::VARIANT_SCALER));
+        cases.add(new ResizeCase(resize.src.width, resize.src.height,
+                                 resize.dst.width, resize.dst.height,
+                                 ResizeCase::VARIANT_SCALER_POOL));
+    }
+}
+
+} // namespace Bench
+} // namespace Camera
+} // namespace Ti